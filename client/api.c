@@ -11,7 +11,7 @@
  *
  * Written by Russ Allbery <eagle@eyrie.org>
  * Based on work by Anton Ushakov
- * Copyright 2018-2020, 2022 Russ Allbery <eagle@eyrie.org>
+ * Copyright 2018-2020, 2022, 2026 Russ Allbery <eagle@eyrie.org>
  * Copyright 2002-2009, 2011-2014
  *     The Board of Trustees of the Leland Stanford Junior University
  *
@@ -32,8 +32,10 @@
 
 #include <client/internal.h>
 #include <client/remctl.h>
+#include <util/compress.h>
 #include <util/macros.h>
 #include <util/network.h>
+#include <util/probes.h>
 
 
 /*
@@ -69,10 +71,11 @@ internal_fail(struct remctl *r, struct remctl_result *result)
  * Given a struct remctl_result into which we're accumulating output and a
  * struct remctl_output that contains a fragment of output, append the output
  * to the appropriate slot in the result.  This is not particularly efficient.
+ * Also used by remctl_multi.
  * Returns false if something fails and tries to set result->error; if we
  * can't even do that, make sure it's set to NULL.
  */
-static bool
+bool
 internal_output_append(struct remctl_result *result,
                        struct remctl_output *output)
 {
@@ -134,7 +137,8 @@ internal_output_append(struct remctl_result *result,
  * The simplified interface.  Given a host, a port, and a command (as a
  * null-terminated argv-style vector), run the command on that host and port
  * and return a struct remctl_result.  The result should be freed with
- * remctl_result_free.
+ * remctl_result_free.  If the connection pool is enabled, reuse a pooled
+ * connection if possible and return the connection to the pool afterwards.
  */
 struct remctl_result *
 remctl(const char *host, unsigned short port, const char *principal,
@@ -152,7 +156,7 @@ remctl(const char *host, unsigned short port, const char *principal,
         free(result);
         return NULL;
     }
-    if (!remctl_open(r, host, port, principal))
+    if (!remctl_pool_open(r, host, port, principal))
         return internal_fail(r, result);
     if (!remctl_command(r, command))
         return internal_fail(r, result);
@@ -179,7 +183,7 @@ remctl(const char *host, unsigned short port, const char *principal,
             return result;
         }
     } while (type == REMCTL_OUT_OUTPUT);
-    remctl_close(r);
+    remctl_pool_close(r);
     return result;
 }
 
@@ -275,6 +279,38 @@ remctl_set_ccache(struct remctl *r, const char *ccache UNUSED)
 #endif /* !HAVE_GSS_KRB5_CCACHE_NAME */
 
 
+/*
+ * Set whether to negotiate compression with the server when opening a
+ * connection with protocol version two or later.  Compressed messages are
+ * only used if the server also supports compression.  Returns true on
+ * success and false if compression was requested but this build of the
+ * library does not support any compression algorithm.
+ */
+int
+remctl_set_compression(struct remctl *r, int enable)
+{
+    if (enable && compress_capabilities() == 0) {
+        internal_set_error(r, "compression not supported");
+        return 0;
+    }
+    r->want_compress = (enable != 0);
+    return 1;
+}
+
+
+/*
+ * Set whether to negotiate large tokens with the server when opening a
+ * connection with protocol version two or later.  Large tokens are only used
+ * if the server also supports them.  Always returns true.
+ */
+int
+remctl_set_large_tokens(struct remctl *r, int enable)
+{
+    r->want_large = (enable != 0);
+    return 1;
+}
+
+
 /*
  * Set the source address for client connections.  Takes a string, which may
  * be NULL to use whatever the default source address is.  The string will be
@@ -315,14 +351,27 @@ remctl_set_timeout(struct remctl *r, time_t timeout)
 }
 
 
-static void
+/*
+ * Close any existing connection and clear the state from the previous
+ * connection, in preparation for opening a new one.
+ */
+void
 internal_reset(struct remctl *r)
 {
+    OM_uint32 minor;
+
     if (r->fd != -1) {
         if (r->protocol > 1)
             internal_v2_quit(r);
         socket_close(r->fd);
+        r->fd = INVALID_SOCKET;
     }
+    if (r->context != GSS_C_NO_CONTEXT)
+        gss_delete_sec_context(&minor, &r->context, GSS_C_NO_BUFFER);
+    internal_nb_free(r);
+    r->ready = false;
+    free(r->pool_ccache);
+    r->pool_ccache = NULL;
     free(r->error);
     r->error = NULL;
     if (r->output != NULL) {
@@ -401,7 +450,7 @@ remctl_open_addrinfo(struct remctl *r, const char *host,
     r->principal = principal;
 
     /* Make the network connection. */
-    fd = network_connect(ai, r->source, r->timeout);
+    fd = network_connect_staggered(ai, r->source, r->timeout);
     if (fd == INVALID_SOCKET) {
         internal_set_error(r, "cannot connect: %s",
                            socket_strerror(socket_errno));
@@ -474,6 +523,7 @@ remctl_close(struct remctl *r)
     if (r->context != GSS_C_NO_CONTEXT) {
         gss_delete_sec_context(&minor, &r->context, GSS_C_NO_BUFFER);
     }
+    internal_nb_free(r);
 
     /* If we have a registered ticket cache, free those resources. */
 #ifdef HAVE_KRB5
@@ -487,6 +537,7 @@ remctl_close(struct remctl *r)
     /* Free remaining resources. */
     free(r->source);
     free(r->ccache);
+    free(r->pool_ccache);
     free(r->error);
     if (r->output != NULL) {
         free(r->output->data);
@@ -511,6 +562,10 @@ remctl_close(struct remctl *r)
 static bool
 internal_reopen(struct remctl *r)
 {
+    if (r->nonblock != NULL) {
+        internal_set_error(r, "connection opened in non-blocking mode");
+        return false;
+    }
     if (r->fd == INVALID_SOCKET) {
         if (r->host == NULL) {
             internal_set_error(r, "no connection open");
@@ -571,6 +626,7 @@ remctl_commandv(struct remctl *r, const struct iovec *command, size_t count)
 {
     if (!internal_reopen(r))
         return 0;
+    PROBE3(client__command, r->fd, command, count);
     if (r->protocol == 1)
         return internal_v1_commandv(r, command, count);
     else
@@ -596,6 +652,111 @@ remctl_noop(struct remctl *r)
 }
 
 
+/*
+ * Start opening a non-blocking remctl connection to a server, given the host,
+ * port, and principal.  The connection must then be completed by calling
+ * remctl_step until it returns REMCTL_STEP_DONE.  Returns true on success
+ * and false on failure.
+ */
+int
+remctl_open_start(struct remctl *r, const char *host, unsigned short port,
+                  const char *principal)
+{
+    internal_reset(r);
+    r->host = NULL;
+    r->port = port;
+    r->principal = principal;
+    if (!internal_nb_open(r, host, port, principal)) {
+        internal_nb_free(r);
+        return 0;
+    }
+    return 1;
+}
+
+
+/*
+ * Queue a command on a non-blocking connection.  command is a NULL-terminated
+ * array of nul-terminated strings.  Returns true on success and false on
+ * failure.
+ */
+int
+remctl_command_start(struct remctl *r, const char **command)
+{
+    struct iovec *vector;
+    size_t count, i;
+    int status;
+
+    for (count = 0; command[count] != NULL; count++)
+        ;
+    if (count == 0) {
+        internal_set_error(r, "cannot send empty command");
+        return 0;
+    }
+    vector = calloc(count, sizeof(struct iovec));
+    if (vector == NULL) {
+        internal_set_error(r, "cannot allocate memory: %s", strerror(errno));
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        vector[i].iov_base = (void *) command[i];
+        vector[i].iov_len = strlen(command[i]);
+    }
+    status = remctl_commandv_start(r, vector, count);
+    free(vector);
+    return status;
+}
+
+
+/*
+ * Same as remctl_command_start, but take the command as an array of struct
+ * iovecs instead.  Use this form for binary data.
+ */
+int
+remctl_commandv_start(struct remctl *r, const struct iovec *command,
+                      size_t count)
+{
+    if (!internal_nb_idle(r))
+        return 0;
+    PROBE3(client__command, r->fd, command, count);
+    return internal_v2_commandv(r, command, count);
+}
+
+
+/*
+ * Queue a NOOP message on a non-blocking connection.  Returns true on
+ * success and false on failure.
+ */
+int
+remctl_noop_start(struct remctl *r)
+{
+    if (!internal_nb_idle(r))
+        return 0;
+    return internal_noop(r);
+}
+
+
+/*
+ * Advance the pending operation on a non-blocking connection as far as
+ * possible without blocking.  Returns what the connection is waiting for.
+ */
+enum remctl_step_status
+remctl_step(struct remctl *r)
+{
+    return internal_nb_step(r);
+}
+
+
+/*
+ * Return the underlying socket so that the caller can wait for readiness.
+ * Returns INVALID_SOCKET if there is no open connection.
+ */
+socket_type
+remctl_fd(struct remctl *r)
+{
+    return r->fd;
+}
+
+
 /*
  * Helper function for remctl_output implementations.  Free and reset the
  * elements of the output struct, but don't free the output struct itself.
@@ -628,6 +789,8 @@ internal_output_wipe(struct remctl_output *output)
 struct remctl_output *
 remctl_output(struct remctl *r)
 {
+    struct remctl_output *output;
+
     if (r->fd == INVALID_SOCKET && (r->protocol != 1 || r->host == NULL)) {
         internal_set_error(r, "no connection open");
         return NULL;
@@ -635,9 +798,13 @@ remctl_output(struct remctl *r)
     free(r->error);
     r->error = NULL;
     if (r->protocol == 1)
-        return internal_v1_output(r);
+        output = internal_v1_output(r);
     else
-        return internal_v2_output(r);
+        output = internal_v2_output(r);
+    if (output != NULL)
+        PROBE4(client__output, r->fd, output->type, output->length,
+               output->status);
+    return output;
 }
 
 
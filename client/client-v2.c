@@ -2,7 +2,8 @@
  * Protocol v2, client implementation.
  *
  * This is the client implementation of the new v2 protocol.  It's fairly
- * close to the regular remctl API.
+ * close to the regular remctl API.  It also implements the optional
+ * compression negotiated with protocol v3 capabilities.
  *
  * Written by Russ Allbery <eagle@eyrie.org>
  * Based on work by Anton Ushakov
@@ -23,10 +24,58 @@
 
 #include <client/internal.h>
 #include <client/remctl.h>
+#include <util/compress.h>
 #include <util/gss-tokens.h>
 #include <util/protocol.h>
 
 
+/*
+ * Send a data token to the server, applying the GSS-API protection layer.  In
+ * non-blocking mode, the protected token is instead queued to be sent by
+ * remctl_step.  Takes the error prefix to use on failure.  Returns true on
+ * success, false on failure.
+ */
+static bool
+internal_v2_send_token(struct remctl *r, gss_buffer_t token, const char *error)
+{
+    OM_uint32 major, minor;
+    int status;
+
+    if (r->nonblock != NULL)
+        return internal_nb_queue(r, token, error);
+    status = token_send_priv(r->fd, r->context, TOKEN_DATA | TOKEN_PROTOCOL,
+                             token, r->timeout, &major, &minor);
+    if (status != TOKEN_OK) {
+        internal_token_error(r, error, status, major, minor);
+        return false;
+    }
+    return true;
+}
+
+
+/*
+ * Send a message to the server, compressing it first if compression was
+ * negotiated and the message is large enough to be worth it.  Takes the error
+ * prefix to use on failure.  Returns true on success, false on failure.
+ */
+static bool
+internal_v3_send_compressed(struct remctl *r, gss_buffer_t token,
+                            const char *error)
+{
+    gss_buffer_desc compressed;
+    bool okay;
+
+    if (r->compress == COMPRESS_NONE || token->length < COMPRESS_MIN_LENGTH)
+        return internal_v2_send_token(r, token, error);
+    if (!compress_message(r->compress, token->value, token->length,
+                          &compressed))
+        return internal_v2_send_token(r, token, error);
+    okay = internal_v2_send_token(r, &compressed, error);
+    free(compressed.value);
+    return okay;
+}
+
+
 /*
  * Send a command to the server using protocol v2.  Returns true on success,
  * false on failure.
@@ -37,8 +86,9 @@
  * desired, and putting the MESSAGE_COMMAND header on each piece with the
  * appropriate continue status.  We don't take full advantage of that (we
  * don't, for instance, ever split numbers across token boundaries), but we do
- * use this to handle commands where all the data is longer than
- * TOKEN_MAX_DATA.
+ * use this to handle commands where all the data is longer than the largest
+ * message the server accepts, which is TOKEN_MAX_DATA unless larger tokens
+ * were negotiated.
  */
 bool
 internal_v2_commandv(struct remctl *r, const struct iovec *command,
@@ -47,8 +97,7 @@ internal_v2_commandv(struct remctl *r, const struct iovec *command,
     size_t length, iov, offset, sent, left, delta;
     gss_buffer_desc token;
     char *p;
-    OM_uint32 data, major, minor;
-    int status;
+    OM_uint32 data;
 
     /* Check that the number of arguments isn't too high to represent. */
     if (count > UINT32_MAX) {
@@ -68,13 +117,13 @@ internal_v2_commandv(struct remctl *r, const struct iovec *command,
      * command consists of pairs of argument length and argument data.
      *
      * If the entire message length plus the overhead for the header is less
-     * than TOKEN_MAX_DATA, we send it in one go.  Otherwise, each time
-     * through this loop, we pull off as much data as we can.  We break the
-     * tokens either in the middle of an argument or just before an argument
-     * length; we never send part of the argument length number and we always
-     * include at least one byte of the argument after the argument length.
-     * The protocol is more lenient, but those constraints make bookkeeping
-     * easier.
+     * than the maximum message size, we send it in one go.  Otherwise, each
+     * time through this loop, we pull off as much data as we can.  We break
+     * the tokens either in the middle of an argument or just before an
+     * argument length; we never send part of the argument length number and
+     * we always include at least one byte of the argument after the argument
+     * length.  The protocol is more lenient, but those constraints make
+     * bookkeeping easier.
      *
      * iov is the index of the argument we're currently sending.  offset is
      * the amount of that argument data we've already sent.  sent holds the
@@ -84,8 +133,8 @@ internal_v2_commandv(struct remctl *r, const struct iovec *command,
     offset = 0;
     sent = 0;
     while (sent < length) {
-        if (length - sent > TOKEN_MAX_DATA - 4)
-            token.length = TOKEN_MAX_DATA;
+        if (length - sent > r->max_data - 4)
+            token.length = r->max_data;
         else
             token.length = length - sent + 4;
         token.value = malloc(token.length);
@@ -160,11 +209,7 @@ internal_v2_commandv(struct remctl *r, const struct iovec *command,
 
         /* Send the result. */
         token.length -= left;
-        status =
-            token_send_priv(r->fd, r->context, TOKEN_DATA | TOKEN_PROTOCOL,
-                            &token, r->timeout, &major, &minor);
-        if (status != TOKEN_OK) {
-            internal_token_error(r, "sending token", status, major, minor);
+        if (!internal_v3_send_compressed(r, &token, "sending token")) {
             free(token.value);
             return false;
         }
@@ -177,50 +222,39 @@ internal_v2_commandv(struct remctl *r, const struct iovec *command,
 
 /*
  * Send a quit command to the server using protocol v2.  Returns true on
- * success, false on failure.
+ * success, false on failure.  In non-blocking mode, we make only a single
+ * attempt to send the QUIT token, since the connection is about to be closed
+ * anyway and we don't want to block.
  */
 bool
 internal_v2_quit(struct remctl *r)
 {
     gss_buffer_desc token;
     char buffer[2] = {2, MESSAGE_QUIT};
-    OM_uint32 major, minor;
-    int status;
 
+    if (r->context == GSS_C_NO_CONTEXT)
+        return true;
     token.length = 1 + 1;
     token.value = buffer;
-    status = token_send_priv(r->fd, r->context, TOKEN_DATA | TOKEN_PROTOCOL,
-                             &token, r->timeout, &major, &minor);
-    if (status != TOKEN_OK) {
-        internal_token_error(r, "sending QUIT token", status, major, minor);
+    if (!internal_v2_send_token(r, &token, "sending QUIT token"))
         return false;
-    }
+    if (r->nonblock != NULL)
+        internal_nb_flush(r);
     return true;
 }
 
 
 /*
- * Read a token from the server connection and store it in the provided
- * buffer.  Return true on success and false on any failure.
+ * Check the flags and the common header of an unwrapped token received from
+ * the server.  On failure, sets the error, frees the token, and returns
+ * false.  Shared between the blocking and non-blocking interfaces.
  */
-static bool
-internal_v2_read_token(struct remctl *r, gss_buffer_t token)
+bool
+internal_v2_check_token(struct remctl *r, int flags, gss_buffer_t token)
 {
-    int status, flags;
-    OM_uint32 major, minor;
+    OM_uint32 minor;
     char *p;
 
-    status = token_recv_priv(r->fd, r->context, &flags, token,
-                             TOKEN_MAX_LENGTH, r->timeout, &major, &minor);
-    if (status != TOKEN_OK) {
-        internal_token_error(r, "receiving token", status, major, minor);
-        if (status == TOKEN_FAIL_EOF || status == TOKEN_FAIL_TIMEOUT) {
-            gss_delete_sec_context(&minor, &r->context, GSS_C_NO_BUFFER);
-            socket_close(r->fd);
-            r->fd = INVALID_SOCKET;
-        }
-        return false;
-    }
     if (flags != (TOKEN_DATA | TOKEN_PROTOCOL)) {
         internal_set_error(r, "unexpected token from server");
         goto fail;
@@ -243,7 +277,33 @@ fail:
 
 
 /*
- * Read a string from a server token, with its length starting at the given
+ * Read a token from the server connection and store it in the provided
+ * buffer.  Return true on success and false on any failure.
+ */
+static bool
+internal_v2_read_token(struct remctl *r, gss_buffer_t token)
+{
+    int status, flags;
+    OM_uint32 major, minor;
+
+    status = token_recv_priv(r->fd, r->context, &flags, token,
+                             r->large ? TOKEN_MAX_LARGE : TOKEN_MAX_LENGTH,
+                             r->timeout, &major, &minor);
+    if (status != TOKEN_OK) {
+        internal_token_error(r, "receiving token", status, major, minor);
+        if (status == TOKEN_FAIL_EOF || status == TOKEN_FAIL_TIMEOUT) {
+            gss_delete_sec_context(&minor, &r->context, GSS_C_NO_BUFFER);
+            socket_close(r->fd);
+            r->fd = INVALID_SOCKET;
+        }
+        return false;
+    }
+    return internal_v2_check_token(r, flags, token);
+}
+
+
+/*
+ * Read a string from a server message, with its length starting at the given
  * offset, and store it in newly allocated memory in the remctl struct.
  * Returns true on success and false on any failure (also setting the error).
  */
@@ -284,7 +344,10 @@ struct remctl_output *
 internal_v2_output(struct remctl *r)
 {
     gss_buffer_desc token = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc inflated = GSS_C_EMPTY_BUFFER;
+    gss_buffer_t message = &token;
     OM_uint32 data, minor;
+    size_t max;
     char *p;
     int type;
 
@@ -305,16 +368,34 @@ internal_v2_output(struct remctl *r)
     if (!r->ready)
         return r->output;
 
-    /* Otherwise, we have to read the token from the server. */
-    if (!internal_v2_read_token(r, &token))
+    /*
+     * Otherwise, we have to read the token from the server, or in
+     * non-blocking mode, take the token that remctl_step already read.
+     */
+    if (r->nonblock != NULL) {
+        if (!internal_nb_token(r, &token))
+            return NULL;
+    } else if (!internal_v2_read_token(r, &token))
         return NULL;
 
-    /* Now, what we do depends on the message type. */
+    /* If the message is compressed, decompress it and use that instead. */
     p = token.value;
+    if (p[1] == MESSAGE_COMPRESSED) {
+        max = r->large ? TOKEN_MAX_LARGE : TOKEN_MAX_DATA;
+        if (r->compress == COMPRESS_NONE
+            || !compress_inflate(&token, &inflated, max)) {
+            internal_set_error(r, "malformed compressed token from server");
+            goto fail;
+        }
+        message = &inflated;
+        p = inflated.value;
+    }
+
+    /* Now, what we do depends on the message type. */
     type = p[1];
     switch (type) {
     case MESSAGE_OUTPUT:
-        if (token.length < 2 + 5) {
+        if (message->length < 2 + 5) {
             internal_set_error(r, "malformed result token from server");
             goto fail;
         }
@@ -324,12 +405,12 @@ internal_v2_output(struct remctl *r)
             goto fail;
         }
         r->output->stream = p[2];
-        if (!internal_v2_read_string(r, &token, 3))
+        if (!internal_v2_read_string(r, message, 3))
             goto fail;
         break;
 
     case MESSAGE_STATUS:
-        if (token.length != 2 + 1) {
+        if (message->length != 2 + 1) {
             internal_set_error(r, "malformed result token from server");
             goto fail;
         }
@@ -339,14 +420,14 @@ internal_v2_output(struct remctl *r)
         break;
 
     case MESSAGE_ERROR:
-        if (token.length < 2 + 8) {
+        if (message->length < 2 + 8) {
             internal_set_error(r, "malformed result token from server");
             goto fail;
         }
         r->output->type = REMCTL_OUT_ERROR;
         memcpy(&data, p + 2, 4);
         r->output->error = ntohl(data);
-        if (!internal_v2_read_string(r, &token, 6))
+        if (!internal_v2_read_string(r, message, 6))
             goto fail;
         r->ready = 0;
         break;
@@ -358,10 +439,12 @@ internal_v2_output(struct remctl *r)
 
     /* We've finished analyzing the packet.  Return the results. */
     gss_release_buffer(&minor, &token);
+    free(inflated.value);
     return r->output;
 
 fail:
     gss_release_buffer(&minor, &token);
+    free(inflated.value);
     return NULL;
 }
 
@@ -375,19 +458,16 @@ internal_noop(struct remctl *r)
 {
     gss_buffer_desc token;
     char buffer[2] = {3, MESSAGE_NOOP};
-    OM_uint32 major, minor;
-    int status;
+    OM_uint32 minor;
     char *p;
 
     /* Send the NOOP token. */
     token.length = 1 + 1;
     token.value = buffer;
-    status = token_send_priv(r->fd, r->context, TOKEN_DATA | TOKEN_PROTOCOL,
-                             &token, r->timeout, &major, &minor);
-    if (status != TOKEN_OK) {
-        internal_token_error(r, "sending NOOP token", status, major, minor);
+    if (!internal_v2_send_token(r, &token, "sending NOOP token"))
         return false;
-    }
+    if (r->nonblock != NULL)
+        return internal_nb_noop(r);
 
     /* Read the resulting NOOP token. */
     token.length = 0;
@@ -405,3 +485,96 @@ internal_noop(struct remctl *r)
     /* Everything looks good. */
     return true;
 }
+
+
+/*
+ * Send a CAPABILITIES message to the server using protocol v3, offering the
+ * compression algorithms we support and large tokens if they were requested,
+ * and read the response.  In non-blocking
+ * mode, the response is instead read by remctl_step.  Returns true on
+ * success, false on failure.
+ */
+bool
+internal_v3_capabilities(struct remctl *r)
+{
+    gss_buffer_desc token;
+    char buffer[1 + 1 + 4];
+    OM_uint32 data, minor;
+    unsigned long flags = 0;
+    bool okay;
+
+    /* Send the CAPABILITIES token. */
+    if (r->want_compress)
+        flags |= compress_capabilities();
+    if (r->want_large)
+        flags |= CAPABILITY_LARGE;
+    buffer[0] = 3;
+    buffer[1] = MESSAGE_CAPABILITIES;
+    data = htonl((OM_uint32) flags);
+    memcpy(buffer + 2, &data, 4);
+    token.length = 1 + 1 + 4;
+    token.value = buffer;
+    if (!internal_v2_send_token(r, &token, "sending CAPABILITIES token"))
+        return false;
+    if (r->nonblock != NULL)
+        return internal_nb_capabilities(r);
+
+    /* Read and parse the response. */
+    token.length = 0;
+    token.value = GSS_C_NO_BUFFER;
+    if (!internal_v2_read_token(r, &token))
+        return false;
+    okay = internal_v3_capabilities_reply(r, &token);
+    gss_release_buffer(&minor, &token);
+    return okay;
+}
+
+
+/*
+ * Parse the server response to a CAPABILITIES message, choose the compression
+ * algorithm to use, and size our messages if the server agreed to large
+ * tokens.  Servers that don't support capabilities reply with an unknown
+ * message error, or with a version message if they only support protocol
+ * version two, and then we use neither.  Returns true on success, false on
+ * failure.
+ */
+bool
+internal_v3_capabilities_reply(struct remctl *r, gss_buffer_t token)
+{
+    OM_uint32 data;
+    size_t max;
+    char *p;
+
+    p = token->value;
+    r->compress = COMPRESS_NONE;
+    r->large = false;
+    r->max_data = TOKEN_MAX_DATA;
+    switch (p[1]) {
+    case MESSAGE_CAPABILITIES:
+        if (token->length != 1 + 1 + 4) {
+            internal_set_error(r, "malformed capabilities token from server");
+            return false;
+        }
+        memcpy(&data, p + 2, 4);
+        data = ntohl(data);
+        r->compress = compress_choose(data);
+
+        /*
+         * If the server agreed to large tokens, it may send them, but we
+         * only send them if we can tell how much data fits in one.
+         */
+        if (data & CAPABILITY_LARGE) {
+            r->large = true;
+            max = token_wrap_limit(r->context, TOKEN_MAX_LARGE);
+            if (max > TOKEN_MAX_DATA)
+                r->max_data = max;
+        }
+        return true;
+    case MESSAGE_ERROR:
+    case MESSAGE_VERSION:
+        return true;
+    default:
+        internal_set_error(r, "unexpected message type %d from server", p[1]);
+        return false;
+    }
+}
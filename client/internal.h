@@ -23,8 +23,21 @@
 #include <portable/stdbool.h>
 #include <sys/types.h>
 
+#include <client/remctl.h>
+
 /* Forward declaration to avoid unnecessary includes. */
 struct iovec;
+struct internal_nb;
+
+/*
+ * The GSS-API flags we request when establishing a context and the subset of
+ * them that the server must agree to for protocol version two and later.
+ */
+#define INTERNAL_GSS_FLAGS_WANTED                           \
+    (GSS_C_MUTUAL_FLAG | GSS_C_CONF_FLAG | GSS_C_INTEG_FLAG \
+     | GSS_C_REPLAY_FLAG | GSS_C_SEQUENCE_FLAG)
+#define INTERNAL_GSS_FLAGS_REQUIRED \
+    (GSS_C_MUTUAL_FLAG | GSS_C_CONF_FLAG | GSS_C_INTEG_FLAG)
 
 /* Private structure that holds the details of an open remctl connection. */
 struct remctl {
@@ -35,12 +48,19 @@ struct remctl {
     char *source;                 /* Source address for connection. */
     time_t timeout;               /* Client-configured timeout. */
     char *ccache;                 /* Path to client ticket cache. */
+    char *pool_ccache;            /* Ticket cache used, for the pool. */
     socket_type fd;               /* Open server socket. */
     gss_ctx_id_t context;         /* Negotiated GSS-API context with server. */
     char *error;                  /* Error of last failed operation. */
     struct remctl_output *output; /* Output from last command. */
     int status;                   /* Status of last command. */
     bool ready;                   /* If true, expecting server output. */
+    bool want_compress;           /* Whether to negotiate compression. */
+    int compress;                 /* Negotiated compression algorithm. */
+    bool want_large;              /* Whether to negotiate large tokens. */
+    bool large;                   /* Whether the server sends large tokens. */
+    size_t max_data;              /* Largest message we may send. */
+    struct internal_nb *nonblock; /* Non-blocking state, if in that mode. */
 
     /* Used to hold state for remctl_set_ccache. */
 #ifdef HAVE_KRB5
@@ -69,12 +89,47 @@ void internal_token_error(struct remctl *, const char *error, int status,
 /* Wipe and free the output token. */
 void internal_output_wipe(struct remctl_output *);
 
+/* Append a piece of output to a result for the simple interface. */
+bool internal_output_append(struct remctl_result *, struct remctl_output *);
+
 /* Establish a network connection */
 socket_type internal_connect(struct remctl *, const char *, unsigned short);
 
+/* Import the server name and, if configured, the client credentials. */
+bool internal_import_name(struct remctl *, const char *host,
+                          const char *principal, gss_name_t *);
+bool internal_set_cred(struct remctl *, gss_cred_id_t *);
+
+/* Close any open connection and clear the state of the previous one. */
+void internal_reset(struct remctl *);
+
 /* General connection opening and negotiation function. */
 bool internal_open(struct remctl *, const char *host, const char *principal);
 
+/*
+ * The non-blocking interface.  internal_nb_open starts a non-blocking
+ * connection, internal_nb_step advances whatever operation is pending, and
+ * internal_nb_free discards the non-blocking state.  internal_nb_idle checks
+ * that the connection is established with no operation pending.
+ *
+ * The protocol code uses the remaining functions.  internal_nb_queue wraps
+ * and queues a data token to be sent by the next step, internal_nb_noop and
+ * internal_nb_capabilities note that a NOOP or CAPABILITIES reply is
+ * expected, and internal_nb_flush makes a single attempt to write any queued
+ * data.  internal_nb_token hands over the next unwrapped token received from
+ * the server for remctl_output to parse.
+ */
+bool internal_nb_open(struct remctl *, const char *host, unsigned short port,
+                      const char *principal);
+enum remctl_step_status internal_nb_step(struct remctl *);
+void internal_nb_free(struct remctl *);
+bool internal_nb_idle(struct remctl *);
+bool internal_nb_queue(struct remctl *, gss_buffer_t, const char *error);
+bool internal_nb_noop(struct remctl *);
+bool internal_nb_capabilities(struct remctl *);
+void internal_nb_flush(struct remctl *);
+bool internal_nb_token(struct remctl *, gss_buffer_t);
+
 /* Send a protocol v1 command. */
 bool internal_v1_commandv(struct remctl *, const struct iovec *command,
                           size_t count);
@@ -89,12 +144,24 @@ bool internal_v2_commandv(struct remctl *, const struct iovec *command,
 /* Send a protocol v3 NOOP command. */
 bool internal_noop(struct remctl *);
 
+/*
+ * Send a protocol v3 CAPABILITIES message offering compression or large
+ * tokens and, when blocking, read the reply.  The reply is parsed by
+ * internal_v3_capabilities_reply, which the non-blocking interface calls
+ * directly.
+ */
+bool internal_v3_capabilities(struct remctl *);
+bool internal_v3_capabilities_reply(struct remctl *, gss_buffer_t);
+
 /* Send a protocol v2 QUIT command. */
 bool internal_v2_quit(struct remctl *);
 
 /* Read a protocol v2 response. */
 struct remctl_output *internal_v2_output(struct remctl *);
 
+/* Check the flags and header of a protocol v2 token from the server. */
+bool internal_v2_check_token(struct remctl *, int flags, gss_buffer_t);
+
 /* Undo default visibility change. */
 #pragma GCC visibility pop
 
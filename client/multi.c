@@ -0,0 +1,570 @@
+/*
+ * Support for sets of equivalent remctl servers.
+ *
+ * Many remctl services run on several equivalent servers, any of which can
+ * handle a request.  The functions here pick one of a set of servers based on
+ * the latency seen on previous connections, fail over to the next server if
+ * a connection fails, and, for idempotent commands, optionally hedge by
+ * sending the same command to a second server if the first one hasn't
+ * answered within the time that most of its previous requests took.
+ *
+ * Latency statistics are kept per host and port for the life of the process
+ * as exponentially weighted moving averages of the latency and of its mean
+ * deviation, computed the same way as the TCP retransmission timer (RFC
+ * 6298).  The mean plus four times the deviation is used as an estimate of a
+ * high percentile of the request latency for hedging.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/socket.h>
+#include <portable/system.h>
+
+#include <errno.h>
+#ifdef HAVE_PTHREAD
+#    include <pthread.h>
+#endif
+#ifdef _WIN32
+#    define poll WSAPoll
+#else
+#    include <poll.h>
+#endif
+#ifdef HAVE_SYS_TIME_H
+#    include <sys/time.h>
+#endif
+#include <time.h>
+
+#include <client/internal.h>
+#include <client/remctl.h>
+
+/* Seconds after a failure during which a server is tried last. */
+#define MULTI_RETRY_INTERVAL 60
+
+/* Seconds after which latency statistics are discarded and remeasured. */
+#define MULTI_STALE_INTERVAL 300
+
+/* Hedging delay in milliseconds to use for a server with no history. */
+#define MULTI_HEDGE_DEFAULT 1000
+
+/* Protect the statistics with a mutex if threads are available. */
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t multi_mutex = PTHREAD_MUTEX_INITIALIZER;
+#    define MULTI_LOCK()   pthread_mutex_lock(&multi_mutex)
+#    define MULTI_UNLOCK() pthread_mutex_unlock(&multi_mutex)
+#else
+#    define MULTI_LOCK()   /* empty */
+#    define MULTI_UNLOCK() /* empty */
+#endif
+
+/* A latency average and mean deviation in milliseconds. */
+struct multi_latency {
+    double average;   /* Smoothed latency. */
+    double deviation; /* Smoothed mean deviation of the latency. */
+    time_t updated;   /* When the last sample was added, or 0 if none. */
+};
+
+/* Statistics for one server. */
+struct multi_endpoint {
+    char *host;                   /* Host as passed by the caller. */
+    unsigned short port;          /* Port as passed by the caller. */
+    struct multi_latency open;    /* Connect and authentication latency. */
+    struct multi_latency request; /* Latency of a complete request. */
+    time_t failed;                /* Time of the last failure, or 0. */
+    struct multi_endpoint *next;  /* Next endpoint in the list. */
+};
+
+/* All servers seen by this process. */
+static struct multi_endpoint *endpoints;
+
+/* One attempt to run a command on a server with remctl_multi. */
+struct multi_attempt {
+    const char *host;             /* Host of this attempt. */
+    struct remctl *r;             /* Non-blocking connection. */
+    enum remctl_step_status step; /* Last return value of remctl_step. */
+    bool sent;                    /* Whether the command was sent. */
+    double start;                 /* When the attempt started, in ms. */
+    struct remctl_result *result; /* Accumulated result. */
+};
+
+
+/*
+ * Return the current time in milliseconds.
+ */
+static double
+multi_now(void)
+{
+#ifdef _WIN32
+    return (double) GetTickCount64();
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec * 1000 + (double) tv.tv_usec / 1000;
+#endif
+}
+
+
+/*
+ * Find the statistics for a host and port, creating a new entry if needed.
+ * Must be called with the statistics locked.  Returns NULL on memory
+ * allocation failure.
+ */
+static struct multi_endpoint *
+multi_find(const char *host, unsigned short port)
+{
+    struct multi_endpoint *endpoint;
+
+    for (endpoint = endpoints; endpoint != NULL; endpoint = endpoint->next)
+        if (endpoint->port == port && strcmp(endpoint->host, host) == 0)
+            return endpoint;
+    endpoint = calloc(1, sizeof(struct multi_endpoint));
+    if (endpoint == NULL)
+        return NULL;
+    endpoint->host = strdup(host);
+    if (endpoint->host == NULL) {
+        free(endpoint);
+        return NULL;
+    }
+    endpoint->port = port;
+    endpoint->next = endpoints;
+    endpoints = endpoint;
+    return endpoint;
+}
+
+
+/*
+ * Add a latency sample in milliseconds to a moving average, using the
+ * weights from RFC 6298.  The first sample initializes the average.
+ */
+static void
+multi_sample(struct multi_latency *latency, double sample, time_t now)
+{
+    double error;
+
+    if (latency->updated == 0
+        || now - latency->updated > MULTI_STALE_INTERVAL) {
+        latency->average = sample;
+        latency->deviation = sample / 2;
+    } else {
+        error = sample - latency->average;
+        if (error < 0)
+            error = -error;
+        latency->deviation += (error - latency->deviation) / 4;
+        latency->average += (sample - latency->average) / 8;
+    }
+    latency->updated = now;
+}
+
+
+/*
+ * Record the result of an attempt to contact a server.  open and request are
+ * the connection and complete request latencies in milliseconds, or negative
+ * if not measured.  If failed is true, the server is tried last for a while.
+ */
+static void
+multi_record(const char *host, unsigned short port, double open,
+             double request, bool failed)
+{
+    struct multi_endpoint *endpoint;
+    time_t now;
+
+    now = time(NULL);
+    MULTI_LOCK();
+    endpoint = multi_find(host, port);
+    if (endpoint != NULL) {
+        if (open >= 0)
+            multi_sample(&endpoint->open, open, now);
+        if (request >= 0)
+            multi_sample(&endpoint->request, request, now);
+        endpoint->failed = failed ? now : 0;
+    }
+    MULTI_UNLOCK();
+}
+
+
+/*
+ * Return how long to wait, in milliseconds, for a request to a server before
+ * sending the same request to another server.
+ */
+static double
+multi_hedge_delay(const char *host, unsigned short port)
+{
+    struct multi_endpoint *endpoint;
+    double delay = MULTI_HEDGE_DEFAULT;
+    time_t now;
+
+    now = time(NULL);
+    MULTI_LOCK();
+    endpoint = multi_find(host, port);
+    if (endpoint != NULL && endpoint->request.updated != 0
+        && now - endpoint->request.updated <= MULTI_STALE_INTERVAL)
+        delay = endpoint->request.average + 4 * endpoint->request.deviation;
+    MULTI_UNLOCK();
+    return delay;
+}
+
+
+/*
+ * Compare two server scores as computed by multi_order.  Returns true if the
+ * server with score a should be tried before the server with score b.
+ * Negative scores mark servers that failed recently and sort last.
+ */
+static bool
+multi_before(double a, double b)
+{
+    if (a < 0)
+        return false;
+    return b < 0 || a < b;
+}
+
+
+/*
+ * Given a NULL-terminated list of hosts, return a newly allocated array of
+ * the hosts in the order in which they should be tried and store the number
+ * of hosts in count.  Servers that failed recently go last and the rest are
+ * sorted by their average connection latency.  Servers with no recent
+ * statistics are tried first so that they get measured, and ties keep the
+ * order given by the caller.  Returns NULL on memory allocation failure.
+ */
+static const char **
+multi_order(const char **hosts, unsigned short port, size_t *count)
+{
+    struct multi_endpoint *endpoint;
+    const char **order;
+    double *score, tmp_score;
+    const char *tmp_host;
+    size_t i, j;
+    time_t now;
+
+    for (*count = 0; hosts[*count] != NULL; (*count)++)
+        ;
+    order = calloc(*count + 1, sizeof(const char *));
+    score = calloc(*count + 1, sizeof(double));
+    if (order == NULL || score == NULL) {
+        free(order);
+        free(score);
+        return NULL;
+    }
+
+    /* Score each host. */
+    now = time(NULL);
+    MULTI_LOCK();
+    for (i = 0; i < *count; i++) {
+        order[i] = hosts[i];
+        endpoint = multi_find(hosts[i], port);
+        if (endpoint == NULL)
+            continue;
+        if (endpoint->failed != 0
+            && now - endpoint->failed < MULTI_RETRY_INTERVAL)
+            score[i] = -1;
+        else if (endpoint->open.updated != 0
+                 && now - endpoint->open.updated <= MULTI_STALE_INTERVAL)
+            score[i] = endpoint->open.average;
+    }
+    MULTI_UNLOCK();
+
+    /* Insertion sort, since the list is short and this keeps ties stable. */
+    for (i = 1; i < *count; i++)
+        for (j = i; j > 0 && multi_before(score[j], score[j - 1]); j--) {
+            tmp_score = score[j];
+            score[j] = score[j - 1];
+            score[j - 1] = tmp_score;
+            tmp_host = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = tmp_host;
+        }
+    free(score);
+    return order;
+}
+
+
+/*
+ * Replace the saved error message with the error from a connection.
+ */
+static void
+multi_error(char **error, struct remctl *r)
+{
+    free(*error);
+    *error = strdup(remctl_error(r));
+}
+
+
+/*
+ * Free the resources used by an attempt.
+ */
+static void
+multi_attempt_free(struct multi_attempt *attempt)
+{
+    remctl_close(attempt->r);
+    if (attempt->result != NULL) {
+        free(attempt->result->error);
+        free(attempt->result->stdout_buf);
+        free(attempt->result->stderr_buf);
+        free(attempt->result);
+    }
+    attempt->r = NULL;
+    attempt->result = NULL;
+}
+
+
+/*
+ * Start an attempt to run a command on a server by starting a non-blocking
+ * connection to it.  On failure, stores the error message in error, records
+ * the failure, and returns false.
+ */
+static bool
+multi_attempt_start(struct multi_attempt *attempt, const char *host,
+                    unsigned short port, const char *principal, char **error)
+{
+    memset(attempt, 0, sizeof(struct multi_attempt));
+    attempt->host = host;
+    attempt->step = REMCTL_STEP_WRITE;
+    attempt->start = multi_now();
+    attempt->r = remctl_new();
+    attempt->result = calloc(1, sizeof(struct remctl_result));
+    if (attempt->r == NULL || attempt->result == NULL) {
+        multi_attempt_free(attempt);
+        free(*error);
+        *error = strdup("cannot allocate memory");
+        return false;
+    }
+    if (!remctl_open_start(attempt->r, host, port, principal)) {
+        multi_error(error, attempt->r);
+        multi_attempt_free(attempt);
+        multi_record(host, port, -1, -1, true);
+        return false;
+    }
+    return true;
+}
+
+
+/*
+ * Advance an attempt as far as possible without blocking, sending the
+ * command once the connection is open and collecting its output.  Returns 1
+ * if the command is complete, 0 if the attempt is waiting for the network,
+ * and -1 on failure.
+ */
+static int
+multi_attempt_step(struct multi_attempt *attempt, unsigned short port,
+                   const char **command)
+{
+    struct remctl *r = attempt->r;
+    struct remctl_output *output;
+
+    for (;;) {
+        attempt->step = remctl_step(r);
+        switch (attempt->step) {
+        case REMCTL_STEP_READ:
+        case REMCTL_STEP_WRITE:
+            return 0;
+        case REMCTL_STEP_DONE:
+            if (attempt->sent)
+                return 1;
+            multi_record(attempt->host, port, multi_now() - attempt->start, -1,
+                         false);
+            if (!remctl_command_start(r, command))
+                return -1;
+            attempt->sent = true;
+            break;
+        case REMCTL_STEP_OUTPUT:
+            output = remctl_output(r);
+            if (output == NULL)
+                return -1;
+            if (output->type == REMCTL_OUT_STATUS)
+                attempt->result->status = output->status;
+            else if (output->type == REMCTL_OUT_OUTPUT
+                     || output->type == REMCTL_OUT_ERROR) {
+                if (!internal_output_append(attempt->result, output)) {
+                    internal_set_error(r, "%s",
+                                       attempt->result->error != NULL
+                                           ? attempt->result->error
+                                           : "cannot allocate memory");
+                    return -1;
+                }
+            }
+            break;
+        case REMCTL_STEP_ERROR:
+        default:
+            return -1;
+        }
+    }
+}
+
+
+/*
+ * Open a connection to one of a NULL-terminated list of equivalent servers.
+ * Servers are tried in the order determined by multi_order, moving on to the
+ * next one if a connection fails, and the connection latency is recorded for
+ * future calls.  Returns true on success and false if no server could be
+ * reached, in which case the error is the error from the last server tried.
+ */
+int
+remctl_open_multi(struct remctl *r, const char **hosts, unsigned short port,
+                  const char *principal)
+{
+    const char **order;
+    size_t count, i;
+    double start;
+
+    order = multi_order(hosts, port, &count);
+    if (order == NULL) {
+        internal_set_error(r, "cannot allocate memory: %s", strerror(errno));
+        return 0;
+    }
+    if (count == 0) {
+        internal_set_error(r, "no hosts given");
+        free(order);
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        start = multi_now();
+        if (remctl_open(r, order[i], port, principal)) {
+            multi_record(order[i], port, multi_now() - start, -1, false);
+            free(order);
+            return 1;
+        }
+        multi_record(order[i], port, -1, -1, true);
+    }
+    free(order);
+    return 0;
+}
+
+
+/*
+ * The simplified interface for a set of equivalent servers.  Like remctl,
+ * but takes a NULL-terminated list of hosts and runs the command on one of
+ * them, failing over to the next server if a connection fails before the
+ * command was sent.  If hedge is true, the command must be safe to run more
+ * than once: if the server hasn't answered within its usual request latency
+ * (or if it fails at any point), the command is also sent to the next server
+ * and the first result is used.
+ *
+ * This uses the non-blocking interface internally so that two requests can
+ * be in flight at the same time, and therefore requires protocol version
+ * two.  Returns NULL only on memory allocation failure.
+ */
+struct remctl_result *
+remctl_multi(const char **hosts, unsigned short port, const char *principal,
+             const char **command, int hedge)
+{
+    const char **order;
+    struct multi_attempt *attempts = NULL;
+    struct pollfd *fds = NULL;
+    struct remctl_result *result = NULL;
+    char *error = NULL;
+    size_t count, next, active, i;
+    double now, deadline = 0, wait;
+    int status;
+    bool fatal = false;
+
+    order = multi_order(hosts, port, &count);
+    if (order == NULL)
+        return NULL;
+    attempts = calloc(count + 1, sizeof(struct multi_attempt));
+    fds = calloc(count + 1, sizeof(struct pollfd));
+    if (attempts == NULL || fds == NULL)
+        goto done;
+
+    /*
+     * Keep one attempt running, or two once the hedging deadline has passed,
+     * until one of them returns a result or we run out of servers.
+     */
+    next = 0;
+    active = 0;
+    while (result == NULL && !fatal) {
+        now = multi_now();
+        if (next < count
+            && (active == 0 || (hedge && active == 1 && now >= deadline))) {
+            if (multi_attempt_start(&attempts[active], order[next], port,
+                                    principal, &error)) {
+                if (active == 0)
+                    deadline = now + multi_hedge_delay(order[next], port);
+                active++;
+            }
+            next++;
+            continue;
+        }
+        if (active == 0)
+            break;
+
+        /* Wait for the network or the hedging deadline. */
+        for (i = 0; i < active; i++) {
+            fds[i].fd = remctl_fd(attempts[i].r);
+            fds[i].events =
+                (attempts[i].step == REMCTL_STEP_READ) ? POLLIN : POLLOUT;
+            fds[i].revents = 0;
+        }
+        wait = -1;
+        if (hedge && active == 1 && next < count) {
+            wait = deadline - now;
+            if (wait < 1)
+                wait = 1;
+        }
+        status = poll(fds, active, (wait < 0) ? -1 : (int) wait);
+        if (status < 0 && socket_errno != EINTR) {
+            free(error);
+            error = strdup(socket_strerror(socket_errno));
+            break;
+        }
+        if (status <= 0)
+            continue;
+
+        /*
+         * Advance the attempts that are ready.  A failed attempt is dropped
+         * and, unless the command may have been run and cannot be retried,
+         * another server will be tried on the next pass through the loop.
+         */
+        for (i = active; i-- > 0;) {
+            if (fds[i].revents == 0)
+                continue;
+            status = multi_attempt_step(&attempts[i], port, command);
+            if (status == 1) {
+                now = multi_now();
+                multi_record(attempts[i].host, port, -1,
+                             now - attempts[i].start, false);
+                result = attempts[i].result;
+                attempts[i].result = NULL;
+                break;
+            } else if (status < 0) {
+                multi_error(&error, attempts[i].r);
+                if (!attempts[i].sent)
+                    multi_record(attempts[i].host, port, -1, -1, true);
+                else if (!hedge)
+                    fatal = true;
+                multi_attempt_free(&attempts[i]);
+                attempts[i] = attempts[--active];
+            }
+        }
+    }
+
+    /* Abandon the remaining attempts and build the result on failure. */
+    for (i = 0; i < active; i++)
+        multi_attempt_free(&attempts[i]);
+    if (result == NULL) {
+        result = calloc(1, sizeof(struct remctl_result));
+        if (result == NULL)
+            goto done;
+        if (error != NULL) {
+            result->error = error;
+            error = NULL;
+        } else if (count == 0)
+            result->error = strdup("no hosts given");
+        else
+            result->error = strdup("cannot allocate memory");
+        if (result->error == NULL) {
+            free(result);
+            result = NULL;
+        }
+    }
+
+done:
+    free(error);
+    free(order);
+    free(attempts);
+    free(fds);
+    return result;
+}
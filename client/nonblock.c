@@ -0,0 +1,838 @@
+/*
+ * Non-blocking client interface.
+ *
+ * This is the implementation of the non-blocking remctl client interface,
+ * intended for callers who want to drive many connections from one event
+ * loop.  Rather than waiting for the network, each operation is started and
+ * then advanced by calls to remctl_step whenever the socket is ready, with
+ * the return value telling the caller what the connection is waiting for.
+ *
+ * Outgoing tokens are queued in a write buffer and incoming data is
+ * accumulated in a read buffer until a complete token is available.  Only
+ * protocol version two and later is supported, since protocol version one
+ * requires a MIC round trip for each token and a new connection for each
+ * command.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/gssapi.h>
+#include <portable/socket.h>
+#include <portable/system.h>
+
+#include <errno.h>
+
+#include <client/internal.h>
+#include <client/remctl.h>
+#include <util/fdflag.h>
+#include <util/network.h>
+#include <util/probes.h>
+#include <util/protocol.h>
+#include <util/tokens.h>
+
+/* The size of the header on each token: one octet of flags and a length. */
+#define TOKEN_HEADER_LENGTH (1 + 4)
+
+/* How much data to try to read from the network at a time. */
+#define READ_CHUNK (64 * 1024)
+
+/* The states of a non-blocking connection. */
+enum nb_state {
+    NB_CONNECTING,  /* Waiting for the TCP connect to complete. */
+    NB_HANDSHAKE,   /* Establishing the GSS-API context. */
+    NB_READY,       /* Connected; idle or reading command output. */
+    NB_NOOP,        /* Waiting for the reply to a NOOP message. */
+    NB_CAPABILITIES /* Waiting for the reply to a CAPABILITIES message. */
+};
+
+/* A simple growable byte buffer for queued network data. */
+struct nb_buffer {
+    char *data;   /* Allocated memory. */
+    size_t size;  /* Total allocated length. */
+    size_t start; /* Offset of the first unconsumed octet. */
+    size_t end;   /* Offset just past the last valid octet. */
+};
+
+/* Non-blocking state attached to a struct remctl. */
+struct internal_nb {
+    enum nb_state state;
+    char *host;              /* Copy of the host, for error messages. */
+    unsigned short port;     /* Port of the current connect attempt. */
+    unsigned short fallback; /* Legacy port to try next, or 0. */
+    struct addrinfo *addrs;  /* Resolved addresses for the connect. */
+    struct addrinfo *next;   /* Next address to try. */
+    gss_name_t name;         /* Imported server name. */
+    gss_cred_id_t cred;      /* Client credentials, if configured. */
+    gss_ctx_id_t context;    /* Context while the handshake is running. */
+    OM_uint32 major;         /* Result of last gss_init_sec_context. */
+    OM_uint32 gss_flags;     /* Flags negotiated for the context. */
+    struct nb_buffer out;    /* Data waiting to be written. */
+    struct nb_buffer in;     /* Data read but not yet processed. */
+    gss_buffer_desc pending; /* Unwrapped token for remctl_output. */
+    bool have_pending;       /* Whether pending holds a token. */
+};
+
+
+/*
+ * Append data to a buffer, growing it as needed.  Returns true on success
+ * and false on memory allocation failure.
+ */
+static bool
+nb_buffer_append(struct nb_buffer *buffer, const void *data, size_t length)
+{
+    size_t size;
+    char *newdata;
+
+    if (buffer->start == buffer->end)
+        buffer->start = buffer->end = 0;
+    if (buffer->size - buffer->end < length && buffer->start > 0) {
+        memmove(buffer->data, buffer->data + buffer->start,
+                buffer->end - buffer->start);
+        buffer->end -= buffer->start;
+        buffer->start = 0;
+    }
+    if (buffer->size - buffer->end < length) {
+        size = buffer->end + length;
+        if (size < READ_CHUNK)
+            size = READ_CHUNK;
+        newdata = realloc(buffer->data, size);
+        if (newdata == NULL)
+            return false;
+        buffer->data = newdata;
+        buffer->size = size;
+    }
+    memcpy(buffer->data + buffer->end, data, length);
+    buffer->end += length;
+    return true;
+}
+
+
+/*
+ * Close down the connection after a failure.  The error message has already
+ * been set by the caller.
+ */
+static void
+nb_fail(struct remctl *r)
+{
+    OM_uint32 minor;
+    struct internal_nb *nb = r->nonblock;
+
+    if (r->fd != INVALID_SOCKET) {
+        socket_close(r->fd);
+        r->fd = INVALID_SOCKET;
+    }
+    if (nb->context != GSS_C_NO_CONTEXT)
+        gss_delete_sec_context(&minor, &nb->context, GSS_C_NO_BUFFER);
+    if (r->context != GSS_C_NO_CONTEXT)
+        gss_delete_sec_context(&minor, &r->context, GSS_C_NO_BUFFER);
+    r->ready = false;
+}
+
+
+/*
+ * Queue a token with the standard header for sending to the server.  The
+ * token is sent as-is; use internal_nb_queue to apply the protection layer.
+ * Returns true on success and false on failure, setting the error.
+ */
+static bool
+nb_queue_raw(struct remctl *r, int flags, gss_buffer_t token,
+             const char *error)
+{
+    struct internal_nb *nb = r->nonblock;
+    unsigned char header[TOKEN_HEADER_LENGTH];
+    OM_uint32 length;
+
+    if (token->length > (r->large ? TOKEN_MAX_LARGE : TOKEN_MAX_LENGTH)) {
+        internal_token_error(r, error, TOKEN_FAIL_LARGE, 0, 0);
+        return false;
+    }
+    header[0] = (unsigned char) flags;
+    length = htonl((OM_uint32) token->length);
+    memcpy(header + 1, &length, sizeof(length));
+    if (!nb_buffer_append(&nb->out, header, sizeof(header))
+        || !nb_buffer_append(&nb->out, token->value, token->length)) {
+        internal_set_error(r, "cannot allocate memory: %s", strerror(errno));
+        return false;
+    }
+    PROBE3(token__send, r->fd, flags, token->length);
+    return true;
+}
+
+
+/*
+ * Wrap a data token with the GSS-API context and queue it to be sent to the
+ * server.  Returns true on success and false on failure, setting the error.
+ */
+bool
+internal_nb_queue(struct remctl *r, gss_buffer_t token, const char *error)
+{
+    gss_buffer_desc out;
+    OM_uint32 major, minor;
+    int state;
+    bool okay;
+
+    if (token->length > r->max_data) {
+        internal_token_error(r, error, TOKEN_FAIL_LARGE, 0, 0);
+        return false;
+    }
+    major = gss_wrap(&minor, r->context, 1, GSS_C_QOP_DEFAULT, token, &state,
+                     &out);
+    if (major != GSS_S_COMPLETE) {
+        internal_token_error(r, error, TOKEN_FAIL_GSSAPI, major, minor);
+        return false;
+    }
+    okay = nb_queue_raw(r, TOKEN_DATA | TOKEN_PROTOCOL, &out, error);
+    gss_release_buffer(&minor, &out);
+    return okay;
+}
+
+
+/*
+ * Returns true if the last socket error means that the operation would have
+ * blocked.  EAGAIN and EWOULDBLOCK are the same number on Linux but not on
+ * some other platforms, and gcc with -Werror=logical-op warns about comparing
+ * against both when they're identical.
+ */
+static bool
+nb_would_block(void)
+{
+    if (socket_errno == EAGAIN)
+        return true;
+#if EAGAIN != EWOULDBLOCK
+    if (socket_errno == EWOULDBLOCK)
+        return true;
+#endif
+    return false;
+}
+
+
+/*
+ * Write as much queued data as the socket will accept.  Returns 1 if all
+ * queued data was written, 0 if the socket would block, and -1 on error
+ * (setting the error message).
+ */
+static int
+nb_write(struct remctl *r)
+{
+    struct nb_buffer *out = &r->nonblock->out;
+    ssize_t status;
+
+    while (out->start < out->end) {
+        status = socket_write(r->fd, out->data + out->start,
+                              out->end - out->start);
+        if (status < 0) {
+            if (socket_errno == EINTR)
+                continue;
+            if (nb_would_block())
+                return 0;
+            internal_token_error(r, "sending token", TOKEN_FAIL_SOCKET, 0, 0);
+            return -1;
+        }
+        out->start += (size_t) status;
+    }
+    out->start = out->end = 0;
+    return 1;
+}
+
+
+/*
+ * Make a single attempt to write any queued data, ignoring errors.  Used when
+ * sending QUIT right before closing the connection.
+ */
+void
+internal_nb_flush(struct remctl *r)
+{
+    if (r->nonblock != NULL && r->fd != INVALID_SOCKET)
+        nb_write(r);
+}
+
+
+/*
+ * Try to assemble a complete token from the network.  On success, stores
+ * the token flags and a newly allocated copy of the token data in the
+ * arguments.  Returns 1 if a token is available, 0 if the socket would
+ * block, and -1 on error (setting the error message).
+ */
+static int
+nb_read(struct remctl *r, int *flags, gss_buffer_t token)
+{
+    struct nb_buffer *in = &r->nonblock->in;
+    OM_uint32 length;
+    size_t available, wanted;
+    ssize_t status;
+
+    for (;;) {
+        available = in->end - in->start;
+
+        /* If we have a complete token, hand it back. */
+        if (available >= TOKEN_HEADER_LENGTH) {
+            memcpy(&length, in->data + in->start + 1, sizeof(length));
+            length = ntohl(length);
+            if (length > (r->large ? TOKEN_MAX_LARGE : TOKEN_MAX_LENGTH)) {
+                internal_token_error(r, "receiving token", TOKEN_FAIL_LARGE,
+                                     0, 0);
+                return -1;
+            }
+            wanted = TOKEN_HEADER_LENGTH + length;
+            if (available >= wanted) {
+                *flags = (unsigned char) in->data[in->start];
+                token->length = length;
+                token->value = malloc(length > 0 ? length : 1);
+                if (token->value == NULL) {
+                    internal_set_error(r, "cannot allocate memory: %s",
+                                       strerror(errno));
+                    return -1;
+                }
+                memcpy(token->value,
+                       in->data + in->start + TOKEN_HEADER_LENGTH, length);
+                in->start += wanted;
+                if (in->start == in->end)
+                    in->start = in->end = 0;
+                PROBE3(token__recv, r->fd, *flags, token->length);
+                return 1;
+            }
+        }
+
+        /* Otherwise, make room and read more data. */
+        if (in->size - in->end < READ_CHUNK) {
+            if (in->start > 0) {
+                memmove(in->data, in->data + in->start, available);
+                in->start = 0;
+                in->end = available;
+            }
+            if (in->size - in->end < READ_CHUNK) {
+                char *newdata;
+
+                newdata = realloc(in->data, in->end + READ_CHUNK);
+                if (newdata == NULL) {
+                    internal_set_error(r, "cannot allocate memory: %s",
+                                       strerror(errno));
+                    return -1;
+                }
+                in->data = newdata;
+                in->size = in->end + READ_CHUNK;
+            }
+        }
+        status = socket_read(r->fd, in->data + in->end, READ_CHUNK);
+        if (status < 0) {
+            if (socket_errno == EINTR)
+                continue;
+            if (nb_would_block())
+                return 0;
+            internal_token_error(r, "receiving token", TOKEN_FAIL_SOCKET, 0,
+                                 0);
+            return -1;
+        } else if (status == 0) {
+            internal_token_error(r, "receiving token", TOKEN_FAIL_EOF, 0, 0);
+            return -1;
+        }
+        in->end += (size_t) status;
+    }
+}
+
+
+/*
+ * Read and unwrap a data token from the server, checking its header.
+ * Returns 1 if a token is available, 0 if the socket would block, and -1 on
+ * error (setting the error message).
+ */
+static int
+nb_read_priv(struct remctl *r, gss_buffer_t token)
+{
+    gss_buffer_desc in;
+    OM_uint32 major, minor;
+    int flags, status, state;
+
+    status = nb_read(r, &flags, &in);
+    if (status <= 0)
+        return status;
+    major = gss_unwrap(&minor, r->context, &in, token, &state, NULL);
+    free(in.value);
+    if (major != GSS_S_COMPLETE) {
+        internal_token_error(r, "receiving token", TOKEN_FAIL_GSSAPI, major,
+                             minor);
+        return -1;
+    }
+    return internal_v2_check_token(r, flags, token) ? 1 : -1;
+}
+
+
+/*
+ * Start a non-blocking connect to the next address in our list, moving on to
+ * the legacy port if we run out of addresses and port fallback was
+ * requested.  Returns true if a connection attempt is in progress or
+ * complete and false if no addresses remain, setting the error message.  The
+ * error from the previous attempt, if any, should be in socket_errno.
+ */
+static bool
+nb_connect_next(struct remctl *r)
+{
+    struct internal_nb *nb = r->nonblock;
+    struct addrinfo hints, *ai;
+    char portbuf[16];
+    int status;
+    int err = socket_errno;
+
+    for (;;) {
+        while (nb->next != NULL) {
+            ai = nb->next;
+            nb->next = ai->ai_next;
+            r->fd = network_client_create(ai->ai_family, SOCK_STREAM,
+                                          r->source);
+            if (r->fd == INVALID_SOCKET) {
+                err = socket_errno;
+                continue;
+            }
+            if (!fdflag_nonblocking(r->fd, true)) {
+                err = socket_errno;
+                socket_close(r->fd);
+                r->fd = INVALID_SOCKET;
+                continue;
+            }
+            status = connect(r->fd, ai->ai_addr, ai->ai_addrlen);
+            if (status == 0 || socket_errno == EINPROGRESS)
+                return true;
+            err = socket_errno;
+            socket_close(r->fd);
+            r->fd = INVALID_SOCKET;
+        }
+
+        /* Out of addresses.  Try the legacy port if we haven't yet. */
+        if (nb->fallback == 0)
+            break;
+        if (nb->addrs != NULL) {
+            freeaddrinfo(nb->addrs);
+            nb->addrs = NULL;
+        }
+        nb->port = nb->fallback;
+        nb->fallback = 0;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        snprintf(portbuf, sizeof(portbuf), "%hu", nb->port);
+        if (getaddrinfo(nb->host, portbuf, &hints, &nb->addrs) != 0)
+            break;
+        nb->next = nb->addrs;
+    }
+    socket_set_errno(err);
+    internal_set_error(r, "cannot connect to %s (port %hu): %s", nb->host,
+                       nb->port, socket_strerror(err));
+    return false;
+}
+
+
+/*
+ * Check whether a pending non-blocking connect has finished.  Returns 1 if
+ * connected, 0 if the connect is still in progress, and -1 if it failed
+ * (leaving the error in socket_errno).
+ */
+static int
+nb_connect_check(struct remctl *r)
+{
+    struct sockaddr_storage ss;
+    socklen_t length;
+    int err;
+
+    length = sizeof(ss);
+    if (getpeername(r->fd, (struct sockaddr *) &ss, &length) == 0)
+        return 1;
+    length = sizeof(err);
+    if (getsockopt(r->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &length) < 0)
+        return -1;
+    if (err == 0)
+        return 0;
+    socket_set_errno(err);
+    return -1;
+}
+
+
+/*
+ * Call gss_init_sec_context with the given input token (which may be
+ * GSS_C_NO_BUFFER) and queue any resulting output token.  Returns true on
+ * success and false on failure, setting the error.
+ */
+static bool
+nb_init_context(struct remctl *r, gss_buffer_t input)
+{
+    struct internal_nb *nb = r->nonblock;
+    gss_buffer_desc send_tok;
+    OM_uint32 minor, init_minor;
+    bool okay = true;
+
+    nb->major = gss_init_sec_context(
+        &init_minor, nb->cred, &nb->context, nb->name,
+        (const gss_OID) GSS_KRB5_MECHANISM, INTERNAL_GSS_FLAGS_WANTED, 0,
+        NULL, input, NULL, &send_tok, &nb->gss_flags, NULL);
+    if (send_tok.length != 0)
+        okay = nb_queue_raw(r, TOKEN_CONTEXT | TOKEN_PROTOCOL, &send_tok,
+                            "sending token");
+    gss_release_buffer(&minor, &send_tok);
+    if (!okay)
+        return false;
+    if (nb->major != GSS_S_COMPLETE && nb->major != GSS_S_CONTINUE_NEEDED) {
+        internal_gssapi_error(r, "initializing context", nb->major,
+                              init_minor);
+        return false;
+    }
+    return true;
+}
+
+
+/*
+ * The connection is established, so queue the initial negotiation token and
+ * the first context token.  Returns true on success and false on failure,
+ * setting the error.
+ */
+static bool
+nb_handshake_start(struct remctl *r)
+{
+    gss_buffer_desc empty_token = {0, (void *) ""};
+
+    r->nonblock->state = NB_HANDSHAKE;
+    if (!nb_queue_raw(r, TOKEN_NOOP | TOKEN_CONTEXT_NEXT | TOKEN_PROTOCOL,
+                      &empty_token, "sending initial token"))
+        return false;
+    return nb_init_context(r, GSS_C_NO_BUFFER);
+}
+
+
+/*
+ * Handle the next step of the context handshake after all queued data has
+ * been written.  Returns REMCTL_STEP_DONE if the handshake is complete,
+ * REMCTL_STEP_READ if we're waiting for data from the server,
+ * REMCTL_STEP_WRITE if another token was queued, or REMCTL_STEP_ERROR.  If
+ * compression or large tokens were requested, a CAPABILITIES message is
+ * queued once the context is established, and the connection isn't ready
+ * until the server replies.
+ */
+static enum remctl_step_status
+nb_handshake(struct remctl *r)
+{
+    struct internal_nb *nb = r->nonblock;
+    gss_buffer_desc token;
+    int flags, status;
+    OM_uint32 minor;
+    bool okay;
+
+    if (nb->major == GSS_S_COMPLETE) {
+        if ((nb->gss_flags & INTERNAL_GSS_FLAGS_REQUIRED)
+            != INTERNAL_GSS_FLAGS_REQUIRED) {
+            internal_set_error(r, "server did not negotiate acceptable"
+                                  " GSS-API flags");
+            return REMCTL_STEP_ERROR;
+        }
+        r->context = nb->context;
+        nb->context = GSS_C_NO_CONTEXT;
+        if (nb->name != GSS_C_NO_NAME)
+            gss_release_name(&minor, &nb->name);
+        if (nb->cred != GSS_C_NO_CREDENTIAL)
+            gss_release_cred(&minor, &nb->cred);
+        nb->state = NB_READY;
+        r->ready = false;
+        r->compress = COMPRESS_NONE;
+        r->large = false;
+        r->max_data = TOKEN_MAX_DATA;
+        PROBE3(client__open, nb->host, r->fd, r->protocol);
+        if (r->want_compress || r->want_large) {
+            if (!internal_v3_capabilities(r))
+                return REMCTL_STEP_ERROR;
+            return REMCTL_STEP_WRITE;
+        }
+        return REMCTL_STEP_DONE;
+    }
+    status = nb_read(r, &flags, &token);
+    if (status == 0)
+        return REMCTL_STEP_READ;
+    else if (status < 0)
+        return REMCTL_STEP_ERROR;
+    if ((flags & TOKEN_PROTOCOL) != TOKEN_PROTOCOL) {
+        free(token.value);
+        internal_set_error(r, "protocol version 1 not supported in"
+                              " non-blocking mode");
+        return REMCTL_STEP_ERROR;
+    }
+    okay = nb_init_context(r, &token);
+    free(token.value);
+    return okay ? REMCTL_STEP_WRITE : REMCTL_STEP_ERROR;
+}
+
+
+/*
+ * Start a non-blocking connection to a server.  Resolves the host (which may
+ * block unless the host is a numeric address), imports the server name, and
+ * starts connecting.  Returns true on success and false on failure, setting
+ * the error.
+ */
+bool
+internal_nb_open(struct remctl *r, const char *host, unsigned short port,
+                 const char *principal)
+{
+    struct internal_nb *nb;
+    struct addrinfo hints;
+    char portbuf[16];
+    int status;
+
+    nb = calloc(1, sizeof(struct internal_nb));
+    if (nb == NULL) {
+        internal_set_error(r, "cannot allocate memory: %s", strerror(errno));
+        return false;
+    }
+    r->nonblock = nb;
+    nb->name = GSS_C_NO_NAME;
+    nb->cred = GSS_C_NO_CREDENTIAL;
+    nb->context = GSS_C_NO_CONTEXT;
+    nb->state = NB_CONNECTING;
+    r->protocol = 2;
+    nb->host = strdup(host);
+    if (nb->host == NULL) {
+        internal_set_error(r, "cannot allocate memory: %s", strerror(errno));
+        return false;
+    }
+
+    /* Import the name and the client credentials. */
+    if (!internal_import_name(r, host, principal, &nb->name))
+        return false;
+    if (r->ccache != NULL)
+        if (!internal_set_cred(r, &nb->cred))
+            return false;
+
+    /* Port 0 means to try the standard port and then the legacy port. */
+    if (port == 0) {
+        port = REMCTL_PORT;
+        nb->fallback = REMCTL_PORT_OLD;
+    }
+    nb->port = port;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(portbuf, sizeof(portbuf), "%hu", port);
+    status = getaddrinfo(host, portbuf, &hints, &nb->addrs);
+    if (status != 0) {
+        internal_set_error(r, "unknown host %s: %s", host,
+                           gai_strerror(status));
+        return false;
+    }
+    nb->next = nb->addrs;
+    return nb_connect_next(r);
+}
+
+
+/*
+ * Returns true if the connection is established and has no pending
+ * operation, and otherwise sets an appropriate error and returns false.
+ */
+bool
+internal_nb_idle(struct remctl *r)
+{
+    struct internal_nb *nb = r->nonblock;
+
+    if (nb == NULL) {
+        internal_set_error(r, "connection not opened in non-blocking mode");
+        return false;
+    }
+    if (r->fd == INVALID_SOCKET) {
+        internal_set_error(r, "no connection open");
+        return false;
+    }
+    if (nb->state != NB_READY || r->ready) {
+        internal_set_error(r, "operation already in progress");
+        return false;
+    }
+    free(r->error);
+    r->error = NULL;
+    return true;
+}
+
+
+/*
+ * Note that a NOOP message has been queued and we should expect the reply.
+ * Always succeeds.
+ */
+bool
+internal_nb_noop(struct remctl *r)
+{
+    r->nonblock->state = NB_NOOP;
+    return true;
+}
+
+
+/*
+ * Note that a CAPABILITIES message has been queued and we should expect the
+ * reply.  Always succeeds.
+ */
+bool
+internal_nb_capabilities(struct remctl *r)
+{
+    r->nonblock->state = NB_CAPABILITIES;
+    return true;
+}
+
+
+/*
+ * Hand the token read by remctl_step over to remctl_output.  Returns true if
+ * a token was available and false otherwise, setting the error.
+ */
+bool
+internal_nb_token(struct remctl *r, gss_buffer_t token)
+{
+    struct internal_nb *nb = r->nonblock;
+
+    if (!nb->have_pending) {
+        internal_set_error(r, "no output available, call remctl_step");
+        return false;
+    }
+    *token = nb->pending;
+    nb->pending.length = 0;
+    nb->pending.value = NULL;
+    nb->have_pending = false;
+    return true;
+}
+
+
+/*
+ * Advance whatever operation is in progress on a non-blocking connection as
+ * far as possible without blocking.
+ */
+enum remctl_step_status
+internal_nb_step(struct remctl *r)
+{
+    struct internal_nb *nb = r->nonblock;
+    enum remctl_step_status result;
+    gss_buffer_desc token;
+    OM_uint32 minor;
+    int status;
+    bool okay;
+    char *p;
+
+    if (nb == NULL) {
+        internal_set_error(r, "connection not opened in non-blocking mode");
+        return REMCTL_STEP_ERROR;
+    }
+    if (r->fd == INVALID_SOCKET) {
+        internal_set_error(r, "no connection open");
+        return REMCTL_STEP_ERROR;
+    }
+
+    /* Finish the TCP connect, moving on to other addresses on failure. */
+    if (nb->state == NB_CONNECTING) {
+        status = nb_connect_check(r);
+        if (status == 0)
+            return REMCTL_STEP_WRITE;
+        if (status < 0) {
+            status = socket_errno;
+            socket_close(r->fd);
+            r->fd = INVALID_SOCKET;
+            socket_set_errno(status);
+            if (!nb_connect_next(r))
+                return REMCTL_STEP_ERROR;
+            return REMCTL_STEP_WRITE;
+        }
+        freeaddrinfo(nb->addrs);
+        nb->addrs = NULL;
+        nb->next = NULL;
+        if (!nb_handshake_start(r))
+            goto fail;
+    }
+
+    /*
+     * Flush any queued data and then see what the current state needs.  The
+     * handshake may queue another token, so loop until we have to wait.
+     */
+    for (;;) {
+        status = nb_write(r);
+        if (status == 0)
+            return REMCTL_STEP_WRITE;
+        else if (status < 0)
+            goto fail;
+        switch (nb->state) {
+        case NB_HANDSHAKE:
+            result = nb_handshake(r);
+            if (result == REMCTL_STEP_ERROR)
+                goto fail;
+            if (result != REMCTL_STEP_WRITE)
+                return result;
+            break;
+        case NB_READY:
+            if (nb->have_pending)
+                return REMCTL_STEP_OUTPUT;
+            if (!r->ready)
+                return REMCTL_STEP_DONE;
+            status = nb_read_priv(r, &nb->pending);
+            if (status == 0)
+                return REMCTL_STEP_READ;
+            else if (status < 0)
+                goto fail;
+            nb->have_pending = true;
+            return REMCTL_STEP_OUTPUT;
+        case NB_NOOP:
+            status = nb_read_priv(r, &token);
+            if (status == 0)
+                return REMCTL_STEP_READ;
+            else if (status < 0)
+                goto fail;
+            p = token.value;
+            if (p[1] != MESSAGE_NOOP) {
+                internal_set_error(r, "unexpected message type %d from server",
+                                   p[1]);
+                gss_release_buffer(&minor, &token);
+                goto fail;
+            }
+            gss_release_buffer(&minor, &token);
+            nb->state = NB_READY;
+            return REMCTL_STEP_DONE;
+        case NB_CAPABILITIES:
+            status = nb_read_priv(r, &token);
+            if (status == 0)
+                return REMCTL_STEP_READ;
+            else if (status < 0)
+                goto fail;
+            okay = internal_v3_capabilities_reply(r, &token);
+            gss_release_buffer(&minor, &token);
+            if (!okay)
+                goto fail;
+            nb->state = NB_READY;
+            return REMCTL_STEP_DONE;
+        case NB_CONNECTING:
+        default:
+            internal_set_error(r, "internal error: bad connection state");
+            goto fail;
+        }
+    }
+
+fail:
+    nb_fail(r);
+    return REMCTL_STEP_ERROR;
+}
+
+
+/*
+ * Free the non-blocking state for a connection, if any.
+ */
+void
+internal_nb_free(struct remctl *r)
+{
+    struct internal_nb *nb = r->nonblock;
+    OM_uint32 minor;
+
+    if (nb == NULL)
+        return;
+    if (nb->addrs != NULL)
+        freeaddrinfo(nb->addrs);
+    if (nb->name != GSS_C_NO_NAME)
+        gss_release_name(&minor, &nb->name);
+    if (nb->cred != GSS_C_NO_CREDENTIAL)
+        gss_release_cred(&minor, &nb->cred);
+    if (nb->context != GSS_C_NO_CONTEXT)
+        gss_delete_sec_context(&minor, &nb->context, GSS_C_NO_BUFFER);
+    if (nb->have_pending)
+        gss_release_buffer(&minor, &nb->pending);
+    free(nb->out.data);
+    free(nb->in.data);
+    free(nb->host);
+    free(nb);
+    r->nonblock = NULL;
+}
@@ -28,6 +28,7 @@
 #include <client/remctl.h>
 #include <util/macros.h>
 #include <util/network.h>
+#include <util/probes.h>
 #include <util/protocol.h>
 #include <util/tokens.h>
 
@@ -47,8 +48,8 @@ internal_connect(struct remctl *r, const char *host, unsigned short port)
 
     /*
      * Look up the remote host and open a TCP connection.  Call getaddrinfo
-     * and network_connect instead of network_connect_host so that we can
-     * report the complete error on host resolution.
+     * and network_connect_staggered instead of network_connect_host so that we
+     * can report the complete error on host resolution.
      */
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC;
@@ -60,7 +61,7 @@ internal_connect(struct remctl *r, const char *host, unsigned short port)
                            gai_strerror(status));
         return INVALID_SOCKET;
     }
-    fd = network_connect(ai, r->source, r->timeout);
+    fd = network_connect_staggered(ai, r->source, r->timeout);
     freeaddrinfo(ai);
     if (fd == INVALID_SOCKET) {
         internal_set_error(r, "cannot connect to %s (port %hu): %s", host,
@@ -82,7 +83,7 @@ internal_connect(struct remctl *r, const char *host, unsigned short port)
  *
  * Returns true on success and false on failure.
  */
-static bool
+bool
 internal_import_name(struct remctl *r, const char *host, const char *principal,
                      gss_name_t *name)
 {
@@ -134,7 +135,7 @@ internal_import_name(struct remctl *r, const char *host, const char *principal,
  * default is.  The other cases are handled in remctl_set_ccache.
  */
 #if defined(HAVE_GSS_KRB5_IMPORT_CRED) && defined(HAVE_KRB5)
-static bool
+bool
 internal_set_cred(struct remctl *r, gss_cred_id_t *gss_cred)
 {
     krb5_error_code code;
@@ -162,7 +163,7 @@ internal_set_cred(struct remctl *r, gss_cred_id_t *gss_cred)
     return true;
 }
 #else  /* !HAVE_GSS_KRB5_IMPORT_CRED || !HAVE_KRB5 */
-static bool
+bool
 internal_set_cred(struct remctl *r UNUSED, gss_cred_id_t *gss_cred UNUSED)
 {
     return false;
@@ -184,11 +185,6 @@ internal_open(struct remctl *r, const char *host, const char *principal)
     gss_cred_id_t gss_cred = GSS_C_NO_CREDENTIAL;
     gss_ctx_id_t gss_context = GSS_C_NO_CONTEXT;
     OM_uint32 major, minor, init_minor, gss_flags;
-    static const OM_uint32 wanted_gss_flags =
-        (GSS_C_MUTUAL_FLAG | GSS_C_CONF_FLAG | GSS_C_INTEG_FLAG
-         | GSS_C_REPLAY_FLAG | GSS_C_SEQUENCE_FLAG);
-    static const OM_uint32 req_gss_flags =
-        (GSS_C_MUTUAL_FLAG | GSS_C_CONF_FLAG | GSS_C_INTEG_FLAG);
 
     /* Import the name. */
     if (!internal_import_name(r, host, principal, &name))
@@ -236,10 +232,10 @@ internal_open(struct remctl *r, const char *host, const char *principal)
      */
     token_ptr = GSS_C_NO_BUFFER;
     do {
-        major = gss_init_sec_context(&init_minor, gss_cred, &gss_context, name,
-                                     (const gss_OID) GSS_KRB5_MECHANISM,
-                                     wanted_gss_flags, 0, NULL, token_ptr,
-                                     NULL, &send_tok, &gss_flags, NULL);
+        major = gss_init_sec_context(
+            &init_minor, gss_cred, &gss_context, name,
+            (const gss_OID) GSS_KRB5_MECHANISM, INTERNAL_GSS_FLAGS_WANTED, 0,
+            NULL, token_ptr, NULL, &send_tok, &gss_flags, NULL);
         if (token_ptr != GSS_C_NO_BUFFER)
             free(recv_tok.value);
 
@@ -285,7 +281,9 @@ internal_open(struct remctl *r, const char *host, const char *principal)
      * establishing the context, since Heimdal doesn't report all flags until
      * context negotiation is complete.
      */
-    if (r->protocol > 1 && (gss_flags & req_gss_flags) != req_gss_flags) {
+    if (r->protocol > 1
+        && (gss_flags & INTERNAL_GSS_FLAGS_REQUIRED)
+               != INTERNAL_GSS_FLAGS_REQUIRED) {
         internal_set_error(r, "server did not negotiate acceptable GSS-API"
                               " flags");
         goto fail;
@@ -294,9 +292,25 @@ internal_open(struct remctl *r, const char *host, const char *principal)
     /* Success.  Set the context in the struct remctl object. */
     r->context = gss_context;
     r->ready = 0;
+    r->compress = COMPRESS_NONE;
+    r->large = false;
+    r->max_data = TOKEN_MAX_DATA;
     gss_release_name(&minor, &name);
     if (gss_cred != GSS_C_NO_CREDENTIAL)
         gss_release_cred(&minor, &gss_cred);
+    PROBE3(client__open, host, r->fd, r->protocol);
+
+    /*
+     * If compression or large tokens were requested, find out what the
+     * server supports.
+     */
+    if (r->protocol > 1 && (r->want_compress || r->want_large))
+        if (!internal_v3_capabilities(r)) {
+            gss_delete_sec_context(&minor, &r->context, GSS_C_NO_BUFFER);
+            socket_close(r->fd);
+            r->fd = INVALID_SOCKET;
+            return false;
+        }
     return true;
 
 fail:
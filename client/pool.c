@@ -0,0 +1,404 @@
+/*
+ * Process-wide connection pool for the remctl client library.
+ *
+ * Opening a remctl connection requires name resolution, a TCP connection, and
+ * a full GSS-API context negotiation, which is expensive for callers who run
+ * many short commands against the same small set of servers.  If the pool is
+ * enabled, remctl_pool_close keeps the authenticated connection instead of
+ * closing it, and a subsequent remctl_pool_open for the same host, port,
+ * principal, and ticket cache reuses it.  If no ticket cache was set, the
+ * connection uses the default, which can change between calls, so the pool
+ * records the name of the default ticket cache at the time of the open.
+ *
+ * Idle connections are checked before reuse.  Connections whose GSS-API
+ * context is about to expire or that the server has closed are discarded,
+ * and connections that have been idle for a while are checked with a NOOP
+ * message first.  Only protocol version two and later connections are kept,
+ * and the health check requires protocol version three.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/gssapi.h>
+#include <portable/socket.h>
+#include <portable/system.h>
+
+#ifdef HAVE_KRB5
+#    include <portable/krb5.h>
+#endif
+#ifdef HAVE_PTHREAD
+#    include <pthread.h>
+#endif
+#ifdef _WIN32
+#    define poll WSAPoll
+#else
+#    include <poll.h>
+#endif
+#include <time.h>
+
+#include <client/internal.h>
+#include <client/remctl.h>
+
+/* Idle connections older than this many seconds get a NOOP before reuse. */
+#define POOL_CHECK_INTERVAL 30
+
+/* Discard connections whose context will expire within this many seconds. */
+#define POOL_MIN_LIFETIME 60
+
+/* Protect the pool with a mutex if threads are available. */
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+#    define POOL_LOCK()   pthread_mutex_lock(&pool_mutex)
+#    define POOL_UNLOCK() pthread_mutex_unlock(&pool_mutex)
+#else
+#    define POOL_LOCK()   /* empty */
+#    define POOL_UNLOCK() /* empty */
+#endif
+
+/* An idle connection in the pool. */
+struct pool_entry {
+    char *host;              /* Host the connection was opened to. */
+    unsigned short port;     /* Port as passed to remctl_open. */
+    char *principal;         /* Server principal, or NULL for the default. */
+    char *ccache;            /* Name of the client ticket cache. */
+    struct remctl *conn;     /* Holds the connection while idle. */
+    time_t idle;             /* When the connection was returned. */
+    struct pool_entry *next; /* Next entry, most recently used first. */
+};
+
+/* The process-wide pool. */
+static struct {
+    bool enabled;               /* Whether connections should be kept. */
+    size_t size;                /* Maximum number of idle connections. */
+    time_t timeout;             /* Maximum idle time, or 0 for no limit. */
+    size_t count;               /* Current number of idle connections. */
+    struct pool_entry *entries; /* Idle connections. */
+} pool;
+
+
+/*
+ * Compare two strings, either of which may be NULL.  Returns true if both are
+ * NULL or both are equal.
+ */
+static bool
+pool_equal(const char *a, const char *b)
+{
+    if (a == NULL || b == NULL)
+        return a == b;
+    return strcmp(a, b) == 0;
+}
+
+
+/*
+ * Return the name of the ticket cache that remctl_open would use for a
+ * connection, as a newly allocated string.  If none was set, this is the
+ * default ticket cache, which is taken from KRB5CCNAME or the Kerberos
+ * library.  KRB5CCNAME is checked first since the Kerberos library may
+ * remember the default from the first call.  Returns NULL if the name can't
+ * be determined, in which case the connection shouldn't be pooled.
+ */
+static char *
+pool_ccache_name(struct remctl *r)
+{
+    const char *name;
+
+    if (r->ccache != NULL)
+        return strdup(r->ccache);
+    name = getenv("KRB5CCNAME");
+    if (name != NULL)
+        return strdup(name);
+#ifdef HAVE_KRB5
+    if (r->krb_ctx == NULL)
+        if (krb5_init_context(&r->krb_ctx) != 0)
+            return NULL;
+    name = krb5_cc_default_name(r->krb_ctx);
+    if (name != NULL)
+        return strdup(name);
+#endif
+    return NULL;
+}
+
+
+/*
+ * Move the network connection and GSS-API context from one remctl object to
+ * another.
+ */
+static void
+pool_move(struct remctl *to, struct remctl *from)
+{
+    to->fd = from->fd;
+    to->context = from->context;
+    to->protocol = from->protocol;
+    to->compress = from->compress;
+    to->large = from->large;
+    to->max_data = from->max_data;
+    from->fd = INVALID_SOCKET;
+    from->context = GSS_C_NO_CONTEXT;
+}
+
+
+/*
+ * Free a list of pool entries, closing their connections.
+ */
+static void
+pool_free_list(struct pool_entry *entry)
+{
+    struct pool_entry *next;
+
+    for (; entry != NULL; entry = next) {
+        next = entry->next;
+        remctl_close(entry->conn);
+        free(entry->host);
+        free(entry->principal);
+        free(entry->ccache);
+        free(entry);
+    }
+}
+
+
+/*
+ * Remove entries beyond the maximum pool size, which will be the least
+ * recently used ones.  Must be called with the pool locked.  Returns the list
+ * of removed entries, which the caller should free after unlocking the pool.
+ */
+static struct pool_entry *
+pool_trim(void)
+{
+    struct pool_entry **entry, *extra;
+    size_t i;
+
+    if (pool.count <= pool.size)
+        return NULL;
+    entry = &pool.entries;
+    for (i = 0; i < pool.size; i++)
+        entry = &(*entry)->next;
+    extra = *entry;
+    *entry = NULL;
+    pool.count = pool.size;
+    return extra;
+}
+
+
+/*
+ * Find and remove an idle connection matching the given parameters from the
+ * pool.  Also removes any connections that have been idle for too long and
+ * returns them in expired, which the caller should free.  Returns NULL if no
+ * matching connection was found.
+ */
+static struct pool_entry *
+pool_take(const char *host, unsigned short port, const char *principal,
+          const char *ccache, struct pool_entry **expired)
+{
+    struct pool_entry **entry, *current, *found = NULL;
+    time_t now;
+
+    *expired = NULL;
+    now = time(NULL);
+    POOL_LOCK();
+    entry = &pool.entries;
+    while (*entry != NULL) {
+        current = *entry;
+        if (pool.timeout > 0 && now - current->idle >= pool.timeout) {
+            *entry = current->next;
+            current->next = *expired;
+            *expired = current;
+            pool.count--;
+        } else if (found == NULL && current->port == port
+                   && pool_equal(current->host, host)
+                   && pool_equal(current->principal, principal)
+                   && pool_equal(current->ccache, ccache)) {
+            *entry = current->next;
+            current->next = NULL;
+            found = current;
+            pool.count--;
+        } else {
+            entry = &current->next;
+        }
+    }
+    POOL_UNLOCK();
+    return found;
+}
+
+
+/*
+ * Check whether an idle connection can be reused.  The GSS-API context must
+ * not be about to expire, the server must not have closed the connection or
+ * sent unexpected data, and, if the connection has been idle for a while, it
+ * must respond to a NOOP.
+ */
+static bool
+pool_healthy(struct pool_entry *entry)
+{
+    struct remctl *conn = entry->conn;
+    struct pollfd pfd;
+    OM_uint32 major, minor, lifetime;
+
+    major = gss_context_time(&minor, conn->context, &lifetime);
+    if (major != GSS_S_COMPLETE || lifetime < POOL_MIN_LIFETIME)
+        return false;
+    pfd.fd = conn->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) != 0)
+        return false;
+    if (time(NULL) - entry->idle >= POOL_CHECK_INTERVAL)
+        return remctl_noop(conn) != 0;
+    return true;
+}
+
+
+/*
+ * Enable the connection pool, or change its settings if it is already
+ * enabled.  size is the maximum number of idle connections to keep and
+ * timeout is the maximum time in seconds to keep an idle connection, or 0 to
+ * keep them until they fail a health check.  Returns true on success and
+ * false on an invalid timeout.
+ */
+int
+remctl_pool_enable(size_t size, time_t timeout)
+{
+    struct pool_entry *extra;
+
+    if (timeout < 0)
+        return 0;
+    POOL_LOCK();
+    pool.enabled = true;
+    pool.size = size;
+    pool.timeout = timeout;
+    extra = pool_trim();
+    POOL_UNLOCK();
+    pool_free_list(extra);
+    return 1;
+}
+
+
+/*
+ * Disable the connection pool and close all idle connections.
+ */
+void
+remctl_pool_disable(void)
+{
+    struct pool_entry *entries;
+
+    POOL_LOCK();
+    pool.enabled = false;
+    entries = pool.entries;
+    pool.entries = NULL;
+    pool.count = 0;
+    POOL_UNLOCK();
+    pool_free_list(entries);
+}
+
+
+/*
+ * Open a connection to a server, reusing an idle connection from the pool if
+ * one is available for the same host, port, principal, and ticket cache and
+ * it passes the health checks.  Otherwise, open a new connection with
+ * remctl_open.  Returns true on success and false on failure.
+ */
+int
+remctl_pool_open(struct remctl *r, const char *host, unsigned short port,
+                 const char *principal)
+{
+    struct pool_entry *entry, *expired;
+    char *ccache;
+
+    /* Without the ticket cache name, don't use the pool. */
+    ccache = pool_ccache_name(r);
+    if (ccache == NULL)
+        return remctl_open(r, host, port, principal);
+    for (;;) {
+        entry = pool_take(host, port, principal, ccache, &expired);
+        pool_free_list(expired);
+        if (entry == NULL)
+            break;
+        if (pool_healthy(entry)) {
+            internal_reset(r);
+            r->host = host;
+            r->port = port;
+            r->principal = principal;
+            r->pool_ccache = ccache;
+            pool_move(r, entry->conn);
+            pool_free_list(entry);
+            return 1;
+        }
+        pool_free_list(entry);
+    }
+    if (!remctl_open(r, host, port, principal)) {
+        free(ccache);
+        return 0;
+    }
+    r->pool_ccache = ccache;
+    return 1;
+}
+
+
+/*
+ * Close a connection, returning it to the pool if the pool is enabled and
+ * the connection can be reused.  The remctl object is always freed.
+ */
+void
+remctl_pool_close(struct remctl *r)
+{
+    struct pool_entry *entry, *extra;
+    bool enabled;
+
+    if (r == NULL)
+        return;
+    POOL_LOCK();
+    enabled = pool.enabled;
+    POOL_UNLOCK();
+    if (!enabled || r->fd == INVALID_SOCKET || r->protocol < 2
+        || r->ready || r->nonblock != NULL || r->host == NULL) {
+        remctl_close(r);
+        return;
+    }
+
+    /* Move the connection into a new pool entry. */
+    entry = calloc(1, sizeof(struct pool_entry));
+    if (entry == NULL) {
+        remctl_close(r);
+        return;
+    }
+    entry->host = strdup(r->host);
+    entry->port = r->port;
+    if (r->principal != NULL)
+        entry->principal = strdup(r->principal);
+    if (r->pool_ccache != NULL) {
+        entry->ccache = r->pool_ccache;
+        r->pool_ccache = NULL;
+    } else {
+        entry->ccache = pool_ccache_name(r);
+    }
+    entry->conn = remctl_new();
+    if (entry->host == NULL || entry->conn == NULL || entry->ccache == NULL
+        || (r->principal != NULL && entry->principal == NULL)) {
+        pool_free_list(entry);
+        remctl_close(r);
+        return;
+    }
+    pool_move(entry->conn, r);
+    entry->conn->host = entry->host;
+    entry->conn->port = entry->port;
+    entry->conn->principal = entry->principal;
+    entry->idle = time(NULL);
+    remctl_close(r);
+
+    /* Add it to the pool, discarding the oldest connection if needed. */
+    POOL_LOCK();
+    if (!pool.enabled) {
+        POOL_UNLOCK();
+        pool_free_list(entry);
+        return;
+    }
+    entry->next = pool.entries;
+    pool.entries = entry;
+    pool.count++;
+    extra = pool_trim();
+    POOL_UNLOCK();
+    pool_free_list(extra);
+}
@@ -5,9 +5,15 @@
  * command on the command line and prints out the results to standard output
  * and standard error as appropriate.
  *
+ * If given a list of hosts, either as a comma-separated list or in a file,
+ * it instead runs the command on all of the hosts in parallel using the
+ * non-blocking client interface, prefixing each line of output with the
+ * host that produced it.  With -a, it instead treats the list as a set of
+ * equivalent hosts and runs the command on only one of them.
+ *
  * Originally written by Anton Ushakov
  * Extensive modifications by Russ Allbery <eagle@eyrie.org>
- * Copyright 2018, 2020 Russ Allbery <eagle@eyrie.org>
+ * Copyright 2018, 2020, 2026 Russ Allbery <eagle@eyrie.org>
  * Copyright 2002-2011, 2013
  *     The Board of Trustees of the Leland Stanford Junior University
  *
@@ -20,23 +26,81 @@
 #include <portable/system.h>
 
 #include <ctype.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#    define poll WSAPoll
+#else
+#    include <poll.h>
+#    include <sys/time.h>
+#endif
 
 #include <client/remctl.h>
+#include <util/buffer.h>
 #include <util/messages.h>
+#include <util/vector.h>
 #include <util/xmalloc.h>
 
+/* The default number of hosts to contact in parallel. */
+#define DEFAULT_PARALLEL 32
+
+/* The number of slowest hosts to report in the summary. */
+#define SLOWEST_COUNT 5
+
+/* The longest to wait in poll in milliseconds, to avoid overflow. */
+#define MAX_POLL_WAIT (60 * 1000)
+
+/* Options for running a command on a list of hosts. */
+struct fanout_config {
+    const char *service;    /* Server principal, or NULL for the default. */
+    const char *source;     /* Source IP address, or NULL. */
+    unsigned short port;    /* Server port, or 0 for the default. */
+    time_t timeout;         /* Network inactivity timeout, or 0. */
+    time_t host_timeout;    /* Total time allowed per host, or 0. */
+    unsigned long parallel; /* Maximum number of simultaneous hosts. */
+    bool group;             /* Whether to collect output per host. */
+    bool compress;          /* Whether to negotiate compression. */
+    bool large;             /* Whether to negotiate large tokens. */
+    const char **command;   /* The command to run. */
+};
+
+/* The state of running the command on one host. */
+struct host {
+    const char *name;             /* Host name as given by the user. */
+    struct remctl *r;             /* Connection while the host is active. */
+    enum remctl_step_status step; /* What the connection is waiting for. */
+    bool sent;                    /* Whether the command has been sent. */
+    double start;                 /* When work on this host started. */
+    double last;                  /* Time of the last network activity. */
+    double elapsed;               /* Total time taken, once finished. */
+    int status;                   /* Exit status for this host. */
+    char *error;                  /* Error message if the host failed. */
+    struct buffer *partial[2];    /* Incomplete lines of stdout, stderr. */
+    struct buffer *saved[2];      /* Collected output if grouping. */
+};
+
 /* Usage message. */
 static const char usage_message[] = "\
 Usage: remctl <options> <host> <command> [<subcommand> [<parameters>]]\n\
+       remctl <options> -f <file> <command> [<subcommand> [<parameters>]]\n\
+\n\
+<host> may be a comma-separated list of hosts.\n\
 \n\
 Options:\n\
+    -a            Run the command on any one of the given hosts\n\
     -b <source>   Source IP used for outgoing connections\n\
     -d            Debugging level of output\n\
+    -f <file>     Run the command on each host listed in <file>\n\
+    -g            Group output by host when running on multiple hosts\n\
+    -H            With -a, also try a second host if the first is slow\n\
     -h            Display this help\n\
+    -j <count>    Number of hosts to contact in parallel (default: 32)\n\
+    -L            Ask the server to use large tokens for bulk transfer\n\
     -p <port>     remctld port (default: 4373 falling back to 4444)\n\
     -s <service>  remctld service principal (default: host/<host>)\n\
+    -T <timeout>  Total time allowed for each of multiple hosts\n\
     -t <timeout>  Timeout in seconds (default: 0, disable timeout)\n\
-    -v            Display the version of remctl\n";
+    -v            Display the version of remctl\n\
+    -z            Ask the server to compress large output\n";
 
 
 /*
@@ -110,23 +174,630 @@ process_response(struct remctl *r, int *errorcode)
 }
 
 
+/*
+ * Return the current time in seconds as a floating point number, used for
+ * timeouts and for reporting how long each host took.
+ */
+static double
+current_time(void)
+{
+#ifdef _WIN32
+    return (double) GetTickCount64() / 1000.0;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec + (double) tv.tv_usec / 1000000.0;
+#endif
+}
+
+
+/*
+ * Canonicalize the host name to which we're connecting for use in the server
+ * principal.  Returns a newly allocated string, or NULL on failure and sets
+ * status to the getaddrinfo error.
+ *
+ * If no principal is given, the remctl library uses host/<server>
+ * (host@<server> in GSS-API parlance).  However, if the server to which
+ * we're connecting is a DNS-load-balanced name, we have to be careful what
+ * principal name we use.
+ *
+ * Ideally, we would let the GSS-API library handle this and choose whether to
+ * canonicalize the <server> in the principal name based on the krb5.conf
+ * rdns setting and similar configuration.  However, with DNS load balancing,
+ * this still may fail.  At the time of network connection, we will connect
+ * to whatever the name resolves to then.  After we connect, we authenticate,
+ * and the GSS-API library will then separately canonicalize the hostname.  It
+ * could get a different answer than we got for our network connection,
+ * leading to an authentication failure.
+ *
+ * Therefore, if the principal isn't specified, we canonicalize the hostname
+ * to which we're connecting before we connect.  Then, the additional
+ * canonicalization possibly done by the GSS-API library should return the
+ * same results and be consistent.
+ *
+ * Note that this opens the possibility of a subtle attack through DNS
+ * spoofing, since both the principal used and the host to which we're
+ * connecting can be changed by varying the DNS response.
+ *
+ * If the principal is specified explicitly, assume the user knows what
+ * they're doing and don't do any of this.
+ */
+static char *
+canonicalize_host(const char *host, int *status)
+{
+    struct addrinfo hints, *ai;
+    char *canon;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_CANONNAME;
+    *status = getaddrinfo(host, NULL, &hints, &ai);
+    if (*status != 0)
+        return NULL;
+    canon = xstrdup(ai->ai_canonname);
+    freeaddrinfo(ai);
+    return canon;
+}
+
+
+/*
+ * Read a list of hosts from a file, adding them to the provided vector.  The
+ * file contains host names separated by whitespace, commas, or newlines.
+ * Blank lines and anything after # on a line are ignored.  A file name of -
+ * means to read the list from standard input.
+ */
+static void
+read_host_file(const char *path, struct vector *hosts)
+{
+    struct buffer *buffer;
+    struct vector *lines, *words = NULL;
+    char *comment;
+    size_t i, j;
+    int fd;
+
+    if (strcmp(path, "-") == 0)
+        fd = fileno(stdin);
+    else {
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+            sysdie("cannot open %s", path);
+    }
+    buffer = buffer_new();
+    if (!buffer_read_file(buffer, fd))
+        sysdie("cannot read %s", path);
+    if (fd != fileno(stdin))
+        close(fd);
+    buffer_append(buffer, "", 1);
+    lines = vector_split_multi(buffer->data, "\r\n", NULL);
+    for (i = 0; i < lines->count; i++) {
+        comment = strchr(lines->strings[i], '#');
+        if (comment != NULL)
+            *comment = '\0';
+        words = vector_split_multi(lines->strings[i], " \t,", words);
+        for (j = 0; j < words->count; j++)
+            vector_add(hosts, words->strings[j]);
+    }
+    if (words != NULL)
+        vector_free(words);
+    vector_free(lines);
+    buffer_free(buffer);
+}
+
+
+/*
+ * Output one line of output from a host, prefixed with the name of the host.
+ * stream is 0 for standard output and 1 for standard error.  If output is
+ * being grouped by host, save the line to print when the host finishes.
+ */
+static void
+emit_line(struct fanout_config *config, struct host *host, int stream,
+          const char *data, size_t length)
+{
+    FILE *output = (stream == 0) ? stdout : stderr;
+
+    if (config->group) {
+        buffer_append_sprintf(host->saved[stream], "%s: ", host->name);
+        buffer_append(host->saved[stream], data, length);
+        buffer_append(host->saved[stream], "\n", 1);
+    } else {
+        fprintf(output, "%s: ", host->name);
+        if (length > 0)
+            fwrite_checked(data, length, 1, output);
+        fputc('\n', output);
+    }
+}
+
+
+/*
+ * Add output from a host to its buffer for the appropriate stream and emit
+ * any complete lines.  Partial lines are held until the rest of the line
+ * arrives or the host finishes, so that output from different hosts doesn't
+ * get mixed together on the same line.
+ */
+static void
+add_output(struct fanout_config *config, struct host *host, int stream,
+           const char *data, size_t length)
+{
+    struct buffer *partial = host->partial[stream];
+    char *start, *end;
+    size_t line;
+
+    if (length == 0)
+        return;
+    buffer_append(partial, data, length);
+    for (;;) {
+        start = partial->data + partial->used;
+        end = memchr(start, '\n', partial->left);
+        if (end == NULL)
+            break;
+        line = (size_t) (end - start);
+        emit_line(config, host, stream, start, line);
+        partial->used += line + 1;
+        partial->left -= line + 1;
+    }
+    buffer_compact(partial);
+}
+
+
+/*
+ * Finish processing a host, either because the command completed or because
+ * of an error.  If error is not NULL, it is a local error message for the
+ * failure and the exit status for this host is set to 1.  Flushes any
+ * remaining output for the host and closes the connection.
+ */
+static void
+finish_host(struct fanout_config *config, struct host *host,
+            const char *error)
+{
+    struct buffer *partial, *saved;
+    int stream;
+    FILE *output;
+
+    host->elapsed = current_time() - host->start;
+    if (error != NULL) {
+        free(host->error);
+        host->error = xstrdup(error);
+        host->status = 1;
+    }
+    for (stream = 0; stream < 2; stream++) {
+        partial = host->partial[stream];
+        saved = host->saved[stream];
+        if (partial->left > 0)
+            emit_line(config, host, stream, partial->data + partial->used,
+                      partial->left);
+        if (config->group && saved->left > 0) {
+            output = (stream == 0) ? stdout : stderr;
+            fwrite_checked(saved->data + saved->used, saved->left, 1, output);
+        }
+        buffer_free(partial);
+        buffer_free(saved);
+        host->partial[stream] = NULL;
+        host->saved[stream] = NULL;
+    }
+    if (error != NULL)
+        warn("%s: %s", host->name, error);
+    if (host->r != NULL) {
+        remctl_close(host->r);
+        host->r = NULL;
+    }
+}
+
+
+/*
+ * Start work on a host: canonicalize its name if needed and start opening the
+ * connection.  Returns true if the host is now active and false if it failed
+ * and has already been finished.
+ */
+static bool
+start_host(struct fanout_config *config, struct host *host)
+{
+    char *server = NULL;
+    char *message;
+    int status;
+    bool okay;
+
+    host->start = current_time();
+    host->last = host->start;
+    for (status = 0; status < 2; status++) {
+        host->partial[status] = buffer_new();
+        host->saved[status] = buffer_new();
+    }
+    host->r = remctl_new();
+    if (host->r == NULL)
+        sysdie("cannot initialize remctl connection");
+    if (config->compress)
+        if (!remctl_set_compression(host->r, 1)) {
+            finish_host(config, host, remctl_error(host->r));
+            return false;
+        }
+    if (config->large)
+        remctl_set_large_tokens(host->r, 1);
+    if (config->source != NULL)
+        if (!remctl_set_source_ip(host->r, config->source)) {
+            finish_host(config, host, remctl_error(host->r));
+            return false;
+        }
+    if (config->service == NULL) {
+        server = canonicalize_host(host->name, &status);
+        if (server == NULL) {
+            xasprintf(&message, "cannot resolve host %s: %s", host->name,
+                      gai_strerror(status));
+            finish_host(config, host, message);
+            free(message);
+            return false;
+        }
+    }
+    okay = remctl_open_start(host->r, (server != NULL) ? server : host->name,
+                             config->port, config->service);
+    free(server);
+    if (!okay) {
+        finish_host(config, host, remctl_error(host->r));
+        return false;
+    }
+    host->step = REMCTL_STEP_WRITE;
+    return true;
+}
+
+
+/*
+ * Handle one piece of output from a host.
+ */
+static void
+handle_output(struct fanout_config *config, struct host *host,
+              struct remctl_output *output)
+{
+    switch (output->type) {
+    case REMCTL_OUT_OUTPUT:
+        if (output->stream == 1)
+            add_output(config, host, 0, output->data, output->length);
+        else
+            add_output(config, host, 1, output->data, output->length);
+        break;
+    case REMCTL_OUT_ERROR:
+        host->status = 255;
+        free(host->error);
+        host->error = xstrndup(output->data, output->length);
+        add_output(config, host, 1, output->data, output->length);
+        add_output(config, host, 1, "\n", 1);
+        break;
+    case REMCTL_OUT_STATUS:
+        host->status = output->status;
+        break;
+    case REMCTL_OUT_DONE:
+        break;
+    }
+}
+
+
+/*
+ * Called when the connection to a host is ready.  Advance the connection as
+ * far as possible without blocking, sending the command once the connection
+ * is established and handling any output.  Returns true if the host has
+ * finished and false if it is waiting for the network.
+ */
+static bool
+advance_host(struct fanout_config *config, struct host *host)
+{
+    struct remctl_output *output;
+    enum remctl_step_status step;
+
+    host->last = current_time();
+    step = remctl_step(host->r);
+    for (;;) {
+        switch (step) {
+        case REMCTL_STEP_READ:
+        case REMCTL_STEP_WRITE:
+            host->step = step;
+            return false;
+        case REMCTL_STEP_OUTPUT:
+            output = remctl_output(host->r);
+            if (output == NULL) {
+                finish_host(config, host, remctl_error(host->r));
+                return true;
+            }
+            handle_output(config, host, output);
+            break;
+        case REMCTL_STEP_DONE:
+            if (host->sent) {
+                finish_host(config, host, NULL);
+                return true;
+            }
+            if (!remctl_command_start(host->r, config->command)) {
+                finish_host(config, host, remctl_error(host->r));
+                return true;
+            }
+            host->sent = true;
+            break;
+        case REMCTL_STEP_ERROR:
+            finish_host(config, host, remctl_error(host->r));
+            return true;
+        }
+        step = remctl_step(host->r);
+    }
+}
+
+
+/*
+ * Return the time by which a host must make progress, or 0 if there is no
+ * timeout.  This is the earlier of the network inactivity timeout and the
+ * total time allowed for each host.
+ */
+static double
+host_deadline(struct fanout_config *config, struct host *host)
+{
+    double deadline = 0;
+    double total;
+
+    if (config->timeout > 0)
+        deadline = host->last + (double) config->timeout;
+    if (config->host_timeout > 0) {
+        total = host->start + (double) config->host_timeout;
+        if (deadline <= 0 || total < deadline)
+            deadline = total;
+    }
+    return deadline;
+}
+
+
+/*
+ * Report a summary of the results of running a command on multiple hosts to
+ * standard error, listing the hosts that failed and the slowest hosts.
+ * Returns the exit status for remctl, which is the largest exit status of
+ * any host.
+ */
+static int
+report_summary(struct host *hosts, size_t count)
+{
+    struct host *slowest[SLOWEST_COUNT];
+    struct buffer *buffer;
+    size_t i, j, failed = 0, nslow = 0;
+    int status = 0;
+
+    for (i = 0; i < count; i++) {
+        if (hosts[i].status != 0)
+            failed++;
+        if (hosts[i].status > status)
+            status = hosts[i].status;
+        for (j = nslow; j > 0; j--) {
+            if (slowest[j - 1]->elapsed >= hosts[i].elapsed)
+                break;
+            if (j < SLOWEST_COUNT)
+                slowest[j] = slowest[j - 1];
+        }
+        if (j < SLOWEST_COUNT) {
+            slowest[j] = &hosts[i];
+            if (nslow < SLOWEST_COUNT)
+                nslow++;
+        }
+    }
+    warn("%lu hosts, %lu succeeded, %lu failed", (unsigned long) count,
+         (unsigned long) (count - failed), (unsigned long) failed);
+    for (i = 0; i < count; i++) {
+        if (hosts[i].status == 0)
+            continue;
+        if (hosts[i].error != NULL)
+            warn("failed: %s: %s", hosts[i].name, hosts[i].error);
+        else
+            warn("failed: %s: exit status %d", hosts[i].name,
+                 hosts[i].status);
+    }
+    if (nslow > 0) {
+        buffer = buffer_new();
+        for (i = 0; i < nslow; i++)
+            buffer_append_sprintf(buffer, "%s%s (%.2fs)",
+                                  (i == 0) ? "" : ", ", slowest[i]->name,
+                                  slowest[i]->elapsed);
+        buffer_append(buffer, "", 1);
+        warn("slowest: %s", buffer->data);
+        buffer_free(buffer);
+    }
+    return status;
+}
+
+
+/*
+ * Run a command on a list of hosts, keeping up to config->parallel
+ * connections active at a time and driving all of them from a single poll
+ * loop.  Returns the exit status for remctl.
+ */
+static int
+run_fanout(struct fanout_config *config, struct vector *names)
+{
+    struct host *hosts, *host;
+    struct host **active;
+    struct pollfd *fds;
+    size_t i, j, next, nactive;
+    double now, deadline, wait;
+    int timeout, status;
+    bool finished;
+
+    hosts = xcalloc(names->count, sizeof(struct host));
+    for (i = 0; i < names->count; i++)
+        hosts[i].name = names->strings[i];
+    active = xcalloc(config->parallel, sizeof(struct host *));
+    fds = xcalloc(config->parallel, sizeof(struct pollfd));
+    next = 0;
+    nactive = 0;
+    while (next < names->count || nactive > 0) {
+        while (nactive < config->parallel && next < names->count) {
+            if (start_host(config, &hosts[next]))
+                active[nactive++] = &hosts[next];
+            next++;
+        }
+        if (nactive == 0)
+            continue;
+
+        /* Wait for a connection to be ready or the next timeout. */
+        now = current_time();
+        timeout = -1;
+        for (i = 0; i < nactive; i++) {
+            host = active[i];
+            fds[i].fd = remctl_fd(host->r);
+            if (host->step == REMCTL_STEP_READ)
+                fds[i].events = POLLIN;
+            else
+                fds[i].events = POLLOUT;
+            fds[i].revents = 0;
+            deadline = host_deadline(config, host);
+            if (deadline > 0) {
+                wait = (deadline > now) ? (deadline - now) * 1000 : 0;
+                if (wait > MAX_POLL_WAIT)
+                    wait = MAX_POLL_WAIT;
+                if (timeout < 0 || wait < (double) timeout)
+                    timeout = (int) wait + 1;
+            }
+        }
+        status = poll(fds, nactive, timeout);
+        if (status < 0 && errno != EINTR)
+            sysdie("poll failed");
+
+        /* Advance each ready connection and time out stalled ones. */
+        now = current_time();
+        for (i = 0; i < nactive; i++) {
+            host = active[i];
+            finished = false;
+            if (status > 0 && fds[i].revents != 0)
+                finished = advance_host(config, host);
+            else {
+                deadline = host_deadline(config, host);
+                if (deadline > 0 && now >= deadline) {
+                    finish_host(config, host, "timed out");
+                    finished = true;
+                }
+            }
+            if (finished)
+                active[i] = NULL;
+        }
+        for (i = 0, j = 0; i < nactive; i++)
+            if (active[i] != NULL)
+                active[j++] = active[i];
+        nactive = j;
+    }
+    status = report_summary(hosts, names->count);
+    for (i = 0; i < names->count; i++)
+        free(hosts[i].error);
+    free(hosts);
+    free(active);
+    free(fds);
+    return status;
+}
+
+
+/*
+ * Run a command on one of a list of equivalent hosts, using remctl_multi if
+ * hedging was requested and remctl_open_multi otherwise.  Hosts whose names
+ * cannot be resolved are skipped with a warning.  Returns the exit status for
+ * remctl.
+ */
+static int
+run_any(struct fanout_config *config, struct vector *names, bool hedge)
+{
+    struct vector *hosts;
+    struct remctl *r;
+    struct remctl_result *result;
+    char *canon;
+    size_t i;
+    int status;
+
+    /* Canonicalize the host names if needed, as for a single host. */
+    hosts = vector_new();
+    for (i = 0; i < names->count; i++) {
+        if (config->service != NULL) {
+            vector_add(hosts, names->strings[i]);
+            continue;
+        }
+        canon = canonicalize_host(names->strings[i], &status);
+        if (canon == NULL) {
+            warn("cannot resolve host %s: %s", names->strings[i],
+                 gai_strerror(status));
+            continue;
+        }
+        vector_add(hosts, canon);
+        free(canon);
+    }
+    if (hosts->count == 0)
+        die("no usable hosts");
+    vector_resize(hosts, hosts->count + 1);
+    hosts->strings[hosts->count] = NULL;
+
+    /*
+     * With hedging, the whole command is run by the library and the output is
+     * only available at the end.
+     */
+    if (hedge) {
+        result = remctl_multi((const char **) hosts->strings, config->port,
+                              config->service, config->command, 1);
+        if (result == NULL)
+            sysdie("cannot run command");
+        if (result->stdout_len > 0)
+            fwrite_checked(result->stdout_buf, result->stdout_len, 1, stdout);
+        if (result->stderr_len > 0)
+            fwrite_checked(result->stderr_buf, result->stderr_len, 1, stderr);
+        if (result->error != NULL) {
+            fprintf(stderr, "%s\n", result->error);
+            status = 255;
+        } else
+            status = result->status;
+        remctl_result_free(result);
+        vector_free(hosts);
+        return status;
+    }
+
+    /* Otherwise, open a connection to the best host and stream the output. */
+    r = remctl_new();
+    if (r == NULL)
+        sysdie("cannot initialize remctl connection");
+    if (config->timeout != 0)
+        remctl_set_timeout(r, config->timeout);
+    if (config->compress)
+        if (!remctl_set_compression(r, 1))
+            die("%s", remctl_error(r));
+    if (config->large)
+        remctl_set_large_tokens(r, 1);
+    if (config->source != NULL)
+        if (!remctl_set_source_ip(r, config->source))
+            die("%s", remctl_error(r));
+    if (!remctl_open_multi(r, (const char **) hosts->strings, config->port,
+                           config->service))
+        die("%s", remctl_error(r));
+    if (!remctl_command(r, config->command))
+        die("%s", remctl_error(r));
+    process_response(r, &status);
+    remctl_close(r);
+    vector_free(hosts);
+    return status;
+}
+
+
 /*
  * Main routine.  Parse the arguments, open the remctl connection, send the
- * command, and then call process_response.
+ * command, and then call process_response.  If given multiple hosts, call
+ * run_fanout instead.
  */
 int
 main(int argc, char *argv[])
 {
     int option, status;
-    char *server_host;
-    struct addrinfo hints, *ai;
+    char *server_host = NULL;
+    char *canon;
     const char *source = NULL;
     const char *service_name = NULL;
+    const char *host_file = NULL;
     char *end;
     time_t timeout = 0;
-    long tmp_port, tmp_timeout;
+    time_t host_timeout = 0;
+    long tmp_port, tmp_timeout, tmp_parallel;
+    unsigned long parallel = DEFAULT_PARALLEL;
     unsigned short port = 0;
+    bool group = false;
+    bool any = false;
+    bool hedge = false;
+    bool compress = false;
+    bool large = false;
+    bool fanout = false;
     struct remctl *r;
+    struct vector *hosts = NULL;
+    struct fanout_config config;
     int errorcode = 0;
 
     /* Set up logging and identity. */
@@ -141,16 +812,40 @@ main(int argc, char *argv[])
      * Non-GNU getopt will treat the + as a supported option, which is handled
      * below.
      */
-    while ((option = getopt(argc, argv, "+b:dhp:s:t:v")) != EOF) {
+    while ((option = getopt(argc, argv, "+ab:df:gHhj:Lp:s:T:t:vz")) != EOF) {
         switch (option) {
+        case 'a':
+            any = true;
+            break;
         case 'b':
             source = optarg;
             break;
         case 'd':
             message_handlers_debug(1, message_log_stderr);
             break;
+        case 'f':
+            host_file = optarg;
+            break;
+        case 'g':
+            group = true;
+            fanout = true;
+            break;
+        case 'H':
+            any = true;
+            hedge = true;
+            break;
         case 'h':
             usage(0);
+        case 'j':
+            tmp_parallel = strtol(optarg, &end, 10);
+            if (*end != '\0' || tmp_parallel < 1)
+                die("invalid parallelism %ld", tmp_parallel);
+            parallel = (unsigned long) tmp_parallel;
+            fanout = true;
+            break;
+        case 'L':
+            large = true;
+            break;
         case 'p':
             tmp_port = strtol(optarg, &end, 10);
             if (*end != '\0' || tmp_port < 1 || tmp_port > (1L << 16) - 1)
@@ -160,6 +855,13 @@ main(int argc, char *argv[])
         case 's':
             service_name = optarg;
             break;
+        case 'T':
+            tmp_timeout = strtol(optarg, &end, 10);
+            if (*end != '\0' || tmp_timeout < 0)
+                die("invalid timeout value %ld", tmp_timeout);
+            host_timeout = (time_t) tmp_timeout;
+            fanout = true;
+            break;
         case 't':
             tmp_timeout = strtol(optarg, &end, 10);
             if (*end != '\0' || tmp_timeout < 0)
@@ -169,6 +871,9 @@ main(int argc, char *argv[])
         case 'v':
             printf("%s\n", PACKAGE_STRING);
             exit(0);
+        case 'z':
+            compress = true;
+            break;
         case '+':
             fprintf(stderr, "%s: invalid option -- +\n", argv[0]);
             usage(1);
@@ -178,47 +883,61 @@ main(int argc, char *argv[])
     }
     argc -= optind;
     argv += optind;
-    if (argc < 2)
-        usage(1);
-    server_host = *argv++;
+
+    if (hedge && (source != NULL || timeout != 0 || compress || large))
+        die("-H cannot be combined with -b, -L, -t, or -z");
 
     /*
-     * If service_name isn't set, the remctl library uses host/<server>
-     * (host@<server> in GSS-API parlance).  However, if the server to which
-     * we're connecting is a DNS-load-balanced name, we have to be careful
-     * what principal name we use.
-     *
-     * Ideally, we would let the GSS-API library handle this and choose
-     * whether to canonicalize the <server> in the principal name based on the
-     * krb5.conf rdns setting and similar configuration.  However, with DNS
-     * load balancing, this still may fail.  At the time of network
-     * connection, we will connect to whatever the name resolves to then.
-     * After we connect, we authenticate, and the GSS-API library will then
-     * separately canonicalize the hostname.  It could get a different answer
-     * than we got for our network connection, leading to an authentication
-     * failure.
-     *
-     * Therefore, if the principal isn't specified, we canonicalize the
-     * hostname to which we're connecting before we connect.  Then, the
-     * additional canonicalization possibly done by the GSS-API library should
-     * return the same results and be consistent.
-     *
-     * Note that this opens the possibility of a subtle attack through DNS
-     * spoofing, since both the principal used and the host to which we're
-     * connecting can be changed by varying the DNS response.
-     *
-     * If the principal is specified explicitly, assume the user knows what
-     * they're doing and don't do any of this.
+     * A host file or a comma-separated list of hosts means to run the command
+     * on multiple hosts in parallel, or on one of them if -a was given.
+     */
+    if (host_file != NULL) {
+        if (argc < 1)
+            usage(1);
+        hosts = vector_new();
+        read_host_file(host_file, hosts);
+    } else {
+        if (argc < 2)
+            usage(1);
+        server_host = *argv++;
+        if (any || strchr(server_host, ',') != NULL)
+            hosts = vector_split_multi(server_host, ",", NULL);
+    }
+    if (hosts == NULL && fanout)
+        die("-g, -j, and -T require -f or multiple hosts");
+    if (hosts != NULL) {
+        if (hosts->count == 0)
+            die("no hosts given");
+        memset(&config, 0, sizeof(config));
+        config.service = service_name;
+        config.source = source;
+        config.port = port;
+        config.timeout = timeout;
+        config.host_timeout = host_timeout;
+        config.parallel = parallel;
+        config.group = group;
+        config.compress = compress;
+        config.large = large;
+        config.command = (const char **) argv;
+        if (any)
+            status = run_any(&config, hosts, hedge);
+        else
+            status = run_fanout(&config, hosts);
+        vector_free(hosts);
+        socket_shutdown();
+        return status;
+    }
+
+    /*
+     * If service_name isn't set, canonicalize the host name to which we're
+     * connecting.  See canonicalize_host for the reasons.
      */
     if (service_name == NULL) {
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_flags = AI_CANONNAME;
-        status = getaddrinfo(server_host, NULL, &hints, &ai);
-        if (status != 0)
+        canon = canonicalize_host(server_host, &status);
+        if (canon == NULL)
             die("cannot resolve host %s: %s", server_host,
                 gai_strerror(status));
-        server_host = xstrdup(ai->ai_canonname);
-        freeaddrinfo(ai);
+        server_host = canon;
     }
 
     /* Open connection. */
@@ -229,6 +948,13 @@ main(int argc, char *argv[])
     if (timeout != 0)
         remctl_set_timeout(r, timeout);
 
+    if (compress)
+        if (!remctl_set_compression(r, 1))
+            die("%s", remctl_error(r));
+
+    if (large)
+        remctl_set_large_tokens(r, 1);
+
     if (source != NULL)
         if (!remctl_set_source_ip(r, source))
             die("%s", remctl_error(r));
@@ -138,6 +138,15 @@ struct remctl_output {
 /* Opaque struct representing an open remctl connection. */
 struct remctl;
 
+/* What a non-blocking connection is waiting for, returned by remctl_step. */
+enum remctl_step_status {
+    REMCTL_STEP_ERROR,  /* An error occurred, use remctl_error. */
+    REMCTL_STEP_READ,   /* Call remctl_step when the socket is readable. */
+    REMCTL_STEP_WRITE,  /* Call remctl_step when the socket is writable. */
+    REMCTL_STEP_OUTPUT, /* Output is available from remctl_output. */
+    REMCTL_STEP_DONE    /* The pending operation is complete. */
+};
+
 BEGIN_DECLS
 
 /*
@@ -190,6 +199,41 @@ int remctl_open_fd(struct remctl *r, const char *host, int fd,
 #endif
 
 
+/*
+ * The process-wide connection pool.  Once the pool is enabled with
+ * remctl_pool_enable, remctl_pool_close returns a connection to the pool
+ * instead of closing it (keeping at most size idle connections, each for at
+ * most timeout seconds if timeout is not 0), and remctl_pool_open reuses a
+ * pooled connection to the same host, port, principal, and ticket cache if
+ * one is available and still healthy, otherwise calling remctl_open.  The
+ * simple interface uses the pool automatically when it is enabled.
+ * remctl_pool_disable closes all idle connections.
+ */
+int remctl_pool_enable(size_t size, time_t timeout);
+void remctl_pool_disable(void);
+int remctl_pool_open(struct remctl *, const char *host, unsigned short port,
+                     const char *principal) __attribute__((__nonnull__(1, 2)));
+void remctl_pool_close(struct remctl *);
+
+/*
+ * Interfaces for a set of equivalent servers, given as a NULL-terminated
+ * list of hosts that all use the same port and principal.  remctl_open_multi
+ * opens a connection to one of them, chosen by the connection latency seen by
+ * previous calls in this process, and fails over to the next one if the
+ * connection fails.  remctl_multi is the equivalent of the simple interface.
+ * If hedge is true, the command must be safe to run more than once, and it
+ * will also be sent to a second server if the first one is slower than
+ * usual.
+ */
+int remctl_open_multi(struct remctl *, const char **hosts, unsigned short port,
+                      const char *principal)
+    __attribute__((__nonnull__(1, 2)));
+struct remctl_result *remctl_multi(const char **hosts, unsigned short port,
+                                   const char *principal, const char **command,
+                                   int hedge)
+    __attribute__((__nonnull__(1, 4), __malloc__(remctl_result_free)));
+
+
 /*
  * Set the Kerberos credential cache for client connections.  This must be
  * called before remctl_open.  Takes a string representing the Kerberos
@@ -207,6 +251,26 @@ int remctl_open_fd(struct remctl *r, const char *host, int fd,
 int remctl_set_ccache(struct remctl *, const char *)
     __attribute__((__nonnull__));
 
+/*
+ * Set whether to ask the server to compress large messages, which saves
+ * bandwidth for commands with large output.  If remctl_set_compression is
+ * called with a true value before remctl_open, the client negotiates
+ * compression with the server when opening the connection, which requires an
+ * additional round trip.  Servers that don't support compression are still
+ * usable.  Returns true on success, false if compression is not supported by
+ * this build of the library.  On failure, use remctl_error to get the error.
+ */
+int remctl_set_compression(struct remctl *, int) __attribute__((__nonnull__));
+
+/*
+ * Set whether to ask the server to use tokens larger than the default 64KB
+ * limit, which reduces per-token overhead for commands that transfer a lot of
+ * data.  Like compression, this is negotiated when opening the connection and
+ * requires an additional round trip.  Servers that don't support large tokens
+ * are still usable.  Always returns true.
+ */
+int remctl_set_large_tokens(struct remctl *, int) __attribute__((__nonnull__));
+
 /*
  * Set the source address for connections.  If remctl_set_source_ip is called
  * before remctl_open, the IP address passed into remctl_set_source_ip will be
@@ -270,6 +334,42 @@ int remctl_noop(struct remctl *) __attribute__((__nonnull__));
 struct remctl_output *remctl_output(struct remctl *)
     __attribute__((__nonnull__));
 
+/*
+ * The non-blocking interface, for driving connections from an event loop.
+ * remctl_open_start, remctl_command_start, remctl_commandv_start, and
+ * remctl_noop_start begin an operation without waiting for the network and
+ * return true on success and false on failure.  remctl_step then advances
+ * the operation as far as it can without blocking and returns what the
+ * connection is waiting for.  remctl_fd returns the socket to watch for the
+ * requested readiness.
+ *
+ * remctl_open_start resolves the host with getaddrinfo, which may block
+ * unless the host is a numeric address.  When remctl_step returns
+ * REMCTL_STEP_OUTPUT, call remctl_output to retrieve the output, which will
+ * not block.  remctl_step returns REMCTL_STEP_DONE once the connection is
+ * established, when the command output is complete, or when the NOOP reply
+ * has been received.  The timeout set with remctl_set_timeout is not used;
+ * the caller's event loop should enforce timeouts.
+ *
+ * Only protocol version two and later is supported in non-blocking mode, and
+ * connections opened this way are not automatically reopened.
+ */
+int remctl_open_start(struct remctl *, const char *host, unsigned short port,
+                      const char *principal)
+    __attribute__((__nonnull__(1, 2)));
+int remctl_command_start(struct remctl *, const char **command)
+    __attribute__((__nonnull__));
+int remctl_commandv_start(struct remctl *, const struct iovec *, size_t count)
+    __attribute__((__nonnull__));
+int remctl_noop_start(struct remctl *) __attribute__((__nonnull__));
+enum remctl_step_status remctl_step(struct remctl *)
+    __attribute__((__nonnull__));
+#ifdef _WIN32
+SOCKET remctl_fd(struct remctl *) __attribute__((__nonnull__));
+#else
+int remctl_fd(struct remctl *) __attribute__((__nonnull__));
+#endif
+
 /*
  * Call remctl_error after an error return to retrieve the internal error
  * message.  The returned error string will be invalidated by any subsequent
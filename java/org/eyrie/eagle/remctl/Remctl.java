@@ -51,6 +51,7 @@ public class Remctl {
 	public static final String DEFAULT_NAME = "RemctlClient";
 
 	protected static final int TOKEN_MAX_DATA =         65536;
+	protected static final int TOKEN_MAX_LENGTH =       1048576;
 
 	/* Token types */
 	protected static final byte TOKEN_NOOP  =           1;
@@ -75,8 +76,10 @@ public class Remctl {
 	protected static final byte MESSAGE_STATUS =        4;
 	protected static final byte MESSAGE_ERROR =         5;
 	protected static final byte MESSAGE_VERSION =       6;
+	protected static final byte MESSAGE_NOOP =          7;
 
 	protected static final byte MESSAGE_V2 =            2;
+	protected static final byte MESSAGE_V3 =            3;
 
 	public static final int ERROR_INTERNAL =         1;
 	public static final int ERROR_BAD_TOKEN =        2;
@@ -104,6 +107,13 @@ public class Remctl {
 	protected String serverIdentity;
 	protected int returnCode;
 
+	/*
+	 * Buffer reused for each token read by read_token, grown as needed,
+	 * and the length of the last token read into it.
+	 */
+	protected byte[] tokenBuffer = new byte[8192];
+	protected int tokenLength;
+
 	/**
 	 * Returns the client's Kerberos principal name.
 	 *
@@ -131,7 +141,14 @@ public class Remctl {
 	protected void write_some_bytes(byte[] bytes)
 	throws GSSException, IOException 
 	{
-		byte[] token = context.wrap(bytes, 0, bytes.length, prop);
+		write_some_bytes(bytes, 0, bytes.length);
+	}
+
+	/* Wrap and send part of a buffer, so callers can reuse buffers. */
+	protected void write_some_bytes(byte[] bytes, int offset, int length)
+	throws GSSException, IOException 
+	{
+		byte[] token = context.wrap(bytes, offset, length, prop);
 		outStream.writeByte(TOKEN_V2_RUN);
 		outStream.writeInt(token.length);
 		outStream.write(token);
@@ -150,6 +167,29 @@ public class Remctl {
 		inStream.readFully(token);
 		return token;
 	}
+
+	/*
+	 * Like read_a_token, but reads the token into tokenBuffer, growing
+	 * it if needed, and returns the length of the token instead of
+	 * allocating a new array for each token.
+	 */
+	protected int read_token(byte state)
+	throws GSSException, IOException 
+	{
+		byte flag = inStream.readByte();
+		if (flag != state) {
+			throw new IOException("remctl: Wrong token type received, got " +
+					flag + " expected " + state);
+		}
+		int length = inStream.readInt();
+		if (length < 0 || length > TOKEN_MAX_LENGTH)
+			throw new IOException("remctl: token too large: " + length);
+		if (length > tokenBuffer.length)
+			tokenBuffer = new byte[Math.max(length, 2 * tokenBuffer.length)];
+		inStream.readFully(tokenBuffer, 0, length);
+		tokenLength = length;
+		return length;
+	}
 }
 
 /*
@@ -35,8 +35,6 @@ import org.ietf.jgss.*;
 
 import java.net.*;
 import java.io.*;
-import java.util.ArrayList;
-import java.util.Iterator;
 import java.nio.ByteBuffer;
 import java.security.PrivilegedExceptionAction;
 
@@ -60,6 +58,19 @@ public class RemctlClient extends Remctl {
 
 	private Writer out, err;
 
+	private String host;	// server we connected to, for RemctlPool
+	private int port;
+
+	private boolean broken;	// set if a command did not complete
+	long lastUsed;		// time of last completed exchange
+
+	private int errorCode;	// from MESSAGE_ERROR, if any
+	private String errorMessage;
+
+	/* Buffers reused for each command sent on this connection. */
+	private ByteBuffer commandBuffer;
+	private byte[] chunkBuffer;
+
 	/**
 	 * Factory method that creates a <code>LogincContext</code>
 	 * and returns a RemctlClient that executed from within that
@@ -193,6 +204,8 @@ public class RemctlClient extends Remctl {
 	throws GSSException, IOException 
 	{
 		this.servicePrincipal = servicePrincipal;
+		this.host = host;
+		this.port = port != 0 ? port : DEFAULT_PORT;
 
 		out = p_out;
 		err = p_err;
@@ -216,11 +229,11 @@ public class RemctlClient extends Remctl {
 			serviceName = "host@" + host;
 			serviceNameType = GSSName.NT_HOSTBASED_SERVICE;
 		} else {
-			serviceName = "host/" + host;
+			serviceName = this.servicePrincipal;
 		}
 
 		/* Make the socket: */
-		socket =    new Socket(host, port != 0 ? port : DEFAULT_PORT);
+		socket =    new Socket(host, this.port);
 		inStream =  new DataInputStream(
 				new BufferedInputStream(socket.getInputStream(),8192));
 		outStream = new DataOutputStream(
@@ -251,6 +264,43 @@ public class RemctlClient extends Remctl {
 		}
 	}
 
+	/**
+	 * Open an authenticated connection for running several commands
+	 * with <code>command</code>.  Output is not sent anywhere by
+	 * <code>process</code> on a connection created this way; use
+	 * <code>command</code> instead.  The caller must already be
+	 * running within a login context with Kerberos credentials.
+	 *
+	 * @param host  host name of remctl server.
+	 * @param port  port of remctl server. If 0, uses the default
+	 *              port of 4373 (Remctl.DEFAULT_PORT).
+	 * @param servicePrincipal Principal to use. If null, uses the default
+	 *              principal of <code>"host/"+host</code>.
+	 */
+	public RemctlClient(String host,
+			int port,
+			String servicePrincipal)
+	throws GSSException, IOException 
+	{
+		this(host,port,servicePrincipal,null,null);
+		this.clientEstablishContext();
+		lastUsed = System.currentTimeMillis();
+	}
+
+	/**
+	 * As above, but establishes the context using the credentials in
+	 * the provided <code>LoginContext</code>.
+	 */
+	public RemctlClient(String host,
+			int port,
+			String servicePrincipal,
+			LoginContext lc)
+	throws GSSException, IOException 
+	{
+		this(host,port,servicePrincipal,null,null,lc);
+		lastUsed = System.currentTimeMillis();
+	}
+
 	public void process(boolean keepalive, String args[])
 	throws GSSException, IOException 
 	{
@@ -258,44 +308,193 @@ public class RemctlClient extends Remctl {
 			returnCode = -1;
 			return;
 		}
-		ArrayList byteArgs;
+		processRequest(toBytes(args), keepalive);
+		if (!processOutput(null, null) && errorMessage != null)
+			returnCode = errorCode;
+	}
+
+	/**
+	 * Run a command on an open connection, leaving the connection
+	 * open for further commands.  Output is written to the given
+	 * streams as raw bytes, without any character set conversion, as
+	 * it arrives from the server.  Either stream may be null to
+	 * discard that output.
+	 *
+	 * @param args  command and arguments, each of which may contain
+	 *              arbitrary binary data.
+	 * @param p_out OutputStream to receive stdout from remote job.
+	 * @param p_err OutputStream to receive stderr from remote job.
+	 * @return the exit status of the command, or -1 if the server
+	 *              returned an error, in which case the error is
+	 *              available from <code>getErrorCode()</code> and
+	 *              <code>getErrorMessage()</code>.
+	 */
+	public int command(byte[][] args, OutputStream p_out, OutputStream p_err)
+	throws GSSException, IOException 
+	{
+		if (!isOpen())
+			throw new IOException("remctl: connection is not open");
+		boolean complete = false;
+		try {
+			processRequest(args, true);
+			boolean status = processOutput(p_out, p_err);
+			complete = true;
+			return status ? returnCode : -1;
+		} finally {
+			if (!complete)
+				broken = true;
+			lastUsed = System.currentTimeMillis();
+		}
+	}
+
+	public int command(String args[], OutputStream p_out, OutputStream p_err)
+	throws GSSException, IOException 
+	{
+		return command(toBytes(args), p_out, p_err);
+	}
 
-		byteArgs = new ArrayList();
+	/**
+	 * Send a NOOP message to check that the connection is still
+	 * alive, such as before reusing an idle connection.  Returns false
+	 * if the server is too old to support NOOP (protocol version 3),
+	 * in which case the connection is still usable.
+	 */
+	public boolean noop()
+	throws GSSException, IOException 
+	{
+		if (!isOpen())
+			throw new IOException("remctl: connection is not open");
+		boolean complete = false;
+		try {
+			byte[] messageBytes = new byte[2];
+			messageBytes[0] = MESSAGE_V3;
+			messageBytes[1] = MESSAGE_NOOP;
+			write_some_bytes(messageBytes);
+			outStream.flush();
+			byte type = processResponse();
+			if (type != MESSAGE_NOOP && type != MESSAGE_VERSION
+					&& type != MESSAGE_ERROR)
+				throw new IOException("remctl: bad message type");
+			complete = true;
+			return type == MESSAGE_NOOP;
+		} finally {
+			if (!complete)
+				broken = true;
+			lastUsed = System.currentTimeMillis();
+		}
+	}
+
+	/**
+	 * Returns true if this connection can be used for another
+	 * command: it was opened with keep-alive and no command on it
+	 * has failed partway through.
+	 */
+	public boolean isOpen() {
+		return keptalive && !broken && context != null
+			&& context.isEstablished() && !socket.isClosed();
+	}
+
+	/**
+	 * Returns the error code from the last MESSAGE_ERROR received, or
+	 * 0 if the last command did not fail with an error.
+	 */
+	public int getErrorCode() {
+		return errorCode;
+	}
+
+	/**
+	 * Returns the error message from the last MESSAGE_ERROR received,
+	 * or null if the last command did not fail with an error.
+	 */
+	public String getErrorMessage() {
+		return errorMessage;
+	}
+
+	String getHost() {
+		return host;
+	}
+
+	int getPort() {
+		return port;
+	}
+
+	String getServicePrincipal() {
+		return servicePrincipal;
+	}
+
+	/* Close the connection without a QUIT, for when finishup fails. */
+	void closeSocket() {
+		broken = true;
+		try {
+			socket.close();
+		} catch (IOException e) {
+			// nothing more we can do
+		}
+	}
+
+	private static byte[][] toBytes(String args[]) {
+		byte[][] byteArgs = new byte[args.length][];
 		for (int i=0; i < args.length; i++) {
-			byteArgs.add(args[i].getBytes());
+			byteArgs[i] = args[i].getBytes();
 		}
-		processRequest(byteArgs, keepalive);
+		return byteArgs;
+	}
+
+	/*
+	 * Read responses to a command until a status or error message.
+	 * Output goes to the OutputStreams if either is given, and
+	 * otherwise to the Writers passed to the constructor.  Output is
+	 * handed over straight from the unwrapped token without copying.
+	 * Returns true if the command ended with a status and false if it
+	 * ended with an error or a protocol version mismatch.
+	 */
+	private boolean processOutput(OutputStream p_out, OutputStream p_err)
+	throws GSSException, IOException 
+	{
+		errorCode = 0;
+		errorMessage = null;
 		for (;;) {
-			switch(processResponse()) {
+			byte type = processResponse();
+			byte[] data = responseBytes.array();
+			int offset;
+			switch(type) {
 			case MESSAGE_OUTPUT:
 				byte stream = responseBytes.get();
-				Writer x;
-				x = stream == 1 ? out : err;
 				int len = responseBytes.getInt();
 				if (len != responseBytes.remaining())
 					throw new IOException("remctl: bad MESSAGE_OUTPUT length");
-				byte[] m = new byte[len];
-				responseBytes.get(m);
-				x.write(new String(m));
-				x.flush();
+				offset = responseBytes.arrayOffset() + responseBytes.position();
+				if (p_out != null || p_err != null) {
+					OutputStream x = stream == 1 ? p_out : p_err;
+					if (x != null)
+						x.write(data, offset, len);
+				} else {
+					Writer x = stream == 1 ? out : err;
+					if (x != null) {
+						x.write(new String(data, offset, len));
+						x.flush();
+					}
+				}
 				continue;
 			case MESSAGE_STATUS:
 				byte status = responseBytes.get();
 				if (0 != responseBytes.remaining())
 					throw new IOException("remctl: bad MESSAGE_STATUS length");
-				// XXX how to indicate cmd ended by status?
 				returnCode = status;
-				break;
+				return true;
 			case MESSAGE_ERROR:
-				status = (byte) responseBytes.getInt();
+				int code = responseBytes.getInt();
 				len = responseBytes.getInt();
 				if (len != responseBytes.remaining())
 					throw new IOException("remctl: bad MESSAGE_ERROR length");
-				err.write(new String(responseBytes.array()) + "\n");
-				err.flush();
-				// XXX how to indicate cmd ended by error?
-				returnCode = status;
-				break;
+				offset = responseBytes.arrayOffset() + responseBytes.position();
+				errorCode = code;
+				errorMessage = new String(data, offset, len);
+				if (p_out == null && p_err == null && err != null) {
+					err.write(errorMessage + "\n");
+					err.flush();
+				}
+				return false;
 			case MESSAGE_VERSION:
 				stream = responseBytes.get();
 				if (stream >= MESSAGE_V2)
@@ -303,12 +502,11 @@ public class RemctlClient extends Remctl {
 				processQuit();
 				returnCode = -1;
 				// XXX how to indicate cmd ended due to protocol?
-				break;
+				return false;
 			default:
 				// XXX how to indicate cmd ended by protocol?
 				throw new IOException("remctl: bad message type");
 			}
-			break;
 		}
 	}
 
@@ -323,8 +521,10 @@ public class RemctlClient extends Remctl {
 	{
 		processQuit();
 		context.dispose();
-		out.flush();
-		err.flush();
+		if (out != null)
+			out.flush();
+		if (err != null)
+			err.flush();
 		outStream.flush();
 		socket.close();
 	}
@@ -419,53 +619,58 @@ public class RemctlClient extends Remctl {
 
 	}
 
-	private void processRequest(ArrayList byteArgs, boolean keepalive)
+	/*
+	 * Send a command, split into several messages if it is larger than
+	 * TOKEN_MAX_DATA.  The message buffer and the buffer used for the
+	 * continuation messages are kept and reused for later commands.
+	 */
+	private void processRequest(byte[][] args, boolean keepalive)
 	throws GSSException, IOException {
 		/* determine size of buffer we need */
 		int messageLength = 8; /* v2+cmd+kp+cs+ac0+ac1+ac2+ac3 */
-		byte continue_status = 1;
-		for (Iterator it = byteArgs.iterator(); it.hasNext();) {
+		for (int i=0; i < args.length; i++) {
 			/* add 4 for the length, then the actual length */
-			byte[]  bytes = (byte[]) it.next();
-			messageLength += 4+bytes.length;	/* szn + argn */
+			messageLength += 4+args[i].length;	/* szn + argn */
 		}
-		ByteBuffer messageBuffer = ByteBuffer.allocate(messageLength);
+		if (commandBuffer == null || commandBuffer.capacity() < messageLength)
+			commandBuffer = ByteBuffer.allocate(messageLength);
+		commandBuffer.clear();
 
 		/* Make the message buffer */
-		messageBuffer.put(MESSAGE_V2);
-		messageBuffer.put(MESSAGE_COMMAND);
-		messageBuffer.put((byte)(keepalive ? 1 : 0));
-		messageBuffer.put(continue_status);	/* will ignore */
-		messageBuffer.putInt(byteArgs.size());
-		for (Iterator it = byteArgs.iterator(); it.hasNext(); ) {
-			byte[]  bytes = (byte[]) it.next();
-			messageBuffer.putInt(bytes.length);
-			messageBuffer.put(bytes);
+		commandBuffer.put(MESSAGE_V2);
+		commandBuffer.put(MESSAGE_COMMAND);
+		commandBuffer.put((byte)(keepalive ? 1 : 0));
+		commandBuffer.put((byte) 0);	/* continue status, set below */
+		commandBuffer.putInt(args.length);
+		for (int i=0; i < args.length; i++) {
+			commandBuffer.putInt(args[i].length);
+			commandBuffer.put(args[i]);
 		}
+		byte[] message = commandBuffer.array();
 
-		messageBuffer.put(3, continue_status);
-		messageBuffer.flip();
-
-		while (messageBuffer.hasRemaining()) {
-			int count = (messageBuffer.remaining());
-			int pos;
-			if (messageBuffer.position() != 0) count += 4;
-			if (count > TOKEN_MAX_DATA) count = TOKEN_MAX_DATA;
-			byte[] messageBytes = new byte[count];
-			if ((pos = messageBuffer.position()) != 0) {
-				messageBuffer.position(0);
-				messageBuffer.get(messageBytes, 0, 3);
-				messageBuffer.position(pos);
-				messageBuffer.get(messageBytes, 4, count-4);
-			} else {
-				messageBuffer.get(messageBytes, 0, count);
+		/*
+		 * The first message is sent straight from the message buffer.
+		 * Each later one repeats the three header bytes, followed by the
+		 * continue status and the next piece of the command.
+		 */
+		if (messageLength <= TOKEN_MAX_DATA) {
+			message[3] = 0;
+			write_some_bytes(message, 0, messageLength);
+		} else {
+			message[3] = 1;
+			write_some_bytes(message, 0, TOKEN_MAX_DATA);
+			if (chunkBuffer == null)
+				chunkBuffer = new byte[TOKEN_MAX_DATA];
+			System.arraycopy(message, 0, chunkBuffer, 0, 3);
+			int pos = TOKEN_MAX_DATA;
+			while (pos < messageLength) {
+				int count = messageLength - pos;
+				if (count > TOKEN_MAX_DATA - 4) count = TOKEN_MAX_DATA - 4;
+				chunkBuffer[3] = (byte)(pos + count < messageLength ? 2 : 3);
+				System.arraycopy(message, pos, chunkBuffer, 4, count);
+				write_some_bytes(chunkBuffer, 0, count + 4);
+				pos += count;
 			}
-			if (!messageBuffer.hasRemaining())
-				continue_status ^= 1;	/* 1 => 0, 2 => 3 */
-			messageBytes[3] = continue_status;
-//			System.out.println("writing a command cs=" + continue_status);
-			continue_status = 2;
-			write_some_bytes(messageBytes);
 		}
 		outStream.flush();
 		keptalive = keepalive;
@@ -482,23 +687,24 @@ public class RemctlClient extends Remctl {
 		outStream.flush();
 	}
 
+	/*
+	 * Read and unwrap the next message.  The token is read into the
+	 * reused token buffer, and responseBytes is left as a view of the
+	 * unwrapped message after the version and type bytes rather than a
+	 * copy of it.
+	 */
 	private byte processResponse() throws GSSException, IOException {
 
-		byte returnType;
-
 //		System.out.println("client reading response");
-		byte[] token = read_a_token(TOKEN_V2_RUN);
-
-		byte[] bytes = context.unwrap(token, 0, token.length, prop);
-		ByteBuffer messageBuffer = ByteBuffer.allocate(bytes.length);
-		messageBuffer.put(bytes);
-		messageBuffer.rewind();
-		returnType = messageBuffer.get();
-		if (returnType != MESSAGE_V2)
-			throw new IOException("remctl: Message protocol version was " + returnType + " not 2?");
-		returnType = messageBuffer.get();
-		responseBytes = messageBuffer.slice();
-		return returnType;
+		int length = read_token(TOKEN_V2_RUN);
+
+		byte[] bytes = context.unwrap(tokenBuffer, 0, length, prop);
+		if (bytes.length < 2)
+			throw new IOException("remctl: message too short");
+		if (bytes[0] != MESSAGE_V2 && bytes[0] != MESSAGE_V3)
+			throw new IOException("remctl: Message protocol version was " + bytes[0] + " not 2 or 3?");
+		responseBytes = ByteBuffer.wrap(bytes, 2, bytes.length - 2).slice();
+		return bytes[1];
 	}
 
 	/**
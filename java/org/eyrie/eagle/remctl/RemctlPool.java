@@ -0,0 +1,175 @@
+/*  R e m c t l P o o l
+ **
+ **  A thread-safe pool of open, authenticated RemctlClient connections,
+ **  so that an application running many commands against the same
+ **  servers pays for the TCP connection and GSS-API context setup only
+ **  once per connection.  Connections are keyed by host, port, and
+ **  service principal.  A connection is used by only one thread at a
+ **  time: get() hands it out and release() returns it to the pool.
+ **
+ **  Written by Russ Allbery <eagle@eyrie.org>
+ **  Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ **
+ **  SPDX-License-Identifier: MIT
+ */
+
+package org.eyrie.eagle.remctl;
+
+import javax.security.auth.login.LoginContext;
+import org.ietf.jgss.GSSException;
+
+import java.io.IOException;
+import java.util.Iterator;
+import java.util.LinkedList;
+
+public class RemctlPool {
+
+	/*
+	 * Connections idle longer than this are checked with a NOOP
+	 * before being handed out again.  Servers too old to support NOOP
+	 * fail that check, so their connections are only reused if they
+	 * have been idle for less than this long.
+	 */
+	private static final long CHECK_INTERVAL = 30 * 1000;
+
+	private final int maxIdle;	// maximum number of idle connections
+	private final long timeout;	// idle time after which to close
+	private final LoginContext lc;	// credentials for new connections
+
+	private final LinkedList idle = new LinkedList(); // newest first
+	private boolean closed;
+
+	/**
+	 * Create a new pool.
+	 *
+	 * @param maxIdle  maximum number of idle connections to keep.
+	 *                 The least recently used connection is closed when
+	 *                 this is exceeded.
+	 * @param timeout  milliseconds after which an idle connection is
+	 *                 closed rather than reused, or 0 for no limit.
+	 * @param lc       <code>LoginContext</code> whose credentials are
+	 *                 used for new connections.  If null, new
+	 *                 connections use the credentials of the calling
+	 *                 thread's login context.
+	 */
+	public RemctlPool(int maxIdle, long timeout, LoginContext lc) {
+		this.maxIdle = maxIdle;
+		this.timeout = timeout;
+		this.lc = lc;
+	}
+
+	/**
+	 * Returns an open connection to the given server, reusing an idle
+	 * one if possible and opening a new one otherwise.  The caller
+	 * must pass it to <code>release</code> when done with it.
+	 *
+	 * @param host  host name of remctl server.
+	 * @param port  port of remctl server. If 0, uses the default
+	 *              port of 4373 (Remctl.DEFAULT_PORT).
+	 * @param servicePrincipal Principal to use. If null, uses the default
+	 *              principal of <code>"host/"+host</code>.
+	 */
+	public RemctlClient get(String host, int port, String servicePrincipal)
+	throws GSSException, IOException
+	{
+		if (port == 0)
+			port = Remctl.DEFAULT_PORT;
+		for (;;) {
+			RemctlClient client = take(host, port, servicePrincipal);
+			if (client == null)
+				break;
+			long age = System.currentTimeMillis() - client.lastUsed;
+			if (age < CHECK_INTERVAL && client.isOpen())
+				return client;
+			try {
+				if (client.noop())
+					return client;
+			} catch (Exception e) {
+				// fall through and try the next one
+			}
+			discard(client);
+		}
+		if (lc != null)
+			return new RemctlClient(host, port, servicePrincipal, lc);
+		else
+			return new RemctlClient(host, port, servicePrincipal);
+	}
+
+	/**
+	 * Return a connection obtained from <code>get</code> to the pool.
+	 * Connections on which a command failed partway through are closed
+	 * instead.
+	 */
+	public void release(RemctlClient client) {
+		RemctlClient victim = null;
+		if (!client.isOpen()) {
+			discard(client);
+			return;
+		}
+		synchronized (this) {
+			if (closed) {
+				victim = client;
+			} else {
+				idle.addFirst(client);
+				if (idle.size() > maxIdle)
+					victim = (RemctlClient) idle.removeLast();
+			}
+		}
+		if (victim != null)
+			discard(victim);
+	}
+
+	/**
+	 * Close all idle connections.  Connections currently handed out
+	 * are closed when they are released.
+	 */
+	public void close() {
+		LinkedList all;
+		synchronized (this) {
+			closed = true;
+			all = new LinkedList(idle);
+			idle.clear();
+		}
+		for (Iterator it = all.iterator(); it.hasNext();)
+			discard((RemctlClient) it.next());
+	}
+
+	/*
+	 * Remove and return the most recently used idle connection to the
+	 * given server, or null if there isn't one.  Connections that have
+	 * been idle past the timeout are closed along the way.
+	 */
+	private RemctlClient take(String host, int port, String principal) {
+		LinkedList expired = new LinkedList();
+		RemctlClient found = null;
+		long now = System.currentTimeMillis();
+		synchronized (this) {
+			for (Iterator it = idle.iterator(); it.hasNext();) {
+				RemctlClient client = (RemctlClient) it.next();
+				if (timeout > 0 && now - client.lastUsed > timeout) {
+					it.remove();
+					expired.add(client);
+				} else if (found == null
+						&& client.getPort() == port
+						&& client.getHost().equals(host)
+						&& (principal == null
+							? client.getServicePrincipal() == null
+							: principal.equals(client.getServicePrincipal()))) {
+					it.remove();
+					found = client;
+				}
+			}
+		}
+		for (Iterator it = expired.iterator(); it.hasNext();)
+			discard((RemctlClient) it.next());
+		return found;
+	}
+
+	private static void discard(RemctlClient client) {
+		try {
+			client.finishup();
+		} catch (Exception e) {
+			client.closeSocket();
+		}
+	}
+}
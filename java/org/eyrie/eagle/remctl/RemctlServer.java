@@ -55,8 +55,7 @@ public class RemctlServer extends Remctl {
 
 //	XXX passing in serverCreds does bcs case great.  can this
 //	also work with jaas?
-//	XXX this should be done in a separate thread per request.
-//	what form of helper code for this?
+//	See RemctlServerRunner for running this in a pool of threads.
 	/* make a server */
 	public RemctlServer(Socket p_socket,
 			GSSCredential serverCreds)
@@ -127,6 +126,23 @@ public class RemctlServer extends Remctl {
 	// XXX big.  can this be broken up?
 	public void serve_a_client(Servlet servlet)
 	throws GSSException, IOException 
+	{
+		try {
+			serve_loop(servlet);
+		} finally {
+			context.dispose();
+			outStream.flush();
+		}
+	}
+
+	/*
+	 * Authenticate the client and then run commands until it sends a
+	 * QUIT or a command without keep-alive.  Between commands this
+	 * blocks waiting for the client, so callers serving many clients
+	 * should set a socket timeout (see RemctlServerRunner).
+	 */
+	private void serve_loop(Servlet servlet)
+	throws GSSException, IOException 
 	{
 		byte state = TOKEN_V2_INIT;
 		client_loop:
@@ -165,11 +181,17 @@ public class RemctlServer extends Remctl {
 				ByteBuffer messageBuffer = ByteBuffer.allocate(bytes.length);
 				messageBuffer.put(bytes);
 				messageBuffer.rewind();
-				byte cmd = messageBuffer.get();
-				if (cmd != MESSAGE_V2) {
-					throw new IOException("remctl: Message protocol version was " + cmd + " not 2?");
+				byte version = messageBuffer.get();
+				if (version != MESSAGE_V2 && version != MESSAGE_V3) {
+					/* tell the client what we speak and carry on */
+					bytes = new byte[3];
+					bytes[0] = MESSAGE_V2;
+					bytes[1] = MESSAGE_VERSION;
+					bytes[2] = MESSAGE_V3;
+					write_some_bytes(bytes);
+					continue;
 				}
-				cmd = messageBuffer.get();
+				byte cmd = messageBuffer.get();
 				switch( cmd ) {
 				default:
 					throw new IOException("remctl: bad message type " + cmd);
@@ -178,6 +200,17 @@ public class RemctlServer extends Remctl {
 						throw new IOException("remctl: MESSAGE_QUIT had junk!");
 					}
 					break client_loop;
+				case MESSAGE_NOOP:
+					/* keep-alive check from an idle client */
+					if (version != MESSAGE_V3 || returnCode != 0
+							|| messageBuffer.remaining() != 0) {
+						throw new IOException("remctl: bad MESSAGE_NOOP");
+					}
+					bytes = new byte[2];
+					bytes[0] = MESSAGE_V3;
+					bytes[1] = MESSAGE_NOOP;
+					write_some_bytes(bytes);
+					continue;
 				case MESSAGE_COMMAND:
 					break;
 				}
@@ -234,9 +267,6 @@ public class RemctlServer extends Remctl {
 				}
 				returnCode = 0;
 			}
-		// XXX these should be done in a "finally"
-		context.dispose();
-		outStream.flush();
 		// XXX should close socket real close to here.
 	}
 	// XXX can a server main() be used as well?  it should
@@ -0,0 +1,217 @@
+/*  R e m c t l S e r v e r R u n n e r
+ **
+ **  Accept loop and thread pool for a Java remctl server.  Each
+ **  accepted connection is handed to a bounded pool of worker threads,
+ **  which authenticate the client and then run commands from it with
+ **  RemctlServer.serve_a_client() for as long as the client keeps the
+ **  connection open.  The same Servlet is called from all worker
+ **  threads and therefore must be thread-safe.
+ **
+ **  Requires Java 5 or later for java.util.concurrent.
+ **
+ **  Written by Russ Allbery <eagle@eyrie.org>
+ **  Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ **
+ **  SPDX-License-Identifier: MIT
+ */
+
+package org.eyrie.eagle.remctl;
+
+import org.ietf.jgss.*;
+
+import java.net.*;
+import java.io.*;
+import java.util.HashSet;
+import java.util.Iterator;
+import java.util.concurrent.ArrayBlockingQueue;
+import java.util.concurrent.RejectedExecutionException;
+import java.util.concurrent.ThreadPoolExecutor;
+import java.util.concurrent.TimeUnit;
+
+public class RemctlServerRunner {
+	/** Default length of the queue of pending connections in the kernel */
+	public static final int DEFAULT_BACKLOG = 50;
+
+	/** Default number of worker threads */
+	public static final int DEFAULT_THREADS = 16;
+
+	/** Default number of accepted connections waiting for a thread */
+	public static final int DEFAULT_QUEUE = 64;
+
+	private final GSSCredential serverCreds;
+	private final RemctlServer.Servlet servlet;
+	private final ServerSocket listener;
+	private final ThreadPoolExecutor executor;
+
+	/* Sockets of connections currently being served. */
+	private final HashSet active = new HashSet();
+
+	private int idleTimeout = 0;
+	private volatile boolean stopping = false;
+
+	/**
+	 * Create a server listening on the given address and port.  No
+	 * connections are accepted until <code>run</code> is called.
+	 *
+	 * @param bindAddr  local address to listen on, or null for all.
+	 * @param port      port to listen on. If 0, uses the default
+	 *                  port of 4373 (Remctl.DEFAULT_PORT).
+	 * @param backlog   length of the listen queue for connections
+	 *                  not yet accepted.
+	 * @param threads   maximum number of connections served at once.
+	 * @param queue     maximum number of accepted connections waiting
+	 *                  for a free thread.  Connections beyond this are
+	 *                  closed immediately.
+	 * @param serverCreds  credentials used to accept GSS-API contexts.
+	 * @param servlet   Servlet that runs the commands.
+	 */
+	public RemctlServerRunner(InetAddress bindAddr,
+			int port,
+			int backlog,
+			int threads,
+			int queue,
+			GSSCredential serverCreds,
+			RemctlServer.Servlet servlet)
+	throws IOException
+	{
+		this.serverCreds = serverCreds;
+		this.servlet = servlet;
+		listener = new ServerSocket(port != 0 ? port : Remctl.DEFAULT_PORT,
+				backlog, bindAddr);
+		executor = new ThreadPoolExecutor(threads, threads,
+				60, TimeUnit.SECONDS, new ArrayBlockingQueue(queue));
+	}
+
+	public RemctlServerRunner(int port,
+			GSSCredential serverCreds,
+			RemctlServer.Servlet servlet)
+	throws IOException
+	{
+		this(null, port, DEFAULT_BACKLOG, DEFAULT_THREADS, DEFAULT_QUEUE,
+				serverCreds, servlet);
+	}
+
+	/**
+	 * Set the time in milliseconds a connection may wait for the next
+	 * token from the client, including between commands on a kept-alive
+	 * connection, before it is closed.  0, the default, means no limit.
+	 */
+	public void setIdleTimeout(int millis) {
+		idleTimeout = millis;
+	}
+
+	/**
+	 * Returns the port the server is listening on.
+	 */
+	public int getLocalPort() {
+		return listener.getLocalPort();
+	}
+
+	/**
+	 * Accept connections and hand them to the worker threads until
+	 * <code>shutdown</code> is called.
+	 */
+	public void run() throws IOException {
+		while (!stopping) {
+			Socket socket;
+			try {
+				socket = listener.accept();
+			} catch (IOException e) {
+				if (stopping) break;
+				throw e;
+			}
+			try {
+				executor.execute(new Connection(socket));
+			} catch (RejectedExecutionException e) {
+				/* Too busy (or stopping), so drop the connection. */
+				close(socket);
+			}
+		}
+	}
+
+	/**
+	 * Stop the server.  No new connections are accepted, and each open
+	 * connection is closed once its current command, if any, finishes.
+	 * Connections still open after the given number of milliseconds are
+	 * closed forcibly.  Returns true if all connections finished within
+	 * that time.
+	 */
+	public boolean shutdown(long timeout) throws InterruptedException {
+		stopping = true;
+		close(listener);
+		executor.shutdown();
+
+		/*
+		 * Shutting down input makes each connection see end of file
+		 * when it next waits for a token from its client, which is
+		 * after the status of any running command has been sent.
+		 */
+		synchronized (active) {
+			for (Iterator it = active.iterator(); it.hasNext();) {
+				try {
+					((Socket) it.next()).shutdownInput();
+				} catch (IOException e) {
+					// already closed
+				}
+			}
+		}
+		if (executor.awaitTermination(timeout, TimeUnit.MILLISECONDS))
+			return true;
+		synchronized (active) {
+			for (Iterator it = active.iterator(); it.hasNext();)
+				close((Socket) it.next());
+		}
+		executor.shutdownNow();
+		return false;
+	}
+
+	/* Serve one client connection in a worker thread. */
+	private class Connection implements Runnable {
+		private final Socket socket;
+
+		Connection(Socket p_socket) {
+			socket = p_socket;
+		}
+
+		public void run() {
+			synchronized (active) {
+				if (stopping) {
+					close(socket);
+					return;
+				}
+				active.add(socket);
+			}
+			try {
+				socket.setSoTimeout(idleTimeout);
+				RemctlServer server = new RemctlServer(socket, serverCreds);
+				server.serve_a_client(servlet);
+			} catch (Exception e) {
+				/*
+				 * The client went away, timed out, or sent something we
+				 * couldn't handle.  XXX there is nowhere to log this.
+				 */
+			} finally {
+				synchronized (active) {
+					active.remove(socket);
+				}
+				close(socket);
+			}
+		}
+	}
+
+	private static void close(Socket socket) {
+		try {
+			socket.close();
+		} catch (IOException e) {
+			// nothing more we can do
+		}
+	}
+
+	private static void close(ServerSocket socket) {
+		try {
+			socket.close();
+		} catch (IOException e) {
+			// nothing more we can do
+		}
+	}
+}
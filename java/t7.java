@@ -87,9 +87,9 @@ System.out.println(" t7_servelet runs");
 	 * This needs to run with Djavax.security.auth.useSubjectCredsOnly=false
 	 * so that this actually works.
 	 *
-	 * In this test case, all requests
-	 * get done in one thread.  Non-trivial requests
-	 * ought to be done on separate threads.
+	 * Clients are served by a pool of threads, so the
+	 * servlet must be thread-safe.  On shutdown (such as
+	 * on SIGTERM), running commands are allowed to finish.
 	 */
     public static void main(String[] args)
 	throws IOException, GSSException {
@@ -103,7 +103,6 @@ System.err.println(" args is " + args.length + " not 3");
 
 	int localPort = Integer.parseInt(args[0]);
 
-	ServerSocket ss = new ServerSocket(localPort);
 	GSSManager manager = GSSManager.getInstance();
 
 	/* get server credentials */
@@ -116,14 +115,19 @@ System.err.println(" args is " + args.length + " not 3");
 	    krb5Mechanism,
 	    GSSCredential.ACCEPT_ONLY);
 
-	/* XXX should start a separate thread to process each request */
-	while (true) {
-	    Socket socket = ss.accept();
-
-	    RemctlServer server = new RemctlServer(socket, serverCreds);
-	    server.serve_a_client(new t7_servlet());
-	    socket.close();
-	}
+	final RemctlServerRunner runner =
+	    new RemctlServerRunner(localPort, serverCreds, new t7_servlet());
+	runner.setIdleTimeout(60 * 1000);
+	Runtime.getRuntime().addShutdownHook(new Thread() {
+	    public void run() {
+		try {
+		    runner.shutdown(10 * 1000);
+		} catch (InterruptedException e) {
+		    // exiting anyway
+		}
+	    }
+	});
+	runner.run();
     }
 }
 
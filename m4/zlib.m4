@@ -0,0 +1,76 @@
+# serial 1
+
+dnl Find the compiler and linker flags for the zlib library.
+dnl
+dnl Finds the compiler and linker flags for linking with the zlib
+dnl compression library.  Provides the --with-zlib, --with-zlib-lib, and
+dnl --with-zlib-include configure options to specify non-standard paths to the
+dnl zlib library.  Uses pkg-config where available.
+dnl
+dnl Provides the macro RRA_LIB_ZLIB_OPTIONAL and sets the substitution
+dnl variables ZLIB_CPPFLAGS, ZLIB_LDFLAGS, and ZLIB_LIBS.  They will be empty
+dnl if the zlib library is not found or if --without-zlib is given.  Also
+dnl provides RRA_LIB_ZLIB_SWITCH to set CPPFLAGS, LDFLAGS, and LIBS to include
+dnl the zlib library, saving the current values first, and
+dnl RRA_LIB_ZLIB_RESTORE to restore those settings to before the last
+dnl RRA_LIB_ZLIB_SWITCH.  Defines HAVE_ZLIB and sets rra_use_ZLIB to true if
+dnl the library is found and --without-zlib is not given.
+dnl
+dnl Depends on the lib-helper.m4 framework and the Autoconf macros that come
+dnl with pkg-config.
+dnl
+dnl Written by Russ Allbery <eagle@eyrie.org>
+dnl Copyright 2026 Russ Allbery <eagle@eyrie.org>
+dnl
+dnl This file is free software; the authors give unlimited permission to copy
+dnl and/or distribute it, with or without modifications, as long as this
+dnl notice is preserved.
+dnl
+dnl SPDX-License-Identifier: FSFULLR
+
+dnl Save the current CPPFLAGS, LDFLAGS, and LIBS settings and switch to
+dnl versions that include the zlib flags.  Used as a wrapper, with
+dnl RRA_LIB_ZLIB_RESTORE, around tests.
+AC_DEFUN([RRA_LIB_ZLIB_SWITCH], [RRA_LIB_HELPER_SWITCH([ZLIB])])
+
+dnl Restore CPPFLAGS, LDFLAGS, and LIBS to their previous values before
+dnl RRA_LIB_ZLIB_SWITCH was called.
+AC_DEFUN([RRA_LIB_ZLIB_RESTORE], [RRA_LIB_HELPER_RESTORE([ZLIB])])
+
+dnl Checks if the zlib library is present.  The single argument, if "true",
+dnl says to fail if it could not be found.  Prefer probing with pkg-config if
+dnl available and the --with flags were not given.
+AC_DEFUN([_RRA_LIB_ZLIB_INTERNAL],
+[RRA_LIB_HELPER_PATHS([ZLIB])
+ AS_IF([test x"$ZLIB_CPPFLAGS" = x && test x"$ZLIB_LDFLAGS" = x],
+    [PKG_CHECK_EXISTS([zlib],
+        [PKG_CHECK_MODULES([ZLIB], [zlib])
+         ZLIB_CPPFLAGS="$ZLIB_CFLAGS"])])
+ AS_IF([test x"$ZLIB_LIBS" = x],
+    [RRA_LIB_ZLIB_SWITCH
+     LIBS=
+     AC_SEARCH_LIBS([deflate], [z],
+        [ZLIB_LIBS="$LIBS"],
+        [AS_IF([test x"$1" = xtrue],
+            [AC_MSG_ERROR([cannot find usable zlib library])])])
+     RRA_LIB_ZLIB_RESTORE])
+ RRA_LIB_ZLIB_SWITCH
+ AC_CHECK_HEADERS([zlib.h], [],
+    [ZLIB_LIBS=
+     AS_IF([test x"$1" = xtrue],
+        [AC_MSG_ERROR([cannot find usable zlib header])])])
+ RRA_LIB_ZLIB_RESTORE])
+
+dnl The main macro for packages with optional zlib support.
+AC_DEFUN([RRA_LIB_ZLIB_OPTIONAL],
+[RRA_LIB_HELPER_VAR_INIT([ZLIB])
+ RRA_LIB_HELPER_WITH_OPTIONAL([zlib], [zlib], [ZLIB])
+ AS_IF([test x"$rra_use_ZLIB" != xfalse],
+    [AS_IF([test x"$rra_use_ZLIB" = xtrue],
+        [_RRA_LIB_ZLIB_INTERNAL([true])],
+        [_RRA_LIB_ZLIB_INTERNAL([false])])])
+ AS_IF([test x"$ZLIB_LIBS" = x],
+    [RRA_LIB_HELPER_VAR_CLEAR([ZLIB])],
+    [rra_use_ZLIB=true
+     AC_DEFINE([HAVE_ZLIB], 1,
+        [Define if the zlib library is available.])])])
@@ -0,0 +1,76 @@
+# serial 1
+
+dnl Find the compiler and linker flags for the Zstandard library.
+dnl
+dnl Finds the compiler and linker flags for linking with the Zstandard
+dnl compression library.  Provides the --with-zstd, --with-zstd-lib, and
+dnl --with-zstd-include configure options to specify non-standard paths to the
+dnl Zstandard library.  Uses pkg-config where available.
+dnl
+dnl Provides the macro RRA_LIB_ZSTD_OPTIONAL and sets the substitution
+dnl variables ZSTD_CPPFLAGS, ZSTD_LDFLAGS, and ZSTD_LIBS.  They will be empty
+dnl if the Zstandard library is not found or if --without-zstd is given.  Also
+dnl provides RRA_LIB_ZSTD_SWITCH to set CPPFLAGS, LDFLAGS, and LIBS to include
+dnl the Zstandard library, saving the current values first, and
+dnl RRA_LIB_ZSTD_RESTORE to restore those settings to before the last
+dnl RRA_LIB_ZSTD_SWITCH.  Defines HAVE_ZSTD and sets rra_use_ZSTD to true if
+dnl the library is found and --without-zstd is not given.
+dnl
+dnl Depends on the lib-helper.m4 framework and the Autoconf macros that come
+dnl with pkg-config.
+dnl
+dnl Written by Russ Allbery <eagle@eyrie.org>
+dnl Copyright 2026 Russ Allbery <eagle@eyrie.org>
+dnl
+dnl This file is free software; the authors give unlimited permission to copy
+dnl and/or distribute it, with or without modifications, as long as this
+dnl notice is preserved.
+dnl
+dnl SPDX-License-Identifier: FSFULLR
+
+dnl Save the current CPPFLAGS, LDFLAGS, and LIBS settings and switch to
+dnl versions that include the Zstandard flags.  Used as a wrapper, with
+dnl RRA_LIB_ZSTD_RESTORE, around tests.
+AC_DEFUN([RRA_LIB_ZSTD_SWITCH], [RRA_LIB_HELPER_SWITCH([ZSTD])])
+
+dnl Restore CPPFLAGS, LDFLAGS, and LIBS to their previous values before
+dnl RRA_LIB_ZSTD_SWITCH was called.
+AC_DEFUN([RRA_LIB_ZSTD_RESTORE], [RRA_LIB_HELPER_RESTORE([ZSTD])])
+
+dnl Checks if the Zstandard library is present.  The single argument, if
+dnl "true", says to fail if it could not be found.  Prefer probing with
+dnl pkg-config if available and the --with flags were not given.
+AC_DEFUN([_RRA_LIB_ZSTD_INTERNAL],
+[RRA_LIB_HELPER_PATHS([ZSTD])
+ AS_IF([test x"$ZSTD_CPPFLAGS" = x && test x"$ZSTD_LDFLAGS" = x],
+    [PKG_CHECK_EXISTS([libzstd],
+        [PKG_CHECK_MODULES([ZSTD], [libzstd])
+         ZSTD_CPPFLAGS="$ZSTD_CFLAGS"])])
+ AS_IF([test x"$ZSTD_LIBS" = x],
+    [RRA_LIB_ZSTD_SWITCH
+     LIBS=
+     AC_SEARCH_LIBS([ZSTD_compress], [zstd],
+        [ZSTD_LIBS="$LIBS"],
+        [AS_IF([test x"$1" = xtrue],
+            [AC_MSG_ERROR([cannot find usable Zstandard library])])])
+     RRA_LIB_ZSTD_RESTORE])
+ RRA_LIB_ZSTD_SWITCH
+ AC_CHECK_HEADERS([zstd.h], [],
+    [ZSTD_LIBS=
+     AS_IF([test x"$1" = xtrue],
+        [AC_MSG_ERROR([cannot find usable Zstandard header])])])
+ RRA_LIB_ZSTD_RESTORE])
+
+dnl The main macro for packages with optional Zstandard support.
+AC_DEFUN([RRA_LIB_ZSTD_OPTIONAL],
+[RRA_LIB_HELPER_VAR_INIT([ZSTD])
+ RRA_LIB_HELPER_WITH_OPTIONAL([zstd], [Zstandard], [ZSTD])
+ AS_IF([test x"$rra_use_ZSTD" != xfalse],
+    [AS_IF([test x"$rra_use_ZSTD" = xtrue],
+        [_RRA_LIB_ZSTD_INTERNAL([true])],
+        [_RRA_LIB_ZSTD_INTERNAL([false])])])
+ AS_IF([test x"$ZSTD_LIBS" = x],
+    [RRA_LIB_HELPER_VAR_CLEAR([ZSTD])],
+    [rra_use_ZSTD=true
+     AC_DEFINE([HAVE_ZSTD], 1,
+        [Define if the Zstandard library is available.])])])
@@ -5,7 +5,7 @@
  * the Net::Remctl bindings for Perl.
  *
  * Originally written by Andrew Mortensen <admorten@umich.edu>
- * Copyright 2016, 2018, 2020 Russ Allbery <eagle@eyrie.org>
+ * Copyright 2016, 2018, 2020, 2026 Russ Allbery <eagle@eyrie.org>
  * Copyright 2008 Andrew Mortensen <admorten@umich.edu>
  * Copyright 2008, 2011-2012, 2014
  *     The Board of Trustees of the Leland Stanford Junior University
@@ -29,6 +29,17 @@
 #include <php_remctl.h>
 
 static int le_remctl_internal;
+static int le_remctl_persistent;
+
+/*
+ * A persistent connection.  refs counts the resources for this connection
+ * handed out by remctl_pconnect during the current request, so that a
+ * connection still in use by the request is never replaced.
+ */
+struct php_remctl_persistent {
+    struct remctl *r; /* The underlying connection. */
+    int refs;         /* Resources referring to the connection. */
+};
 
 /* clang-format off */
 ZEND_BEGIN_ARG_INFO_EX(arginfo_remctl, 0, 0, 4)
@@ -41,6 +52,13 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_INFO_EX(arginfo_remctl_new, 0, 0, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_remctl_pconnect, 0, 0, 1)
+    ZEND_ARG_INFO(0, "host")
+    ZEND_ARG_INFO(0, "port")
+    ZEND_ARG_INFO(0, "principal")
+    ZEND_ARG_INFO(0, "ccache")
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_remctl_set_ccache, 0, 0, 2)
     ZEND_ARG_INFO(0, "remctl")
     ZEND_ARG_INFO(0, "path")
@@ -87,6 +105,7 @@ ZEND_END_ARG_INFO()
 static zend_function_entry remctl_functions[] = {
     ZEND_FE(remctl,               arginfo_remctl)
     ZEND_FE(remctl_new,           arginfo_remctl_new)
+    ZEND_FE(remctl_pconnect,      arginfo_remctl_pconnect)
     ZEND_FE(remctl_set_ccache,    arginfo_remctl_set_ccache)
     ZEND_FE(remctl_set_source_ip, arginfo_remctl_set_source_ip)
     ZEND_FE(remctl_set_timeout,   arginfo_remctl_set_timeout)
@@ -132,17 +151,91 @@ php_remctl_dtor(zend_resource *rsrc)
 
 
 /*
- * Initialize the module and register the destructor.  Stores the resource
- * number of the module in le_remctl_internal.
+ * Destructor for a resource referring to a persistent connection, called at
+ * the end of the request or by remctl_close.  The connection stays open.
+ */
+static void
+php_remctl_release(zend_resource *rsrc)
+{
+    struct php_remctl_persistent *pr = rsrc->ptr;
+
+    pr->refs--;
+}
+
+
+/*
+ * Destructor for a persistent connection, called when it is removed from the
+ * persistent list, either because it failed its health check or because the
+ * PHP process is exiting.
+ */
+static void
+php_remctl_pdtor(zend_resource *rsrc)
+{
+    struct php_remctl_persistent *pr = rsrc->ptr;
+
+    if (pr->r != NULL)
+        remctl_close(pr->r);
+    pefree(pr, 1);
+}
+
+
+/*
+ * Initialize the module and register the destructors.  Stores the resource
+ * number of the module in le_remctl_internal and the resource number for
+ * persistent connections in le_remctl_persistent.
  */
 PHP_MINIT_FUNCTION(remctl)
 {
     le_remctl_internal = zend_register_list_destructors_ex(
         php_remctl_dtor, NULL, PHP_REMCTL_RES_NAME, module_number);
+    le_remctl_persistent = zend_register_list_destructors_ex(
+        php_remctl_release, php_remctl_pdtor, PHP_REMCTL_PRES_NAME,
+        module_number);
     return SUCCESS;
 }
 
 
+/*
+ * Retrieve the struct remctl from a resource, which may be either a
+ * connection created by remctl_new or a persistent connection.  Used by the
+ * functions that only use an already open connection.  Returns NULL (after
+ * Zend reports an error) if the resource is of some other type.
+ */
+static struct remctl *
+php_remctl_fetch(zval *zrem)
+{
+    struct php_remctl_persistent *pr;
+
+    if (Z_RES_P(zrem)->type == le_remctl_persistent) {
+        pr = Z_RES_P(zrem)->ptr;
+        return pr->r;
+    }
+    return zend_fetch_resource(Z_RES_P(zrem), PHP_REMCTL_RES_NAME,
+                               le_remctl_internal);
+}
+
+
+/*
+ * Retrieve the struct remctl from a resource created by remctl_new.  Used by
+ * the functions that change the connection itself or the settings for
+ * opening it, which would otherwise change a shared persistent connection
+ * for later callers of remctl_pconnect with the same key.  Returns NULL
+ * (after reporting an error) if the resource is a persistent connection or
+ * of some other type.
+ */
+static struct remctl *
+php_remctl_fetch_internal(zval *zrem, const char *function)
+{
+    if (Z_RES_P(zrem)->type == le_remctl_persistent) {
+        zend_error(E_WARNING, "%s: not supported for persistent connections\n",
+                   function);
+        return NULL;
+    }
+    return zend_fetch_resource(Z_RES_P(zrem), PHP_REMCTL_RES_NAME,
+                               le_remctl_internal);
+}
+
+
 /*
  * The simplified interface.  Make a call and return the results as an
  * object.
@@ -270,6 +363,123 @@ ZEND_FUNCTION(remctl_new)
 }
 
 
+/*
+ * Return an open persistent connection, which survives the end of the PHP
+ * request and is reused by later calls with the same host, port, principal,
+ * and credential cache in the same PHP process.  An existing connection left
+ * over from a previous request is checked with a NOOP message before it is
+ * reused, and if that fails (such as because the server closed the
+ * connection), it is transparently replaced with a new connection.  A
+ * connection already returned earlier in the same request is returned again
+ * without any check.  PHP may require something be passed in for
+ * principal, but the empty string is taken to mean "use the library default,"
+ * and the empty string for ccache means to use the default credential cache.
+ * The default credential cache must then be set with KRB5CCNAME, since
+ * otherwise it can't be told apart from a different default.
+ */
+ZEND_FUNCTION(remctl_pconnect)
+{
+    struct php_remctl_persistent *pr = NULL;
+    struct remctl *r;
+    zend_resource *le, new_le;
+    zend_string *key;
+    char *host;
+    char *principal = NULL;
+    char *ccache = NULL;
+    const char *effective;
+    zend_long port = 0;
+    size_t hlen, plen = 0, clen = 0;
+    int status;
+
+    /* Parse and verify arguments. */
+    status = zend_parse_parameters(ZEND_NUM_ARGS(), "s|lss", &host, &hlen,
+                                   &port, &principal, &plen, &ccache, &clen);
+    if (status == FAILURE) {
+        zend_error(E_WARNING, "remctl_pconnect: invalid parameters\n");
+        RETURN_FALSE;
+    }
+    if (hlen == 0) {
+        zend_error(E_WARNING,
+                   "remctl_pconnect: host must be a valid string\n");
+        RETURN_FALSE;
+    }
+
+    /*
+     * A connection must only be reused with the credential cache it was
+     * authenticated with.  If none was given, the connection will use the
+     * default, which may be changed between requests by setting KRB5CCNAME.
+     * Without KRB5CCNAME, we can't tell what the default is, so refuse.
+     */
+    effective = (clen == 0) ? getenv("KRB5CCNAME") : ccache;
+    if (effective == NULL || effective[0] == '\0') {
+        zend_error(E_WARNING, "remctl_pconnect: no credential cache given"
+                              " and KRB5CCNAME not set\n");
+        RETURN_FALSE;
+    }
+
+    /*
+     * Build the key for the persistent list.  Each string is prefixed with
+     * its length so that no combination of arguments can produce the same
+     * key as another.
+     */
+    key = strpprintf(0, "remctl_%ld_%s_%ld_%ld_%s_%ld_%s", (long) hlen, host,
+                     (long) port, (long) plen, plen == 0 ? "" : principal,
+                     (long) strlen(effective), effective);
+    if (plen == 0)
+        principal = NULL;
+    if (clen == 0)
+        ccache = NULL;
+
+    /* Reuse an existing connection if it's in use or still works. */
+    le = zend_hash_find_ptr(&EG(persistent_list), key);
+    if (le != NULL && le->type == le_remctl_persistent) {
+        pr = le->ptr;
+        if (pr->refs == 0 && !remctl_noop(pr->r)) {
+            zend_hash_del(&EG(persistent_list), key);
+            pr = NULL;
+        }
+    }
+
+    /* Otherwise, open a new connection and add it to the persistent list. */
+    if (pr == NULL) {
+        r = remctl_new();
+        if (r == NULL) {
+            zend_error(E_WARNING, "remctl_pconnect: %s", strerror(errno));
+            zend_string_release(key);
+            RETURN_FALSE;
+        }
+        if (ccache != NULL && !remctl_set_ccache(r, ccache))
+            goto fail;
+        if (!remctl_open(r, host, port, principal))
+            goto fail;
+        pr = pemalloc(sizeof(struct php_remctl_persistent), 1);
+        pr->r = r;
+        pr->refs = 0;
+        memset(&new_le, 0, sizeof(new_le));
+        new_le.type = le_remctl_persistent;
+        new_le.ptr = pr;
+        if (zend_hash_str_update_mem(&EG(persistent_list), ZSTR_VAL(key),
+                                     ZSTR_LEN(key), &new_le, sizeof(new_le))
+            == NULL) {
+            zend_error(E_WARNING, "remctl_pconnect: cannot save connection\n");
+            remctl_close(r);
+            pefree(pr, 1);
+            zend_string_release(key);
+            RETURN_FALSE;
+        }
+    }
+    zend_string_release(key);
+    pr->refs++;
+    RETURN_RES(zend_register_resource(pr, le_remctl_persistent));
+
+fail:
+    zend_error(E_WARNING, "remctl_pconnect: %s\n", remctl_error(r));
+    remctl_close(r);
+    zend_string_release(key);
+    RETURN_FALSE;
+}
+
+
 /*
  * Set the credential cache for subsequent connections with remctl_open.
  */
@@ -287,8 +497,9 @@ ZEND_FUNCTION(remctl_set_ccache)
         zend_error(E_WARNING, "remctl_set_ccache: invalid parameters\n");
         RETURN_FALSE;
     }
-    r = zend_fetch_resource(Z_RES_P(zrem), PHP_REMCTL_RES_NAME,
-                            le_remctl_internal);
+    r = php_remctl_fetch_internal(zrem, "remctl_set_ccache");
+    if (r == NULL)
+        RETURN_FALSE;
     if (!remctl_set_ccache(r, ccache))
         RETURN_FALSE;
     RETURN_TRUE;
@@ -312,8 +523,9 @@ ZEND_FUNCTION(remctl_set_source_ip)
         zend_error(E_WARNING, "remctl_set_source_ip: invalid parameters\n");
         RETURN_FALSE;
     }
-    r = zend_fetch_resource(Z_RES_P(zrem), PHP_REMCTL_RES_NAME,
-                            le_remctl_internal);
+    r = php_remctl_fetch_internal(zrem, "remctl_set_source_ip");
+    if (r == NULL)
+        RETURN_FALSE;
     if (!remctl_set_source_ip(r, source))
         RETURN_FALSE;
     RETURN_TRUE;
@@ -335,8 +547,9 @@ ZEND_FUNCTION(remctl_set_timeout)
         zend_error(E_WARNING, "remctl_set_timeout: invalid parameters\n");
         RETURN_FALSE;
     }
-    r = zend_fetch_resource(Z_RES_P(zrem), PHP_REMCTL_RES_NAME,
-                            le_remctl_internal);
+    r = php_remctl_fetch_internal(zrem, "remctl_set_timeout");
+    if (r == NULL)
+        RETURN_FALSE;
     if (!remctl_set_timeout(r, timeout))
         RETURN_FALSE;
     RETURN_TRUE;
@@ -367,8 +580,9 @@ ZEND_FUNCTION(remctl_open)
     }
     if (plen == 0)
         principal = NULL;
-    r = zend_fetch_resource(Z_RES_P(zrem), PHP_REMCTL_RES_NAME,
-                            le_remctl_internal);
+    r = php_remctl_fetch_internal(zrem, "remctl_open");
+    if (r == NULL)
+        RETURN_FALSE;
 
     /* Now we have all the arguments and can do the real work. */
     if (!remctl_open(r, host, port, principal))
@@ -396,8 +610,9 @@ ZEND_FUNCTION(remctl_command)
         zend_error(E_WARNING, "remctl_command: invalid parameters\n");
         RETURN_FALSE;
     }
-    r = zend_fetch_resource(Z_RES_P(zrem), PHP_REMCTL_RES_NAME,
-                            le_remctl_internal);
+    r = php_remctl_fetch(zrem);
+    if (r == NULL)
+        RETURN_FALSE;
     hash = Z_ARRVAL_P(cmd_array);
     count = zend_hash_num_elements(hash);
     if (count < 1) {
@@ -473,8 +688,9 @@ ZEND_FUNCTION(remctl_output)
         zend_error(E_WARNING, "remctl_output: invalid parameters\n");
         RETURN_NULL();
     }
-    r = zend_fetch_resource(Z_RES_P(zrem), PHP_REMCTL_RES_NAME,
-                            le_remctl_internal);
+    r = php_remctl_fetch(zrem);
+    if (r == NULL)
+        RETURN_NULL();
 
     /* Get the output token. */
     output = remctl_output(r);
@@ -524,8 +740,9 @@ ZEND_FUNCTION(remctl_noop)
         zend_error(E_WARNING, "remctl_noop: invalid parameters\n");
         RETURN_FALSE;
     }
-    r = zend_fetch_resource(Z_RES_P(zrem), PHP_REMCTL_RES_NAME,
-                            le_remctl_internal);
+    r = php_remctl_fetch(zrem);
+    if (r == NULL)
+        RETURN_FALSE;
     if (!remctl_noop(r))
         RETURN_FALSE;
     RETURN_TRUE;
@@ -548,8 +765,9 @@ ZEND_FUNCTION(remctl_error)
         zend_error(E_WARNING, "remctl_error: invalid parameters\n");
         RETURN_NULL();
     }
-    r = zend_fetch_resource(Z_RES_P(zrem), PHP_REMCTL_RES_NAME,
-                            le_remctl_internal);
+    r = php_remctl_fetch(zrem);
+    if (r == NULL)
+        RETURN_NULL();
 
     /* Do the work. */
     error = remctl_error(r);
@@ -573,7 +791,10 @@ ZEND_FUNCTION(remctl_close)
         RETURN_NULL();
     }
 
-    /* This delete invokes php_remctl_dtor, which calls remctl_close. */
+    /*
+     * This delete invokes php_remctl_dtor, which calls remctl_close, or for a
+     * persistent connection php_remctl_release, which leaves it open.
+     */
     zend_list_delete(Z_RES_P(zrem));
     RETURN_TRUE;
 }
@@ -0,0 +1,94 @@
+--TEST--
+Check persistent connections
+--CREDITS--
+Russ Allbery
+# Copyright 2026 Russ Allbery <eagle@eyrie.org>
+#
+# SPDX-License-Identifier: MIT
+--ENV--
+KRB5CCNAME=remctl-test.cache
+LD_LIBRARY_PATH=../client/.libs
+--SKIPIF--
+<?php
+    if (!file_exists("remctl-test.pid"))
+        echo "skip remctld not running";
+    elseif (!function_exists("remctl_pconnect"))
+        echo "skip remctl_pconnect not supported";
+?>
+--FILE--
+<?php
+    $fh = fopen("remctl-test.princ", "r");
+    $principal = rtrim(fread($fh, filesize("remctl-test.princ")));
+    for ($i = 1; $i <= 2; $i++) {
+        $r = remctl_pconnect("127.0.0.1", 14373, $principal);
+        if ($r == null) {
+            echo "remctl_pconnect failed\n";
+            exit(2);
+        }
+        echo "Opened persistent connection $i\n";
+        $args = array("test", "test");
+        if (!remctl_command($r, $args)) {
+            echo "remctl_command failed\n";
+            exit(2);
+        }
+        $output = remctl_output($r);
+        echo "Output: $output->type\n";
+        echo "Data: $output->data";
+        $output = remctl_output($r);
+        echo "Output: $output->type\n";
+        echo "Status: $output->status\n";
+
+        // The request ID holds the PID of the remctld child handling the
+        // connection and the number of the command on that connection.
+        $args = array("test", "env", "REMCTL_REQUEST_ID");
+        if (!remctl_command($r, $args)) {
+            echo "remctl_command failed\n";
+            exit(2);
+        }
+        $output = remctl_output($r);
+        $ids[$i] = explode("-", rtrim($output->data));
+        $output = remctl_output($r);
+        if (@remctl_open($r, "127.0.0.1", 14444, $principal)) {
+            echo "remctl_open unexpectedly succeeded\n";
+            exit(2);
+        }
+        if (@remctl_set_timeout($r, 10)) {
+            echo "remctl_set_timeout unexpectedly succeeded\n";
+            exit(2);
+        }
+        echo "Settings of persistent connection $i not changed\n";
+        remctl_close($r);
+    }
+    if ($ids[1][1] == $ids[2][1] && $ids[2][2] == $ids[1][2] + 2)
+        echo "Persistent connection reused\n";
+    else
+        echo "Persistent connection not reused\n";
+    putenv("KRB5CCNAME");
+    if (@remctl_pconnect("127.0.0.1", 14373, $principal)) {
+        echo "remctl_pconnect unexpectedly succeeded\n";
+        exit(2);
+    }
+    echo "remctl_pconnect without KRB5CCNAME failed\n";
+    putenv("KRB5CCNAME=remctl-test.cache");
+    if (@remctl_pconnect("127.0.0.1", 14444, $principal)) {
+        echo "remctl_pconnect unexpectedly succeeded\n";
+        exit(2);
+    }
+    echo "remctl_pconnect to bad port failed\n";
+?>
+--EXPECT--
+Opened persistent connection 1
+Output: output
+Data: hello world
+Output: status
+Status: 0
+Settings of persistent connection 1 not changed
+Opened persistent connection 2
+Output: output
+Data: hello world
+Output: status
+Status: 0
+Settings of persistent connection 2 not changed
+Persistent connection reused
+remctl_pconnect without KRB5CCNAME failed
+remctl_pconnect to bad port failed
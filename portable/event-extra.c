@@ -47,6 +47,26 @@ bufferevent_read_buffer(struct bufferevent *bufev, struct evbuffer *buf)
 #endif /* !HAVE_BUFFEREVENT_READ_BUFFER */
 
 
+#ifndef HAVE_BUFFEREVENT_SET_TIMEOUTS
+/*
+ * Set the read and write timeouts for a bufferevent.  Older versions of
+ * libevent only have bufferevent_settimeout, which takes whole seconds.
+ */
+int
+bufferevent_set_timeouts(struct bufferevent *bufev,
+                         const struct timeval *timeout_read,
+                         const struct timeval *timeout_write)
+{
+    int read_secs, write_secs;
+
+    read_secs = (timeout_read == NULL) ? 0 : (int) timeout_read->tv_sec;
+    write_secs = (timeout_write == NULL) ? 0 : (int) timeout_write->tv_sec;
+    bufferevent_settimeout(bufev, read_secs, write_secs);
+    return 0;
+}
+#endif /* !HAVE_BUFFEREVENT_SET_TIMEOUTS */
+
+
 #ifndef HAVE_BUFFEREVENT_SOCKET_NEW
 /*
  * Create a new bufferevent for a socket and register it with the provided
@@ -74,11 +74,22 @@ typedef void (*event_callback_fn)(evutil_socket_t, short, void *);
 #    define bufferevent_get_input(bev) EVBUFFER_INPUT(bev)
 #endif
 
+/* Introduced in 2.0.1-alpha. */
+#ifndef HAVE_BUFFEREVENT_GET_OUTPUT
+#    define bufferevent_get_output(bev) EVBUFFER_OUTPUT(bev)
+#endif
+
 /* Introduced in 2.0.1-alpha. */
 #ifndef HAVE_BUFFEREVENT_READ_BUFFER
 int bufferevent_read_buffer(struct bufferevent *, struct evbuffer *);
 #endif
 
+/* Introduced in 2.0.1-alpha.  Older versions only support whole seconds. */
+#ifndef HAVE_BUFFEREVENT_SET_TIMEOUTS
+int bufferevent_set_timeouts(struct bufferevent *, const struct timeval *,
+                             const struct timeval *);
+#endif
+
 /*
  * Introduced in 2.0.1-alpha.  Note that options are silently ignored with
  * older versions and therefore cannot be relied on in code that has to be
@@ -94,6 +105,17 @@ struct bufferevent *bufferevent_socket_new(struct event_base *,
 #    define libevent_global_shutdown() /* empty */
 #endif
 
+/*
+ * Introduced in 2.1.1-alpha.  Older versions read and write as much as the
+ * watermarks and the socket allow, which is close enough.
+ */
+#ifndef HAVE_BUFFEREVENT_SET_MAX_SINGLE_READ
+#    define bufferevent_set_max_single_read(bev, size) 0
+#endif
+#ifndef HAVE_BUFFEREVENT_SET_MAX_SINGLE_WRITE
+#    define bufferevent_set_max_single_write(bev, size) 0
+#endif
+
 /*
  * evbuffer_drain returns 0 or -1 with 2.x, but 1.4.13-stable declares this as
  * a void function.  Convert the older version to one that always returns
@@ -110,6 +132,14 @@ struct bufferevent *bufferevent_socket_new(struct event_base *,
 #    define evbuffer_get_length(buf) EVBUFFER_LENGTH(buf)
 #endif
 
+/*
+ * Introduced in 2.0.1-alpha.  Older versions always store the data of an
+ * evbuffer contiguously, so just return it.
+ */
+#ifndef HAVE_EVBUFFER_PULLUP
+#    define evbuffer_pullup(buf, size) EVBUFFER_DATA(buf)
+#endif
+
 /* Introduced in 2.0.1-alpha. */
 #ifndef HAVE_EVENT_FREE
 #    define event_free(event) free(event)
@@ -5,8 +5,15 @@
  * should not use this interface directly; instead, they should use the remctl
  * Python wrapper around this class.
  *
+ * All calls that may block on the network release the GIL so that other
+ * Python threads can run.  Each remctl object is paired with a lock that is
+ * held while the underlying libremctl object is in use, so that concurrent
+ * calls on the same object from different threads are serialized.  That lock
+ * is only ever waited for with the GIL released, so a thread holding the
+ * lock can always get the GIL back.
+ *
  * Original implementation by Thomas L. Kula <kula@tproa.net>
- * Copyright 2018-2020, 2025 Russ Allbery <eagle@eyrie.org>
+ * Copyright 2018-2020, 2025-2026 Russ Allbery <eagle@eyrie.org>
  * Copyright 2008 Thomas L. Kula <kula@tproa.net>
  * Copyright 2008, 2011-2012, 2014
  *     The Board of Trustees of the Leland Stanford Junior University
@@ -58,6 +65,66 @@ static const struct {
 };
 /* clang-format on */
 
+/* The object wrapped in a capsule for the Python interface. */
+struct py_remctl {
+    struct remctl *r;        /* libremctl object, or NULL once closed. */
+    PyThread_type_lock lock; /* Held while r is in use. */
+};
+
+
+/*
+ * Return the py_remctl struct wrapped by a capsule with its lock held.  If
+ * the lock isn't immediately available, release the GIL while waiting for
+ * it.  Raises an exception and returns NULL if the object is invalid or has
+ * been closed.  The caller must call release_remctl when done.
+ */
+static struct py_remctl *
+acquire_remctl(PyObject *object)
+{
+    struct py_remctl *rc;
+
+    rc = PyCapsule_GetPointer(object, "remctl");
+    if (rc == NULL)
+        return NULL;
+    if (!PyThread_acquire_lock(rc->lock, NOWAIT_LOCK)) {
+        Py_BEGIN_ALLOW_THREADS
+        PyThread_acquire_lock(rc->lock, WAIT_LOCK);
+        Py_END_ALLOW_THREADS
+    }
+    if (rc->r == NULL) {
+        PyThread_release_lock(rc->lock);
+        PyErr_SetString(PyExc_ValueError, "remctl object has been closed");
+        return NULL;
+    }
+    return rc;
+}
+
+
+/*
+ * Release the lock on a remctl object.
+ */
+static void
+release_remctl(struct py_remctl *rc)
+{
+    PyThread_release_lock(rc->lock);
+}
+
+
+/*
+ * Convert a Python list of bytes objects to a tuple, so that the elements
+ * stay referenced while the GIL is released even if another thread changes
+ * the list.  Returns a new reference or NULL on error.
+ */
+static PyObject *
+command_tuple(PyObject *list)
+{
+    if (!PyList_Check(list)) {
+        PyErr_SetString(PyExc_TypeError, "command must be a list");
+        return NULL;
+    }
+    return PyList_AsTuple(list);
+}
+
 
 static PyObject *
 py_remctl(PyObject *self, PyObject *args)
@@ -68,6 +135,7 @@ py_remctl(PyObject *self, PyObject *args)
     char *principal = NULL;
     const char **command = NULL;
     PyObject *list = NULL;
+    PyObject *tuple = NULL;
     PyObject *tmp = NULL;
     Py_ssize_t length, i;
     PyObject *result = NULL;
@@ -79,26 +147,29 @@ py_remctl(PyObject *self, PyObject *args)
      * The command is passed as a list object.  For the remctl API, we need to
      * turn it into a NULL-terminated array of pointers.
      */
-    length = PyList_Size(list);
+    tuple = command_tuple(list);
+    if (tuple == NULL)
+        return NULL;
+    length = PyTuple_GET_SIZE(tuple);
     command = malloc((length + 1) * sizeof(char *));
     if (command == NULL) {
         PyErr_NoMemory();
-        return NULL;
+        goto end;
     }
     for (i = 0; i < length; i++) {
-        tmp = PyList_GetItem(list, i);
-        if (tmp == NULL)
-            goto end;
+        tmp = PyTuple_GET_ITEM(tuple, i);
         command[i] = PyBytes_AsString(tmp);
         if (command[i] == NULL)
             goto end;
     }
     command[i] = NULL;
 
+    Py_BEGIN_ALLOW_THREADS
     rr = remctl(host, port, principal, command);
+    Py_END_ALLOW_THREADS
     if (rr == NULL) {
         PyErr_NoMemory();
-        return NULL;
+        goto end;
     }
 
     result = Py_BuildValue("(yy#y#i)", rr->error, rr->stdout_buf,
@@ -108,6 +179,7 @@ py_remctl(PyObject *self, PyObject *args)
 
 end:
     free(command);
+    Py_DECREF(tuple);
     return result;
 }
 
@@ -119,25 +191,44 @@ end:
 static void
 remctl_destruct(PyObject *obj)
 {
-    struct remctl *r;
-
-    r = PyCapsule_GetPointer(obj, "remctl");
-    if (r != NULL)
-        remctl_close(r);
+    struct py_remctl *rc;
+
+    rc = PyCapsule_GetPointer(obj, "remctl");
+    if (rc == NULL)
+        return;
+    if (rc->r != NULL)
+        remctl_close(rc->r);
+    PyThread_free_lock(rc->lock);
+    free(rc);
 }
 
 
 static PyObject *
 py_remctl_new(PyObject *self, PyObject *args)
 {
-    struct remctl *r;
-
-    r = remctl_new();
-    if (r == NULL) {
-        PyErr_NoMemory();
-        return NULL;
+    struct py_remctl *rc;
+    PyObject *capsule;
+
+    rc = calloc(1, sizeof(struct py_remctl));
+    if (rc == NULL)
+        return PyErr_NoMemory();
+    rc->r = remctl_new();
+    rc->lock = PyThread_allocate_lock();
+    if (rc->r == NULL || rc->lock == NULL) {
+        if (rc->r != NULL)
+            remctl_close(rc->r);
+        if (rc->lock != NULL)
+            PyThread_free_lock(rc->lock);
+        free(rc);
+        return PyErr_NoMemory();
     }
-    return PyCapsule_New(r, "remctl", remctl_destruct);
+    capsule = PyCapsule_New(rc, "remctl", remctl_destruct);
+    if (capsule == NULL) {
+        remctl_close(rc->r);
+        PyThread_free_lock(rc->lock);
+        free(rc);
+    }
+    return capsule;
 }
 
 
@@ -145,16 +236,17 @@ static PyObject *
 py_remctl_set_ccache(PyObject *self, PyObject *args)
 {
     PyObject *object = NULL;
-    struct remctl *r;
+    struct py_remctl *rc;
     char *ccache = NULL;
     int status;
 
     if (!PyArg_ParseTuple(args, "Os", &object, &ccache))
         return NULL;
-    r = PyCapsule_GetPointer(object, "remctl");
-    if (r == NULL)
+    rc = acquire_remctl(object);
+    if (rc == NULL)
         return NULL;
-    status = remctl_set_ccache(r, ccache);
+    status = remctl_set_ccache(rc->r, ccache);
+    release_remctl(rc);
     return Py_BuildValue("i", status);
 }
 
@@ -163,16 +255,17 @@ static PyObject *
 py_remctl_set_source_ip(PyObject *self, PyObject *args)
 {
     PyObject *object = NULL;
-    struct remctl *r;
+    struct py_remctl *rc;
     char *source = NULL;
     int status;
 
     if (!PyArg_ParseTuple(args, "Os", &object, &source))
         return NULL;
-    r = PyCapsule_GetPointer(object, "remctl");
-    if (r == NULL)
+    rc = acquire_remctl(object);
+    if (rc == NULL)
         return NULL;
-    status = remctl_set_source_ip(r, source);
+    status = remctl_set_source_ip(rc->r, source);
+    release_remctl(rc);
     return Py_BuildValue("i", status);
 }
 
@@ -181,16 +274,17 @@ static PyObject *
 py_remctl_set_timeout(PyObject *self, PyObject *args)
 {
     PyObject *object = NULL;
-    struct remctl *r;
+    struct py_remctl *rc;
     long timeout;
     int status;
 
     if (!PyArg_ParseTuple(args, "Ol", &object, &timeout))
         return NULL;
-    r = PyCapsule_GetPointer(object, "remctl");
-    if (r == NULL)
+    rc = acquire_remctl(object);
+    if (rc == NULL)
         return NULL;
-    status = remctl_set_timeout(r, timeout);
+    status = remctl_set_timeout(rc->r, timeout);
+    release_remctl(rc);
     return Py_BuildValue("i", status);
 }
 
@@ -202,15 +296,18 @@ py_remctl_open(PyObject *self, PyObject *args)
     char *host = NULL;
     unsigned short port = 0;
     char *principal = NULL;
-    struct remctl *r;
+    struct py_remctl *rc;
     int status;
 
     if (!PyArg_ParseTuple(args, "Os|Hz", &object, &host, &port, &principal))
         return NULL;
-    r = PyCapsule_GetPointer(object, "remctl");
-    if (r == NULL)
+    rc = acquire_remctl(object);
+    if (rc == NULL)
         return NULL;
-    status = remctl_open(r, host, port, principal);
+    Py_BEGIN_ALLOW_THREADS
+    status = remctl_open(rc->r, host, port, principal);
+    Py_END_ALLOW_THREADS
+    release_remctl(rc);
     return Py_BuildValue("i", status);
 }
 
@@ -219,14 +316,18 @@ static PyObject *
 py_remctl_close(PyObject *self, PyObject *args)
 {
     PyObject *object = NULL;
-    struct remctl *r;
+    struct py_remctl *rc;
 
     if (!PyArg_ParseTuple(args, "O", &object))
         return NULL;
-    r = PyCapsule_GetPointer(object, "remctl");
-    if (r == NULL)
+    rc = acquire_remctl(object);
+    if (rc == NULL)
         return NULL;
-    remctl_close(r);
+    Py_BEGIN_ALLOW_THREADS
+    remctl_close(rc->r);
+    Py_END_ALLOW_THREADS
+    rc->r = NULL;
+    release_remctl(rc);
     Py_INCREF(Py_None);
     return Py_None;
 }
@@ -236,14 +337,17 @@ static PyObject *
 py_remctl_error(PyObject *self, PyObject *args)
 {
     PyObject *object = NULL;
-    struct remctl *r;
+    struct py_remctl *rc;
+    PyObject *result;
 
     if (!PyArg_ParseTuple(args, "O", &object))
         return NULL;
-    r = PyCapsule_GetPointer(object, "remctl");
-    if (r == NULL)
+    rc = acquire_remctl(object);
+    if (rc == NULL)
         return NULL;
-    return Py_BuildValue("s", remctl_error(r));
+    result = Py_BuildValue("s", remctl_error(rc->r));
+    release_remctl(rc);
+    return result;
 }
 
 
@@ -252,50 +356,53 @@ py_remctl_commandv(PyObject *self, PyObject *args)
 {
     PyObject *object = NULL;
     PyObject *list = NULL;
-    struct remctl *r;
+    PyObject *tuple;
+    struct py_remctl *rc;
     struct iovec *iov;
     size_t count, i;
     char *string;
     Py_ssize_t length;
     PyObject *element;
     PyObject *result = NULL;
+    int status;
 
     if (!PyArg_ParseTuple(args, "OO", &object, &list))
         return NULL;
-    r = PyCapsule_GetPointer(object, "remctl");
-    if (r == NULL)
-        return NULL;
 
     /*
      * Convert the Python list into an array of struct iovecs, each of which
      * pointing to the elements of the list.
      */
-    count = PyList_Size(list);
+    tuple = command_tuple(list);
+    if (tuple == NULL)
+        return NULL;
+    count = PyTuple_GET_SIZE(tuple);
     iov = malloc(count * sizeof(struct iovec));
     if (iov == NULL) {
         PyErr_NoMemory();
-        return NULL;
+        goto end;
     }
     for (i = 0; i < count; i++) {
-        element = PyList_GetItem(list, i);
-        if (element == NULL)
-            goto end;
+        element = PyTuple_GET_ITEM(tuple, i);
         if (PyBytes_AsStringAndSize(element, &string, &length) == -1)
             goto end;
         iov[i].iov_base = string;
         iov[i].iov_len = length;
     }
 
-    if (remctl_commandv(r, iov, count)) {
-        Py_INCREF(Py_True);
-        result = Py_True;
-    } else {
-        Py_INCREF(Py_False);
-        result = Py_False;
-    }
+    rc = acquire_remctl(object);
+    if (rc == NULL)
+        goto end;
+    Py_BEGIN_ALLOW_THREADS
+    status = remctl_commandv(rc->r, iov, count);
+    Py_END_ALLOW_THREADS
+    release_remctl(rc);
+    result = status ? Py_True : Py_False;
+    Py_INCREF(result);
 
 end:
     free(iov);
+    Py_DECREF(tuple);
     return result;
 }
 
@@ -304,7 +411,7 @@ static PyObject *
 py_remctl_output(PyObject *self, PyObject *args)
 {
     PyObject *object = NULL;
-    struct remctl *r;
+    struct py_remctl *rc;
     struct remctl_output *output;
     const char *type = "unknown";
     size_t i;
@@ -312,13 +419,21 @@ py_remctl_output(PyObject *self, PyObject *args)
 
     if (!PyArg_ParseTuple(args, "O", &object))
         return NULL;
-    r = PyCapsule_GetPointer(object, "remctl");
-    if (r == NULL)
+    rc = acquire_remctl(object);
+    if (rc == NULL)
         return NULL;
 
-    output = remctl_output(r);
-    if (output == NULL)
+    /*
+     * The output is owned by the remctl object and is only valid until the
+     * next call, so keep the object locked until it has been copied.
+     */
+    Py_BEGIN_ALLOW_THREADS
+    output = remctl_output(rc->r);
+    Py_END_ALLOW_THREADS
+    if (output == NULL) {
+        release_remctl(rc);
         return Py_BuildValue("()");
+    }
     for (i = 0; OUTPUT_TYPE[i].name != NULL; i++)
         if (OUTPUT_TYPE[i].type == output->type) {
             type = OUTPUT_TYPE[output->type].name;
@@ -328,6 +443,7 @@ py_remctl_output(PyObject *self, PyObject *args)
     result = Py_BuildValue("(sy#iii)", type, output->data,
                            (Py_ssize_t) output->length, output->stream,
                            output->status, output->error);
+    release_remctl(rc);
     return result;
 }
 
@@ -336,15 +452,18 @@ static PyObject *
 py_remctl_noop(PyObject *self, PyObject *args)
 {
     PyObject *object = NULL;
-    struct remctl *r;
+    struct py_remctl *rc;
     int status;
 
     if (!PyArg_ParseTuple(args, "O", &object))
         return NULL;
-    r = PyCapsule_GetPointer(object, "remctl");
-    if (r == NULL)
+    rc = acquire_remctl(object);
+    if (rc == NULL)
         return NULL;
-    status = remctl_noop(r);
+    Py_BEGIN_ALLOW_THREADS
+    status = remctl_noop(rc->r);
+    Py_END_ALLOW_THREADS
+    release_remctl(rc);
     return Py_BuildValue("i", status);
 }
 
@@ -1,12 +1,13 @@
 # test_remctl.py -- Test suite for remctl Python bindings
 #
 # Written by Russ Allbery <eagle@eyrie.org>
-# Copyright 2019 Russ Allbery <eagle@eyrie.org>
+# Copyright 2019, 2026 Russ Allbery <eagle@eyrie.org>
 # Copyright 2008, 2011-2012, 2014
 #     The Board of Trustees of the Leland Stanford Junior University
 #
 # SPDX-License-Identifier: MIT
 
+import concurrent.futures
 import errno
 import os
 import re
@@ -142,6 +143,24 @@ class TestRemctlSimple(TestRemctl):
         self.assertEqual(result.stderr, None)
         self.assertEqual(result.status, 0)
 
+    @needs_kerberos
+    def test_simple_threads(self):
+        # type: () -> None
+        command = ("test", "sleep")
+        start = time.time()
+        with concurrent.futures.ThreadPoolExecutor(max_workers=4) as pool:
+            futures = [
+                pool.submit(
+                    remctl.remctl, "localhost", 14373, self.principal, command
+                )
+                for _ in range(4)
+            ]
+            for future in futures:
+                self.assertEqual(future.result().status, 0)
+
+        # Each command takes three seconds, so they must have run in parallel.
+        self.assertLess(time.time() - start, 9)
+
     @needs_kerberos
     def test_simple_status(self):
         # type: () -> None
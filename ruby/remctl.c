@@ -5,7 +5,7 @@
  * simple and complex forms of the API.
  *
  * Original implementation by Anthony M. Martinez <twopir@nmt.edu>
- * Copyright 2018, 2020, 2022 Russ Allbery <eagle@eyrie.org>
+ * Copyright 2018, 2020, 2022, 2026 Russ Allbery <eagle@eyrie.org>
  * Copyright 2010-2013
  *     The Board of Trustees of the Leland Stanford Junior University
  * Copyright 2010 Anthony M. Martinez <twopir@nmt.edu>
@@ -37,6 +37,9 @@
  * sets.  We don't care about any of these settings, thankfully.
  */
 #include <ruby.h>
+#ifdef HAVE_RUBY_THREAD_H
+#    include <ruby/thread.h>
+#endif
 #undef PACKAGE_NAME
 #undef PACKAGE_TARNAME
 #undef PACKAGE_VERSION
@@ -44,6 +47,7 @@
 #undef PACKAGE_BUGREPORT
 
 #include <config.h>
+#include <portable/socket.h>
 #include <portable/system.h>
 
 #include <errno.h>
@@ -87,39 +91,218 @@ static const struct {
 /* clang-format on */
 
 /*
- * Used for the complex interface when a method that requires the remctl
- * connection be open is called.  Retrieves the underlying struct remctl
- * object and raises an exception if it is NULL.
+ * The data wrapped by a Remctl object.  The mutex serializes method calls on
+ * the same object, since the connection is used without holding the GVL and
+ * therefore could otherwise be used or closed by another thread at the same
+ * time.
+ */
+struct rb_remctl {
+    struct remctl *r; /* Connection, NULL if closed. */
+    VALUE mutex;      /* Ruby Mutex protecting the connection. */
+};
+
+/*
+ * Arguments to and results of a libremctl call made without holding the GVL.
+ * Only the members used by a given call need be set.
  */
-#define GET_REMCTL_OR_RAISE(obj, var)                                  \
-    do {                                                               \
-        Data_Get_Struct((obj), struct remctl, (var));                  \
-        if ((var) == NULL)                                             \
-            rb_raise(eRemctlNotOpen, "Connection is no longer open."); \
-    } while (0)
+struct rb_remctl_call {
+    struct remctl *r;             /* Connection to use. */
+    const char *host;             /* Host for remctl_open. */
+    unsigned short port;          /* Port for remctl_open. */
+    const char *principal;        /* Principal for remctl_open. */
+    bool pool;                    /* Whether to use remctl_pool_open. */
+    struct iovec *command;        /* Command for remctl_commandv. */
+    size_t count;                 /* Number of elements in command. */
+    long timeout;                 /* Timeout for remctl_set_timeout. */
+    struct remctl_output *output; /* Result of remctl_output. */
+    int status;                   /* Result of the other calls. */
+};
 
 
 /*
- * Given a remctl_result pointer, return a Ruby Remctl::Result, unless the
- * remctl call had an error, in which case raise a Remctl::Error.  This is
- * used only internally by the extension and isn't exported as a method.
+ * The functions run without the GVL.  These must not call any Ruby API
+ * functions.
  */
-static VALUE
-rb_remctl_result_new(struct remctl_result *rr)
+static void *
+rb_remctl_open_nogvl(void *data)
+{
+    struct rb_remctl_call *call = data;
+
+    if (call->pool)
+        call->status =
+            remctl_pool_open(call->r, call->host, call->port, call->principal);
+    else
+        call->status =
+            remctl_open(call->r, call->host, call->port, call->principal);
+    return NULL;
+}
+
+static void *
+rb_remctl_commandv_nogvl(void *data)
+{
+    struct rb_remctl_call *call = data;
+
+    call->status = remctl_commandv(call->r, call->command, call->count);
+    return NULL;
+}
+
+static void *
+rb_remctl_output_nogvl(void *data)
+{
+    struct rb_remctl_call *call = data;
+
+    call->output = remctl_output(call->r);
+    return NULL;
+}
+
+static void *
+rb_remctl_noop_nogvl(void *data)
+{
+    struct rb_remctl_call *call = data;
+
+    call->status = remctl_noop(call->r);
+    return NULL;
+}
+
+
+/*
+ * Unblocking function for calls on an open connection, called by Ruby from
+ * another thread if the thread waiting on the network is interrupted (by
+ * Thread#raise, Thread#kill, or Timeout, for instance).  Shutting down the
+ * socket forces the pending read or write to fail, after which the
+ * connection can no longer be used.
+ */
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+static void
+rb_remctl_interrupt(void *data)
+{
+    struct rb_remctl_call *call = data;
+    socket_type fd;
+
+    fd = remctl_fd(call->r);
+    if (fd != INVALID_SOCKET)
+        shutdown(fd, SHUT_RDWR);
+}
+#endif
+
+
+/*
+ * Run one of the above functions without holding the GVL, so that other Ruby
+ * threads can run while this one waits on the network.  While a connection
+ * is being opened, the socket isn't yet stable enough to shut down from
+ * another thread, so fall back on Ruby's generic unblocking function, which
+ * interrupts the system call with a signal.  Without
+ * rb_thread_call_without_gvl (Ruby 1.9 and earlier), just call the function.
+ */
+static void
+rb_remctl_blocking(void *(*func)(void *), struct rb_remctl_call *call)
+{
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    if (func == rb_remctl_open_nogvl)
+        rb_thread_call_without_gvl(func, call, RUBY_UBF_IO, NULL);
+    else
+        rb_thread_call_without_gvl(func, call, rb_remctl_interrupt, call);
+#else
+    func(call);
+#endif
+}
+
+
+/*
+ * Convert an array of Ruby strings to a struct iovec array for
+ * remctl_commandv, storing it in call.  Each string is replaced in vargs with
+ * a frozen copy, which shares storage with the original but ensures the data
+ * can't change or move while the GVL is released.  The iovec array is
+ * allocated with ALLOCV_N using vbuf, which the caller should release with
+ * ALLOCV_END.
+ */
+static void
+rb_remctl_convert_command(VALUE vargs, struct rb_remctl_call *call,
+                          VALUE *vbuf)
 {
-    VALUE result;
+    VALUE s;
+    long i;
+
+    call->count = RARRAY_LEN(vargs);
+    call->command = ALLOCV_N(struct iovec, *vbuf, call->count);
+    for (i = 0; i < RARRAY_LEN(vargs); i++) {
+        s = rb_ary_entry(vargs, i);
+        s = rb_str_new_frozen(StringValue(s));
+        rb_ary_store(vargs, i, s);
+        call->command[i].iov_base = RSTRING_PTR(s);
+        call->command[i].iov_len = RSTRING_LEN(s);
+    }
+}
+
 
-    if (rr->error)
-        rb_raise(eRemctlError, "%s", rr->error);
+/*
+ * The body of the simple Remctl.remctl call, run inside rb_ensure so that the
+ * connection is always closed.  Output is appended directly to the Ruby
+ * strings in the Remctl::Result object as it arrives.  Raises Remctl::Error on
+ * any failure or if the server returns an error.
+ */
+static VALUE
+rb_remctl_remctl_body(VALUE data)
+{
+    struct rb_remctl_call *call = (struct rb_remctl_call *) data;
+    struct remctl_output *output;
+    VALUE result, vstdout, vstderr;
+    int status = 0;
+
+    rb_remctl_blocking(rb_remctl_open_nogvl, call);
+    if (!call->status)
+        rb_raise(eRemctlError, "%s", remctl_error(call->r));
+    rb_remctl_blocking(rb_remctl_commandv_nogvl, call);
+    if (!call->status)
+        rb_raise(eRemctlError, "%s", remctl_error(call->r));
+    vstdout = rb_str_new(NULL, 0);
+    vstderr = rb_str_new(NULL, 0);
+    do {
+        rb_remctl_blocking(rb_remctl_output_nogvl, call);
+        output = call->output;
+        if (output == NULL)
+            rb_raise(eRemctlError, "%s", remctl_error(call->r));
+        if (output->type == REMCTL_OUT_OUTPUT) {
+            if (output->stream == 1)
+                rb_str_cat(vstdout, output->data, output->length);
+            else if (output->stream == 2)
+                rb_str_cat(vstderr, output->data, output->length);
+            else
+                rb_raise(eRemctlError, "bad output stream %d",
+                         output->stream);
+        } else if (output->type == REMCTL_OUT_ERROR) {
+            rb_raise(eRemctlError, "%.*s", (int) output->length,
+                     output->data);
+        } else if (output->type == REMCTL_OUT_STATUS) {
+            status = output->status;
+        }
+    } while (output->type == REMCTL_OUT_OUTPUT);
     result = rb_class_new_instance(0, NULL, cRemctlResult);
-    rb_iv_set(result, "@stderr", rb_str_new(rr->stderr_buf, rr->stderr_len));
-    rb_iv_set(result, "@stdout", rb_str_new(rr->stdout_buf, rr->stdout_len));
-    rb_iv_set(result, "@status", INT2FIX(rr->status));
-    remctl_result_free(rr);
+    rb_iv_set(result, "@stderr", vstderr);
+    rb_iv_set(result, "@stdout", vstdout);
+    rb_iv_set(result, "@status", INT2FIX(status));
     return result;
 }
 
 
+/*
+ * Close the connection used by the simple Remctl.remctl call.  If the command
+ * completed normally, return the connection to the pool (which closes it if
+ * the pool is not enabled).
+ */
+static VALUE
+rb_remctl_remctl_done(VALUE data)
+{
+    struct rb_remctl_call *call = (struct rb_remctl_call *) data;
+
+    if (call->output != NULL && call->output->type == REMCTL_OUT_STATUS)
+        remctl_pool_close(call->r);
+    else
+        remctl_close(call->r);
+    return Qnil;
+}
+
+
 /* call-seq:
  * Remctl::Result.new() -> #&lt;Remctl::Result&gt;
  *
@@ -144,38 +327,40 @@ rb_remctl_result_initialize(VALUE self UNUSED)
 static VALUE
 rb_remctl_remctl(int argc, VALUE argv[], VALUE self UNUSED)
 {
-    VALUE vhost, vport, vprinc, vargs, tmp;
-    unsigned int port;
-    char *host, *princ;
-    const char **args;
-    struct remctl_result *result;
-    int i, rc_argc;
+    VALUE vhost, vport, vprinc, vargs, vbuf, result;
+    struct rb_remctl_call call;
 
     /*
      * Take the port and princ from the class instead of demanding that the
      * user specify "nil, nil" so often.
      */
+    memset(&call, 0, sizeof(call));
     rb_scan_args(argc, argv, "1*", &vhost, &vargs);
-    host = StringValuePtr(vhost);
+    vhost = rb_str_new_frozen(StringValue(vhost));
+    call.host = StringValueCStr(vhost);
     vport = rb_cvar_get(cRemctl, AAdefault_port);
     vprinc = rb_cvar_get(cRemctl, AAdefault_principal);
-    port = NIL_P(vport) ? 0 : FIX2UINT(vport);
-    princ = NIL_P(vprinc) ? NULL : StringValuePtr(vprinc);
+    call.port = NIL_P(vport) ? 0 : FIX2UINT(vport);
+    if (!NIL_P(vprinc)) {
+        vprinc = rb_str_new_frozen(StringValue(vprinc));
+        call.principal = StringValueCStr(vprinc);
+    }
+    call.pool = true;
 
     /* Convert the remaining arguments to their underlying pointers. */
-    rc_argc = RARRAY_LEN(vargs);
-    args = ALLOC_N(const char *, rc_argc + 1);
-    for (i = 0; i < rc_argc; i++) {
-        tmp = rb_ary_entry(vargs, i);
-        args[i] = StringValuePtr(tmp);
-    }
-    args[rc_argc] = NULL;
+    rb_remctl_convert_command(vargs, &call, &vbuf);
 
     /* Make the actual call. */
-    result = remctl(host, port, princ, args);
-    if (result == NULL)
+    call.r = remctl_new();
+    if (call.r == NULL)
         rb_raise(rb_eNoMemError, "remctl");
-    return rb_remctl_result_new(result);
+    result = rb_ensure(rb_remctl_remctl_body, (VALUE) &call,
+                       rb_remctl_remctl_done, (VALUE) &call);
+    ALLOCV_END(vbuf);
+    RB_GC_GUARD(vhost);
+    RB_GC_GUARD(vprinc);
+    RB_GC_GUARD(vargs);
+    return result;
 }
 
 
@@ -335,15 +520,30 @@ rb_remctl_timeout_set(VALUE self UNUSED, VALUE new)
 }
 
 
+/*
+ * Mark function for a Remctl object, which keeps its mutex alive.
+ */
+static void
+rb_remctl_mark(void *data)
+{
+    struct rb_remctl *object = data;
+
+    rb_gc_mark(object->mutex);
+}
+
+
 /*
  * Destructor for a Remctl object.  Closes the connection and frees the
  * underlying memory.
  */
 static void
-rb_remctl_destroy(void *r)
+rb_remctl_destroy(void *data)
 {
-    if (r != NULL)
-        remctl_close(r);
+    struct rb_remctl *object = data;
+
+    if (object->r != NULL)
+        remctl_close(object->r);
+    xfree(object);
 }
 
 
@@ -354,9 +554,51 @@ rb_remctl_destroy(void *r)
 static VALUE
 rb_remctl_alloc(VALUE klass)
 {
-    struct remctl *r = NULL;
+    struct rb_remctl *object;
+    VALUE self;
+
+    object = ALLOC(struct rb_remctl);
+    object->r = NULL;
+    object->mutex = Qnil;
+    self = Data_Wrap_Struct(klass, rb_remctl_mark, rb_remctl_destroy, object);
+    object->mutex = rb_mutex_new();
+    return self;
+}
+
+
+/*
+ * Lock a Remctl object for use by the current thread, waiting for any other
+ * thread using it to finish, and return the wrapped data.  If open is true,
+ * raises Remctl::NotOpen if the connection is closed.  The caller must call
+ * rb_remctl_unlock when done, normally via rb_ensure.
+ */
+static struct rb_remctl *
+rb_remctl_lock(VALUE self, bool open)
+{
+    struct rb_remctl *object;
+
+    Data_Get_Struct(self, struct rb_remctl, object);
+    rb_mutex_lock(object->mutex);
+    if (open && object->r == NULL) {
+        rb_mutex_unlock(object->mutex);
+        rb_raise(eRemctlNotOpen, "Connection is no longer open.");
+    }
+    return object;
+}
+
+
+/*
+ * Unlock a Remctl object locked with rb_remctl_lock.  Takes and returns a
+ * VALUE so that it can be passed to rb_ensure.
+ */
+static VALUE
+rb_remctl_unlock(VALUE self)
+{
+    struct rb_remctl *object;
 
-    return Data_Wrap_Struct(klass, NULL, rb_remctl_destroy, r);
+    Data_Get_Struct(self, struct rb_remctl, object);
+    rb_mutex_unlock(object->mutex);
+    return Qnil;
 }
 
 
@@ -369,67 +611,110 @@ rb_remctl_alloc(VALUE klass)
 static VALUE
 rb_remctl_close(VALUE self)
 {
-    struct remctl *r;
+    struct rb_remctl *object;
 
-    GET_REMCTL_OR_RAISE(self, r);
-    remctl_close(r);
-    DATA_PTR(self) = NULL;
+    object = rb_remctl_lock(self, true);
+    remctl_close(object->r);
+    object->r = NULL;
+    rb_remctl_unlock(self);
     return Qnil;
 }
 
 
-/* call-seq:
- * r.reopen  -> nil
- *
- * Reopen a Remctl connection to the stored host, port, and principal.  Raises
- * Remctl::Error if the connection fails.
+/*
+ * The body of reopen, run with the object locked.  The new connection is
+ * stored in the object only if opening it succeeds.
  */
 static VALUE
-rb_remctl_reopen(VALUE self)
+rb_remctl_reopen_body(VALUE self)
 {
-    struct remctl *r;
+    struct rb_remctl *object;
+    struct rb_remctl_call call;
     VALUE vhost, vport, vprinc, vdefccache, vdefsource, vdeftimeout;
-    char *host, *princ;
-    unsigned int port;
+    VALUE message;
+
+    Data_Get_Struct(self, struct rb_remctl, object);
+    if (object->r != NULL) {
+        remctl_close(object->r);
+        object->r = NULL;
+    }
+
+    /* Retrieve the stored host, port, and principal values. */
+    memset(&call, 0, sizeof(call));
+    vhost = rb_ivar_get(self, Ahost);
+    vport = rb_ivar_get(self, Aport);
+    vprinc = rb_ivar_get(self, Aprincipal);
+    vhost = rb_str_new_frozen(StringValue(vhost));
+    call.host = StringValueCStr(vhost);
+    call.port = NIL_P(vport) ? 0 : FIX2UINT(vport);
+    if (!NIL_P(vprinc)) {
+        vprinc = rb_str_new_frozen(StringValue(vprinc));
+        call.principal = StringValueCStr(vprinc);
+    }
+    vdefccache = rb_cvar_get(cRemctl, AAccache);
+    vdefsource = rb_cvar_get(cRemctl, AAsource_ip);
+    vdeftimeout = rb_cvar_get(cRemctl, AAtimeout);
 
-    Data_Get_Struct(self, struct remctl, r);
-    if (r != NULL)
-        remctl_close(r);
-    r = remctl_new();
-    if (r == NULL)
+    call.r = remctl_new();
+    if (call.r == NULL)
         rb_raise(rb_eNoMemError, "remctl");
 
     /* Set the credential cache if needed. */
-    vdefccache = rb_cvar_get(cRemctl, AAccache);
     if (!NIL_P(vdefccache))
-        if (!remctl_set_ccache(r, StringValuePtr(vdefccache)))
-            rb_raise(eRemctlError, "%s", remctl_error(r));
+        if (!remctl_set_ccache(call.r, StringValueCStr(vdefccache)))
+            goto fail;
 
     /* Set the source IP if needed. */
-    vdefsource = rb_cvar_get(cRemctl, AAsource_ip);
     if (!NIL_P(vdefsource))
-        if (!remctl_set_source_ip(r, StringValuePtr(vdefsource)))
-            rb_raise(eRemctlError, "%s", remctl_error(r));
+        if (!remctl_set_source_ip(call.r, StringValueCStr(vdefsource)))
+            goto fail;
 
     /* Set the timeout if needed. */
-    vdeftimeout = rb_cvar_get(cRemctl, AAtimeout);
     if (!NIL_P(vdeftimeout))
-        if (!remctl_set_timeout(r, FIX2UINT(vdeftimeout)))
-            rb_raise(eRemctlError, "%s", remctl_error(r));
-
-    /* Retrieve the stored host, port, and principal values. */
-    vhost = rb_ivar_get(self, Ahost);
-    vport = rb_ivar_get(self, Aport);
-    vprinc = rb_ivar_get(self, Aprincipal);
-    host = StringValuePtr(vhost);
-    port = NIL_P(vport) ? 0 : FIX2UINT(vport);
-    princ = NIL_P(vprinc) ? NULL : StringValuePtr(vprinc);
+        if (!remctl_set_timeout(call.r, FIX2UINT(vdeftimeout)))
+            goto fail;
 
     /* Reopen the connection. */
-    if (!remctl_open(r, host, port, princ))
-        rb_raise(eRemctlError, "%s", remctl_error(r));
-    DATA_PTR(self) = r;
+    rb_remctl_blocking(rb_remctl_open_nogvl, &call);
+    if (!call.status)
+        goto fail;
+    object->r = call.r;
+    RB_GC_GUARD(vhost);
+    RB_GC_GUARD(vprinc);
     return self;
+
+fail:
+    message = rb_str_new2(remctl_error(call.r));
+    remctl_close(call.r);
+    rb_exc_raise(rb_exc_new3(eRemctlError, message));
+}
+
+
+/* call-seq:
+ * r.reopen  -> nil
+ *
+ * Reopen a Remctl connection to the stored host, port, and principal.  Raises
+ * Remctl::Error if the connection fails.
+ */
+static VALUE
+rb_remctl_reopen(VALUE self)
+{
+    rb_remctl_lock(self, false);
+    return rb_ensure(rb_remctl_reopen_body, self, rb_remctl_unlock, self);
+}
+
+
+/*
+ * The body of set_timeout, run with the object locked.
+ */
+static VALUE
+rb_remctl_set_timeout_body(VALUE data)
+{
+    struct rb_remctl_call *call = (struct rb_remctl_call *) data;
+
+    if (!remctl_set_timeout(call->r, call->timeout))
+        rb_raise(eRemctlError, "%s", remctl_error(call->r));
+    return Qnil;
 }
 
 
@@ -443,14 +728,28 @@ rb_remctl_reopen(VALUE self)
 static VALUE
 rb_remctl_set_timeout(VALUE self, VALUE vtimeout)
 {
-    struct remctl *r;
-    long timeout;
+    struct rb_remctl_call call;
 
-    GET_REMCTL_OR_RAISE(self, r);
     Check_Type(vtimeout, T_FIXNUM);
-    timeout = NIL_P(vtimeout) ? 0 : FIX2LONG(vtimeout);
-    if (!remctl_set_timeout(r, timeout))
-        rb_raise(eRemctlError, "%s", remctl_error(r));
+    memset(&call, 0, sizeof(call));
+    call.timeout = NIL_P(vtimeout) ? 0 : FIX2LONG(vtimeout);
+    call.r = rb_remctl_lock(self, true)->r;
+    return rb_ensure(rb_remctl_set_timeout_body, (VALUE) &call,
+                     rb_remctl_unlock, self);
+}
+
+
+/*
+ * The body of command, run with the object locked.
+ */
+static VALUE
+rb_remctl_command_body(VALUE data)
+{
+    struct rb_remctl_call *call = (struct rb_remctl_call *) data;
+
+    rb_remctl_blocking(rb_remctl_commandv_nogvl, call);
+    if (!call->status)
+        rb_raise(eRemctlError, "%s", remctl_error(call->r));
     return Qnil;
 }
 
@@ -466,21 +765,18 @@ rb_remctl_set_timeout(VALUE self, VALUE vtimeout)
 static VALUE
 rb_remctl_command(int argc, VALUE argv[], VALUE self)
 {
-    struct remctl *r;
-    struct iovec *iov;
-    int i;
-    VALUE s;
-
-    GET_REMCTL_OR_RAISE(self, r);
-    iov = ALLOC_N(struct iovec, argc);
-    for (i = 0; i < argc; i++) {
-        s = StringValue(argv[i]);
-        iov[i].iov_base = RSTRING_PTR(s);
-        iov[i].iov_len = RSTRING_LEN(s);
-    }
-    if (!remctl_commandv(r, iov, argc))
-        rb_raise(eRemctlError, "%s", remctl_error(r));
-    return Qnil;
+    struct rb_remctl_call call;
+    VALUE vargs, vbuf, result;
+
+    memset(&call, 0, sizeof(call));
+    vargs = rb_ary_new4(argc, argv);
+    rb_remctl_convert_command(vargs, &call, &vbuf);
+    call.r = rb_remctl_lock(self, true)->r;
+    result = rb_ensure(rb_remctl_command_body, (VALUE) &call,
+                       rb_remctl_unlock, self);
+    ALLOCV_END(vbuf);
+    RB_GC_GUARD(vargs);
+    return result;
 }
 
 
@@ -499,23 +795,21 @@ rb_remctl_type_intern(enum remctl_output_type type)
 }
 
 
-/* call-seq:
- * rc.command -> [type, output, stream, status, error]
- *
- * Retrieve the output tokens from the remote command.  Raises Remctl::Error
- * in the event of failure, and Remctl::NotOpen if the connection has been
- * closed.
+/*
+ * The body of output, run with the object locked.  The output is converted
+ * to Ruby objects before the object is unlocked, since the next call on the
+ * connection overwrites it.
  */
 static VALUE
-rb_remctl_output(VALUE self)
+rb_remctl_output_body(VALUE data)
 {
-    struct remctl *r;
+    struct rb_remctl_call *call = (struct rb_remctl_call *) data;
     struct remctl_output *output;
 
-    GET_REMCTL_OR_RAISE(self, r);
-    output = remctl_output(r);
+    rb_remctl_blocking(rb_remctl_output_nogvl, call);
+    output = call->output;
     if (output == NULL)
-        rb_raise(eRemctlError, "%s", remctl_error(r));
+        rb_raise(eRemctlError, "%s", remctl_error(call->r));
     else
         return rb_ary_new3(5, rb_remctl_type_intern(output->type),
                            rb_str_new(output->data, output->length),
@@ -524,6 +818,40 @@ rb_remctl_output(VALUE self)
 }
 
 
+/* call-seq:
+ * rc.command -> [type, output, stream, status, error]
+ *
+ * Retrieve the output tokens from the remote command.  Raises Remctl::Error
+ * in the event of failure, and Remctl::NotOpen if the connection has been
+ * closed.
+ */
+static VALUE
+rb_remctl_output(VALUE self)
+{
+    struct rb_remctl_call call;
+
+    memset(&call, 0, sizeof(call));
+    call.r = rb_remctl_lock(self, true)->r;
+    return rb_ensure(rb_remctl_output_body, (VALUE) &call, rb_remctl_unlock,
+                     self);
+}
+
+
+/*
+ * The body of noop, run with the object locked.
+ */
+static VALUE
+rb_remctl_noop_body(VALUE data)
+{
+    struct rb_remctl_call *call = (struct rb_remctl_call *) data;
+
+    rb_remctl_blocking(rb_remctl_noop_nogvl, call);
+    if (!call->status)
+        rb_raise(eRemctlError, "%s", remctl_error(call->r));
+    return Qnil;
+}
+
+
 /* call-seq:
  * r.noop()  -> nil
  *
@@ -535,12 +863,12 @@ rb_remctl_output(VALUE self)
 static VALUE
 rb_remctl_noop(VALUE self)
 {
-    struct remctl *r;
+    struct rb_remctl_call call;
 
-    GET_REMCTL_OR_RAISE(self, r);
-    if (!remctl_noop(r))
-        rb_raise(eRemctlError, "%s", remctl_error(r));
-    return Qnil;
+    memset(&call, 0, sizeof(call));
+    call.r = rb_remctl_lock(self, true)->r;
+    return rb_ensure(rb_remctl_noop_body, (VALUE) &call, rb_remctl_unlock,
+                     self);
 }
 
 
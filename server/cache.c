@@ -0,0 +1,789 @@
+/*
+ * Result cache for the remctld server.
+ *
+ * Configuration rules can ask for the output and exit status of their
+ * command to be cached for some number of seconds, so that repeated requests
+ * with the same arguments are answered without running the command again.
+ * Results are keyed by the protocol version, the configuration rule, all of
+ * the command arguments, and (unless the rule shares results between users)
+ * the authenticated principal.
+ *
+ * The cache lives in an anonymous shared memory segment created before any
+ * children are forked, so results are shared across connections.  It holds a
+ * fixed-size hash table of entries and a data area divided into fixed-size
+ * blocks, which are chained together to hold the key and output of each
+ * entry.  When there are no free blocks or no free table entries, the least
+ * recently used entries are evicted.  The cache is protected by a lock,
+ * which is held while copying a result in or out.  If a process dies while
+ * holding it, the cache may be inconsistent, so the next process to take the
+ * lock discards all of its contents.
+ *
+ * Rules can also ask for identical requests to be coalesced while the command
+ * is running.  The first request adds a pending entry holding only the key
+ * and its PID and runs the command.  Identical requests that arrive while it
+ * is running wait for the entry to be completed and then return the result,
+ * which is kept for a short time for them even if the rule doesn't otherwise
+ * cache results.  If the command fails, its result is too large to cache, or
+ * the process running it dies, the pending entry is replaced by a marker that
+ * the command can't be coalesced.  The waiting requests and any identical
+ * requests for a while afterwards then all run the command themselves, at the
+ * same time rather than one after another.
+ *
+ * While a command runs, its output is recorded in an evbuffer as a sequence
+ * of records, each a one-octet stream number, a four-octet length in network
+ * byte order, and that much data.  This is also the format in which results
+ * are stored and returned.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/event.h>
+#include <portable/system.h>
+#include <portable/uio.h>
+
+#include <server/internal.h>
+#include <util/messages.h>
+#include <util/xmalloc.h>
+
+/* Size of the hash table and the number of entries probed for a key. */
+#define CACHE_ENTRIES 4096
+#define CACHE_PROBES  16
+
+/* Size of a data block. */
+#define CACHE_BLOCK 1024
+
+/* No single result may use more than this fraction of the cache. */
+#define CACHE_MAX_FRACTION 8
+
+/* Seconds to keep a coalesced result for the requests waiting for it. */
+#define CACHE_LINGER 2
+
+/* Seconds to stop coalescing a command after its result couldn't be shared. */
+#define CACHE_UNCOALESCED 30
+
+/* Length of the header of an output record. */
+#define RECORD_HEADER (1 + 4)
+
+/* A cached result. */
+struct cache_entry {
+    uint64_t hash;    /* FNV-1a hash of the key. */
+    uint32_t first;   /* First block plus one, 0 if the entry is unused. */
+    uint32_t keylen;  /* Length of the key, which is stored first. */
+    uint32_t length;  /* Length of the key and the output records. */
+    int32_t status;   /* Exit status of the command. */
+    int32_t pid;      /* Process running the command, 0 if complete. */
+    uint32_t waiters; /* Whether any request waited for the result. */
+    uint32_t nowait;  /* Whether requests should run the command themselves. */
+    double expires;   /* server_clock time after which the entry is stale. */
+    double used;      /* server_clock time of the last use. */
+};
+
+/*
+ * The header of the shared memory segment.  It is followed by the array of
+ * next pointers for each block, terminated by 0 and otherwise the index of
+ * the next block plus one, and then by the blocks themselves.
+ */
+struct cache {
+    uint32_t nblocks;    /* Total number of blocks. */
+    uint32_t free;       /* First free block plus one, 0 if none. */
+    uint32_t nfree;      /* Number of free blocks. */
+    struct cache_entry entries[CACHE_ENTRIES];
+};
+
+/* The shared memory segment and its size, or NULL if caching is disabled. */
+static struct cache *cache = NULL;
+static size_t cache_size = 0;
+
+/* The lock protecting the shared memory segment. */
+static struct shared_lock *lock = NULL;
+
+
+/*
+ * Return the array of next pointers and the start of a given block.
+ */
+static uint32_t *
+block_next(void)
+{
+    return (uint32_t *) (cache + 1);
+}
+
+static char *
+block_data(uint32_t block)
+{
+    char *start;
+
+    start = (char *) (block_next() + cache->nblocks);
+    return start + (size_t) block * CACHE_BLOCK;
+}
+
+
+/*
+ * Empty the cache, putting all of the blocks on the free list.  The cache
+ * must be locked or not yet shared with any other process.
+ */
+static void
+cache_reset(void)
+{
+    uint32_t *next = block_next();
+    uint32_t i;
+
+    memset(cache->entries, 0, sizeof(cache->entries));
+    for (i = 0; i < cache->nblocks - 1; i++)
+        next[i] = i + 2;
+    next[cache->nblocks - 1] = 0;
+    cache->free = 1;
+    cache->nfree = cache->nblocks;
+}
+
+
+/*
+ * Lock and unlock the cache.  If a process died while holding the lock, it
+ * may have been in the middle of changing the free list or an entry, so
+ * start over with an empty cache.
+ */
+static void
+cache_lock(void)
+{
+    if (server_shared_lock(lock))
+        cache_reset();
+}
+
+static void
+cache_unlock(void)
+{
+    server_shared_unlock(lock);
+}
+
+
+/*
+ * Create the shared memory segment with room for about size bytes of cached
+ * results.  This must be called before forking any children.  A size of zero
+ * disables caching.  Dies on failure.
+ */
+void
+server_cache_init(size_t size)
+{
+    size_t nblocks;
+
+    nblocks = size / CACHE_BLOCK;
+    if (nblocks == 0)
+        return;
+    if (nblocks > UINT32_MAX - 1)
+        nblocks = UINT32_MAX - 1;
+    cache_size = sizeof(struct cache) + nblocks * sizeof(uint32_t)
+                 + nblocks * CACHE_BLOCK;
+    cache = server_shared_new(cache_size, "result cache");
+    cache->nblocks = (uint32_t) nblocks;
+    cache_reset();
+    lock = server_shared_lock_new();
+}
+
+
+/*
+ * Release the shared memory segment.  After this, nothing is cached.
+ */
+void
+server_cache_free(void)
+{
+    if (cache == NULL)
+        return;
+    server_shared_free(cache, cache_size);
+    server_shared_lock_free(lock);
+    cache = NULL;
+    cache_size = 0;
+    lock = NULL;
+}
+
+
+/*
+ * Remove an entry from the cache, returning its blocks to the free list.  The
+ * cache must be locked.
+ */
+static void
+evict(struct cache_entry *entry)
+{
+    uint32_t *next = block_next();
+    uint32_t block, last;
+
+    if (entry->first == 0)
+        return;
+    for (last = entry->first; next[last - 1] != 0; last = next[last - 1])
+        cache->nfree++;
+    cache->nfree++;
+    block = entry->first;
+    next[last - 1] = cache->free;
+    cache->free = block;
+    entry->first = 0;
+    entry->pid = 0;
+    entry->waiters = 0;
+    entry->nowait = 0;
+}
+
+
+/*
+ * Give up on a pending entry whose command didn't produce a result that can
+ * be shared.  Rather than removing the entry, which would make each of the
+ * waiting requests in turn run the command while the others keep waiting,
+ * keep only its key and mark it so that identical requests run the command
+ * themselves until it expires.  The cache must be locked.
+ */
+static void
+give_up(struct cache_entry *entry, double now)
+{
+    entry->pid = 0;
+    entry->waiters = 0;
+    entry->nowait = 1;
+    entry->expires = now + CACHE_UNCOALESCED;
+    entry->used = now;
+}
+
+
+/*
+ * Discard all cached results, such as after the configuration is reloaded
+ * and the rules that they came from may have changed.
+ */
+void
+server_cache_flush(void)
+{
+    size_t i;
+
+    if (cache == NULL)
+        return;
+    cache_lock();
+    for (i = 0; i < CACHE_ENTRIES; i++)
+        evict(&cache->entries[i]);
+    cache_unlock();
+}
+
+
+/*
+ * Return true if results of the given rule should be cached or identical
+ * requests for it coalesced.
+ */
+bool
+server_cache_enabled(const struct rule *rule)
+{
+    return cache != NULL && (rule->cache > 0 || rule->coalesce);
+}
+
+
+/*
+ * Add data to the key for a command, preceded by its length so that different
+ * commands can never produce the same key.
+ */
+static void
+add_key(struct evbuffer *key, const void *data, size_t length)
+{
+    uint32_t tmp;
+
+    tmp = htonl((uint32_t) length);
+    if (evbuffer_add(key, &tmp, sizeof(tmp)) < 0)
+        die("internal error: cannot build cache key");
+    if (evbuffer_add(key, data, length) < 0)
+        die("internal error: cannot build cache key");
+}
+
+
+/*
+ * Build the key for a command in an evbuffer.  The key includes the protocol
+ * version, since protocol version one combines standard output and standard
+ * error and limits the size of the output.
+ */
+static struct evbuffer *
+build_key(const struct client *client, const struct rule *rule,
+          struct iovec **argv)
+{
+    struct evbuffer *key;
+    const char *user;
+    char *location;
+    size_t i;
+
+    key = evbuffer_new();
+    if (key == NULL)
+        die("internal error: cannot create cache key buffer");
+    xasprintf(&location, "%d %s:%lu", (client->protocol == 1) ? 1 : 2,
+              rule->file, (unsigned long) rule->lineno);
+    add_key(key, location, strlen(location));
+    free(location);
+    user = rule->cache_global ? "" : client->user;
+    add_key(key, user, strlen(user));
+    for (i = 0; argv[i] != NULL; i++)
+        add_key(key, argv[i]->iov_base, argv[i]->iov_len);
+    return key;
+}
+
+
+/*
+ * Return the FNV-1a hash of some data.
+ */
+static uint64_t
+hash_data(const unsigned char *data, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = 0; i < length; i++)
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    return hash;
+}
+
+
+/*
+ * Copy the output records of an entry, which follow the key, into an
+ * evbuffer.  The cache must be locked.  Returns false if the output couldn't
+ * be copied.
+ */
+static bool
+copy_out(const struct cache_entry *entry, struct evbuffer *output)
+{
+    uint32_t *next = block_next();
+    uint32_t block = entry->first;
+    size_t offset = 0;
+    size_t skip = entry->keylen;
+    size_t chunk;
+
+    while (block != 0 && offset < entry->length) {
+        chunk = entry->length - offset;
+        if (chunk > CACHE_BLOCK)
+            chunk = CACHE_BLOCK;
+        if (skip < chunk) {
+            if (evbuffer_add(output, block_data(block - 1) + skip,
+                             chunk - skip)
+                < 0)
+                return false;
+            skip = 0;
+        } else
+            skip -= chunk;
+        offset += chunk;
+        block = next[block - 1];
+    }
+    return true;
+}
+
+
+/*
+ * Return whether the key stored in an entry matches the given key.  The cache
+ * must be locked.
+ */
+static bool
+key_matches(const struct cache_entry *entry, const unsigned char *key,
+            size_t keylen)
+{
+    uint32_t *next = block_next();
+    uint32_t block = entry->first;
+    size_t offset = 0;
+    size_t chunk;
+
+    if (entry->keylen != keylen)
+        return false;
+    while (block != 0 && offset < keylen) {
+        chunk = keylen - offset;
+        if (chunk > CACHE_BLOCK)
+            chunk = CACHE_BLOCK;
+        if (memcmp(block_data(block - 1), key + offset, chunk) != 0)
+            return false;
+        offset += chunk;
+        block = next[block - 1];
+    }
+    return offset == keylen;
+}
+
+
+/*
+ * Find the entry for a key, whether or not it is complete or still valid.
+ * The cache must be locked.  Returns the entry or NULL if the key is not
+ * present.
+ */
+static struct cache_entry *
+find_entry(uint64_t hash, const unsigned char *key, size_t keylen)
+{
+    struct cache_entry *entry;
+    size_t i;
+
+    for (i = 0; i < CACHE_PROBES; i++) {
+        entry = &cache->entries[(hash + i) % CACHE_ENTRIES];
+        if (entry->first == 0 || entry->hash != hash)
+            continue;
+        if (key_matches(entry, key, keylen))
+            return entry;
+    }
+    return NULL;
+}
+
+
+/*
+ * Return whether an entry holds a result that may be returned.
+ */
+static bool
+is_valid(const struct cache_entry *entry, double now)
+{
+    return entry->pid == 0 && !entry->nowait && entry->expires > now;
+}
+
+
+/*
+ * Return whether an entry must not be evicted to make room for another, since
+ * its command is still running.
+ */
+static bool
+is_pinned(const struct cache_entry *entry)
+{
+    return entry->pid != 0;
+}
+
+
+/*
+ * Choose the entry in which to store a new key: an empty or stale entry if
+ * possible and otherwise the least recently used one that isn't pinned.  The
+ * cache must be locked.  Returns NULL if all candidates are pinned.
+ */
+static struct cache_entry *
+choose_entry(uint64_t hash, double now)
+{
+    struct cache_entry *entry, *slot = NULL;
+    size_t i;
+
+    for (i = 0; i < CACHE_PROBES; i++) {
+        entry = &cache->entries[(hash + i) % CACHE_ENTRIES];
+        if (is_pinned(entry))
+            continue;
+        if (entry->first == 0 || entry->expires <= now)
+            return entry;
+        if (slot == NULL || entry->used < slot->used)
+            slot = entry;
+    }
+    return slot;
+}
+
+
+/*
+ * Make sure that there are at least the given number of free blocks, evicting
+ * the least recently used entries other than keep as needed.  The cache must
+ * be locked.  Returns false if there isn't enough room even after evicting
+ * every entry that isn't pinned.
+ */
+static bool
+make_room(uint32_t nblocks, const struct cache_entry *keep)
+{
+    struct cache_entry *entry, *oldest;
+    size_t i;
+
+    while (cache->nfree < nblocks) {
+        oldest = NULL;
+        for (i = 0; i < CACHE_ENTRIES; i++) {
+            entry = &cache->entries[i];
+            if (entry->first == 0 || entry == keep || is_pinned(entry))
+                continue;
+            if (oldest == NULL || entry->used < oldest->used)
+                oldest = entry;
+        }
+        if (oldest == NULL)
+            return false;
+        evict(oldest);
+    }
+    return true;
+}
+
+
+/*
+ * Take blocks off the free list for an empty entry and copy data into them.
+ * The cache must be locked and there must be enough free blocks.
+ */
+static void
+fill_entry(struct cache_entry *entry, const unsigned char *data,
+           size_t length)
+{
+    uint32_t *next = block_next();
+    uint32_t block, nblocks, i;
+    size_t offset, chunk;
+
+    nblocks = (uint32_t) ((length + CACHE_BLOCK - 1) / CACHE_BLOCK);
+    entry->first = cache->free;
+    block = cache->free;
+    for (offset = 0, i = 0; i < nblocks; i++) {
+        chunk = length - offset;
+        if (chunk > CACHE_BLOCK)
+            chunk = CACHE_BLOCK;
+        memcpy(block_data(block - 1), data + offset, chunk);
+        offset += chunk;
+        if (i == nblocks - 1) {
+            cache->free = next[block - 1];
+            next[block - 1] = 0;
+        } else
+            block = next[block - 1];
+    }
+    cache->nfree -= nblocks;
+    entry->length = (uint32_t) length;
+}
+
+
+/*
+ * Look up the result of a command.  If it's cached, copy its output records
+ * into output, store its exit status in status, and return true.  Otherwise,
+ * return false.
+ *
+ * If the rule coalesces identical requests and the same command is already
+ * running for another request, wait for it to finish and return its result.
+ * If it isn't running, record that this request is running it, so that
+ * server_cache_store or server_cache_abandon must be called afterwards.
+ */
+bool
+server_cache_lookup(const struct client *client, const struct rule *rule,
+                    struct iovec **argv, struct evbuffer *output, int *status)
+{
+    struct evbuffer *key;
+    const unsigned char *data;
+    struct cache_entry *entry;
+    size_t keylen;
+    uint32_t nblocks;
+    uint64_t hash;
+    double now;
+    long poll = 0;
+    bool found = false;
+    bool copied = true;
+
+    if (!server_cache_enabled(rule))
+        return false;
+    key = build_key(client, rule, argv);
+    keylen = evbuffer_get_length(key);
+    data = evbuffer_pullup(key, -1);
+    hash = hash_data(data, keylen);
+    while (1) {
+        now = server_clock();
+        cache_lock();
+        entry = find_entry(hash, data, keylen);
+
+        /* Return the result if there is one. */
+        if (entry != NULL && is_valid(entry, now)) {
+            entry->used = now;
+            *status = entry->status;
+            copied = copy_out(entry, output);
+            found = true;
+            break;
+        }
+
+        /* If the command is running for another request, wait for it. */
+        if (entry != NULL && entry->pid != 0) {
+            entry->waiters = 1;
+            cache_unlock();
+            server_shared_wait(&poll);
+            continue;
+        }
+
+        /*
+         * Otherwise, we have to run the command.  If its result recently
+         * couldn't be shared, run it without making other requests wait.
+         */
+        if (entry != NULL && entry->nowait && entry->expires > now)
+            break;
+        if (entry != NULL)
+            evict(entry);
+        if (rule->coalesce) {
+            entry = choose_entry(hash, now);
+            nblocks = (uint32_t) ((keylen + CACHE_BLOCK - 1) / CACHE_BLOCK);
+            if (entry != NULL) {
+                evict(entry);
+                if (make_room(nblocks, entry)) {
+                    fill_entry(entry, data, keylen);
+                    entry->hash = hash;
+                    entry->keylen = (uint32_t) keylen;
+                    entry->pid = (int32_t) getpid();
+                    entry->used = now;
+                }
+            }
+        }
+        break;
+    }
+    cache_unlock();
+    evbuffer_free(key);
+    if (!copied)
+        die("internal error: cannot copy cached output");
+    return found;
+}
+
+
+/*
+ * Store the result of a command, given its output records and exit status.
+ * Results that are too large are silently not cached.  The output buffer is
+ * not modified.
+ */
+void
+server_cache_store(const struct client *client, const struct rule *rule,
+                   struct iovec **argv, struct evbuffer *output, int status)
+{
+    struct evbuffer *key;
+    struct cache_entry *entry;
+    const unsigned char *data;
+    size_t keylen, length;
+    uint32_t nblocks;
+    uint32_t waiters = 0;
+    uint64_t hash;
+    double now;
+
+    if (!server_cache_enabled(rule))
+        return;
+    key = build_key(client, rule, argv);
+    keylen = evbuffer_get_length(key);
+    length = keylen + evbuffer_get_length(output);
+    if (length > (size_t) cache->nblocks * CACHE_BLOCK / CACHE_MAX_FRACTION) {
+        evbuffer_free(key);
+        server_cache_abandon(client, rule, argv);
+        return;
+    }
+    if (evbuffer_add(key, evbuffer_pullup(output, -1),
+                     evbuffer_get_length(output))
+        < 0)
+        die("internal error: cannot copy output to cache");
+    data = evbuffer_pullup(key, -1);
+    hash = hash_data(data, keylen);
+    now = server_clock();
+
+    /*
+     * Replace any existing entry for the same key unless another request is
+     * still running the command.  If other requests were waiting for this
+     * one, keep the result long enough for them to collect it.
+     */
+    cache_lock();
+    entry = find_entry(hash, data, keylen);
+    if (entry != NULL && entry->pid != 0 && entry->pid != (int32_t) getpid())
+        goto done;
+    if (entry != NULL) {
+        waiters = entry->waiters;
+        evict(entry);
+    } else {
+        entry = choose_entry(hash, now);
+        if (entry == NULL)
+            goto done;
+        evict(entry);
+    }
+    nblocks = (uint32_t) ((length + CACHE_BLOCK - 1) / CACHE_BLOCK);
+    if (!make_room(nblocks, entry))
+        goto done;
+    fill_entry(entry, data, length);
+    entry->hash = hash;
+    entry->keylen = (uint32_t) keylen;
+    entry->status = status;
+    entry->expires = now + (double) rule->cache;
+    if (waiters > 0 && rule->cache < CACHE_LINGER)
+        entry->expires = now + CACHE_LINGER;
+    entry->used = now;
+
+done:
+    cache_unlock();
+    evbuffer_free(key);
+}
+
+
+/*
+ * Give up on running a command for a rule that coalesces identical requests,
+ * such as when the command failed.  If this request was running the command,
+ * the requests waiting for it, and identical requests for a while afterwards,
+ * run it themselves instead.  Does nothing if the result was already stored.
+ */
+void
+server_cache_abandon(const struct client *client, const struct rule *rule,
+                     struct iovec **argv)
+{
+    struct evbuffer *key;
+    struct cache_entry *entry;
+    const unsigned char *data;
+    size_t keylen;
+
+    if (!server_cache_enabled(rule) || !rule->coalesce)
+        return;
+    key = build_key(client, rule, argv);
+    keylen = evbuffer_get_length(key);
+    data = evbuffer_pullup(key, -1);
+    cache_lock();
+    entry = find_entry(hash_data(data, keylen), data, keylen);
+    if (entry != NULL && entry->pid == (int32_t) getpid())
+        give_up(entry, server_clock());
+    cache_unlock();
+    evbuffer_free(key);
+}
+
+
+/*
+ * Give up on any commands being run by a child that has exited, so that
+ * requests waiting for them run the command themselves.  Only the parent
+ * process may call this.
+ */
+void
+server_cache_reap(pid_t pid)
+{
+    double now;
+    size_t i;
+
+    if (cache == NULL)
+        return;
+    now = server_clock();
+    cache_lock();
+    for (i = 0; i < CACHE_ENTRIES; i++)
+        if (cache->entries[i].first != 0
+            && cache->entries[i].pid == (int32_t) pid)
+            give_up(&cache->entries[i], now);
+    cache_unlock();
+}
+
+
+/*
+ * Record output from a running command so that it can be cached, given the
+ * stream number and a buffer holding the output, which is not modified.  If
+ * the output grows too large to cache, stop recording it.
+ */
+void
+server_cache_record(struct process *process, int stream, struct evbuffer *data)
+{
+    size_t length;
+    uint32_t tmp;
+    unsigned char header[RECORD_HEADER];
+
+    if (process->cache == NULL || cache == NULL)
+        return;
+    length = evbuffer_get_length(data);
+    if (evbuffer_get_length(process->cache) + RECORD_HEADER + length
+        > (size_t) cache->nblocks * CACHE_BLOCK / CACHE_MAX_FRACTION) {
+        evbuffer_free(process->cache);
+        process->cache = NULL;
+        return;
+    }
+    header[0] = (unsigned char) stream;
+    tmp = htonl((uint32_t) length);
+    memcpy(header + 1, &tmp, sizeof(tmp));
+    if (evbuffer_add(process->cache, header, sizeof(header)) < 0)
+        die("internal error: cannot record output for cache");
+    if (evbuffer_add(process->cache, evbuffer_pullup(data, -1), length) < 0)
+        die("internal error: cannot record output for cache");
+}
+
+
+/*
+ * Remove the next output record from a buffer of records, storing its stream
+ * number in stream and adding its data to data.  Returns false if there are
+ * no more records.
+ */
+bool
+server_cache_next(struct evbuffer *records, int *stream, struct evbuffer *data)
+{
+    unsigned char header[RECORD_HEADER];
+    uint32_t length;
+
+    if (evbuffer_get_length(records) < RECORD_HEADER)
+        return false;
+    if (evbuffer_remove(records, header, sizeof(header)) < 0)
+        die("internal error: cannot read cached output");
+    *stream = header[0];
+    memcpy(&length, header + 1, sizeof(length));
+    length = ntohl(length);
+    if (length > evbuffer_get_length(records))
+        die("internal error: truncated cached output");
+    if (evbuffer_add(data, evbuffer_pullup(records, -1), length) < 0)
+        die("internal error: cannot read cached output");
+    if (evbuffer_drain(records, length) < 0)
+        die("internal error: cannot read cached output");
+    return true;
+}
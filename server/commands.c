@@ -21,12 +21,16 @@
 
 #include <fcntl.h>
 #include <grp.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <sys/wait.h>
+#include <time.h>
 
 #include <server/internal.h>
 #include <util/fdflag.h>
 #include <util/macros.h>
 #include <util/messages.h>
+#include <util/probes.h>
 #include <util/protocol.h>
 #include <util/xmalloc.h>
 
@@ -68,9 +72,9 @@ line_matches(const struct rule *rule, const char *command,
  * Takes the configuration, a command, and a subcommand to match against
  * Returns the matching config line or NULL if none match.
  */
-static struct rule *
-find_config_line(struct config *config, const char *command,
-                 const char *subcommand)
+struct rule *
+server_find_config_line(struct config *config, const char *command,
+                        const char *subcommand)
 {
     size_t i;
 
@@ -81,17 +85,41 @@ find_config_line(struct config *config, const char *command,
 }
 
 
+/*
+ * Check whether the client may run a command given only the command and
+ * subcommand, so that commands the client isn't allowed to run can be
+ * rejected before the rest of a long command has been received.  Returns
+ * false only if there is a matching rule and the client is not authorized by
+ * its ACL.  Anything else, including unknown and help commands, is checked
+ * by server_run_command once the command is complete.
+ *
+ * This only checks.  The caller should pass a denied command to
+ * server_run_command with the denied flag set in the client struct, so that
+ * it is rate-limited, logged, and rejected like any other.
+ */
+bool
+server_command_permitted(struct client *client, struct config *config,
+                         const char *command, const char *subcommand)
+{
+    struct rule *rule;
+
+    rule = server_find_config_line(config, command, subcommand);
+    return rule == NULL || server_config_acl_permit(rule, client);
+}
+
+
 /*
  * Find the summary of all commands the user can run against this remctl
  * server.  We do so by checking all configuration lines for any that
  * provide a summary setup that the user can access, then running that
  * line's command with the given summary sub-command.
  *
- * Takes a client object, the user requesting access, and the list of all
- * valid configurations.
+ * Takes a client object, the list of all valid configurations, and the
+ * request ID to pass to each summary command.
  */
 static void
-server_send_summary(struct client *client, struct config *config)
+server_send_summary(struct client *client, struct config *config,
+                    const char *id)
 {
     char *path = NULL;
     char *program;
@@ -119,6 +147,7 @@ server_send_summary(struct client *client, struct config *config)
     for (i = 0; i < config->count; i++) {
         memset(&process, 0, sizeof(process));
         process.client = client;
+        process.id = id;
         rule = config->rules[i];
         if (!server_config_acl_permit(rule, client))
             continue;
@@ -295,6 +324,50 @@ create_argv_help(const char *path, const char *command, const char *subcommand)
 }
 
 
+/*
+ * Return the difference between two timevals in seconds.
+ */
+static double
+timeval_diff(const struct timeval *end, const struct timeval *start)
+{
+    return (double) (end->tv_sec - start->tv_sec)
+           + (double) (end->tv_usec - start->tv_usec) / 1e6;
+}
+
+
+/*
+ * Send a cached result to the client, given the process struct with the exit
+ * status filled in and a buffer of output records from the result cache.  For
+ * protocol version one, the output is sent along with the status, and
+ * otherwise it is sent as it would have been while running the command.
+ */
+static void
+send_cached(struct client *client, struct process *process,
+            struct evbuffer *records)
+{
+    struct evbuffer *output, *data;
+    int stream;
+
+    output = evbuffer_new();
+    data = evbuffer_new();
+    if (output == NULL || data == NULL)
+        die("internal error: cannot create output buffer");
+    while (server_cache_next(records, &stream, data)) {
+        process->bytes[stream - 1] += evbuffer_get_length(data);
+        if (client->protocol == 1) {
+            if (evbuffer_add_buffer(output, data) < 0)
+                die("internal error: cannot move data into output buffer");
+        } else if (!client->output(client, stream, data))
+            goto done;
+    }
+    client->finish(client, output, process->status);
+
+done:
+    evbuffer_free(output);
+    evbuffer_free(data);
+}
+
+
 /*
  * Process an incoming command.  Check the configuration files and the ACL
  * file, and if appropriate, forks off the command.  Takes the argument vector
@@ -307,6 +380,10 @@ create_argv_help(const char *path, const char *command, const char *subcommand)
  * subcommand equal to "ALL", that is a wildcard match for any given
  * subcommand.  The first argument is then replaced with the actual program
  * name to be executed.
+ *
+ * If the denied flag is set in the client struct, the command was already
+ * denied by server_command_permitted while it was being received, and argv
+ * holds only its command and subcommand.  It is then always rejected.
  */
 int
 server_run_command(struct client *client, struct config *config,
@@ -321,12 +398,44 @@ server_run_command(struct client *client, struct config *config,
     int status = -1;
     bool ok = false;
     bool help = false;
+    bool cacheable = false;
+    bool denied = client->denied;
+    bool permit;
+    size_t length = 0;
     const char *user = client->user;
     struct process process;
+    struct timeval start;
+    struct rusage before, after;
+    char *id;
+    double received;
 
-    /* Start with an empty process. */
+    /*
+     * Start with an empty process.  Assign a request ID that is unique on
+     * this host, which is logged and passed to the command.
+     */
     memset(&process, 0, sizeof(process));
     process.client = client;
+    received = server_clock();
+    client->count++;
+    client->uncompressed = false;
+    client->denied = false;
+    xasprintf(&id, "%lx-%lx-%lu", (unsigned long) time(NULL),
+              (unsigned long) getpid(), client->count);
+    process.id = id;
+
+    /* Count the command and its size for the metrics. */
+    for (i = 0; argv[i] != NULL; i++)
+        length += argv[i]->iov_len;
+    server_metrics_count(METRICS_COMMANDS, 1);
+    server_metrics_count(METRICS_BYTES_IN, length);
+    server_scoreboard_bytes(length, 0);
+
+    /* Reject the command if the user is sending commands too quickly. */
+    if (!server_ratelimit_check(RATELIMIT_COMMANDS, user, 1)) {
+        notice("command from user %s exceeds rate limit", user);
+        client->error(client, ERROR_RATE_LIMIT, "Rate limit exceeded");
+        goto done;
+    }
 
     /*
      * We need at least one argument.  This is also rejected earlier when
@@ -350,6 +459,7 @@ server_run_command(struct client *client, struct config *config,
 
     /* We need the command and subcommand as nul-terminated strings. */
     command = xstrndup(argv[0]->iov_base, argv[0]->iov_len);
+    process.command = command;
     if (argv[1] != NULL)
         subcommand = xstrndup(argv[1]->iov_base, argv[1]->iov_len);
 
@@ -360,7 +470,9 @@ server_run_command(struct client *client, struct config *config,
      * specific help command was listed, check for that in the configuration
      * instead.
      */
-    rule = find_config_line(config, command, subcommand);
+    rule = server_find_config_line(config, command, subcommand);
+    if (rule != NULL)
+        PROBE4(server__rule, command, subcommand, rule->file, rule->lineno);
     if (rule == NULL && strcmp(command, "help") == 0) {
 
         /* Error if we have more than a command and possible subcommand. */
@@ -372,13 +484,14 @@ server_run_command(struct client *client, struct config *config,
         }
 
         if (subcommand == NULL) {
-            server_send_summary(client, config);
+            server_send_summary(client, config, id);
             goto done;
         } else {
             help = true;
             if (argv[2] != NULL)
                 helpsubcommand = xstrndup(argv[2]->iov_base, argv[2]->iov_len);
-            rule = find_config_line(config, subcommand, helpsubcommand);
+            rule =
+                server_find_config_line(config, subcommand, helpsubcommand);
         }
     }
 
@@ -415,7 +528,15 @@ server_run_command(struct client *client, struct config *config,
         client->error(client, ERROR_UNKNOWN_COMMAND, "Unknown command");
         goto done;
     }
-    if (!server_config_acl_permit(rule, client)) {
+    server_metrics_rule(rule);
+    client->uncompressed = !rule->compress;
+    server_metrics_start(&start);
+    process.acl_time = server_clock();
+    permit = !denied && server_config_acl_permit(rule, client);
+    process.acl_time = server_clock() - process.acl_time;
+    server_metrics_time(METRICS_ACL, &start);
+    if (!permit) {
+        server_metrics_count(METRICS_ACL_DENIED, 1);
         notice("access denied: user %s, command %s%s%s", user, command,
                (subcommand == NULL) ? "" : " ",
                (subcommand == NULL) ? "" : subcommand);
@@ -443,21 +564,106 @@ server_run_command(struct client *client, struct config *config,
         req_argv = create_argv_command(rule, &process, argv);
     }
 
-    /* Now actually execute the program. */
-    process.command = command;
+    /*
+     * If results of this command are cached or identical requests coalesced,
+     * answer from the cache if possible, which may wait for an identical
+     * request to finish.  Otherwise, create the buffer in which the output is
+     * recorded so that it can be cached afterwards.
+     */
+    if (!help && server_cache_enabled(rule)) {
+        process.cache = evbuffer_new();
+        if (process.cache == NULL)
+            die("internal error: cannot create cache buffer");
+        if (server_cache_lookup(client, rule, argv, process.cache,
+                                &process.status)) {
+            debug("answering %s%s%s for user %s from cache", command,
+                  (subcommand == NULL) ? "" : " ",
+                  (subcommand == NULL) ? "" : subcommand, user);
+            server_metrics_count(METRICS_CACHE_HITS, 1);
+            send_cached(client, &process, process.cache);
+            status = process.status;
+            goto done;
+        }
+        cacheable = true;
+    }
+
+    /*
+     * If the rule has a concurrency limit, wait for a free slot, rejecting the
+     * command if too many others are already waiting or if waiting takes too
+     * long.
+     */
+    switch (server_limits_acquire(rule)) {
+    case LIMITS_OK:
+        break;
+    case LIMITS_BUSY:
+        notice("too many running: user %s, command %s%s%s", user, command,
+               (subcommand == NULL) ? "" : " ",
+               (subcommand == NULL) ? "" : subcommand);
+        client->error(client, ERROR_BUSY,
+                      "Too many instances of command running");
+        goto done;
+    case LIMITS_TIMEOUT:
+        notice("timed out waiting to run: user %s, command %s%s%s", user,
+               command, (subcommand == NULL) ? "" : " ",
+               (subcommand == NULL) ? "" : subcommand);
+        client->error(client, ERROR_BUSY,
+                      "Timed out waiting for other instances of command");
+        goto done;
+    }
+
+    /*
+     * If the client allows it and there's no input to send to the command or
+     * output to record for the cache, run the command in place of this
+     * process so that its output goes directly to the client.  This doesn't
+     * return.
+     */
+    if (client->direct && process.input == NULL && process.cache == NULL) {
+        debug("running %s%s%s for user %s in place", command,
+              (subcommand == NULL) ? "" : " ",
+              (subcommand == NULL) ? "" : subcommand, user);
+        process.subcommand = subcommand;
+        process.argv = (const char **) req_argv;
+        process.rule = rule;
+        server_process_exec(&process);
+    }
+
+    /*
+     * Now actually execute the program.  The difference in the resource usage
+     * of our children before and after is the usage of this command, except
+     * that the maximum resident set size is the largest of any child so far.
+     */
+    process.subcommand = subcommand;
     process.argv = (const char **) req_argv;
     process.rule = rule;
+    server_metrics_start(&start);
+    getrusage(RUSAGE_CHILDREN, &before);
     ok = server_process_run(&process);
+    server_limits_release(rule);
+    getrusage(RUSAGE_CHILDREN, &after);
+    server_metrics_time(METRICS_COMMAND, &start);
+    process.utime = timeval_diff(&after.ru_utime, &before.ru_utime);
+    process.stime = timeval_diff(&after.ru_stime, &before.ru_stime);
+    process.maxrss = after.ru_maxrss;
     if (ok) {
         if (WIFEXITED(process.status))
             process.status = (signed int) WEXITSTATUS(process.status);
         else
             process.status = -1;
+        if (client->protocol == 1) {
+            process.bytes[0] = evbuffer_get_length(process.output);
+            server_cache_record(&process, 1, process.output);
+        }
+        if (process.status >= 0 && process.cache != NULL)
+            server_cache_store(client, rule, argv, process.cache,
+                               process.status);
         client->finish(client, process.output, process.status);
     }
     status = process.status;
 
 done:
+    server_scoreboard_state(SCOREBOARD_IDLE);
+    server_log_completion(&process, subcommand, status, received);
+    free(id);
     free(command);
     free(subcommand);
     free(helpsubcommand);
@@ -470,6 +676,10 @@ done:
         evbuffer_free(process.input);
     if (process.output != NULL)
         evbuffer_free(process.output);
+    if (cacheable)
+        server_cache_abandon(client, rule, argv);
+    if (process.cache != NULL)
+        evbuffer_free(process.cache);
     return status;
 }
 
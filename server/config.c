@@ -40,6 +40,7 @@
 #include <server/internal.h>
 #include <util/macros.h>
 #include <util/messages.h>
+#include <util/probes.h>
 #ifdef HAVE_KRB5
 #    include <util/messages-krb5.h>
 #endif
@@ -359,18 +360,176 @@ option_help(struct rule *rule, char *value, const char *name UNUSED,
 }
 
 
+/*
+ * Parse the cache configuration option, which takes the number of seconds for
+ * which results of the command are cached.  Returns CONFIG_SUCCESS on success
+ * and CONFIG_ERROR on error.
+ */
+static enum config_status
+option_cache(struct rule *rule, char *value, const char *name, size_t lineno)
+{
+    if (!convert_number(value, &rule->cache)) {
+        warn("%s:%lu: invalid cache value %s", name, (unsigned long) lineno,
+             value);
+        return CONFIG_ERROR;
+    }
+    return CONFIG_SUCCESS;
+}
+
+
+/*
+ * Parse the cache-scope configuration option, which is either "user" if
+ * cached results are only returned to the same user or "global" if they are
+ * shared by all users.  Returns CONFIG_SUCCESS on success and CONFIG_ERROR on
+ * error.
+ */
+static enum config_status
+option_cache_scope(struct rule *rule, char *value, const char *name,
+                   size_t lineno)
+{
+    if (strcmp(value, "user") == 0)
+        rule->cache_global = false;
+    else if (strcmp(value, "global") == 0)
+        rule->cache_global = true;
+    else {
+        warn("%s:%lu: invalid cache-scope value %s", name,
+             (unsigned long) lineno, value);
+        return CONFIG_ERROR;
+    }
+    return CONFIG_SUCCESS;
+}
+
+
+/*
+ * Parse the coalesce configuration option, which is either "yes" or "no".
+ * Returns CONFIG_SUCCESS on success and CONFIG_ERROR on error.
+ */
+static enum config_status
+option_coalesce(struct rule *rule, char *value, const char *name,
+                size_t lineno)
+{
+    if (strcmp(value, "yes") == 0)
+        rule->coalesce = true;
+    else if (strcmp(value, "no") == 0)
+        rule->coalesce = false;
+    else {
+        warn("%s:%lu: invalid coalesce value %s", name,
+             (unsigned long) lineno, value);
+        return CONFIG_ERROR;
+    }
+    return CONFIG_SUCCESS;
+}
+
+
+/*
+ * Parse the compress configuration option, which is either "yes" or "no".
+ * Returns CONFIG_SUCCESS on success and CONFIG_ERROR on error.
+ */
+static enum config_status
+option_compress(struct rule *rule, char *value, const char *name,
+                size_t lineno)
+{
+    if (strcmp(value, "yes") == 0)
+        rule->compress = true;
+    else if (strcmp(value, "no") == 0)
+        rule->compress = false;
+    else {
+        warn("%s:%lu: invalid compress value %s", name,
+             (unsigned long) lineno, value);
+        return CONFIG_ERROR;
+    }
+    return CONFIG_SUCCESS;
+}
+
+
+/*
+ * Parse the class configuration option.  Stores the name of the concurrency
+ * class in the configuration rule struct.  Returns CONFIG_SUCCESS on success
+ * and CONFIG_ERROR on error.
+ */
+static enum config_status
+option_class(struct rule *rule, char *value, const char *name UNUSED,
+             size_t lineno UNUSED)
+{
+    rule->class = value;
+    return CONFIG_SUCCESS;
+}
+
+
+/*
+ * Parse the concurrency, queue, queue-timeout, and reserve configuration
+ * options, which all take a positive number.  Returns CONFIG_SUCCESS on
+ * success and CONFIG_ERROR on error.
+ */
+static enum config_status
+option_concurrency(struct rule *rule, char *value, const char *name,
+                   size_t lineno)
+{
+    if (!convert_number(value, &rule->concurrency)) {
+        warn("%s:%lu: invalid concurrency value %s", name,
+             (unsigned long) lineno, value);
+        return CONFIG_ERROR;
+    }
+    return CONFIG_SUCCESS;
+}
+
+static enum config_status
+option_queue(struct rule *rule, char *value, const char *name, size_t lineno)
+{
+    if (!convert_number(value, &rule->queue)) {
+        warn("%s:%lu: invalid queue value %s", name, (unsigned long) lineno,
+             value);
+        return CONFIG_ERROR;
+    }
+    return CONFIG_SUCCESS;
+}
+
+static enum config_status
+option_queue_timeout(struct rule *rule, char *value, const char *name,
+                     size_t lineno)
+{
+    if (!convert_number(value, &rule->queue_timeout)) {
+        warn("%s:%lu: invalid queue-timeout value %s", name,
+             (unsigned long) lineno, value);
+        return CONFIG_ERROR;
+    }
+    return CONFIG_SUCCESS;
+}
+
+static enum config_status
+option_reserve(struct rule *rule, char *value, const char *name,
+               size_t lineno)
+{
+    if (!convert_number(value, &rule->reserve)) {
+        warn("%s:%lu: invalid reserve value %s", name, (unsigned long) lineno,
+             value);
+        return CONFIG_ERROR;
+    }
+    return CONFIG_SUCCESS;
+}
+
+
 /*
  * The table relating configuration option names to functions.
  */
 /* clang-format off */
 static const struct config_option options[] = {
-    {"help",    option_help   },
-    {"logmask", option_logmask},
-    {"stdin",   option_stdin  },
-    {"sudo",    option_sudo   },
-    {"summary", option_summary},
-    {"user",    option_user   },
-    {NULL,      NULL          }
+    {"cache",         option_cache        },
+    {"cache-scope",   option_cache_scope  },
+    {"class",         option_class        },
+    {"coalesce",      option_coalesce     },
+    {"compress",      option_compress     },
+    {"concurrency",   option_concurrency  },
+    {"help",          option_help         },
+    {"logmask",       option_logmask      },
+    {"queue",         option_queue        },
+    {"queue-timeout", option_queue_timeout},
+    {"reserve",       option_reserve      },
+    {"stdin",         option_stdin        },
+    {"sudo",          option_sudo         },
+    {"summary",       option_summary      },
+    {"user",          option_user         },
+    {NULL,            NULL                }
 };
 /* clang-format on */
 
@@ -534,6 +693,7 @@ read_conf_file(void *data, const char *name)
         rule->command = line->strings[0];
         rule->subcommand = line->strings[1];
         rule->program = line->strings[2];
+        rule->compress = true;
 
         /*
          * Parse config options.
@@ -1256,6 +1416,7 @@ acl_check(const struct client *client, const char *entry, int def_index,
     const struct acl_scheme *scheme;
     char *prefix;
     const char *data;
+    enum config_status status;
 
     /* First, check for ANYUSER and map it to anyuser:auth. */
     if (strcmp(entry, "ANYUSER") == 0)
@@ -1286,7 +1447,9 @@ acl_check(const struct client *client, const char *entry, int def_index,
              (unsigned long) lineno, scheme->name);
         return CONFIG_ERROR;
     }
-    return scheme->check(client, data, file, lineno);
+    status = scheme->check(client, data, file, lineno);
+    PROBE4(server__acl, client->user, scheme->name, data, status);
+    return status;
 }
 
 
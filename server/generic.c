@@ -25,6 +25,7 @@
 
 #include <server/internal.h>
 #include <util/messages.h>
+#include <util/probes.h>
 #include <util/protocol.h>
 #include <util/tokens.h>
 #include <util/xmalloc.h>
@@ -50,6 +51,8 @@ server_new_client(int fd, gss_cred_id_t creds)
     OM_uint32 minor = 0;
     OM_uint32 acc_minor, time_rec;
     int flags, status;
+    int reason = TOKEN_FAIL_SYSTEM;
+    double start, resolved;
     static const OM_uint32 req_gss_flags =
         (GSS_C_MUTUAL_FLAG | GSS_C_CONF_FLAG | GSS_C_INTEG_FLAG);
 
@@ -57,6 +60,8 @@ server_new_client(int fd, gss_cred_id_t creds)
     client = xcalloc(1, sizeof(struct client));
     client->fd = fd;
     client->context = GSS_C_NO_CONTEXT;
+    client->max_data = TOKEN_MAX_DATA;
+    start = server_clock();
 
     /* Fill in hostname and IP address. */
     socklen = sizeof(ss);
@@ -82,12 +87,15 @@ server_new_client(int fd, gss_cred_id_t creds)
         client->hostname = buffer;
     else
         free(buffer);
+    resolved = server_clock();
+    client->dns_time = resolved - start;
 
     /* Accept the initial (worthless) token. */
     status =
         token_recv(client->fd, &flags, &recv_tok, TOKEN_MAX_LENGTH, TIMEOUT);
     if (status != TOKEN_OK) {
         warn_token("receiving initial token", status, major, minor);
+        reason = status;
         goto fail;
     }
     free(recv_tok.value);
@@ -97,6 +105,7 @@ server_new_client(int fd, gss_cred_id_t creds)
         client->protocol = 1;
     else {
         warn("bad token flags %d in initial token", flags);
+        reason = TOKEN_FAIL_INVALID;
         goto fail;
     }
 
@@ -106,6 +115,7 @@ server_new_client(int fd, gss_cred_id_t creds)
                             TIMEOUT);
         if (status != TOKEN_OK) {
             warn_token("receiving context token", status, major, minor);
+            reason = status;
             goto fail;
         }
         if (flags == TOKEN_CONTEXT)
@@ -113,6 +123,7 @@ server_new_client(int fd, gss_cred_id_t creds)
         else if (flags != (TOKEN_CONTEXT | TOKEN_PROTOCOL)) {
             warn("bad token flags %d in context token", flags);
             free(recv_tok.value);
+            reason = TOKEN_FAIL_INVALID;
             goto fail;
         }
         debug("received context token (size=%lu)",
@@ -134,6 +145,7 @@ server_new_client(int fd, gss_cred_id_t creds)
             if (status != TOKEN_OK) {
                 warn_token("sending context token", status, major, minor);
                 gss_release_buffer(&minor, &send_tok);
+                reason = status;
                 goto fail;
             }
             gss_release_buffer(&minor, &send_tok);
@@ -142,6 +154,7 @@ server_new_client(int fd, gss_cred_id_t creds)
         /* Bail out if we lose. */
         if (major != GSS_S_COMPLETE && major != GSS_S_CONTINUE_NEEDED) {
             warn_gssapi("while accepting context", major, acc_minor);
+            reason = TOKEN_FAIL_GSSAPI;
             goto fail;
         }
         if (major == GSS_S_CONTINUE_NEEDED)
@@ -152,6 +165,7 @@ server_new_client(int fd, gss_cred_id_t creds)
     if (client->protocol > 1) {
         if ((client->flags & req_gss_flags) != req_gss_flags) {
             warn("client did not negotiate appropriate GSS-API flags");
+            reason = TOKEN_FAIL_GSSAPI;
             goto fail;
         }
     }
@@ -163,6 +177,7 @@ server_new_client(int fd, gss_cred_id_t creds)
         client->error = server_v1_send_error;
     } else {
         client->setup = server_v2_command_setup;
+        client->output = server_v2_send_output;
         client->finish = server_v2_command_finish;
         client->error = server_v2_send_error;
     }
@@ -171,6 +186,7 @@ server_new_client(int fd, gss_cred_id_t creds)
     major = gss_display_name(&minor, name, &name_buf, &doid);
     if (major != GSS_S_COMPLETE) {
         warn_gssapi("while displaying client name", major, minor);
+        reason = TOKEN_FAIL_GSSAPI;
         goto fail;
     }
     gss_release_name(&minor, &name);
@@ -179,9 +195,12 @@ server_new_client(int fd, gss_cred_id_t creds)
     client->user = xstrndup(name_buf.value, name_buf.length);
     client->expires = time(NULL) + time_rec;
     gss_release_buffer(&minor, &name_buf);
+    client->gss_time = server_clock() - resolved;
+    PROBE3(server__context, fd, client->user, client->protocol);
     return client;
 
 fail:
+    server_metrics_handshake_failed(reason);
     if (client->context != GSS_C_NO_CONTEXT)
         gss_delete_sec_context(&minor, &client->context, GSS_C_NO_BUFFER);
     if (name != GSS_C_NO_NAME)
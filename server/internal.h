@@ -19,6 +19,7 @@
 #include <portable/socket.h>
 #include <portable/stdbool.h>
 
+#include <stdio.h>
 #include <sys/types.h>
 
 #include <util/protocol.h>
@@ -30,6 +31,9 @@ struct event;
 struct event_base;
 struct iovec;
 struct process;
+struct shared_lock;
+struct sockaddr;
+struct timeval;
 
 /*
  * The maximum size of argc passed to the server (4K arguments), and the
@@ -68,12 +72,24 @@ struct client {
     time_t expires;       /* Expiration time of GSS-API session. */
     bool keepalive;       /* Whether keep-alive was set. */
     bool fatal;           /* Whether a fatal error has occurred. */
+    unsigned long count;  /* Number of commands received so far. */
+    double dns_time;      /* Seconds spent looking up the client hostname. */
+    double gss_time;      /* Seconds spent establishing the context. */
+    int compress;         /* Negotiated compression (protocol v3). */
+    bool uncompressed;    /* Whether to send the current output as is. */
+    char *inflated;       /* Decompressed token being processed, if any. */
+    bool large;           /* Whether the client may send large tokens. */
+    size_t max_data;      /* Largest message we may send to the client. */
+    bool direct;          /* Whether commands may replace this process. */
+    bool denied;          /* Whether the current command was denied early. */
 
     /*
      * Callbacks used by generic server code handle the separate protocols,
-     * set up when the client opens the connection.
+     * set up when the client opens the connection.  output is NULL for
+     * protocol version one, which sends all output along with the status.
      */
     void (*setup)(struct process *);
+    bool (*output)(struct client *, int, struct evbuffer *);
     bool (*finish)(struct client *, struct evbuffer *, int);
     bool (*error)(struct client *, enum error_codes, const char *);
 };
@@ -95,6 +111,17 @@ struct rule {
     char *summary;         /* Argument that gives a command summary. */
     char *help;            /* Argument that gives help for a command. */
     char **acls;           /* Full file names of ACL files. */
+    unsigned int metric;   /* Metrics slot for the rule, 0 if none. */
+    char *class;           /* Concurrency class, or NULL for just this rule. */
+    long concurrency;      /* Maximum concurrent runs, 0 for unlimited. */
+    long queue;            /* Maximum requests waiting to run. */
+    long queue_timeout;    /* Seconds a request may wait, 0 for default. */
+    long reserve;          /* Slots of the -L limit reserved for the class. */
+    unsigned int limit;    /* Concurrency slot for the rule, 0 if none. */
+    long cache;            /* Seconds to cache results, 0 for none. */
+    bool cache_global;     /* Whether cached results are shared by users. */
+    bool coalesce;         /* Whether to merge identical running commands. */
+    bool compress;         /* Whether output may be compressed. */
 };
 
 /* Holds the complete parsed configuration for remctld. */
@@ -115,12 +142,14 @@ struct process {
 
     /* Command input. */
     const char *command;    /* The remctl command run by the user. */
+    const char *subcommand; /* The subcommand, which may be NULL. */
     const char **argv;      /* argv for running the command. */
     struct rule *rule;      /* Configuration rule for the command. */
     struct evbuffer *input; /* Buffer of input to process. */
 
     /* Command output. */
     struct evbuffer *output; /* Buffer of output from process. */
+    struct evbuffer *cache;  /* Copy of the output for the result cache. */
     int status;              /* Exit status. */
 
     /* Everything below this point is used internally by the process loop. */
@@ -134,12 +163,70 @@ struct process {
     struct event_base *loop;   /* Event base for the process event loop. */
     struct bufferevent *inout; /* Input and output from process. */
     struct bufferevent *err;   /* Standard error from process. */
+    struct bufferevent *queue; /* Output tokens queued for the client. */
+    struct event *throttle;    /* Resume reading after pacing output. */
     struct event *sigchld;     /* Handle the SIGCHLD signal for exit. */
 
     /* State flags. */
     bool reaped;     /* Whether we've reaped the process. */
     bool saw_error;  /* Whether we encountered some error. */
     bool saw_output; /* Whether we saw process output. */
+    bool paused;     /* Whether reading output waits for the queue. */
+    bool throttled;  /* Whether reading output waits for the rate limit. */
+
+    /* Statistics for the completion log. */
+    const char *id;     /* Request ID, also passed to the process. */
+    double acl_time;    /* Seconds spent checking ACLs. */
+    double started;     /* Time at which we started spawning the process. */
+    double spawned;     /* Time at which the process was forked. */
+    double exited;      /* Time at which the process was reaped. */
+    size_t bytes[2];    /* Bytes of standard output and standard error. */
+    double utime;       /* User CPU seconds used by the process. */
+    double stime;       /* System CPU seconds used by the process. */
+    long maxrss;        /* Maximum resident set size in KB. */
+};
+
+/* Counters and timers kept by server/metrics.c. */
+enum metrics_counter {
+    METRICS_CONNECTIONS,
+    METRICS_COMMANDS,
+    METRICS_ACL_DENIED,
+    METRICS_SPAWN_FAILED,
+    METRICS_BYTES_IN,
+    METRICS_BYTES_OUT,
+    METRICS_CACHE_HITS,
+    METRICS_COUNTER_MAX
+};
+enum metrics_timer {
+    METRICS_HANDSHAKE,
+    METRICS_ACL,
+    METRICS_SPAWN,
+    METRICS_COMMAND,
+    METRICS_TIMER_MAX
+};
+
+/* Rate limits enforced by server/ratelimit.c. */
+enum ratelimit_type {
+    RATELIMIT_CONNECTIONS, /* Connections per second per client IP. */
+    RATELIMIT_COMMANDS,    /* Commands per second per principal. */
+    RATELIMIT_OUTPUT,      /* Output bytes per second per principal. */
+    RATELIMIT_MAX
+};
+
+/* Results of waiting for a concurrency slot in server/limits.c. */
+enum limits_status {
+    LIMITS_OK,     /* The command may run. */
+    LIMITS_BUSY,   /* Too many commands are running and waiting. */
+    LIMITS_TIMEOUT /* Waited too long for a command to finish. */
+};
+
+/* States of a connection in the scoreboard kept by server/scoreboard.c. */
+enum scoreboard_state {
+    SCOREBOARD_FREE,      /* Slot not in use. */
+    SCOREBOARD_HANDSHAKE, /* Establishing the GSS-API context. */
+    SCOREBOARD_IDLE,      /* Waiting for a command from the client. */
+    SCOREBOARD_RUNNING,   /* Running a command. */
+    SCOREBOARD_OUTPUT     /* Command exited, still sending its output. */
 };
 
 BEGIN_DECLS
@@ -149,6 +236,10 @@ void warn_gssapi(const char *, OM_uint32 major, OM_uint32 minor);
 void warn_token(const char *, int status, OM_uint32 major, OM_uint32 minor);
 void server_log_command(struct iovec **, const struct rule *,
                         const char *user);
+void server_log_completion(const struct process *, const char *subcommand,
+                           int status, double start);
+void server_log_set_slow(double seconds);
+double server_clock(void);
 
 /* Configuration file functions. */
 struct config *server_config_load(const char *file);
@@ -158,12 +249,18 @@ void server_config_set_gput_file(char *file);
 
 /* Running commands. */
 int server_run_command(struct client *, struct config *, struct iovec **);
+bool server_command_permitted(struct client *, struct config *,
+                              const char *command, const char *subcommand);
+struct rule *server_find_config_line(struct config *, const char *command,
+                                     const char *subcommand);
 
 /* Freeing the command structure. */
 void server_free_command(struct iovec **);
 
 /* Running processes. */
 bool server_process_run(struct process *process);
+void server_process_exec(struct process *process)
+    __attribute__((__noreturn__));
 void server_handle_io_event(struct bufferevent *, short, void *);
 void server_handle_input_end(struct bufferevent *, void *);
 
@@ -180,6 +277,7 @@ void server_v1_handle_messages(struct client *, struct config *);
 
 /* Protocol v2 functions. */
 void server_v2_command_setup(struct process *);
+bool server_v2_send_output(struct client *, int stream, struct evbuffer *);
 bool server_v2_command_finish(struct client *, struct evbuffer *, int status);
 bool server_v2_send_error(struct client *, enum error_codes, const char *);
 void server_v2_handle_messages(struct client *, struct config *);
@@ -189,6 +287,70 @@ struct client *server_ssh_new_client(const char *user);
 void server_ssh_free_client(struct client *);
 struct iovec **server_ssh_parse_command(const char *);
 
+/* Shared memory functions. */
+void *server_shared_new(size_t, const char *purpose);
+void server_shared_free(void *, size_t);
+struct shared_lock *server_shared_lock_new(void);
+void server_shared_lock_free(struct shared_lock *);
+bool server_shared_lock(struct shared_lock *);
+void server_shared_unlock(struct shared_lock *);
+void server_shared_wait(long *poll);
+
+/* Metrics functions. */
+void server_metrics_init(void);
+void server_metrics_free(void);
+void server_metrics_rules(struct config *);
+bool server_metrics_write(const char *path);
+void server_metrics_count(enum metrics_counter, size_t);
+void server_metrics_handshake_failed(int status);
+void server_metrics_rule(const struct rule *);
+void server_metrics_start(struct timeval *);
+void server_metrics_time(enum metrics_timer, const struct timeval *start);
+
+/* Rate limiting functions. */
+void server_ratelimit_set(enum ratelimit_type, double rate, double burst);
+void server_ratelimit_init(void);
+void server_ratelimit_free(void);
+bool server_ratelimit_check(enum ratelimit_type, const char *key, double n);
+double server_ratelimit_delay(enum ratelimit_type, const char *key, double n);
+void server_ratelimit_wait(enum ratelimit_type, const char *key, double n);
+
+/* Concurrency limit functions. */
+void server_limits_init(unsigned long total);
+void server_limits_free(void);
+void server_limits_rules(struct config *);
+enum limits_status server_limits_acquire(const struct rule *);
+void server_limits_release(const struct rule *);
+void server_limits_reap(pid_t);
+
+/* Result cache functions. */
+void server_cache_init(size_t size);
+void server_cache_free(void);
+void server_cache_flush(void);
+bool server_cache_enabled(const struct rule *);
+bool server_cache_lookup(const struct client *, const struct rule *,
+                         struct iovec **, struct evbuffer *, int *status);
+void server_cache_store(const struct client *, const struct rule *,
+                        struct iovec **, struct evbuffer *, int status);
+void server_cache_abandon(const struct client *, const struct rule *,
+                          struct iovec **);
+void server_cache_reap(pid_t);
+void server_cache_record(struct process *, int stream, struct evbuffer *);
+bool server_cache_next(struct evbuffer *, int *stream, struct evbuffer *);
+
+/* Scoreboard functions. */
+void server_scoreboard_init(const char *path);
+void server_scoreboard_free(void);
+bool server_scoreboard_print(const char *path, FILE *);
+void server_scoreboard_connect(const struct sockaddr *);
+void server_scoreboard_forked(pid_t);
+void server_scoreboard_reap(pid_t);
+void server_scoreboard_state(enum scoreboard_state);
+void server_scoreboard_user(const char *);
+void server_scoreboard_command(const char *command, const char *subcommand,
+                               pid_t);
+void server_scoreboard_bytes(size_t in, size_t out);
+
 /* libevent utility functions. */
 void server_event_log_callback(int, const char *);
 void server_event_fatal_callback(int) __attribute__((__noreturn__));
@@ -0,0 +1,423 @@
+/*
+ * Concurrency limits for the remctld server.
+ *
+ * Configuration rules can limit how many copies of their command may run at
+ * once across all children of a stand-alone remctld, how many more requests
+ * may wait for a free slot, and for how long.  Rules can also be grouped into
+ * named classes that share those limits.  Separately, remctld can limit the
+ * total number of running commands, and classes can reserve part of that
+ * total so that they are never starved by other commands.
+ *
+ * The counts are kept in an anonymous shared memory segment created before
+ * any children are forked.  The parent assigns each rule a class slot when it
+ * loads the configuration, so children only update counts.  Each child also
+ * records the slots it holds under its PID so that the parent can release
+ * them if the child dies without doing so.  Waiting requests poll for a free
+ * slot with a short, growing delay.  The table is protected by a lock, which
+ * is only held while updating the counts.  If a process dies while holding
+ * it, the counts are recomputed from the records of each child.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <server/internal.h>
+#include <util/messages.h>
+#include <util/xmalloc.h>
+
+/* Maximum number of classes and of running or waiting requests tracked. */
+#define LIMITS_MAX_CLASSES 1024
+#define LIMITS_MAX_HOLDERS 4096
+
+/* Maximum length of a class name, including the nul. */
+#define LIMITS_NAME_MAX 256
+
+/* Default number of seconds a request may wait for a free slot. */
+#define LIMITS_QUEUE_TIMEOUT 60
+
+/* A concurrency class. */
+struct limit_class {
+    char name[LIMITS_NAME_MAX];
+    uint32_t concurrency;   /* Maximum running, 0 for unlimited. */
+    uint32_t queue;         /* Maximum waiting. */
+    uint32_t queue_timeout; /* Seconds a request may wait, 0 for default. */
+    uint32_t reserve;       /* Slots of the total reserved for the class. */
+    uint32_t running;       /* Requests currently running. */
+    uint32_t waiting;       /* Requests currently waiting. */
+};
+
+/* A running or waiting request, so that it can be cleaned up. */
+struct holder {
+    int32_t pid;    /* PID of the remctld child, 0 if unused. */
+    uint32_t slot;  /* Class slot plus one. */
+    uint32_t state; /* 1 for waiting, 2 for running. */
+};
+#define HOLDER_WAITING 1
+#define HOLDER_RUNNING 2
+
+/* The contents of the shared memory segment. */
+struct limits {
+    uint32_t total; /* Limit on all running commands, 0 for unlimited. */
+    uint32_t nclasses;
+    struct limit_class classes[LIMITS_MAX_CLASSES];
+    struct holder holders[LIMITS_MAX_HOLDERS];
+};
+
+/* The shared memory segment, or NULL if limits are not enabled. */
+static struct limits *limits = NULL;
+
+/* The lock protecting the shared memory segment. */
+static struct shared_lock *lock = NULL;
+
+
+/*
+ * Recompute the number of running and waiting requests in each class from the
+ * records of the requests.  The table must be locked.
+ */
+static void
+limits_recount(void)
+{
+    struct holder *holder;
+    struct limit_class *class;
+    size_t i;
+
+    for (i = 0; i < limits->nclasses; i++) {
+        limits->classes[i].running = 0;
+        limits->classes[i].waiting = 0;
+    }
+    for (i = 0; i < LIMITS_MAX_HOLDERS; i++) {
+        holder = &limits->holders[i];
+        if (holder->pid == 0 || holder->slot == 0
+            || holder->slot > limits->nclasses) {
+            holder->pid = 0;
+            continue;
+        }
+        class = &limits->classes[holder->slot - 1];
+        if (holder->state == HOLDER_RUNNING)
+            class->running++;
+        else if (holder->state == HOLDER_WAITING)
+            class->waiting++;
+    }
+}
+
+
+/*
+ * Lock and unlock the table.  If a process died while holding the lock, it
+ * may have been in the middle of changing the counts, so recompute them.
+ */
+static void
+limits_lock(void)
+{
+    if (server_shared_lock(lock))
+        limits_recount();
+}
+
+static void
+limits_unlock(void)
+{
+    server_shared_unlock(lock);
+}
+
+
+/*
+ * Create the shared memory segment and set the limit on the total number of
+ * running commands, 0 for no limit.  This must be called before forking any
+ * children.  Dies on failure.
+ */
+void
+server_limits_init(unsigned long total)
+{
+    limits = server_shared_new(sizeof(struct limits), "concurrency limits");
+    limits->total = (uint32_t) total;
+    lock = server_shared_lock_new();
+}
+
+
+/*
+ * Release the shared memory segment.  After this, all commands run
+ * immediately.
+ */
+void
+server_limits_free(void)
+{
+    if (limits == NULL)
+        return;
+    server_shared_free(limits, sizeof(struct limits));
+    server_shared_lock_free(lock);
+    limits = NULL;
+    lock = NULL;
+}
+
+
+/*
+ * Assign each rule in a configuration a class slot, reusing the slot of an
+ * existing class with the same name.  Rules without a class are in a class of
+ * their own named after the command and subcommand, which can't collide with
+ * a class name since it contains a space.  If there is a limit on the total
+ * number of commands, every rule needs a slot so that it can be counted;
+ * otherwise, only rules with limits get one.  The first rule of a class that
+ * sets a limit determines it.  Only the parent process may call this.
+ */
+void
+server_limits_rules(struct config *config)
+{
+    size_t i, j;
+    struct rule *rule;
+    struct limit_class *class;
+    char **names;
+    char *name;
+    bool *seen;
+
+    if (limits == NULL)
+        return;
+
+    /* Build the class names first so that nothing can die holding the lock. */
+    names = xcalloc(config->count, sizeof(char *));
+    for (i = 0; i < config->count; i++) {
+        rule = config->rules[i];
+        if (rule->class != NULL)
+            names[i] = xstrdup(rule->class);
+        else if (rule->concurrency > 0 || rule->reserve > 0)
+            xasprintf(&names[i], "%s %s", rule->command, rule->subcommand);
+        else if (limits->total > 0)
+            names[i] = xstrdup("");
+    }
+    seen = xcalloc(LIMITS_MAX_CLASSES, sizeof(bool));
+
+    /* Now assign the slots. */
+    limits_lock();
+    for (i = 0; i < config->count; i++) {
+        rule = config->rules[i];
+        rule->limit = 0;
+        name = names[i];
+        if (name == NULL)
+            continue;
+        if (strlen(name) >= LIMITS_NAME_MAX) {
+            warn("%s:%lu: concurrency class name too long", rule->file,
+                 (unsigned long) rule->lineno);
+            continue;
+        }
+        for (j = 0; j < limits->nclasses; j++)
+            if (strcmp(limits->classes[j].name, name) == 0)
+                break;
+        if (j == limits->nclasses) {
+            if (j == LIMITS_MAX_CLASSES) {
+                warn("%s:%lu: too many concurrency classes", rule->file,
+                     (unsigned long) rule->lineno);
+                continue;
+            }
+            memcpy(limits->classes[j].name, name, strlen(name) + 1);
+            limits->nclasses++;
+        }
+
+        /* Reset the class the first time it's seen in this configuration. */
+        class = &limits->classes[j];
+        if (!seen[j]) {
+            seen[j] = true;
+            class->concurrency = 0;
+            class->queue = 0;
+            class->queue_timeout = 0;
+            class->reserve = 0;
+        }
+        if (class->concurrency == 0)
+            class->concurrency = (uint32_t) rule->concurrency;
+        if (class->queue == 0)
+            class->queue = (uint32_t) rule->queue;
+        if (class->queue_timeout == 0)
+            class->queue_timeout = (uint32_t) rule->queue_timeout;
+        if (class->reserve == 0)
+            class->reserve = (uint32_t) rule->reserve;
+        rule->limit = (unsigned int) j + 1;
+    }
+
+    /* Classes no longer in the configuration have no limits or reservation. */
+    for (j = 0; j < limits->nclasses; j++)
+        if (!seen[j]) {
+            limits->classes[j].concurrency = 0;
+            limits->classes[j].queue = 0;
+            limits->classes[j].reserve = 0;
+        }
+    limits_unlock();
+    for (i = 0; i < config->count; i++)
+        free(names[i]);
+    free(names);
+    free(seen);
+}
+
+
+/*
+ * Return whether a request in the given class may start running now.  The
+ * table must be locked.
+ */
+static bool
+can_run(const struct limit_class *class)
+{
+    const struct limit_class *other;
+    unsigned long reserved = 0;
+    unsigned long shared = 0;
+    size_t i;
+
+    if (class->concurrency > 0 && class->running >= class->concurrency)
+        return false;
+    if (limits->total == 0 || class->running < class->reserve)
+        return true;
+
+    /*
+     * Otherwise, the request needs one of the slots that aren't reserved.
+     * Running requests beyond the reservation of their class use those.
+     */
+    for (i = 0; i < limits->nclasses; i++) {
+        other = &limits->classes[i];
+        reserved += other->reserve;
+        if (other->running > other->reserve)
+            shared += other->running - other->reserve;
+    }
+    if (reserved >= limits->total)
+        return false;
+    return shared < limits->total - reserved;
+}
+
+
+/*
+ * Record that the current process is running or waiting in a class, or
+ * change the state of an existing record.  The table must be locked.  If the
+ * table of holders is full, the request is counted but not recorded, so it
+ * won't be cleaned up if the child dies.
+ */
+static void
+set_holder(uint32_t slot, uint32_t state)
+{
+    struct holder *holder, *empty = NULL;
+    int32_t pid = (int32_t) getpid();
+    size_t i;
+
+    for (i = 0; i < LIMITS_MAX_HOLDERS; i++) {
+        holder = &limits->holders[i];
+        if (holder->pid == pid && holder->slot == slot) {
+            holder->state = state;
+            if (state == 0)
+                holder->pid = 0;
+            return;
+        }
+        if (holder->pid == 0 && empty == NULL)
+            empty = holder;
+    }
+    if (state != 0 && empty != NULL) {
+        empty->pid = pid;
+        empty->slot = slot;
+        empty->state = state;
+    }
+}
+
+
+/*
+ * Wait for a slot to run a command for the given rule.  Returns
+ * LIMITS_OK if the command may run, in which case server_limits_release must
+ * be called when it finishes, LIMITS_BUSY if the queue is full, or
+ * LIMITS_TIMEOUT if no slot became free in time.
+ */
+enum limits_status
+server_limits_acquire(const struct rule *rule)
+{
+    struct limit_class *class;
+    double deadline, timeout;
+    long poll = 0;
+
+    if (limits == NULL || rule->limit == 0)
+        return LIMITS_OK;
+    class = &limits->classes[rule->limit - 1];
+
+    /* Run immediately if possible and nothing else is waiting. */
+    limits_lock();
+    if (class->waiting == 0 && can_run(class)) {
+        class->running++;
+        set_holder(rule->limit, HOLDER_RUNNING);
+        limits_unlock();
+        return LIMITS_OK;
+    }
+    if (class->waiting >= class->queue) {
+        limits_unlock();
+        return LIMITS_BUSY;
+    }
+    class->waiting++;
+    set_holder(rule->limit, HOLDER_WAITING);
+    if (class->queue_timeout == 0)
+        timeout = LIMITS_QUEUE_TIMEOUT;
+    else
+        timeout = class->queue_timeout;
+    deadline = server_clock() + timeout;
+    limits_unlock();
+
+    /* Poll until a slot is free or we run out of time. */
+    while (1) {
+        server_shared_wait(&poll);
+        limits_lock();
+        if (can_run(class)) {
+            class->waiting--;
+            class->running++;
+            set_holder(rule->limit, HOLDER_RUNNING);
+            limits_unlock();
+            return LIMITS_OK;
+        }
+        if (server_clock() >= deadline) {
+            class->waiting--;
+            set_holder(rule->limit, 0);
+            limits_unlock();
+            return LIMITS_TIMEOUT;
+        }
+        limits_unlock();
+    }
+}
+
+
+/*
+ * Release the slot acquired for a rule after its command finishes.
+ */
+void
+server_limits_release(const struct rule *rule)
+{
+    struct limit_class *class;
+
+    if (limits == NULL || rule->limit == 0)
+        return;
+    class = &limits->classes[rule->limit - 1];
+    limits_lock();
+    if (class->running > 0)
+        class->running--;
+    set_holder(rule->limit, 0);
+    limits_unlock();
+}
+
+
+/*
+ * Release any slots held by a child that has exited.  Only the parent process
+ * may call this.
+ */
+void
+server_limits_reap(pid_t pid)
+{
+    struct holder *holder;
+    struct limit_class *class;
+    size_t i;
+
+    if (limits == NULL)
+        return;
+    limits_lock();
+    for (i = 0; i < LIMITS_MAX_HOLDERS; i++) {
+        holder = &limits->holders[i];
+        if (holder->pid != (int32_t) pid)
+            continue;
+        class = &limits->classes[holder->slot - 1];
+        if (holder->state == HOLDER_RUNNING && class->running > 0)
+            class->running--;
+        else if (holder->state == HOLDER_WAITING && class->waiting > 0)
+            class->waiting--;
+        holder->pid = 0;
+    }
+    limits_unlock();
+}
@@ -20,13 +20,22 @@
 #include <portable/uio.h>
 
 #include <errno.h>
+#include <sys/time.h>
+#include <time.h>
 
 #include <server/internal.h>
+#include <util/buffer.h>
 #include <util/gss-errors.h>
 #include <util/messages.h>
 #include <util/tokens.h>
 #include <util/vector.h>
 
+/*
+ * Commands that take at least this many seconds have their completion record
+ * logged at notice instead of debug.  Negative means never.
+ */
+static double slow_threshold = -1;
+
 
 /*
  * Report a GSS-API failure using warn.
@@ -126,3 +135,100 @@ server_log_command(struct iovec **argv, const struct rule *rule,
     notice("COMMAND from %s: %s", user, command);
     free(command);
 }
+
+
+/*
+ * Set the threshold in seconds at or above which command completion records
+ * are logged at notice rather than debug.  A negative threshold means that
+ * they are always logged at debug.
+ */
+void
+server_log_set_slow(double seconds)
+{
+    slow_threshold = seconds;
+}
+
+
+/*
+ * Return the current time in seconds, from a monotonic clock if available.
+ * Only differences between two calls are meaningful.
+ */
+double
+server_clock(void)
+{
+    struct timeval tv;
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+#endif
+
+    gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec + (double) tv.tv_usec / 1e6;
+}
+
+
+/*
+ * Append a key and a string value to a completion record, replacing
+ * characters that would make the record ambiguous with a period.
+ */
+static void
+append_word(struct buffer *record, const char *key, const char *value)
+{
+    size_t start;
+    char *p;
+
+    buffer_append_sprintf(record, " %s=", key);
+    start = record->left;
+    buffer_append(record, value, strlen(value));
+    for (p = record->data + record->used + start;
+         p < record->data + record->used + record->left; p++)
+        if (*p <= 32 || *p == 127 || *p == '=')
+            *p = '.';
+}
+
+
+/*
+ * Log the completion record for a command.  Takes the process struct for the
+ * command, the subcommand (which may be NULL), the exit status or -1 if the
+ * command could not be run, and the time returned by server_clock when the
+ * command was received.  Phases that were not reached are logged as zero.
+ * The connection setup times are only included for the first command on a
+ * connection.
+ */
+void
+server_log_completion(const struct process *process, const char *subcommand,
+                      int status, double start)
+{
+    const struct client *client = process->client;
+    struct buffer *record;
+    double now, spawn, run;
+
+    now = server_clock();
+    spawn = (process->spawned > 0) ? process->spawned - process->started : 0;
+    run = (process->exited > 0) ? process->exited - process->spawned : 0;
+    record = buffer_new();
+    buffer_append_sprintf(record, "COMPLETED id=%s", process->id);
+    append_word(record, "user", client->user);
+    if (process->command != NULL)
+        append_word(record, "command", process->command);
+    if (subcommand != NULL)
+        append_word(record, "subcommand", subcommand);
+    buffer_append_sprintf(record, " status=%d", status);
+    if (client->count == 1)
+        buffer_append_sprintf(record, " dns=%.6f gss=%.6f", client->dns_time,
+                              client->gss_time);
+    buffer_append_sprintf(record, " acl=%.6f spawn=%.6f run=%.6f total=%.6f",
+                          process->acl_time, spawn, run, now - start);
+    buffer_append_sprintf(record, " stdout=%lu stderr=%lu",
+                          (unsigned long) process->bytes[0],
+                          (unsigned long) process->bytes[1]);
+    buffer_append_sprintf(record, " utime=%.6f stime=%.6f maxrss=%ld",
+                          process->utime, process->stime, process->maxrss);
+    if (slow_threshold >= 0 && now - start >= slow_threshold)
+        notice("%.*s", (int) record->left, record->data + record->used);
+    else
+        debug("%.*s", (int) record->left, record->data + record->used);
+    buffer_free(record);
+}
@@ -0,0 +1,400 @@
+/*
+ * Counters and latency histograms for the remctld server.
+ *
+ * When running as a stand-alone daemon, remctld can keep statistics in an
+ * anonymous shared memory segment created before any children are forked.
+ * Each child updates the counters with atomic operations, and the parent
+ * periodically writes the totals to a file in the Prometheus text exposition
+ * format, suitable for the textfile collector of the node exporter.
+ *
+ * Commands are counted per configuration rule.  The parent assigns each rule
+ * a slot in the shared segment when it loads the configuration, so children
+ * never have to add entries to the table and only increment counters.  Slots
+ * are never reused, so a command keeps its counts across reloads.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <server/internal.h>
+#include <util/messages.h>
+#include <util/tokens.h>
+#include <util/xmalloc.h>
+
+/*
+ * Use the __atomic builtins if available and otherwise fall back on the older
+ * __sync builtins.  Reads are done as an addition of zero in the latter case
+ * so that 64-bit counters are never torn on 32-bit platforms.
+ */
+#ifdef HAVE_ATOMIC_BUILTINS
+#    define ATOMIC_ADD(p, n) __atomic_fetch_add((p), (n), __ATOMIC_RELAXED)
+#    define ATOMIC_LOAD(p)   __atomic_load_n((p), __ATOMIC_RELAXED)
+#else
+#    define ATOMIC_ADD(p, n) __sync_fetch_and_add((p), (n))
+#    define ATOMIC_LOAD(p)   __sync_fetch_and_add((p), 0)
+#endif
+
+/*
+ * Histogram buckets.  Bucket i counts times under 2^i microseconds, so the
+ * finite buckets run from 1us to about 33 seconds.  The last bucket counts
+ * everything longer.
+ */
+#define HISTOGRAM_BUCKETS 26
+
+/* Maximum number of rules and the maximum length of a command name. */
+#define METRICS_MAX_RULES 1024
+#define METRICS_NAME_MAX  128
+
+/*
+ * Labels for handshake failures, indexed by the negation of the token status
+ * from util/tokens.h.  Index zero is for anything else.
+ */
+static const char *const handshake_reasons[] = {
+    "unknown", "system", "socket", "invalid",
+    "large",   "eof",    "gssapi", "timeout",
+};
+#define HANDSHAKE_REASONS \
+    (sizeof(handshake_reasons) / sizeof(handshake_reasons[0]))
+
+/* Names and help text of the counters and histograms. */
+static const struct {
+    const char *name;
+    const char *help;
+} counters[METRICS_COUNTER_MAX] = {
+    /* clang-format off */
+    {"remctld_connections_total", "Connections accepted."},
+    {"remctld_commands_total", "Commands received."},
+    {"remctld_acl_denials_total", "Commands rejected by ACL."},
+    {"remctld_spawn_failures_total", "Commands that could not be started."},
+    {"remctld_command_input_bytes_total", "Bytes of command arguments."},
+    {"remctld_command_output_bytes_total", "Bytes of command output."},
+    {"remctld_cache_hits_total", "Commands answered from the result cache."},
+    /* clang-format on */
+}, timers[METRICS_TIMER_MAX] = {
+    /* clang-format off */
+    {"remctld_handshake_seconds", "Time to establish a GSS-API context."},
+    {"remctld_acl_check_seconds", "Time to check the ACLs of a command."},
+    {"remctld_spawn_seconds", "Time to start a command."},
+    {"remctld_command_seconds", "Wall clock time to run a command."},
+    /* clang-format on */
+};
+
+/* A latency histogram.  Times are in microseconds. */
+struct histogram {
+    uint64_t buckets[HISTOGRAM_BUCKETS + 1];
+    uint64_t sum;
+};
+
+/* Commands run for a single configuration rule. */
+struct rule_metrics {
+    char command[METRICS_NAME_MAX];
+    char subcommand[METRICS_NAME_MAX];
+    uint64_t count;
+};
+
+/* The contents of the shared memory segment. */
+struct metrics {
+    uint64_t counters[METRICS_COUNTER_MAX];
+    uint64_t handshake_failures[HANDSHAKE_REASONS];
+    struct histogram timers[METRICS_TIMER_MAX];
+    size_t nrules;
+    struct rule_metrics rules[METRICS_MAX_RULES];
+};
+
+/* The shared memory segment, or NULL if metrics are not enabled. */
+static struct metrics *metrics = NULL;
+
+
+/*
+ * Create the shared memory segment.  This must be called before forking any
+ * children that should update it.  Dies on failure.
+ */
+void
+server_metrics_init(void)
+{
+    metrics = server_shared_new(sizeof(struct metrics), "metrics");
+}
+
+
+/*
+ * Release the shared memory segment.  After this, all updates are ignored.
+ */
+void
+server_metrics_free(void)
+{
+    if (metrics == NULL)
+        return;
+    server_shared_free(metrics, sizeof(struct metrics));
+    metrics = NULL;
+}
+
+
+/*
+ * Assign each rule in a configuration a slot for its command count, reusing
+ * the slot of any earlier rule with the same command and subcommand.  Only
+ * the parent process may call this.  Rules that don't fit are left without a
+ * slot and are only included in the total command count.
+ */
+void
+server_metrics_rules(struct config *config)
+{
+    size_t i, j;
+    struct rule *rule;
+    struct rule_metrics *slot;
+
+    if (metrics == NULL)
+        return;
+    for (i = 0; i < config->count; i++) {
+        rule = config->rules[i];
+        rule->metric = 0;
+        if (strlen(rule->command) >= METRICS_NAME_MAX)
+            continue;
+        if (strlen(rule->subcommand) >= METRICS_NAME_MAX)
+            continue;
+        for (j = 0; j < metrics->nrules; j++) {
+            slot = &metrics->rules[j];
+            if (strcmp(slot->command, rule->command) == 0
+                && strcmp(slot->subcommand, rule->subcommand) == 0)
+                break;
+        }
+        if (j == metrics->nrules) {
+            if (j == METRICS_MAX_RULES)
+                continue;
+            slot = &metrics->rules[j];
+            memcpy(slot->command, rule->command, strlen(rule->command) + 1);
+            memcpy(slot->subcommand, rule->subcommand,
+                   strlen(rule->subcommand) + 1);
+            metrics->nrules++;
+        }
+        rule->metric = (unsigned int) j + 1;
+    }
+}
+
+
+/*
+ * Add to one of the counters.
+ */
+void
+server_metrics_count(enum metrics_counter counter, size_t n)
+{
+    if (metrics == NULL)
+        return;
+    ATOMIC_ADD(&metrics->counters[counter], (uint64_t) n);
+}
+
+
+/*
+ * Count a failure to establish a GSS-API context, given the token status that
+ * best describes the reason.
+ */
+void
+server_metrics_handshake_failed(int status)
+{
+    size_t reason;
+
+    if (metrics == NULL)
+        return;
+    reason = (status < 0) ? (size_t) -status : 0;
+    if (reason >= HANDSHAKE_REASONS)
+        reason = 0;
+    ATOMIC_ADD(&metrics->handshake_failures[reason], 1);
+}
+
+
+/*
+ * Count a command run for a configuration rule.
+ */
+void
+server_metrics_rule(const struct rule *rule)
+{
+    if (metrics == NULL || rule->metric == 0)
+        return;
+    ATOMIC_ADD(&metrics->rules[rule->metric - 1].count, 1);
+}
+
+
+/*
+ * Record the start of a timed operation.  Does nothing if metrics are not
+ * enabled, to avoid the cost of getting the time.
+ */
+void
+server_metrics_start(struct timeval *start)
+{
+    if (metrics == NULL)
+        return;
+    gettimeofday(start, NULL);
+}
+
+
+/*
+ * Record the time since start in one of the histograms.
+ */
+void
+server_metrics_time(enum metrics_timer timer, const struct timeval *start)
+{
+    struct timeval now;
+    struct histogram *histogram;
+    uint64_t usec;
+    size_t bucket;
+
+    if (metrics == NULL)
+        return;
+    gettimeofday(&now, NULL);
+    if (now.tv_sec < start->tv_sec
+        || (now.tv_sec == start->tv_sec && now.tv_usec < start->tv_usec))
+        usec = 0;
+    else
+        usec = (uint64_t) (now.tv_sec - start->tv_sec) * 1000000
+               + (uint64_t) (now.tv_usec - start->tv_usec);
+    for (bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+        if (usec < (UINT64_C(1) << bucket))
+            break;
+    histogram = &metrics->timers[timer];
+    ATOMIC_ADD(&histogram->buckets[bucket], 1);
+    ATOMIC_ADD(&histogram->sum, usec);
+}
+
+
+/*
+ * Print a string as a Prometheus label value, escaping as required.
+ */
+static void
+print_label(FILE *output, const char *value)
+{
+    const char *p;
+
+    for (p = value; *p != '\0'; p++) {
+        if (*p == '\\' || *p == '"')
+            fputc('\\', output);
+        if (*p == '\n')
+            fputs("\\n", output);
+        else
+            fputc(*p, output);
+    }
+}
+
+
+/*
+ * Print a histogram in the Prometheus text format.  The stored buckets are
+ * disjoint, but Prometheus buckets are cumulative.
+ */
+static void
+print_histogram(FILE *output, const char *name, struct histogram *histogram)
+{
+    uint64_t total = 0;
+    uint64_t sum;
+    size_t i;
+
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        total += ATOMIC_LOAD(&histogram->buckets[i]);
+        fprintf(output, "%s_bucket{le=\"%.6f\"} %llu\n", name,
+                (double) (UINT64_C(1) << i) / 1e6, (unsigned long long) total);
+    }
+    total += ATOMIC_LOAD(&histogram->buckets[HISTOGRAM_BUCKETS]);
+    fprintf(output, "%s_bucket{le=\"+Inf\"} %llu\n", name,
+            (unsigned long long) total);
+    sum = ATOMIC_LOAD(&histogram->sum);
+    fprintf(output, "%s_sum %.6f\n", name, (double) sum / 1e6);
+    fprintf(output, "%s_count %llu\n", name, (unsigned long long) total);
+}
+
+
+/*
+ * Write the current metrics to a file in the Prometheus text format.  The
+ * file is replaced atomically so that collectors never see a partial file.
+ * Returns true on success and false on failure, logging a warning.
+ */
+bool
+server_metrics_write(const char *path)
+{
+    char *template;
+    FILE *output;
+    struct rule_metrics *slot;
+    uint64_t value;
+    size_t i;
+    int fd;
+
+    if (metrics == NULL)
+        return true;
+    xasprintf(&template, "%s.XXXXXX", path);
+    fd = mkstemp(template);
+    if (fd < 0) {
+        syswarn("cannot create temporary metrics file %s", template);
+        free(template);
+        return false;
+    }
+    if (fchmod(fd, 0644) < 0)
+        syswarn("cannot change mode of temporary metrics file %s", template);
+    output = fdopen(fd, "w");
+    if (output == NULL) {
+        syswarn("cannot reopen temporary metrics file %s", template);
+        close(fd);
+        goto fail;
+    }
+
+    /* Simple counters. */
+    for (i = 0; i < METRICS_COUNTER_MAX; i++) {
+        value = ATOMIC_LOAD(&metrics->counters[i]);
+        fprintf(output, "# HELP %s %s\n", counters[i].name, counters[i].help);
+        fprintf(output, "# TYPE %s counter\n", counters[i].name);
+        fprintf(output, "%s %llu\n", counters[i].name,
+                (unsigned long long) value);
+    }
+
+    /* Handshake failures by reason. */
+    fputs("# HELP remctld_handshake_failures_total Failed GSS-API context"
+          " negotiations.\n", output);
+    fputs("# TYPE remctld_handshake_failures_total counter\n", output);
+    for (i = 0; i < HANDSHAKE_REASONS; i++) {
+        value = ATOMIC_LOAD(&metrics->handshake_failures[i]);
+        fprintf(output,
+                "remctld_handshake_failures_total{reason=\"%s\"} %llu\n",
+                handshake_reasons[i], (unsigned long long) value);
+    }
+
+    /* Commands by rule. */
+    fputs("# HELP remctld_rule_commands_total Commands received for each"
+          " configured command.\n", output);
+    fputs("# TYPE remctld_rule_commands_total counter\n", output);
+    for (i = 0; i < metrics->nrules; i++) {
+        slot = &metrics->rules[i];
+        fputs("remctld_rule_commands_total{command=\"", output);
+        print_label(output, slot->command);
+        fputs("\",subcommand=\"", output);
+        print_label(output, slot->subcommand);
+        fprintf(output, "\"} %llu\n",
+                (unsigned long long) ATOMIC_LOAD(&slot->count));
+    }
+
+    /* Latency histograms. */
+    for (i = 0; i < METRICS_TIMER_MAX; i++) {
+        fprintf(output, "# HELP %s %s\n", timers[i].name, timers[i].help);
+        fprintf(output, "# TYPE %s histogram\n", timers[i].name);
+        print_histogram(output, timers[i].name, &metrics->timers[i]);
+    }
+
+    /* Flush and move the file into place. */
+    if (fclose(output) != 0) {
+        syswarn("cannot write temporary metrics file %s", template);
+        goto fail;
+    }
+    if (rename(template, path) < 0) {
+        syswarn("cannot rename temporary metrics file to %s", path);
+        goto fail;
+    }
+    free(template);
+    return true;
+
+fail:
+    unlink(template);
+    free(template);
+    return false;
+}
@@ -22,12 +22,14 @@
 #include <grp.h>
 #include <signal.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 
 #include <server/internal.h>
 #include <util/fdflag.h>
 #include <util/macros.h>
 #include <util/messages.h>
+#include <util/probes.h>
 #include <util/protocol.h>
 #include <util/xmalloc.h>
 
@@ -122,13 +124,35 @@ handle_exit(evutil_socket_t sig UNUSED, short what UNUSED, void *data)
     struct process *process = data;
 
     if (waitpid(process->pid, &process->status, WNOHANG) > 0) {
+        process->exited = server_clock();
         process->reaped = true;
+        PROBE2(server__reap, process->pid, process->status);
+        server_scoreboard_state(SCOREBOARD_OUTPUT);
         event_del(process->sigchld);
         event_base_loopexit(process->loop, NULL);
     }
 }
 
 
+/*
+ * Returns whether any output is queued to be sent to the client or reading
+ * output from the process is throttled by a bandwidth limit, in either of
+ * which cases the event loop has to wait for something to happen.
+ */
+static bool
+output_pending(const struct process *process)
+{
+    struct evbuffer *queue;
+
+    if (process->throttled)
+        return true;
+    if (process->queue == NULL)
+        return false;
+    queue = bufferevent_get_output(process->queue);
+    return evbuffer_get_length(queue) > 0;
+}
+
+
 /*
  * Called on fatal errors in the child process before exec.  This callback
  * exists only to change the exit status for fatal internal errors in the
@@ -141,6 +165,89 @@ child_die_handler(void)
 }
 
 
+/*
+ * Replace the current process with the command, once standard input, output,
+ * and error have been set up.  This is the common code between a child of the
+ * server and remctl-shell running a command in place, and does not return.
+ */
+__attribute__((__noreturn__)) static void
+exec_command(struct process *process)
+{
+    struct client *client = process->client;
+    struct sigaction sa;
+    const char *argv0;
+    char *expires;
+    int fd;
+
+    /*
+     * Older versions of MIT Kerberos left the replay cache file open across
+     * exec.  Newer versions correctly set it close-on-exec, but close our
+     * low-numbered file descriptors anyway for older versions.  We're just
+     * trying to get the replay cache, so we don't have to go very high.
+     */
+    for (fd = 3; fd < 16; fd++)
+        close(fd);
+
+    /*
+     * Restore the default SIGPIPE handler.  The server sets it to SIG_IGN,
+     * which is inherited by children.  We want the child to have a default
+     * set of signal handlers.
+     */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    if (sigaction(SIGPIPE, &sa, NULL) < 0)
+        sysdie("cannot clear SIGPIPE handler");
+
+    /*
+     * Put the authenticated principal and other connection and command
+     * information in the environment.  REMUSER is for backwards compatibility
+     * with earlier versions of remctl.
+     */
+    if (setenv("REMUSER", client->user, 1) < 0)
+        sysdie("cannot set REMUSER in environment");
+    if (setenv("REMOTE_USER", client->user, 1) < 0)
+        sysdie("cannot set REMOTE_USER in environment");
+    if (setenv("REMOTE_ADDR", client->ipaddress, 1) < 0)
+        sysdie("cannot set REMOTE_ADDR in environment");
+    if (client->hostname != NULL)
+        if (setenv("REMOTE_HOST", client->hostname, 1) < 0)
+            sysdie("cannot set REMOTE_HOST in environment");
+    if (setenv("REMCTL_COMMAND", process->command, 1) < 0)
+        sysdie("cannot set REMCTL_COMMAND in environment");
+    if (setenv("REMCTL_REQUEST_ID", process->id, 1) < 0)
+        sysdie("cannot set REMCTL_REQUEST_ID in environment");
+    xasprintf(&expires, "%lu", (unsigned long) client->expires);
+    if (setenv("REMOTE_EXPIRES", expires, 1) < 0)
+        sysdie("cannot set REMOTE_EXPIRES in environment");
+    free(expires);
+
+    /* Drop privileges if requested. */
+    if (process->rule->user != NULL && process->rule->uid > 0) {
+        if (initgroups(process->rule->user, process->rule->gid) != 0)
+            sysdie("cannot initgroups for %s\n", process->rule->user);
+        if (setgid(process->rule->gid) != 0)
+            sysdie("cannot setgid to %lu\n",
+                   (unsigned long) process->rule->gid);
+        if (setuid(process->rule->uid) != 0)
+            sysdie("cannot setuid to %lu\n",
+                   (unsigned long) process->rule->uid);
+    }
+
+    /*
+     * Run the command.  On error, we intentionally don't reveal information
+     * about the command we ran.  We have to cast away const because the
+     * prototype for execv is historically incorrect even though it doesn't
+     * modify its arguments.
+     */
+    if (process->rule->sudo_user == NULL)
+        argv0 = process->rule->program;
+    else
+        argv0 = PATH_SUDO;
+    execv(argv0, (char **) process->argv);
+    sysdie("cannot execute command");
+}
+
+
 /*
  * Start the child process.  This runs as a one-time event inside the event
  * loop, forks off the child process, and sets up the events that process
@@ -155,9 +262,11 @@ start(evutil_socket_t junk UNUSED, short what UNUSED, void *data)
     socket_type stdinout_fds[2] = {INVALID_SOCKET, INVALID_SOCKET};
     socket_type stderr_fds[2] = {INVALID_SOCKET, INVALID_SOCKET};
     socket_type fd;
-    struct sigaction sa;
-    const char *argv0;
-    char *expires;
+    struct timeval spawn_start;
+
+    /* Time from here until the child has been forked. */
+    server_metrics_start(&spawn_start);
+    process->started = server_clock();
 
     /*
      * Socket pairs are used for communication with the child process that
@@ -231,75 +340,17 @@ start(evutil_socket_t junk UNUSED, short what UNUSED, void *data)
         }
         close(stdinout_fds[1]);
 
-        /*
-         * Older versions of MIT Kerberos left the replay cache file open
-         * across exec.  Newer versions correctly set it close-on-exec, but
-         * close our low-numbered file descriptors anyway for older versions.
-         * We're just trying to get the replay cache, so we don't have to go
-         * very high.
-         */
-        for (fd = 3; fd < 16; fd++)
-            close(fd);
-
-        /*
-         * Restore the default SIGPIPE handler.  The server sets it to
-         * SIG_IGN, which is inherited by children.  We want the child to have
-         * a default set of signal handlers.
-         */
-        memset(&sa, 0, sizeof(sa));
-        sa.sa_handler = SIG_DFL;
-        if (sigaction(SIGPIPE, &sa, NULL) < 0)
-            sysdie("cannot clear SIGPIPE handler");
-
-        /*
-         * Put the authenticated principal and other connection and command
-         * information in the environment.  REMUSER is for backwards
-         * compatibility with earlier versions of remctl.
-         */
-        if (setenv("REMUSER", client->user, 1) < 0)
-            sysdie("cannot set REMUSER in environment");
-        if (setenv("REMOTE_USER", client->user, 1) < 0)
-            sysdie("cannot set REMOTE_USER in environment");
-        if (setenv("REMOTE_ADDR", client->ipaddress, 1) < 0)
-            sysdie("cannot set REMOTE_ADDR in environment");
-        if (client->hostname != NULL)
-            if (setenv("REMOTE_HOST", client->hostname, 1) < 0)
-                sysdie("cannot set REMOTE_HOST in environment");
-        if (setenv("REMCTL_COMMAND", process->command, 1) < 0)
-            sysdie("cannot set REMCTL_COMMAND in environment");
-        xasprintf(&expires, "%lu", (unsigned long) client->expires);
-        if (setenv("REMOTE_EXPIRES", expires, 1) < 0)
-            sysdie("cannot set REMOTE_EXPIRES in environment");
-        free(expires);
-
-        /* Drop privileges if requested. */
-        if (process->rule->user != NULL && process->rule->uid > 0) {
-            if (initgroups(process->rule->user, process->rule->gid) != 0)
-                sysdie("cannot initgroups for %s\n", process->rule->user);
-            if (setgid(process->rule->gid) != 0)
-                sysdie("cannot setgid to %lu\n",
-                       (unsigned long) process->rule->gid);
-            if (setuid(process->rule->uid) != 0)
-                sysdie("cannot setuid to %lu\n",
-                       (unsigned long) process->rule->uid);
-        }
-
-        /*
-         * Run the command.  On error, we intentionally don't reveal
-         * information about the command we ran.  We have to cast away const
-         * because the prototype for execv is historically incorrect even
-         * though it doesn't modify its arguments.
-         */
-        if (process->rule->sudo_user == NULL)
-            argv0 = process->rule->program;
-        else
-            argv0 = PATH_SUDO;
-        if (execv(argv0, (char **) process->argv) < 0)
-            sysdie("cannot execute command");
-        break;
+        /* Run the command.  This does not return. */
+        exec_command(process);
 
     /* In the parent.  Close the other sides of the socket pairs. */
     default:
+        process->spawned = server_clock();
+        server_metrics_time(METRICS_SPAWN, &spawn_start);
+        PROBE3(server__spawn, process->pid, process->rule->program,
+               process->id);
+        server_scoreboard_command(process->command, process->subcommand,
+                                  process->pid);
         close(stdinout_fds[1]);
         stdinout_fds[1] = INVALID_SOCKET;
         process->stdinout_fd = stdinout_fds[0];
@@ -355,6 +406,7 @@ fail:
         close(stderr_fds[0]);
     if (stderr_fds[1] != INVALID_SOCKET)
         close(stderr_fds[1]);
+    server_metrics_count(METRICS_SPAWN_FAILED, 1);
     client->error(client, ERROR_INTERNAL, "Internal failure");
     process->saw_error = true;
     event_base_loopbreak(process->loop);
@@ -373,6 +425,7 @@ bool
 server_process_run(struct process *process)
 {
     bool success;
+    int flags;
     struct event_base *loop;
     const struct client *client = process->client;
     const struct timeval immediate = {0, 0};
@@ -417,14 +470,36 @@ server_process_run(struct process *process)
      * if process->saw_output remains true and we didn't break out of the loop
      * (indicating an error).  The saw_output flag will be set by the event
      * handlers if we see any output from the process.
+     *
+     * While output is still queued for the client, we instead wait for the
+     * client to accept more of it, since we can't finish until it's sent and
+     * reading from the process may be paused until then.  Similarly, wait for
+     * the bandwidth limit if reading from the process is throttled.
      */
     process->saw_output = true;
-    while (process->saw_output && !event_base_got_break(loop)) {
+    while ((process->saw_output || output_pending(process))
+           && !event_base_got_break(loop)) {
+        flags = output_pending(process) ? EVLOOP_ONCE : EVLOOP_NONBLOCK;
         process->saw_output = false;
-        if (event_base_loop(loop, EVLOOP_NONBLOCK) < 0)
+        if (event_base_loop(loop, flags) < 0)
             die("internal error: process event loop failed");
     }
 
+    /*
+     * Stop queuing output for the client and put its socket back into
+     * blocking mode.  Output is only left in the queue if we're aborting.
+     */
+    if (process->queue != NULL) {
+        bufferevent_free(process->queue);
+        process->queue = NULL;
+        fdflag_nonblocking(client->fd, false);
+    }
+    if (process->throttle != NULL) {
+        event_del(process->throttle);
+        event_free(process->throttle);
+        process->throttle = NULL;
+    }
+
     /* Close down the file descriptors now that we have all the data. */
     close(process->stdinout_fd);
     if (client->protocol > 1)
@@ -443,8 +518,11 @@ server_process_run(struct process *process)
      * of keeping the remctld process around until the child completes.
      */
     if (event_base_got_break(loop)) {
-        if (!process->reaped)
+        if (!process->reaped) {
             waitpid(process->pid, &process->status, 0);
+            process->exited = server_clock();
+            PROBE2(server__reap, process->pid, process->status);
+        }
         return false;
     }
 
@@ -471,3 +549,45 @@ server_process_run(struct process *process)
     event_base_free(loop);
     return success;
 }
+
+
+/*
+ * Run a command in place of the current process rather than as a child.  This
+ * is used by remctl-shell, which has nothing to do with the output of the
+ * command other than pass it along to ssh.  The command inherits the client
+ * file descriptors as its standard output and standard error, so its output
+ * goes directly to the client, and its exit status is seen directly by sshd.
+ * Standard input is /dev/null, so this is only usable for commands that don't
+ * take input.  Does not return.
+ */
+void
+server_process_exec(struct process *process)
+{
+    struct client *client = process->client;
+    int fd;
+
+    message_fatal_cleanup = child_die_handler;
+    server_scoreboard_command(process->command, process->subcommand,
+                              getpid());
+
+    /* Set up standard input, ignoring failure as for a child process. */
+    close(0);
+    fd = open("/dev/null", O_RDONLY);
+    if (fd > 0) {
+        dup2(fd, 0);
+        close(fd);
+    }
+
+    /* Set up stdout and stderr if they aren't already the client. */
+    if (client->fd != 1)
+        dup2(client->fd, 1);
+    if (client->stderr_fd != 2)
+        dup2(client->stderr_fd, 2);
+
+    /*
+     * Flush output in case -S was given and we've been writing log messages
+     * to standard output, and then run the command.
+     */
+    fflush(stdout);
+    exec_command(process);
+}
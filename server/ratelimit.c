@@ -0,0 +1,246 @@
+/*
+ * Token-bucket rate limits for the remctld server.
+ *
+ * When running as a stand-alone daemon, remctld can limit the rate of
+ * connections from each client IP address, the rate of commands from each
+ * principal, and the bandwidth of command output sent to each principal.
+ * Each limit is a token bucket that refills at a fixed rate up to a maximum
+ * burst size.  The buckets live in an anonymous shared memory segment created
+ * before any children are forked, so the limits apply across all
+ * connections.  The parent checks the connection limit before forking and
+ * the children check the other limits.
+ *
+ * The buckets are kept in a fixed-size hash table with linear probing.  If
+ * all of the probed entries are in use by other keys, the least recently
+ * used one is taken over, which at worst forgets the history of an idle
+ * client.  The table is protected by a lock, which is only held while
+ * updating a single bucket.  If a process dies while holding it, the bucket
+ * it was updating may be corrupt, so all buckets are cleared, which only
+ * forgets the recent history of every client.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <errno.h>
+#include <time.h>
+
+#include <server/internal.h>
+
+/* Size of the hash table and the number of entries probed for a key. */
+#define RATELIMIT_BUCKETS 4096
+#define RATELIMIT_PROBES  16
+
+/* Maximum length of a key (IP address or principal), including the nul. */
+#define RATELIMIT_KEY_MAX 256
+
+/* A single token bucket. */
+struct bucket {
+    uint32_t type;               /* enum ratelimit_type, plus one. */
+    char key[RATELIMIT_KEY_MAX]; /* IP address or principal. */
+    double tokens;               /* Tokens available, may be negative. */
+    double updated;              /* server_clock time of the last update. */
+};
+
+/* The contents of the shared memory segment. */
+struct ratelimit_table {
+    struct bucket buckets[RATELIMIT_BUCKETS];
+};
+
+/* The configured limits, indexed by enum ratelimit_type. */
+static struct {
+    double rate;  /* Tokens added per second, or 0 for no limit. */
+    double burst; /* Maximum number of tokens. */
+} limits[RATELIMIT_MAX];
+
+/* The shared memory segment, or NULL if rate limiting is not enabled. */
+static struct ratelimit_table *table = NULL;
+
+/* The lock protecting the shared memory segment. */
+static struct shared_lock *lock = NULL;
+
+
+/*
+ * Set a limit.  A rate of zero disables that limit.  This must be called
+ * before server_ratelimit_init and before forking any children.
+ */
+void
+server_ratelimit_set(enum ratelimit_type type, double rate, double burst)
+{
+    limits[type].rate = rate;
+    limits[type].burst = burst;
+}
+
+
+/*
+ * Create the shared memory segment if any limits are set.  This must be
+ * called before forking any children that should share the limits.  Dies on
+ * failure.
+ */
+void
+server_ratelimit_init(void)
+{
+    size_t i;
+
+    for (i = 0; i < RATELIMIT_MAX; i++)
+        if (limits[i].rate > 0)
+            break;
+    if (i == RATELIMIT_MAX)
+        return;
+    table = server_shared_new(sizeof(struct ratelimit_table), "rate limits");
+    lock = server_shared_lock_new();
+}
+
+
+/*
+ * Release the shared memory segment.  After this, all checks succeed.
+ */
+void
+server_ratelimit_free(void)
+{
+    if (table == NULL)
+        return;
+    server_shared_free(table, sizeof(struct ratelimit_table));
+    server_shared_lock_free(lock);
+    table = NULL;
+    lock = NULL;
+}
+
+
+/*
+ * Find the bucket for a key, creating or taking over an entry if needed.
+ * The table must be locked.  Returns the bucket with its tokens refilled up
+ * to the current time.
+ */
+static struct bucket *
+find_bucket(enum ratelimit_type type, const char *key, double now)
+{
+    struct bucket *bucket, *oldest = NULL;
+    const unsigned char *p;
+    uint32_t hash = 2166136261U;
+    size_t i, length;
+
+    /* FNV-1a hash of the type and key. */
+    hash = (hash ^ (uint32_t) type) * 16777619U;
+    for (p = (const unsigned char *) key; *p != '\0'; p++)
+        hash = (hash ^ *p) * 16777619U;
+
+    /* Look for the key, an empty entry, or the least recently used one. */
+    for (i = 0; i < RATELIMIT_PROBES; i++) {
+        bucket = &table->buckets[(hash + i) % RATELIMIT_BUCKETS];
+        if (bucket->type == 0)
+            break;
+        if (bucket->type == type + 1 && strcmp(bucket->key, key) == 0) {
+            bucket->tokens += (now - bucket->updated) * limits[type].rate;
+            if (bucket->tokens > limits[type].burst)
+                bucket->tokens = limits[type].burst;
+            bucket->updated = now;
+            return bucket;
+        }
+        if (oldest == NULL || bucket->updated < oldest->updated)
+            oldest = bucket;
+    }
+    if (i == RATELIMIT_PROBES)
+        bucket = oldest;
+
+    /* Start a new bucket full. */
+    length = strlen(key);
+    if (length >= sizeof(bucket->key))
+        length = sizeof(bucket->key) - 1;
+    memcpy(bucket->key, key, length);
+    bucket->key[length] = '\0';
+    bucket->type = type + 1;
+    bucket->tokens = limits[type].burst;
+    bucket->updated = now;
+    return bucket;
+}
+
+
+/*
+ * Lock and unlock the table.  If a process died while holding the lock,
+ * start over with empty buckets.
+ */
+static void
+table_lock(void)
+{
+    if (server_shared_lock(lock))
+        memset(table->buckets, 0, sizeof(table->buckets));
+}
+
+static void
+table_unlock(void)
+{
+    server_shared_unlock(lock);
+}
+
+
+/*
+ * Check whether a client identified by key may do n more things of the
+ * given type, and if so, deduct them from its bucket.  Returns true if the
+ * request is allowed and false if it exceeds the limit.
+ */
+bool
+server_ratelimit_check(enum ratelimit_type type, const char *key, double n)
+{
+    struct bucket *bucket;
+    bool okay;
+
+    if (table == NULL || limits[type].rate <= 0)
+        return true;
+    table_lock();
+    bucket = find_bucket(type, key, server_clock());
+    okay = (bucket->tokens >= n);
+    if (okay)
+        bucket->tokens -= n;
+    table_unlock();
+    return okay;
+}
+
+
+/*
+ * Deduct n tokens of the given type from the bucket for key, even if that
+ * puts the bucket in debt.  Returns the number of seconds until the bucket
+ * would no longer be in debt, which is 0 if it still has tokens left.  This
+ * is used to pace output rather than reject it.
+ */
+double
+server_ratelimit_delay(enum ratelimit_type type, const char *key, double n)
+{
+    struct bucket *bucket;
+    double delay;
+
+    if (table == NULL || limits[type].rate <= 0)
+        return 0;
+    table_lock();
+    bucket = find_bucket(type, key, server_clock());
+    bucket->tokens -= n;
+    delay = (bucket->tokens < 0) ? -bucket->tokens / limits[type].rate : 0;
+    table_unlock();
+    return delay;
+}
+
+
+/*
+ * Deduct n tokens of the given type from the bucket for key and then sleep
+ * until the bucket would no longer be in debt.  This is used to pace output
+ * sent outside of an event loop.
+ */
+void
+server_ratelimit_wait(enum ratelimit_type type, const char *key, double n)
+{
+    struct timespec delay;
+    double wait;
+
+    wait = server_ratelimit_delay(type, key, n);
+    if (wait <= 0)
+        return;
+    delay.tv_sec = (time_t) wait;
+    delay.tv_nsec = (long) ((wait - (double) delay.tv_sec) * 1e9);
+    while (nanosleep(&delay, &delay) < 0 && errno == EINTR)
+        ;
+}
@@ -28,8 +28,8 @@
 
 /* Usage message. */
 static const char usage_message[] = "\
-Usage: remctl-shell [-dhqSv] [-f <file>] -c <command>\n\
-       remctl-shell [-dqS] [-f <file>] <user>\n\
+Usage: remctl-shell [-dhqSvx] [-f <file>] -c <command>\n\
+       remctl-shell [-dqSx] [-f <file>] <user>\n\
 \n\
 Options:\n\
     -c <command>  Specifies the command to run\n\
@@ -39,6 +39,7 @@ Options:\n\
     -q            Suppress informational logging (such as the command run)\n\
     -S            Log to standard output/error rather than syslog\n\
     -v            Display the version of remctld\n\
+    -x            Run commands in place so output goes directly to ssh\n\
 \n\
 This is meant to be used as the shell or forced command for a dedicated\n\
 account, and handles incoming commands via ssh.  It must be run under ssh\n\
@@ -87,6 +88,7 @@ main(int argc, char *argv[])
     bool debug = false;
     bool log_stdout = false;
     bool quiet = false;
+    bool direct = false;
     struct sigaction sa;
     const char *command_string = NULL;
     const char *user = NULL;
@@ -112,7 +114,7 @@ main(int argc, char *argv[])
      * Parse options.  Since we're being run as a shell, there isn't all that
      * much here.
      */
-    while ((option = getopt(argc, argv, "c:df:hqS")) != EOF) {
+    while ((option = getopt(argc, argv, "c:df:hqSx")) != EOF) {
         switch (option) {
         case 'c':
             command_string = optarg;
@@ -134,6 +136,9 @@ main(int argc, char *argv[])
         case 'v':
             printf("remctl-shell %s\n", PACKAGE_VERSION);
             exit(0);
+        case 'x':
+            direct = true;
+            break;
         default:
             warn("unknown option -%c", optopt);
             usage(1);
@@ -182,6 +187,7 @@ main(int argc, char *argv[])
 
     /* Create the client struct based on the ssh environment. */
     client = server_ssh_new_client(user);
+    client->direct = direct;
 
     /* Parse and execute the command. */
     command = server_ssh_parse_command(command_string);
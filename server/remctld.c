@@ -22,6 +22,7 @@
 #include <portable/system.h>
 
 #include <signal.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 #include <syslog.h>
 #include <time.h>
@@ -31,6 +32,7 @@
 #include <util/macros.h>
 #include <util/messages.h>
 #include <util/network.h>
+#include <util/probes.h>
 #include <util/vector.h>
 #include <util/xmalloc.h>
 
@@ -52,21 +54,42 @@ static volatile sig_atomic_t config_signaled = 0;
  */
 static volatile sig_atomic_t exit_signaled = 0;
 
+/*
+ * Flag indicating whether it's time to write out the metrics file (only used
+ * in standalone mode with -M).
+ */
+static volatile sig_atomic_t metrics_signaled = 0;
+
+/* How often, in seconds, to write out the metrics file. */
+#define METRICS_INTERVAL 15
+
+/* Default size of the result cache in bytes. */
+#define CACHE_SIZE (16UL * 1024 * 1024)
+
 /* Usage message. */
 static const char usage_message[] = "\
 Usage: remctld <options>\n\
 \n\
 Options:\n\
+    -B <file>     Keep a scoreboard of connections in file, only with -m\n\
     -b <addr>     Bind to a specific address (may be given multiple times)\n\
+    -C <bytes>    Size of the result cache, only with -m (default: 16MB)\n\
     -d            Log verbose debugging information\n\
     -F            Run in the foreground instead of forking and exiting\n\
     -f <file>     Config file (default: " CONFIG_FILE ")\n\
     -h            Display this help\n\
+    -L <count>    Limit the number of commands running at once, only with -m\n\
+    -M <file>     Write metrics to file periodically, only useful with -m\n\
     -m            Stand-alone daemon mode, meant mostly for testing\n\
+    -O <bytes>    Limit output to each principal to bytes per second\n\
     -P <file>     Write PID to file, only useful with -m\n\
     -p <port>     Port to use, only for standalone mode (default: 4373)\n\
+    -Q            Display the scoreboard given with -B and exit\n\
+    -R <rate>     Limit commands per second from each principal\n\
+    -r <rate>     Limit connections per second from each client IP\n\
     -S            Log to standard output/error rather than syslog\n\
     -s <service>  Service principal to use (default: host/<host>)\n\
+    -T <seconds>  Log completion of commands this slow at notice level\n\
     -v            Display the version of remctld\n\
     -Z            Raise SIGSTOP once ready for connections\n\
 \n\
@@ -78,11 +101,17 @@ struct options {
     bool foreground;          /* -F: run in the foreground */
     bool log_stdout;          /* -S: log to standard output and error */
     bool standalone;          /* -m: run in stand-alone daemon mode */
+    bool status;              /* -Q: display the scoreboard */
+    bool ratelimit;           /* -O, -R, -r: some rate limit was set */
     bool suspend;             /* -Z: raise SIGSTOP when ready */
     unsigned short port;      /* -p: port on which to listen */
+    unsigned long limit;      /* -L: limit on running commands */
+    long cache_size;          /* -C: size of the result cache, -1 if unset */
     char *service;            /* -s: service principal to use */
     const char *config_path;  /* -f: path to the configuration file */
+    const char *metrics_path; /* -M: path to the metrics file to write */
     const char *pid_path;     /* -P: path to the PID file to write */
+    const char *board_path;   /* -B: path to the scoreboard file */
     struct vector *bindaddrs; /* -b: bind to a specific address */
 };
 
@@ -116,6 +145,32 @@ usage(int status)
 }
 
 
+/*
+ * Parse a rate limit of the form <rate>[:<burst>] and set it.  The burst
+ * defaults to the rate, but at least one.  Dies on a syntax error.
+ */
+static void
+parse_ratelimit(enum ratelimit_type type, const char *arg)
+{
+    double rate, burst;
+    char *end;
+
+    rate = strtod(arg, &end);
+    if (end == arg || rate <= 0)
+        die("invalid rate limit %s", arg);
+    if (*end == ':') {
+        burst = strtod(end + 1, &end);
+        if (burst < 1)
+            die("invalid rate limit %s", arg);
+    } else {
+        burst = (rate < 1) ? 1 : rate;
+    }
+    if (*end != '\0')
+        die("invalid rate limit %s", arg);
+    server_ratelimit_set(type, rate, burst);
+}
+
+
 /*
  * Signal handler for child processes forked when running in standalone mode.
  * Just set the child_signaled global so that we know to reap the processes
@@ -152,6 +207,18 @@ exit_handler(int sig UNUSED)
 }
 
 
+/*
+ * Signal handler for the alarm used to write out the metrics file when
+ * running in standalone mode.  Set the metrics_signaled global so that we do
+ * this the next time through the processing loop.
+ */
+static void
+metrics_handler(int sig UNUSED)
+{
+    metrics_signaled = 1;
+}
+
+
 /*
  * Given a service name, imports it and acquires credentials for it, storing
  * them in the second argument.  Returns true on success and false on failure,
@@ -198,15 +265,20 @@ static void
 handle_connection(int fd, struct config *config, gss_cred_id_t creds)
 {
     struct client *client;
+    struct timeval start;
 
     /* Establish a context with the client. */
+    PROBE1(server__accept, fd);
+    server_metrics_start(&start);
     client = server_new_client(fd, creds);
+    server_metrics_time(METRICS_HANDSHAKE, &start);
     if (client == NULL) {
         close(fd);
         return;
     }
     debug("accepted connection from %s (protocol %d)", client->user,
           client->protocol);
+    server_scoreboard_user(client->user);
 
     /*
      * Now, we process incoming commands.  This is handled differently
@@ -397,6 +469,15 @@ server_daemon(struct options *options, struct config *config,
     if (sigaction(SIGHUP, &sa, NULL) < 0)
         sysdie("cannot set SIGHUP handler");
 
+    /* Set up a SIGALRM handler so that we know when to write metrics. */
+    if (options->metrics_path != NULL) {
+        sa.sa_handler = metrics_handler;
+        if (sigaction(SIGALRM, &sa, NULL) < 0)
+            sysdie("cannot set SIGALRM handler");
+        server_metrics_write(options->metrics_path);
+        alarm(METRICS_INTERVAL);
+    }
+
     /* Bind to the network sockets and configure listening addresses. */
     bind_sockets(options, &fds, &nfds);
 
@@ -433,8 +514,12 @@ server_daemon(struct options *options, struct config *config,
     while (1) {
         if (child_signaled) {
             child_signaled = 0;
-            while ((child = waitpid(0, &status, WNOHANG)) > 0)
+            while ((child = waitpid(0, &status, WNOHANG)) > 0) {
                 log_child(child, status);
+                server_scoreboard_reap(child);
+                server_limits_reap(child);
+                server_cache_reap(child);
+            }
             if (child < 0 && errno != ECHILD)
                 sysdie("waitpid failed");
         }
@@ -445,6 +530,14 @@ server_daemon(struct options *options, struct config *config,
             config = server_config_load(options->config_path);
             if (config == NULL)
                 die("cannot load configuration file %s", options->config_path);
+            server_metrics_rules(config);
+            server_limits_rules(config);
+            server_cache_flush();
+        }
+        if (metrics_signaled) {
+            metrics_signaled = 0;
+            server_metrics_write(options->metrics_path);
+            alarm(METRICS_INTERVAL);
         }
         if (exit_signaled) {
             notice("signal received, exiting");
@@ -458,7 +551,16 @@ server_daemon(struct options *options, struct config *config,
             continue;
         }
         fdflag_close_exec(s, true);
+        server_metrics_count(METRICS_CONNECTIONS, 1);
+        network_sockaddr_sprint(ip, sizeof(ip), (struct sockaddr *) &ss);
+        if (!server_ratelimit_check(RATELIMIT_CONNECTIONS, ip, 1)) {
+            notice("connection from %s exceeds rate limit", ip);
+            close(s);
+            continue;
+        }
+        server_scoreboard_connect((struct sockaddr *) &ss);
         child = fork();
+        server_scoreboard_forked(child);
         if (child < 0) {
             syswarn("forking a new child failed");
             warn("sleeping ten seconds in the hope we recover...");
@@ -475,13 +577,16 @@ server_daemon(struct options *options, struct config *config,
             if (options->log_stdout)
                 fflush(stdout);
             server_config_free(config);
+            server_scoreboard_free();
+            server_ratelimit_free();
+            server_limits_free();
+            server_cache_free();
             vector_free(options->bindaddrs);
             libevent_global_shutdown();
             message_handlers_reset();
             exit(0);
         } else {
             close(s);
-            network_sockaddr_sprint(ip, sizeof(ip), (struct sockaddr *) &ss);
             debug("child %lu for %s", (unsigned long) child, ip);
         }
     }
@@ -492,6 +597,14 @@ server_daemon(struct options *options, struct config *config,
      */
     if (options->pid_path != NULL)
         unlink(options->pid_path);
+    if (options->board_path != NULL) {
+        server_scoreboard_free();
+        unlink(options->board_path);
+    }
+    if (options->metrics_path != NULL) {
+        alarm(0);
+        server_metrics_write(options->metrics_path);
+    }
     for (i = 0; i < nfds; i++)
         close(fds[i]);
     network_bind_all_free(fds);
@@ -508,8 +621,10 @@ int
 main(int argc, char *argv[])
 {
     struct options options;
+    const char *optstring;
     int option;
-    long tmp_port;
+    long tmp_port, tmp_limit;
+    double slow;
     char *end;
     struct sigaction sa;
     gss_cred_id_t creds = GSS_C_NO_CREDENTIAL;
@@ -532,15 +647,25 @@ main(int argc, char *argv[])
     /* Initialize options. */
     memset(&options, 0, sizeof(options));
     options.port = 4373;
+    options.cache_size = -1;
     options.config_path = CONFIG_FILE;
     options.bindaddrs = vector_new();
 
     /* Parse options. */
-    while ((option = getopt(argc, argv, "b:dFf:hk:mP:p:Ss:vZ")) != EOF) {
+    optstring = "B:b:C:dFf:hk:L:M:mO:P:p:QR:r:Ss:T:vZ";
+    while ((option = getopt(argc, argv, optstring)) != EOF) {
         switch (option) {
+        case 'B':
+            options.board_path = optarg;
+            break;
         case 'b':
             vector_add(options.bindaddrs, optarg);
             break;
+        case 'C':
+            options.cache_size = strtol(optarg, &end, 10);
+            if (*end != '\0' || options.cache_size < 0)
+                die("invalid result cache size %s", optarg);
+            break;
         case 'd':
             options.debug = true;
             break;
@@ -556,9 +681,22 @@ main(int argc, char *argv[])
             if (setenv("KRB5_KTNAME", optarg, 1) < 0)
                 sysdie("cannot set KRB5_KTNAME");
             break;
+        case 'L':
+            tmp_limit = strtol(optarg, &end, 10);
+            if (*end != '\0' || tmp_limit < 1)
+                die("invalid limit on running commands %s", optarg);
+            options.limit = (unsigned long) tmp_limit;
+            break;
+        case 'M':
+            options.metrics_path = optarg;
+            break;
         case 'm':
             options.standalone = true;
             break;
+        case 'O':
+            parse_ratelimit(RATELIMIT_OUTPUT, optarg);
+            options.ratelimit = true;
+            break;
         case 'P':
             options.pid_path = optarg;
             break;
@@ -568,12 +706,29 @@ main(int argc, char *argv[])
                 die("invalid port number %ld", tmp_port);
             options.port = (unsigned short) tmp_port;
             break;
+        case 'Q':
+            options.status = true;
+            break;
+        case 'R':
+            parse_ratelimit(RATELIMIT_COMMANDS, optarg);
+            options.ratelimit = true;
+            break;
+        case 'r':
+            parse_ratelimit(RATELIMIT_CONNECTIONS, optarg);
+            options.ratelimit = true;
+            break;
         case 'S':
             options.log_stdout = true;
             break;
         case 's':
             options.service = optarg;
             break;
+        case 'T':
+            slow = strtod(optarg, &end);
+            if (*end != '\0' || slow < 0)
+                die("invalid slow command threshold %s", optarg);
+            server_log_set_slow(slow);
+            break;
         case 'v':
             printf("remctld %s\n", PACKAGE_VERSION);
             exit(0);
@@ -590,6 +745,26 @@ main(int argc, char *argv[])
         die("-b only makes sense in combination with -m");
     if (options.suspend && !options.standalone)
         die("-Z only makes sense in combination with -m");
+    if (options.metrics_path != NULL && !options.standalone)
+        die("-M only makes sense in combination with -m");
+    if (options.limit > 0 && !options.standalone)
+        die("-L only makes sense in combination with -m");
+    if (options.cache_size >= 0 && !options.standalone)
+        die("-C only makes sense in combination with -m");
+    if (options.ratelimit && !options.standalone)
+        die("-O, -R, and -r only make sense in combination with -m");
+    if (options.status && options.board_path == NULL)
+        die("-Q requires a scoreboard file given with -B");
+    if (options.board_path != NULL && !options.standalone && !options.status)
+        die("-B only makes sense in combination with -m or -Q");
+
+    /* If asked to display the scoreboard, do that and exit. */
+    if (options.status) {
+        if (!server_scoreboard_print(options.board_path, stdout))
+            exit(1);
+        vector_free(options.bindaddrs);
+        exit(0);
+    }
 
     /* Daemonize if told to do so. */
     if (options.standalone && !options.foreground)
@@ -617,6 +792,26 @@ main(int argc, char *argv[])
     if (config == NULL)
         die("cannot read configuration file %s", options.config_path);
 
+    /*
+     * Create the shared memory for metrics, the scoreboard, rate limits,
+     * concurrency limits, and the result cache before forking any children so
+     * that they all update the same data.
+     */
+    if (options.metrics_path != NULL) {
+        server_metrics_init();
+        server_metrics_rules(config);
+    }
+    if (options.board_path != NULL)
+        server_scoreboard_init(options.board_path);
+    server_ratelimit_init();
+    if (options.standalone) {
+        server_limits_init(options.limit);
+        server_limits_rules(config);
+        if (options.cache_size < 0)
+            options.cache_size = CACHE_SIZE;
+        server_cache_init((size_t) options.cache_size);
+    }
+
     /*
      * If a service was specified, we should load only those credentials since
      * those are the only ones we're allowed to use.  Otherwise, creds will
@@ -638,6 +833,10 @@ main(int argc, char *argv[])
         server_daemon(&options, config, creds);
 
     /* Clean up and exit. */
+    server_cache_free();
+    server_limits_free();
+    server_ratelimit_free();
+    server_metrics_free();
     server_config_free(config);
     if (creds != GSS_C_NO_CREDENTIAL)
         gss_release_cred(&minor, &creds);
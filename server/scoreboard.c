@@ -0,0 +1,385 @@
+/*
+ * Scoreboard of active connections for the remctld server.
+ *
+ * When running as a stand-alone daemon, remctld can keep a table of its
+ * children in a file mapped into shared memory, similar to the Apache
+ * scoreboard.  The parent claims a slot for each connection before forking
+ * the child and frees it when the child is reaped, so slot allocation never
+ * races.  Each child then only updates its own slot with its state, the
+ * client identity, the command it's running, and the bytes transferred.
+ *
+ * Since the table is in a file, any process that can read the file can
+ * display it, which is what remctld -Q does.  Nothing is locked, so a reader
+ * may see a slot in the middle of an update, which is harmless for a status
+ * display.  If the scoreboard wasn't enabled with -B, all of the update
+ * functions do nothing.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/socket.h>
+#include <portable/system.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <server/internal.h>
+#include <util/messages.h>
+#include <util/network.h>
+
+/* Identifies a scoreboard file and the version of its layout. */
+#define SCOREBOARD_MAGIC   "remctlSB"
+#define SCOREBOARD_VERSION 1
+
+/* The number of slots, which limits the number of tracked connections. */
+#define SCOREBOARD_SLOTS 256
+
+/* Maximum lengths of the strings stored in a slot, including the nul. */
+#define SCOREBOARD_USER_MAX    256
+#define SCOREBOARD_ADDRESS_MAX 64
+#define SCOREBOARD_COMMAND_MAX 256
+
+/* Names of the states for display, indexed by enum scoreboard_state. */
+static const char *const state_names[] = {
+    "free", "handshake", "idle", "running", "output",
+};
+
+/* The information about one connection. */
+struct scoreboard_slot {
+    uint32_t state;           /* enum scoreboard_state. */
+    int32_t pid;              /* PID of the child handling the connection. */
+    int32_t command_pid;      /* PID of the running command, if any. */
+    uint32_t commands;        /* Number of commands run so far. */
+    int64_t started;          /* When the connection was accepted. */
+    int64_t command_started;  /* When the current command was started. */
+    uint64_t bytes_in;        /* Bytes of command arguments received. */
+    uint64_t bytes_out;       /* Bytes of command output sent. */
+    char user[SCOREBOARD_USER_MAX];
+    char address[SCOREBOARD_ADDRESS_MAX];
+    char command[SCOREBOARD_COMMAND_MAX];
+};
+
+/* The contents of the scoreboard file. */
+struct scoreboard {
+    char magic[8];
+    uint32_t version;
+    uint32_t nslots;
+    int64_t started;
+    int32_t pid;
+    struct scoreboard_slot slots[SCOREBOARD_SLOTS];
+};
+
+/* The mapped scoreboard, or NULL if it is not enabled. */
+static struct scoreboard *scoreboard = NULL;
+
+/*
+ * The slot for the current connection.  In the parent, this is the slot
+ * claimed for the connection about to be forked.  In the child, it's the slot
+ * inherited from the parent, or NULL if there was no free slot.
+ */
+static struct scoreboard_slot *current = NULL;
+
+
+/*
+ * Copy a string into a fixed-size buffer, truncating it if needed.
+ */
+static void
+copy_string(char *dest, const char *src, size_t size)
+{
+    size_t length;
+
+    length = strlen(src);
+    if (length >= size)
+        length = size - 1;
+    memcpy(dest, src, length);
+    dest[length] = '\0';
+}
+
+
+/*
+ * Create the scoreboard file and map it into memory.  This must be called
+ * before forking any children.  Any existing file is removed and a new one
+ * created, rather than opening and truncating it, so that remctld running as
+ * root never follows a symlink to some other file.  The file is only
+ * readable by its owner since it contains client identities and commands.
+ * Dies on failure.
+ */
+void
+server_scoreboard_init(const char *path)
+{
+    int fd;
+    void *mapping;
+
+    if (unlink(path) < 0 && errno != ENOENT)
+        sysdie("cannot remove old scoreboard %s", path);
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        sysdie("cannot create scoreboard %s", path);
+    if (ftruncate(fd, sizeof(struct scoreboard)) < 0)
+        sysdie("cannot size scoreboard %s", path);
+    mapping = mmap(NULL, sizeof(struct scoreboard), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+        sysdie("cannot map scoreboard %s", path);
+    close(fd);
+    scoreboard = mapping;
+    scoreboard->version = SCOREBOARD_VERSION;
+    scoreboard->nslots = SCOREBOARD_SLOTS;
+    scoreboard->started = time(NULL);
+    scoreboard->pid = getpid();
+    memcpy(scoreboard->magic, SCOREBOARD_MAGIC, sizeof(scoreboard->magic));
+}
+
+
+/*
+ * Unmap the scoreboard.  After this, all updates are ignored.  The file is
+ * left alone; the caller should remove it if appropriate.
+ */
+void
+server_scoreboard_free(void)
+{
+    if (scoreboard == NULL)
+        return;
+    munmap(scoreboard, sizeof(struct scoreboard));
+    scoreboard = NULL;
+    current = NULL;
+}
+
+
+/*
+ * Claim a slot for a new connection from the given address.  Only the parent
+ * process may call this, before forking the child.  If all slots are in use,
+ * the connection is not tracked.
+ */
+void
+server_scoreboard_connect(const struct sockaddr *addr)
+{
+    struct scoreboard_slot *slot;
+    char ip[INET6_ADDRSTRLEN];
+    size_t i;
+
+    current = NULL;
+    if (scoreboard == NULL)
+        return;
+    for (i = 0; i < SCOREBOARD_SLOTS; i++)
+        if (scoreboard->slots[i].state == SCOREBOARD_FREE)
+            break;
+    if (i == SCOREBOARD_SLOTS)
+        return;
+    slot = &scoreboard->slots[i];
+    memset(slot, 0, sizeof(*slot));
+    slot->started = time(NULL);
+    if (network_sockaddr_sprint(ip, sizeof(ip), addr))
+        copy_string(slot->address, ip, sizeof(slot->address));
+    slot->state = SCOREBOARD_HANDSHAKE;
+    current = slot;
+}
+
+
+/*
+ * Record the result of forking the child for the connection.  This is called
+ * in both the parent and the child with the return value of fork.  A
+ * negative value means the fork failed and frees the slot again.
+ */
+void
+server_scoreboard_forked(pid_t child)
+{
+    if (current == NULL)
+        return;
+    if (child == 0) {
+        current->pid = getpid();
+        return;
+    }
+    if (child < 0)
+        current->state = SCOREBOARD_FREE;
+    else
+        current->pid = child;
+    current = NULL;
+}
+
+
+/*
+ * Free the slot of a child that has exited.  Only the parent process may call
+ * this.
+ */
+void
+server_scoreboard_reap(pid_t child)
+{
+    size_t i;
+
+    if (scoreboard == NULL)
+        return;
+    for (i = 0; i < SCOREBOARD_SLOTS; i++)
+        if (scoreboard->slots[i].pid == child) {
+            scoreboard->slots[i].state = SCOREBOARD_FREE;
+            scoreboard->slots[i].pid = 0;
+            return;
+        }
+}
+
+
+/*
+ * Change the state of the current connection.  Returning to idle also clears
+ * the information about the previous command.
+ */
+void
+server_scoreboard_state(enum scoreboard_state state)
+{
+    if (current == NULL)
+        return;
+    if (state == SCOREBOARD_IDLE) {
+        current->command_pid = 0;
+        current->command_started = 0;
+        current->command[0] = '\0';
+    }
+    current->state = state;
+}
+
+
+/*
+ * Record the identity of the client once the GSS-API context is established,
+ * which also moves the connection to idle.
+ */
+void
+server_scoreboard_user(const char *user)
+{
+    if (current == NULL)
+        return;
+    copy_string(current->user, user, sizeof(current->user));
+    server_scoreboard_state(SCOREBOARD_IDLE);
+}
+
+
+/*
+ * Record that a command has been started.  Takes the command, subcommand
+ * (which may be NULL), and the PID of the running program.
+ */
+void
+server_scoreboard_command(const char *command, const char *subcommand,
+                          pid_t pid)
+{
+    char buffer[SCOREBOARD_COMMAND_MAX];
+
+    if (current == NULL)
+        return;
+    snprintf(buffer, sizeof(buffer), "%s%s%s", command,
+             (subcommand == NULL) ? "" : " ",
+             (subcommand == NULL) ? "" : subcommand);
+    copy_string(current->command, buffer, sizeof(current->command));
+    current->command_pid = pid;
+    current->command_started = time(NULL);
+    current->commands++;
+    current->state = SCOREBOARD_RUNNING;
+}
+
+
+/*
+ * Add to the bytes transferred for the current connection.
+ */
+void
+server_scoreboard_bytes(size_t in, size_t out)
+{
+    if (current == NULL)
+        return;
+    current->bytes_in += in;
+    current->bytes_out += out;
+}
+
+
+/*
+ * Print the contents of the scoreboard file at the given path to the given
+ * output, one line per active connection.  This does not require the
+ * scoreboard to be initialized and is normally done by a separate process.
+ * Returns true on success and false on failure, logging a warning.
+ */
+bool
+server_scoreboard_print(const char *path, FILE *output)
+{
+    int fd;
+    void *mapping;
+    const struct scoreboard *board;
+    const struct scoreboard_slot *slot;
+    struct stat st;
+    time_t now;
+    size_t i, active;
+    uint32_t state;
+    bool okay = false;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        syswarn("cannot open scoreboard %s", path);
+        return false;
+    }
+    if (fstat(fd, &st) < 0) {
+        syswarn("cannot stat scoreboard %s", path);
+        close(fd);
+        return false;
+    }
+    if ((size_t) st.st_size < sizeof(struct scoreboard)) {
+        warn("scoreboard %s is too short", path);
+        close(fd);
+        return false;
+    }
+    mapping = mmap(NULL, sizeof(struct scoreboard), PROT_READ, MAP_SHARED, fd,
+                   0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        syswarn("cannot map scoreboard %s", path);
+        return false;
+    }
+    board = mapping;
+    if (memcmp(board->magic, SCOREBOARD_MAGIC, sizeof(board->magic)) != 0
+        || board->version != SCOREBOARD_VERSION
+        || board->nslots != SCOREBOARD_SLOTS) {
+        warn("%s is not a remctld scoreboard", path);
+        goto done;
+    }
+
+    /* Print a summary line, a header, and then the active slots. */
+    now = time(NULL);
+    active = 0;
+    for (i = 0; i < SCOREBOARD_SLOTS; i++)
+        if (board->slots[i].state != SCOREBOARD_FREE)
+            active++;
+    fprintf(output, "remctld %ld, up %lds, %lu of %lu slots in use\n",
+            (long) board->pid, (long) (now - board->started),
+            (unsigned long) active, (unsigned long) SCOREBOARD_SLOTS);
+    fprintf(output, "%7s %-9s %6s %6s %4s %10s %10s %7s %s\n", "PID", "STATE",
+            "CONN", "CMD", "CMDS", "IN", "OUT", "CMDPID",
+            "ADDRESS PRINCIPAL COMMAND");
+    for (i = 0; i < SCOREBOARD_SLOTS; i++) {
+        slot = &board->slots[i];
+        state = slot->state;
+        if (state == SCOREBOARD_FREE || state > SCOREBOARD_OUTPUT)
+            continue;
+        fprintf(output, "%7ld %-9s %6ld %6ld %4lu %10llu %10llu %7ld",
+                (long) slot->pid, state_names[state],
+                (long) (now - slot->started),
+                slot->command_started == 0
+                    ? 0L
+                    : (long) (now - slot->command_started),
+                (unsigned long) slot->commands,
+                (unsigned long long) slot->bytes_in,
+                (unsigned long long) slot->bytes_out,
+                (long) slot->command_pid);
+        fprintf(output, " %.*s %.*s %.*s\n",
+                (int) sizeof(slot->address) - 1,
+                slot->address[0] == '\0' ? "-" : slot->address,
+                (int) sizeof(slot->user) - 1,
+                slot->user[0] == '\0' ? "-" : slot->user,
+                (int) sizeof(slot->command) - 1,
+                slot->command[0] == '\0' ? "-" : slot->command);
+    }
+    okay = true;
+
+done:
+    munmap(mapping, sizeof(struct scoreboard));
+    return okay;
+}
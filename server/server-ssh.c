@@ -145,23 +145,43 @@ fail:
 }
 
 
+/*
+ * Send a block of output to our standard output or standard error, depending
+ * on the stream.  Returns true on success and false on failure (and logs a
+ * message on failure).
+ */
+static bool
+send_output(struct client *client, int stream, struct evbuffer *output)
+{
+    int fd;
+
+    fd = (stream == 1) ? client->fd : client->stderr_fd;
+    while (evbuffer_get_length(output) > 0)
+        if (evbuffer_write(output, fd) < 0) {
+            syswarn("error sending output");
+            client->fatal = true;
+            return false;
+        }
+    return true;
+}
+
+
 /*
  * Handle one block of output from the running command.
  */
 static void
 handle_output(struct bufferevent *bev, void *data)
 {
-    int fd;
+    int stream;
     struct evbuffer *buf;
     struct process *process = data;
-    struct client *client = process->client;
 
     process->saw_output = true;
-    fd = (bev == process->inout) ? client->fd : client->stderr_fd;
+    stream = (bev == process->inout) ? 1 : 2;
     buf = bufferevent_get_input(bev);
-    if (evbuffer_write(buf, fd) < 0) {
-        syswarn("error sending output");
-        client->fatal = true;
+    process->bytes[stream - 1] += evbuffer_get_length(buf);
+    server_cache_record(process, stream, buf);
+    if (!send_output(process->client, stream, buf)) {
         process->saw_error = true;
         event_base_loopbreak(process->loop);
     }
@@ -171,7 +191,9 @@ handle_output(struct bufferevent *bev, void *data)
 /*
  * Set up to execute a command.  For the ssh protocol, all we need to do is
  * install output handlers for both stdout and stderr that just send the
- * output back to our stdout and stderr.
+ * output back to our stdout and stderr.  With -x, this is only used for
+ * commands that take input on standard input or whose output is cached, since
+ * other commands are run in place of remctl-shell.
  */
 static void
 command_setup(struct process *process)
@@ -278,6 +300,7 @@ server_ssh_new_client(const char *user)
 
     /* Add ssh protocol callbacks. */
     client->setup = command_setup;
+    client->output = send_output;
     client->finish = command_finish;
     client->error = send_error;
 
@@ -132,7 +132,8 @@ server_v1_send_output(struct client *client, struct evbuffer *output,
     if (evbuffer_remove(output, p, outlen) < 0)
         die("internal error: cannot move data from output buffer");
 
-    /* Send the token. */
+    /* Pace the output if there is a bandwidth limit, and send the token. */
+    server_ratelimit_wait(RATELIMIT_OUTPUT, client->user, (double) outlen);
     status = token_send_priv(client->fd, client->context, TOKEN_DATA, &token,
                              TIMEOUT, &major, &minor);
     if (status != TOKEN_OK) {
@@ -141,6 +142,8 @@ server_v1_send_output(struct client *client, struct evbuffer *output,
         return false;
     }
     free(token.value);
+    server_metrics_count(METRICS_BYTES_OUT, outlen);
+    server_scoreboard_bytes(0, outlen);
     return true;
 }
 
@@ -21,34 +21,77 @@
 #include <portable/uio.h>
 
 #include <server/internal.h>
+#include <util/compress.h>
+#include <util/fdflag.h>
 #include <util/gss-tokens.h>
 #include <util/macros.h>
 #include <util/messages.h>
+#include <util/probes.h>
 #include <util/xmalloc.h>
 
 
 /*
- * Given the client struct and the stream number the data is from, send a
- * protocol v2 output token to the client containing the data stored in the
- * buffer in the client struct.  Returns true on success, false on failure
- * (and logs a message on failure).
+ * The number of maximum-size tokens of output that may be queued for the
+ * client before we stop reading output from the process, and the number
+ * below which we start reading again.
+ */
+#define QUEUE_HIGH_TOKENS 4
+#define QUEUE_LOW_TOKENS  1
+
+
+/*
+ * Wrap a token with the GSS-API context and queue it to be sent to the client
+ * by the process event loop.  The token__send probe fires here rather than
+ * when the queue is written, since the queue may hold several tokens.
+ * Returns true on success, false on failure (and logs a message on failure).
  */
 static bool
-server_v2_send_output(struct client *client, int stream,
-                      struct evbuffer *output)
+queue_token(struct process *process, gss_buffer_t token)
 {
-    gss_buffer_desc token;
-    size_t outlen;
+    struct client *client = process->client;
+    struct evbuffer *queue;
+    gss_buffer_desc wrapped;
+    unsigned char flags = TOKEN_DATA | TOKEN_PROTOCOL;
+    OM_uint32 length, major, minor;
+    int state;
+
+    major = gss_wrap(&minor, client->context, 1, GSS_C_QOP_DEFAULT, token,
+                     &state, &wrapped);
+    if (major != GSS_S_COMPLETE) {
+        warn_token("wrapping output token", TOKEN_FAIL_GSSAPI, major, minor);
+        return false;
+    }
+    queue = bufferevent_get_output(process->queue);
+    length = htonl((OM_uint32) wrapped.length);
+    if (evbuffer_add(queue, &flags, 1) < 0
+        || evbuffer_add(queue, &length, sizeof(length)) < 0
+        || evbuffer_add(queue, wrapped.value, wrapped.length) < 0)
+        die("internal error: cannot queue output token");
+    PROBE3(token__send, client->fd, flags, wrapped.length);
+    gss_release_buffer(&minor, &wrapped);
+    return true;
+}
+
+
+/*
+ * Given the client struct, the process if the token should be queued rather
+ * than sent immediately, the stream number the data is from, and the amount
+ * of data, send a protocol v2 output token to the client containing that much
+ * data from the start of the buffer.  If the client negotiated compression,
+ * the token is compressed unless it is small or the command opted out.
+ * Returns true on success, false on failure (and logs a message on failure).
+ */
+static bool
+send_output_token(struct client *client, struct process *process, int stream,
+                  struct evbuffer *output, size_t outlen)
+{
+    gss_buffer_desc token, compressed;
     char *p;
     OM_uint32 tmp, major, minor;
     int status;
-
-    /* Sanity check on stream. */
-    if (stream < 0 || stream > 128)
-        die("internal error: invalid stream number");
+    bool okay;
 
     /* Allocate room for the total message. */
-    outlen = evbuffer_get_length(output);
     if (outlen >= UINT32_MAX - 1 - 1 - 1 - 4)
         die("internal error: memory allocation too large");
     token.length = 1 + 1 + 1 + 4 + outlen;
@@ -70,28 +113,125 @@ server_v2_send_output(struct client *client, int stream,
     p += 4;
     if (evbuffer_remove(output, p, outlen) < 0)
         die("internal error: cannot move data from output buffer");
+    if (client->compress != COMPRESS_NONE && !client->uncompressed
+        && token.length >= COMPRESS_MIN_LENGTH)
+        if (compress_message(client->compress, token.value, token.length,
+                             &compressed)) {
+            debug("compressed OUTPUT token from %lu to %lu bytes",
+                  (unsigned long) token.length,
+                  (unsigned long) compressed.length);
+            free(token.value);
+            token = compressed;
+        }
 
-    /* Send the token. */
-    debug("sending OUTPUT token (size=%lu)", (unsigned long) token.length);
-    status = token_send_priv(client->fd, client->context,
-                             TOKEN_DATA | TOKEN_PROTOCOL, &token, TIMEOUT,
-                             &major, &minor);
-    if (status != TOKEN_OK) {
-        warn_token("sending output token", status, major, minor);
-        free(token.value);
+    /*
+     * Either queue the token, in which case handle_output paces the output if
+     * there is a bandwidth limit, or pace the output here and send it.
+     */
+    if (process != NULL) {
+        debug("queuing OUTPUT token (size=%lu)", (unsigned long) token.length);
+        okay = queue_token(process, &token);
+    } else {
+        server_ratelimit_wait(RATELIMIT_OUTPUT, client->user, (double) outlen);
+        debug("sending OUTPUT token (size=%lu)", (unsigned long) token.length);
+        status = token_send_priv(client->fd, client->context,
+                                 TOKEN_DATA | TOKEN_PROTOCOL, &token, TIMEOUT,
+                                 &major, &minor);
+        okay = (status == TOKEN_OK);
+        if (!okay)
+            warn_token("sending output token", status, major, minor);
+    }
+    free(token.value);
+    if (!okay) {
         client->fatal = true;
         return false;
     }
-    free(token.value);
+    server_metrics_count(METRICS_BYTES_OUT, outlen);
+    server_scoreboard_bytes(0, outlen);
+    return true;
+}
+
+
+/*
+ * Given the client struct, the process if the output should be queued, and
+ * the stream number the data is from, send the data stored in the buffer to
+ * the client in as many protocol v2 output tokens as needed to stay within
+ * the largest token the client accepts.  Returns true on success, false on
+ * failure (and logs a message on failure).
+ */
+static bool
+send_output(struct client *client, struct process *process, int stream,
+            struct evbuffer *output)
+{
+    size_t length, max;
+
+    /* Sanity check on stream. */
+    if (stream < 0 || stream > 128)
+        die("internal error: invalid stream number");
+
+    /* Send the data, always sending at least one token. */
+    max = client->max_data - (1 + 1 + 1 + 4);
+    do {
+        length = evbuffer_get_length(output);
+        if (length > max)
+            length = max;
+        if (!send_output_token(client, process, stream, output, length))
+            return false;
+    } while (evbuffer_get_length(output) > 0);
     return true;
 }
 
 
+/*
+ * Given the client struct and the stream number the data is from, send the
+ * data stored in the buffer to the client, waiting until it has been sent.
+ * This is used outside of the process event loop, such as for cached
+ * results.  Returns true on success, false on failure (and logs a message on
+ * failure).
+ */
+bool
+server_v2_send_output(struct client *client, int stream,
+                      struct evbuffer *output)
+{
+    return send_output(client, NULL, stream, output);
+}
+
+
+/*
+ * Stop reading output from the process, and start reading it again unless
+ * it's still paused for the client or throttled by the rate limit.  When
+ * starting again, note that we need to keep running the event loop to see
+ * that output.
+ */
+static void
+stop_reading(struct process *process)
+{
+    bufferevent_disable(process->inout, EV_READ);
+    bufferevent_disable(process->err, EV_READ);
+}
+
+static void
+resume_reading(struct process *process)
+{
+    if (process->paused || process->throttled)
+        return;
+    process->saw_output = true;
+    bufferevent_enable(process->inout, EV_READ);
+    bufferevent_enable(process->err, EV_READ);
+}
+
+
 /*
  * Callback used to handle output from a process (protocol version two or
  * later).  We use the same handler for both standard output and standard
  * error and check the bufferevent to determine which stream we're seeing.
  *
+ * The output is queued to be sent to the client by the event loop.  If that
+ * queue is full, stop reading from the process until the client catches up,
+ * so that a slow client slows down the process rather than using unbounded
+ * memory.  Similarly, if there is a bandwidth limit and this output exceeded
+ * it, stop reading from the process until the limit allows more output.
+ *
  * When called, note that we saw some output, which is a flag to continue
  * processing when running the event loop after the child has exited.
  */
@@ -99,36 +239,142 @@ static void
 handle_output(struct bufferevent *bev, void *data)
 {
     int stream;
-    struct evbuffer *buf;
+    size_t length;
+    double delay;
+    struct evbuffer *buf, *queue;
+    struct timeval wait;
     struct process *process = data;
+    struct client *client = process->client;
 
     process->saw_output = true;
     stream = (bev == process->inout) ? 1 : 2;
     buf = bufferevent_get_input(bev);
-    if (!server_v2_send_output(process->client, stream, buf)) {
+    length = evbuffer_get_length(buf);
+    process->bytes[stream - 1] += length;
+    server_cache_record(process, stream, buf);
+    if (!send_output(client, process, stream, buf)) {
         process->saw_error = true;
         event_base_loopbreak(process->loop);
+        return;
+    }
+    queue = bufferevent_get_output(process->queue);
+    if (evbuffer_get_length(queue) >= QUEUE_HIGH_TOKENS * client->max_data) {
+        stop_reading(process);
+        process->paused = true;
     }
+    delay = server_ratelimit_delay(RATELIMIT_OUTPUT, client->user,
+                                   (double) length);
+    if (delay > 0) {
+        stop_reading(process);
+        process->throttled = true;
+        wait.tv_sec = (time_t) delay;
+        wait.tv_usec = (long) ((delay - (double) wait.tv_sec) * 1e6);
+        if (event_add(process->throttle, &wait) < 0)
+            die("internal error: cannot add output pacing event");
+    }
+}
+
+
+/*
+ * Callback when the output queued for the client has drained to the low
+ * watermark.  If reading output from the process was paused, start again.
+ */
+static void
+handle_queue_drained(struct bufferevent *bev UNUSED, void *data)
+{
+    struct process *process = data;
+
+    if (!process->paused)
+        return;
+    process->paused = false;
+    resume_reading(process);
+}
+
+
+/*
+ * Callback when the bandwidth limit allows more output after reading from the
+ * process was throttled.  Start reading again.
+ */
+static void
+handle_throttle_end(evutil_socket_t fd UNUSED, short what UNUSED, void *data)
+{
+    struct process *process = data;
+
+    process->throttled = false;
+    resume_reading(process);
+}
+
+
+/*
+ * Callback for errors sending queued output to the client, including the
+ * client not accepting data for TIMEOUT seconds.  We can't talk to the client
+ * any more, so give up on the command.
+ */
+static void
+handle_queue_event(struct bufferevent *bev UNUSED, short events, void *data)
+{
+    struct process *process = data;
+
+    if (events & BEV_EVENT_TIMEOUT)
+        warn("timeout sending output to client");
+    else
+        syswarn("error sending output to client");
+    process->client->fatal = true;
+    process->saw_error = true;
+    event_base_loopbreak(process->loop);
 }
 
 
 /*
  * Set up handling of a child process with the v2 protocol.  Takes the process
- * struct and sets up the necessary event loop hooks.
+ * struct and sets up the necessary event loop hooks.  Output is read in
+ * chunks of up to the largest amount that fits in one token to the client, so
+ * that commands with a lot of output need as few tokens as possible.
+ *
+ * Output tokens are queued in a bufferevent for the client socket, which the
+ * same event loop writes as the client accepts data, so a slow client doesn't
+ * keep us from reading standard error or noticing that the process exited.
+ * Only writing is enabled, since the client may already have sent its next
+ * command, which is read after this command finishes.  A timer event resumes
+ * reading output after it has been paced by a bandwidth limit.
  */
 void
 server_v2_command_setup(struct process *process)
 {
+    struct client *client = process->client;
+    const struct timeval timeout = {TIMEOUT, 0};
     bufferevent_data_cb writecb;
-
+    size_t max;
+
+    /* Set up the queue of output to the client. */
+    fdflag_nonblocking(client->fd, true);
+    process->queue = bufferevent_socket_new(process->loop, client->fd, 0);
+    if (process->queue == NULL)
+        die("internal error: cannot create client bufferevent");
+    bufferevent_setcb(process->queue, NULL, handle_queue_drained,
+                      handle_queue_event, process);
+    bufferevent_setwatermark(process->queue, EV_WRITE,
+                             QUEUE_LOW_TOKENS * client->max_data, 0);
+    bufferevent_set_max_single_write(process->queue, client->max_data);
+    bufferevent_set_timeouts(process->queue, NULL, &timeout);
+    bufferevent_enable(process->queue, EV_WRITE);
+    process->throttle =
+        event_new(process->loop, -1, 0, handle_throttle_end, process);
+    if (process->throttle == NULL)
+        die("internal error: cannot create output pacing event");
+
+    /* Set up reading output from the process. */
+    max = client->max_data - (1 + 1 + 1 + 4);
     writecb = (process->input == NULL) ? NULL : server_handle_input_end;
     bufferevent_setcb(process->inout, handle_output, writecb,
                       server_handle_io_event, process);
-    bufferevent_setwatermark(process->inout, EV_READ, 0, TOKEN_MAX_OUTPUT);
+    bufferevent_setwatermark(process->inout, EV_READ, 0, max);
+    bufferevent_set_max_single_read(process->inout, max);
     bufferevent_enable(process->err, EV_READ);
     bufferevent_setcb(process->err, handle_output, NULL,
                       server_handle_io_event, process);
-    bufferevent_setwatermark(process->err, EV_READ, 0, TOKEN_MAX_OUTPUT);
+    bufferevent_setwatermark(process->err, EV_READ, 0, max);
+    bufferevent_set_max_single_read(process->err, max);
 }
 
 
@@ -286,25 +532,117 @@ server_v3_send_noop(struct client *client)
 }
 
 
+/*
+ * Given the client struct and the capability flags sent by the client, send a
+ * protocol v3 capabilities token to the client with the flags that we also
+ * support, and enable compression if we have an algorithm in common and large
+ * tokens if both sides want them.  Returns true on success, false on failure
+ * (and logs a message on failure).
+ */
+static bool
+server_v3_send_capabilities(struct client *client, unsigned long flags)
+{
+    gss_buffer_desc token;
+    char buffer[1 + 1 + 4];
+    OM_uint32 tmp, major, minor;
+    size_t max = 0;
+    int status;
+
+    /*
+     * Build the capabilities token.  Only agree to large tokens if the
+     * GSS-API library can tell us how much data fits in one.
+     */
+    flags &= compress_capabilities() | CAPABILITY_LARGE;
+    if (flags & CAPABILITY_LARGE) {
+        max = token_wrap_limit(client->context, TOKEN_MAX_LARGE);
+        if (max <= TOKEN_MAX_DATA)
+            flags &= ~(unsigned long) CAPABILITY_LARGE;
+    }
+    token.length = 1 + 1 + 4;
+    buffer[0] = 3;
+    buffer[1] = MESSAGE_CAPABILITIES;
+    tmp = htonl((OM_uint32) flags);
+    memcpy(buffer + 2, &tmp, 4);
+    token.value = &buffer;
+
+    /* Send the token. */
+    debug("sending CAPABILITIES token (flags=%lu)", flags);
+    status = token_send_priv(client->fd, client->context,
+                             TOKEN_DATA | TOKEN_PROTOCOL, &token, TIMEOUT,
+                             &major, &minor);
+    if (status != TOKEN_OK) {
+        warn_token("sending capabilities token", status, major, minor);
+        client->fatal = true;
+        return false;
+    }
+    client->compress = compress_choose(flags);
+    if (flags & CAPABILITY_LARGE) {
+        client->large = true;
+        client->max_data = max;
+    }
+    return true;
+}
+
+
+/*
+ * Release a token received from the client, which may be a decompressed
+ * token that was allocated by us rather than by the GSS-API library.
+ */
+static void
+server_v2_release_token(struct client *client, gss_buffer_t token)
+{
+    OM_uint32 minor;
+
+    if (client->inflated != NULL && token->value == client->inflated) {
+        free(client->inflated);
+        client->inflated = NULL;
+        token->value = NULL;
+        token->length = 0;
+    } else
+        gss_release_buffer(&minor, token);
+}
+
+
 /*
  * Receive a new token from the client, handling reporting of errors.  Takes
- * the client struct and a pointer to storage for the token.  Returns TOKEN_OK
+ * the client struct and a pointer to storage for the token.  If the token is
+ * compressed, it is replaced with the message it contains.  Returns TOKEN_OK
  * on success, TOKEN_FAIL_EOF if the other end has gone away, and a different
  * error code on a recoverable error.
  */
 static int
 server_v2_read_token(struct client *client, gss_buffer_t token)
 {
+    gss_buffer_desc message;
     OM_uint32 major, minor;
     int status, flags;
+    size_t max;
+    char *p;
 
-    status = token_recv_priv(client->fd, client->context, &flags, token,
-                             TOKEN_MAX_LENGTH, TIMEOUT, &major, &minor);
+    max = client->large ? TOKEN_MAX_LARGE : TOKEN_MAX_LENGTH;
+    status = token_recv_priv(client->fd, client->context, &flags, token, max,
+                             TIMEOUT, &major, &minor);
     if (status != TOKEN_OK) {
         warn_token("receiving token", status, major, minor);
         if (status != TOKEN_FAIL_EOF && status != TOKEN_FAIL_SOCKET)
             client->error(client, ERROR_BAD_TOKEN, "Invalid token");
+        return status;
     }
+    p = token->value;
+    if (token->length < 2 || p[1] != MESSAGE_COMPRESSED)
+        return status;
+    if (client->compress == COMPRESS_NONE
+        || !compress_inflate(token, &message,
+                             client->large ? TOKEN_MAX_LARGE
+                                           : TOKEN_MAX_DATA)) {
+        warn("invalid compressed token from client");
+        gss_release_buffer(&minor, token);
+        client->error(client, ERROR_BAD_TOKEN, "Invalid token");
+        return TOKEN_FAIL_INVALID;
+    }
+    gss_release_buffer(&minor, token);
+    *token = message;
+    client->inflated = message.value;
     return status;
 }
 
@@ -347,6 +685,78 @@ server_v2_read_continuation(struct client *client, gss_buffer_t token)
 }
 
 
+/*
+ * Given the start of a command that is still being received, extract the
+ * command and subcommand if enough of it has arrived.  Returns true and sets
+ * command and subcommand to newly allocated strings if so, with subcommand
+ * set to NULL if the command has only one argument.  Returns false if more
+ * data is needed or if the command and subcommand aren't valid strings, in
+ * which case the problem is diagnosed once the command is complete.
+ */
+static bool
+peek_command(const char *buffer, size_t length, char **command,
+             char **subcommand)
+{
+    OM_uint32 tmp;
+    size_t argc, arglen, offset, i;
+    char *args[2] = {NULL, NULL};
+
+    /* Read the argument count. */
+    if (length < 4)
+        return false;
+    memcpy(&tmp, buffer, 4);
+    argc = ntohl(tmp);
+    if (argc == 0)
+        return false;
+
+    /* Extract the first two arguments. */
+    offset = 4;
+    for (i = 0; i < 2 && i < argc; i++) {
+        if (length - offset < 4)
+            goto fail;
+        memcpy(&tmp, buffer + offset, 4);
+        arglen = ntohl(tmp);
+        offset += 4;
+        if (length - offset < arglen)
+            goto fail;
+        if (memchr(buffer + offset, '\0', arglen) != NULL)
+            goto fail;
+        args[i] = xstrndup(buffer + offset, arglen);
+        offset += arglen;
+    }
+    *command = args[0];
+    *subcommand = args[1];
+    return true;
+
+fail:
+    free(args[0]);
+    return false;
+}
+
+
+/*
+ * Build the argument vector for a command that was denied before all of it
+ * was received, which holds only the command and subcommand.  Takes ownership
+ * of the strings.  The result should be freed with server_free_command.
+ */
+static struct iovec **
+denied_command(char *command, char *subcommand)
+{
+    struct iovec **argv;
+
+    argv = xcalloc(3, sizeof(struct iovec *));
+    argv[0] = xmalloc(sizeof(struct iovec));
+    argv[0]->iov_base = command;
+    argv[0]->iov_len = strlen(command);
+    if (subcommand != NULL) {
+        argv[1] = xmalloc(sizeof(struct iovec));
+        argv[1]->iov_base = subcommand;
+        argv[1]->iov_len = strlen(subcommand);
+    }
+    return argv;
+}
+
+
 /*
  * Handles a single command message from the client, responding or running the
  * command as appropriate.  Returns true if we should continue to process
@@ -358,19 +768,27 @@ server_v2_handle_command(struct client *client, struct config *config,
                          gss_buffer_t token)
 {
     char *p;
-    size_t length, total;
+    size_t length, total, max;
     char *buffer = NULL;
-    OM_uint32 minor;
+    char *command = NULL;
+    char *subcommand = NULL;
     struct iovec **argv = NULL;
     bool result = false;
     bool allocated = false;
     bool continued = false;
+    bool checked = false;
+    bool denied = false;
 
     /*
      * Loop on tokens until we have a complete command, allowing for continued
      * commands.  We're going to accumulate the full command in buffer until
      * we've seen all of it.  If the command isn't continued, we can use the
      * token as the buffer.
+     *
+     * For continued commands, check the ACL as soon as we have the command
+     * and subcommand.  If the client isn't allowed to run the command, read
+     * and discard the rest of it rather than accumulating it, keeping only
+     * the command and subcommand.
      */
     total = 0;
     do {
@@ -378,9 +796,10 @@ server_v2_handle_command(struct client *client, struct config *config,
         client->keepalive = p[2] ? true : false;
 
         /* Check the data size. */
-        if (token->length > TOKEN_MAX_DATA) {
-            warn("command data length %lu exceeds 64KB",
-                 (unsigned long) token->length);
+        max = client->large ? TOKEN_MAX_LARGE : TOKEN_MAX_DATA;
+        if (token->length > max) {
+            warn("command data length %lu exceeds %luKB",
+                 (unsigned long) token->length, (unsigned long) max / 1024);
             result =
                 client->error(client, ERROR_TOOMUCH_DATA, "Too much data");
             goto fail;
@@ -409,7 +828,9 @@ server_v2_handle_command(struct client *client, struct config *config,
                 client->error(client, ERROR_TOOMUCH_DATA, "Too much data");
             goto fail;
         }
-        if (continued || buffer != NULL) {
+        if (denied)
+            total += length;
+        else if (continued || buffer != NULL) {
             if (buffer == NULL)
                 buffer = xmalloc(length);
             else
@@ -419,21 +840,52 @@ server_v2_handle_command(struct client *client, struct config *config,
             total += length;
         }
 
+        /* Check the ACL once we have the command and subcommand. */
+        if (continued && !checked
+            && peek_command(buffer, total, &command, &subcommand)) {
+            checked = true;
+            if (!server_command_permitted(client, config, command,
+                                          subcommand)) {
+                denied = true;
+                free(buffer);
+                buffer = NULL;
+                allocated = false;
+            } else {
+                free(command);
+                free(subcommand);
+                command = NULL;
+                subcommand = NULL;
+            }
+        }
+
         /*
          * If the command was continued, we have to read the next token.
          * Otherwise, if buffer is NULL (no continuation), we just use this
          * token as the complete buffer.
          */
         if (continued) {
-            gss_release_buffer(&minor, token);
+            server_v2_release_token(client, token);
             if (!server_v2_read_continuation(client, token))
                 goto fail;
-        } else if (buffer == NULL) {
+        } else if (buffer == NULL && !denied) {
             buffer = p;
             total = length;
         }
     } while (continued);
 
+    /*
+     * If the command was denied, we've now read and discarded all of it.
+     * Reject it through the normal path so that it's still rate-limited and
+     * logged.
+     */
+    if (denied) {
+        argv = denied_command(command, subcommand);
+        client->denied = true;
+        server_run_command(client, config, argv);
+        server_free_command(argv);
+        return !client->fatal;
+    }
+
     /*
      * Okay, we now have a complete command that was possibly spread over
      * multiple tokens.  Now we can parse it.
@@ -451,6 +903,8 @@ server_v2_handle_command(struct client *client, struct config *config,
 
 fail:
     free(buffer);
+    free(command);
+    free(subcommand);
     return client->fatal ? false : result;
 }
 
@@ -467,6 +921,7 @@ server_v2_handle_token(struct client *client, struct config *config,
                        gss_buffer_t token)
 {
     char *p;
+    OM_uint32 flags;
     bool result = true;
 
     p = token->value;
@@ -480,6 +935,16 @@ server_v2_handle_token(struct client *client, struct config *config,
         debug("replying to no-op message");
         result = server_v3_send_noop(client);
         break;
+    case MESSAGE_CAPABILITIES:
+        if (token->length != 1 + 1 + 4) {
+            warn("invalid capabilities token from client");
+            result = client->error(client, ERROR_BAD_TOKEN,
+                                   "Invalid capabilities token");
+            break;
+        }
+        memcpy(&flags, p + 2, 4);
+        result = server_v3_send_capabilities(client, ntohl(flags));
+        break;
     case MESSAGE_QUIT:
         debug("quit received, closing connection");
         client->keepalive = false;
@@ -505,7 +970,6 @@ void
 server_v2_handle_messages(struct client *client, struct config *config)
 {
     gss_buffer_desc token;
-    OM_uint32 minor;
     int status;
 
     /* Loop receiving messages until we're finished. */
@@ -515,9 +979,9 @@ server_v2_handle_messages(struct client *client, struct config *config)
         if (status != TOKEN_OK)
             break;
         if (!server_v2_handle_token(client, config, &token)) {
-            gss_release_buffer(&minor, &token);
+            server_v2_release_token(client, &token);
             break;
         }
-        gss_release_buffer(&minor, &token);
+        server_v2_release_token(client, &token);
     } while (client->keepalive);
 }
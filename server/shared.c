@@ -0,0 +1,246 @@
+/*
+ * Shared memory and locking for the remctld server.
+ *
+ * When running as a stand-alone daemon, remctld keeps metrics, rate limits,
+ * concurrency limits, and cached results in anonymous shared memory segments
+ * created before any children are forked, so that they are shared by all
+ * connections.  This file provides the code common to all of them: creating
+ * the segments, a lock that can be used by any process sharing a segment,
+ * and a delay for polling for a change made by another process.
+ *
+ * The segments are only created by a stand-alone remctld, so none of these
+ * features are enabled for remctl-shell or for remctld run from inetd, and
+ * their functions then do nothing.
+ *
+ * The lock is a robust process-shared mutex where available, so that if a
+ * child dies while holding it, the next process to lock it takes it over
+ * rather than blocking forever.  Otherwise, the lock is a spinlock that
+ * records the PID of its owner, and a process waiting for the lock takes it
+ * over if the owner no longer exists.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <errno.h>
+#ifdef HAVE_ROBUST_MUTEX
+#    include <pthread.h>
+#else
+#    include <sched.h>
+#    include <signal.h>
+#endif
+#include <sys/mman.h>
+#include <time.h>
+
+#include <server/internal.h>
+#include <util/messages.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#    define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* Shortest and longest delay in microseconds between polls. */
+#define SHARED_POLL_MIN 5000
+#define SHARED_POLL_MAX 200000
+
+/*
+ * How many times to spin waiting for the spinlock before checking whether its
+ * owner still exists.
+ */
+#define SHARED_SPIN_CHECK 1000
+
+/* A lock in shared memory. */
+struct shared_lock {
+#ifdef HAVE_ROBUST_MUTEX
+    pthread_mutex_t mutex;
+#else
+    volatile int32_t owner; /* PID of the process holding the lock, or 0. */
+#endif
+};
+
+/*
+ * Compare and swap for the spinlock.  Use the __atomic builtins if available
+ * and otherwise fall back on the older __sync builtins.
+ */
+#ifndef HAVE_ROBUST_MUTEX
+#    ifdef HAVE_ATOMIC_BUILTINS
+#        define ATOMIC_CAS(p, old, new)                                    \
+            __atomic_compare_exchange_n((p), &(old), (new), false,        \
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)
+#        define ATOMIC_LOAD(p)  __atomic_load_n((p), __ATOMIC_RELAXED)
+#        define ATOMIC_CLEAR(p) __atomic_store_n((p), 0, __ATOMIC_RELEASE)
+#    else
+#        define ATOMIC_CAS(p, old, new) \
+            __sync_bool_compare_and_swap((p), (old), (new))
+#        define ATOMIC_LOAD(p)  __sync_fetch_and_add((p), 0)
+#        define ATOMIC_CLEAR(p) __sync_lock_release(p)
+#    endif
+#endif
+
+
+/*
+ * Create a zero-filled shared memory segment of the given size, which will be
+ * shared with all children forked afterwards.  purpose is used in the error
+ * message.  Dies on failure.
+ */
+void *
+server_shared_new(size_t size, const char *purpose)
+{
+    void *segment;
+
+    segment = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (segment == MAP_FAILED)
+        sysdie("cannot create shared memory for %s", purpose);
+    return segment;
+}
+
+
+/*
+ * Release a shared memory segment of the given size.
+ */
+void
+server_shared_free(void *segment, size_t size)
+{
+    if (segment != NULL)
+        munmap(segment, size);
+}
+
+
+/*
+ * Create a lock in its own shared memory segment.  This must be called before
+ * forking any children that use it.  Dies on failure.
+ */
+struct shared_lock *
+server_shared_lock_new(void)
+{
+    struct shared_lock *lock;
+#ifdef HAVE_ROBUST_MUTEX
+    pthread_mutexattr_t attr;
+    int status;
+#endif
+
+    lock = server_shared_new(sizeof(struct shared_lock), "lock");
+#ifdef HAVE_ROBUST_MUTEX
+    status = pthread_mutexattr_init(&attr);
+    if (status != 0) {
+        errno = status;
+        sysdie("cannot initialize shared memory lock");
+    }
+    status = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    if (status == 0)
+        status = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    if (status == 0)
+        status = pthread_mutex_init(&lock->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (status != 0) {
+        errno = status;
+        sysdie("cannot initialize shared memory lock");
+    }
+#endif
+    return lock;
+}
+
+
+/*
+ * Free a lock.  No process may be holding it or use it afterwards.
+ */
+void
+server_shared_lock_free(struct shared_lock *lock)
+{
+    if (lock == NULL)
+        return;
+#ifdef HAVE_ROBUST_MUTEX
+    pthread_mutex_destroy(&lock->mutex);
+#endif
+    server_shared_free(lock, sizeof(struct shared_lock));
+}
+
+
+/*
+ * Acquire a lock, waiting for it if necessary.  Returns true if the lock was
+ * taken over from a process that died while holding it, in which case the
+ * data that it protects may be inconsistent, and false otherwise.
+ */
+bool
+server_shared_lock(struct shared_lock *lock)
+{
+#ifdef HAVE_ROBUST_MUTEX
+    int status;
+
+    status = pthread_mutex_lock(&lock->mutex);
+    if (status == EOWNERDEAD) {
+        pthread_mutex_consistent(&lock->mutex);
+        warn("took over shared memory lock from dead process");
+        return true;
+    }
+    if (status != 0) {
+        errno = status;
+        sysdie("cannot lock shared memory");
+    }
+    return false;
+#else
+    int32_t pid = (int32_t) getpid();
+    int32_t owner;
+    unsigned long spins = 0;
+
+    while (1) {
+        owner = 0;
+        if (ATOMIC_CAS(&lock->owner, owner, pid))
+            return false;
+        sched_yield();
+        if (++spins % SHARED_SPIN_CHECK != 0)
+            continue;
+        owner = ATOMIC_LOAD(&lock->owner);
+        if (owner == 0 || kill((pid_t) owner, 0) == 0 || errno != ESRCH)
+            continue;
+        if (ATOMIC_CAS(&lock->owner, owner, pid)) {
+            warn("took over shared memory lock from dead process %ld",
+                 (long) owner);
+            return true;
+        }
+    }
+#endif
+}
+
+
+/*
+ * Release a lock.
+ */
+void
+server_shared_unlock(struct shared_lock *lock)
+{
+#ifdef HAVE_ROBUST_MUTEX
+    pthread_mutex_unlock(&lock->mutex);
+#else
+    ATOMIC_CLEAR(&lock->owner);
+#endif
+}
+
+
+/*
+ * Sleep while polling for another process to change something in shared
+ * memory.  poll holds the length of the sleep in microseconds and should
+ * start at zero.  It's doubled after each sleep up to a maximum, so that
+ * changes are noticed quickly but long waits don't keep the process busy.
+ */
+void
+server_shared_wait(long *poll)
+{
+    struct timespec delay;
+
+    if (*poll < SHARED_POLL_MIN)
+        *poll = SHARED_POLL_MIN;
+    delay.tv_sec = 0;
+    delay.tv_nsec = *poll * 1000;
+    while (nanosleep(&delay, &delay) < 0 && errno == EINTR)
+        ;
+    *poll *= 2;
+    if (*poll > SHARED_POLL_MAX)
+        *poll = SHARED_POLL_MAX;
+}
@@ -0,0 +1,525 @@
+/*
+ * Micro-benchmarks for remctl internals.
+ *
+ * Times the token framing layer, command parsing, configuration loading and
+ * rule lookup, each ACL scheme, command logging, and the vector and buffer
+ * utilities.  None of these need Kerberos or the network: tokens are sent
+ * over a local socketpair, and the server functions are called directly with
+ * a client struct made up for the purpose, as in the server tests.
+ *
+ * Each benchmark is run with increasing iteration counts until it takes at
+ * least the minimum time (half a second by default), and then one line is
+ * printed for it in the same format as Go benchmarks:
+ *
+ *     BenchmarkName  <iterations>  <time> ns/op  [<rate> MB/s]
+ *
+ * so that results from two builds can be compared with tools such as
+ * benchstat to catch performance regressions.  Any command-line arguments
+ * other than options are substrings, and only benchmarks whose names
+ * contain one of them are run.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/getopt.h>
+#include <portable/gssapi.h>
+#include <portable/socket.h>
+#include <portable/system.h>
+#include <portable/uio.h>
+
+#include <sys/time.h>
+#if defined(HAVE_KRB5) && defined(HAVE_GETGRNAM_R)
+#    include <grp.h>
+#endif
+
+#include <server/internal.h>
+#include <tests/tap/basic.h>
+#include <util/buffer.h>
+#include <util/messages.h>
+#include <util/tokens.h>
+#include <util/vector.h>
+#include <util/xmalloc.h>
+
+/* Number of rules in the synthetic configuration. */
+#define CONFIG_RULES 10000
+
+/* Signature of a benchmark.  Runs the operation count times. */
+typedef void (*bench_func)(void *, unsigned long count);
+
+/* Shared state for the benchmarks. */
+struct bench_data {
+    socket_type fds[2];        /* socketpair for token framing. */
+    gss_buffer_desc token;     /* Token to send. */
+    char *payload;             /* Encoded command for parsing. */
+    size_t payload_length;     /* Length of that command. */
+    struct config *config;     /* Synthetic configuration. */
+    const char *command;       /* Command to look up. */
+    const char *subcommand;    /* Subcommand to look up. */
+    struct rule rule;          /* Rule used for ACL and logging checks. */
+    struct client client;      /* Client used for ACL and parsing checks. */
+    struct iovec **argv;       /* Command to log. */
+    const char *line;          /* Line to split. */
+};
+
+/* Options and filters for which benchmarks to run. */
+static double min_time = 0.5;
+static char **filters = NULL;
+
+
+/*
+ * Return the current time in seconds as a floating point number.
+ */
+static double
+current_time(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec + (double) tv.tv_usec / 1000000.0;
+}
+
+
+/*
+ * Run a benchmark with increasing iteration counts until it takes at least
+ * min_time and print the result.  bytes is the amount of data processed by
+ * each iteration, if any, for reporting MB/s.
+ */
+static void
+bench(const char *name, bench_func func, void *data, size_t bytes)
+{
+    unsigned long count = 1;
+    double start, elapsed;
+    char **filter;
+
+    if (filters != NULL && filters[0] != NULL) {
+        for (filter = filters; *filter != NULL; filter++)
+            if (strstr(name, *filter) != NULL)
+                break;
+        if (*filter == NULL)
+            return;
+    }
+    for (;;) {
+        start = current_time();
+        func(data, count);
+        elapsed = current_time() - start;
+        if (elapsed >= min_time || count >= (1UL << 30))
+            break;
+
+        /* Aim a bit past min_time, but don't grow more than 100x. */
+        if (elapsed <= 0)
+            count *= 100;
+        else if (min_time * 1.2 / elapsed > 100)
+            count *= 100;
+        else
+            count = (unsigned long) ((double) count * min_time * 1.2 / elapsed)
+                    + 1;
+    }
+    printf("Benchmark%s\t%lu\t%.1f ns/op", name, count,
+           elapsed * 1e9 / (double) count);
+    if (bytes > 0)
+        printf("\t%.2f MB/s", (double) bytes * (double) count / elapsed / 1e6);
+    printf("\n");
+    fflush(stdout);
+}
+
+
+/*
+ * Send a token over one end of the socketpair and read it from the other.
+ */
+static void
+bench_token(void *data, unsigned long count)
+{
+    struct bench_data *b = data;
+    gss_buffer_desc result;
+    unsigned long i;
+    int flags;
+
+    for (i = 0; i < count; i++) {
+        if (token_send(b->fds[0], 3, &b->token, 0) != TOKEN_OK)
+            sysdie("token_send failed");
+        if (token_recv(b->fds[1], &flags, &result, b->token.length + 1, 0)
+            != TOKEN_OK)
+            sysdie("token_recv failed");
+        free(result.value);
+    }
+}
+
+
+/*
+ * Parse an encoded command into an argv vector and free it.
+ */
+static void
+bench_parse(void *data, unsigned long count)
+{
+    struct bench_data *b = data;
+    struct iovec **argv;
+    unsigned long i;
+
+    for (i = 0; i < count; i++) {
+        argv = server_parse_command(&b->client, b->payload, b->payload_length);
+        if (argv == NULL)
+            die("server_parse_command failed");
+        server_free_command(argv);
+    }
+}
+
+
+/*
+ * Build an encoded command with argc arguments each of size length, in the
+ * format of the payload of a MESSAGE_COMMAND after the continue status.
+ */
+static void
+build_payload(struct bench_data *b, uint32_t argc, uint32_t length)
+{
+    uint32_t i, tmp;
+    char *p;
+
+    free(b->payload);
+    b->payload_length = 4 + (size_t) argc * (4 + length);
+    b->payload = xmalloc(b->payload_length);
+    p = b->payload;
+    tmp = htonl(argc);
+    memcpy(p, &tmp, 4);
+    p += 4;
+    for (i = 0; i < argc; i++) {
+        tmp = htonl(length);
+        memcpy(p, &tmp, 4);
+        p += 4;
+        memset(p, 'a' + (int) (i % 26), length);
+        p += length;
+    }
+}
+
+
+/*
+ * Write a synthetic configuration file with CONFIG_RULES rules in the given
+ * directory and return its path.
+ */
+static char *
+write_config(const char *tmpdir)
+{
+    char *path;
+    FILE *file;
+    unsigned long i;
+
+    xasprintf(&path, "%s/bench-config", tmpdir);
+    file = fopen(path, "w");
+    if (file == NULL)
+        sysdie("cannot create %s", path);
+    fprintf(file, "# Synthetic configuration for benchmarks.\n");
+    for (i = 0; i < CONFIG_RULES; i++)
+        fprintf(file,
+                "command%05lu sub%lu /usr/bin/true logmask=2 "
+                "princ:user%lu@EXAMPLE.ORG ANYUSER\n",
+                i / 10, i % 10, i);
+    if (fclose(file) == EOF)
+        sysdie("cannot write %s", path);
+    return path;
+}
+
+
+/*
+ * Load and free the synthetic configuration.
+ */
+static void
+bench_config_load(void *data, unsigned long count)
+{
+    const char *path = data;
+    struct config *config;
+    unsigned long i;
+
+    for (i = 0; i < count; i++) {
+        config = server_config_load(path);
+        if (config == NULL)
+            die("cannot load %s", path);
+        server_config_free(config);
+    }
+}
+
+
+/*
+ * Look up a command in the synthetic configuration.
+ */
+static void
+bench_find(void *data, unsigned long count)
+{
+    struct bench_data *b = data;
+    unsigned long i;
+
+    for (i = 0; i < count; i++)
+        server_find_config_line(b->config, b->command, b->subcommand);
+}
+
+
+/*
+ * Check the ACL in the rule against the client.
+ */
+static void
+bench_acl(void *data, unsigned long count)
+{
+    struct bench_data *b = data;
+    unsigned long i;
+
+    for (i = 0; i < count; i++)
+        server_config_acl_permit(&b->rule, &b->client);
+}
+
+
+/*
+ * Log a command.
+ */
+static void
+bench_log(void *data, unsigned long count)
+{
+    struct bench_data *b = data;
+    unsigned long i;
+
+    for (i = 0; i < count; i++)
+        server_log_command(b->argv, &b->rule, b->client.user);
+}
+
+
+/*
+ * Split a line on whitespace, reusing the vector.
+ */
+static void
+bench_vector_split(void *data, unsigned long count)
+{
+    struct bench_data *b = data;
+    struct vector *vector = NULL;
+    unsigned long i;
+
+    for (i = 0; i < count; i++)
+        vector = vector_split_space(b->line, vector);
+    vector_free(vector);
+}
+
+
+/*
+ * Build a vector of 1,000 strings, join it, and free it.
+ */
+static void
+bench_vector_join(void *data UNUSED, unsigned long count)
+{
+    struct vector *vector;
+    char *joined;
+    unsigned long i, j;
+
+    for (i = 0; i < count; i++) {
+        vector = vector_new();
+        for (j = 0; j < 1000; j++)
+            vector_add(vector, "argument");
+        joined = vector_join(vector, " ");
+        free(joined);
+        vector_free(vector);
+    }
+}
+
+
+/*
+ * Append 1MB to a buffer in 4KB pieces and free it.
+ */
+static void
+bench_buffer_append(void *data UNUSED, unsigned long count)
+{
+    static char chunk[4096];
+    struct buffer *buffer;
+    unsigned long i, j;
+
+    for (i = 0; i < count; i++) {
+        buffer = buffer_new();
+        for (j = 0; j < 256; j++)
+            buffer_append(buffer, chunk, sizeof(chunk));
+        buffer_free(buffer);
+    }
+}
+
+
+/*
+ * Format 1,000 short lines into a buffer and search it.
+ */
+static void
+bench_buffer_sprintf(void *data UNUSED, unsigned long count)
+{
+    struct buffer *buffer;
+    unsigned long i, j;
+    size_t offset;
+
+    for (i = 0; i < count; i++) {
+        buffer = buffer_new();
+        for (j = 0; j < 1000; j++)
+            buffer_append_sprintf(buffer, "line %lu of output\n", j);
+        buffer_find_string(buffer, "line 999", 0, &offset);
+        buffer_free(buffer);
+    }
+}
+
+
+/*
+ * Message handler that discards its output, so that the logging benchmark
+ * measures building the log message but not writing it.
+ */
+static void
+message_log_discard(size_t len UNUSED, const char *fmt UNUSED,
+                    va_list args UNUSED, int err UNUSED)
+{
+}
+
+
+/*
+ * Set up the rule to have a single ACL and time the check.
+ */
+static void
+bench_one_acl(struct bench_data *b, const char *name, const char *acl)
+{
+    const char *acls[2];
+
+    acls[0] = acl;
+    acls[1] = NULL;
+    b->rule.acls = (char **) acls;
+    bench(name, bench_acl, b, 0);
+    b->rule.acls = NULL;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    struct bench_data b;
+    size_t sizes[] = {64, 4096, 65536};
+    char name[64];
+    char *tmpdir, *path, *end;
+    const char *source;
+    unsigned long i;
+    int option, size;
+    struct vector *words;
+#if defined(HAVE_KRB5) && defined(HAVE_GETGRNAM_R)
+    struct group *group;
+#endif
+
+    message_program_name = "micro";
+    while ((option = getopt(argc, argv, "t:")) != EOF) {
+        switch (option) {
+        case 't':
+            min_time = strtod(optarg, &end);
+            if (*end != '\0' || min_time <= 0)
+                die("invalid time %s", optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: micro [-t <seconds>] [<filter> ...]\n");
+            exit(1);
+        }
+    }
+    filters = argv + optind;
+
+    /* ACL files are relative to the test source directory. */
+    source = getenv("C_TAP_SOURCE");
+    if (source != NULL && chdir(source) < 0)
+        sysdie("cannot chdir to %s", source);
+
+    memset(&b, 0, sizeof(b));
+    b.client.fd = -1;
+    b.client.stderr_fd = -1;
+    b.client.user = (char *) "user@EXAMPLE.ORG";
+    b.client.protocol = 2;
+    b.rule.file = (char *) "bench";
+    b.rule.lineno = 1;
+
+    /* Token framing. */
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, b.fds) < 0)
+        sysdie("cannot create socketpair");
+    size = 256 * 1024;
+    setsockopt(b.fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(b.fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+        b.token.length = sizes[i];
+        b.token.value = xcalloc(1, sizes[i]);
+        snprintf(name, sizeof(name), "TokenSendRecv/%lu",
+                 (unsigned long) sizes[i]);
+        bench(name, bench_token, &b, sizes[i]);
+        free(b.token.value);
+    }
+    close(b.fds[0]);
+    close(b.fds[1]);
+
+    /* Command parsing. */
+    build_payload(&b, COMMAND_MAX_ARGS, 16);
+    bench("ParseCommand/4096x16", bench_parse, &b, b.payload_length);
+    build_payload(&b, 4, 256 * 1024);
+    bench("ParseCommand/4x256K", bench_parse, &b, b.payload_length);
+    free(b.payload);
+
+    /* Configuration loading and lookup. */
+    message_handlers_warn(1, message_log_discard);
+    tmpdir = test_tmpdir();
+    path = write_config(tmpdir);
+    bench("ConfigLoad/10000", bench_config_load, path, 0);
+    b.config = server_config_load(path);
+    if (b.config == NULL)
+        die("cannot load %s", path);
+    b.command = "command00000";
+    b.subcommand = "sub0";
+    bench("FindConfigLine/first", bench_find, &b, 0);
+    b.command = "command00999";
+    b.subcommand = "sub9";
+    bench("FindConfigLine/last", bench_find, &b, 0);
+    b.command = "nonexistent";
+    bench("FindConfigLine/missing", bench_find, &b, 0);
+    server_config_free(b.config);
+    unlink(path);
+    free(path);
+    test_tmpdir_free(tmpdir);
+
+    /* Each ACL scheme. */
+    bench_one_acl(&b, "ACL/file", "file:data/acl-simple");
+    bench_one_acl(&b, "ACL/princ", "princ:user@EXAMPLE.ORG");
+    bench_one_acl(&b, "ACL/deny", "deny:princ:other@EXAMPLE.ORG");
+    bench_one_acl(&b, "ACL/anyuser", "anyuser:auth");
+#if defined(HAVE_PCRE) || defined(HAVE_PCRE2)
+    bench_one_acl(&b, "ACL/pcre", "pcre:^user.*@EXAMPLE\\.ORG$");
+#endif
+#ifdef HAVE_REGCOMP
+    bench_one_acl(&b, "ACL/regex", "regex:^user.*@EXAMPLE\\.ORG$");
+#endif
+#if defined(HAVE_KRB5) && defined(HAVE_GETGRNAM_R)
+    group = getgrgid(getgid());
+    if (group != NULL) {
+        snprintf(name, sizeof(name), "localgroup:%s", group->gr_name);
+        bench_one_acl(&b, "ACL/localgroup", name);
+    }
+#endif
+
+    /* Command logging. */
+    message_handlers_notice(1, message_log_discard);
+    words = vector_split_space("command subcommand secret arg3 arg4 arg5 "
+                               "arg6 arg7 arg8 data",
+                               NULL);
+    b.argv = xcalloc(words->count + 1, sizeof(struct iovec *));
+    for (i = 0; i < words->count; i++) {
+        b.argv[i] = xmalloc(sizeof(struct iovec));
+        b.argv[i]->iov_base = words->strings[i];
+        b.argv[i]->iov_len = strlen(words->strings[i]);
+    }
+    b.rule.logmask = xcalloc(2, sizeof(unsigned int));
+    b.rule.logmask[0] = 2;
+    b.rule.stdin_arg = -1;
+    bench("LogCommand", bench_log, &b, 0);
+    for (i = 0; i < words->count; i++)
+        free(b.argv[i]);
+    free(b.argv);
+    free(b.rule.logmask);
+    vector_free(words);
+
+    /* Utility functions. */
+    b.line = "test stdin /usr/bin/cmd-stdin stdin=last logmask=3,4 "
+             "user=nobody summary=help help=help ANYUSER princ:a@EXAMPLE.ORG";
+    bench("VectorSplitSpace", bench_vector_split, &b, strlen(b.line));
+    bench("VectorAddJoin/1000", bench_vector_join, &b, 0);
+    bench("BufferAppend/1M", bench_buffer_append, &b, 1024 * 1024);
+    bench("BufferSprintf/1000", bench_buffer_sprintf, &b, 0);
+    return 0;
+}
@@ -0,0 +1,688 @@
+/*
+ * Load generator and latency benchmark for remctld.
+ *
+ * Runs a command, or a weighted mix of commands read from a file, against a
+ * remctl server from several concurrent worker processes, each either
+ * opening a new connection for each command or keeping one connection open
+ * for all of its commands.  When done, reports throughput in commands per
+ * second and MB/s of command input and output, and log-linear histograms
+ * (in the style of HdrHistogram) of connection setup time, time to the
+ * first response from the server, and total command latency.
+ *
+ * With -l, starts a remctld on port 14373 using the test suite Kerberos
+ * configuration and tests/data/conf-simple and runs the benchmark against
+ * it.  This mode is used by make bench and needs the same environment as
+ * the test suite.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/getopt.h>
+#include <portable/system.h>
+#include <portable/uio.h>
+
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <client/remctl.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/kerberos.h>
+#include <tests/tap/remctl.h>
+#include <util/messages.h>
+#include <util/vector.h>
+#include <util/xmalloc.h>
+#include <util/xwrite.h>
+
+/*
+ * Histogram parameters.  Values are recorded in microseconds.  Values below
+ * 2 * HIST_SUB are counted exactly, and larger values are counted with
+ * HIST_SUB_BITS bits of precision (about 3%).  Values of 2^HIST_MAX_BITS
+ * microseconds (about 19 hours) or more are counted in the last bucket.
+ */
+#define HIST_SUB_BITS 5
+#define HIST_SUB      (1UL << HIST_SUB_BITS)
+#define HIST_MAX_BITS 36
+#define HIST_BUCKETS  ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+/* A latency histogram. */
+struct histogram {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t max; /* Largest value recorded, exactly. */
+};
+
+/* Results from one worker, sent back to the parent over a pipe. */
+struct stats {
+    unsigned long commands;    /* Commands that completed. */
+    unsigned long errors;      /* Commands or connections that failed. */
+    unsigned long connections; /* Connections opened. */
+    uint64_t bytes_in;         /* Bytes of command arguments sent. */
+    uint64_t bytes_out;        /* Bytes of output received. */
+    double start;              /* When the worker started. */
+    double end;                /* When the worker finished. */
+    struct histogram handshake;
+    struct histogram first;
+    struct histogram latency;
+};
+
+/* One command in the mix. */
+struct command {
+    unsigned long weight;
+    struct iovec *iov;
+    size_t count;
+    size_t length; /* Total length of all arguments. */
+};
+
+/* Benchmark configuration. */
+struct bench_config {
+    const char *host;
+    unsigned short port;
+    const char *principal;
+    unsigned long clients;  /* Number of worker processes. */
+    unsigned long count;    /* Commands per worker, if duration is 0. */
+    time_t duration;        /* Seconds to run, or 0 to use count. */
+    time_t timeout;         /* Network timeout, or 0. */
+    bool keepalive;         /* Whether to reuse connections. */
+    struct command *commands;
+    size_t ncommands;
+    unsigned long weights; /* Sum of all command weights. */
+};
+
+/* Usage message. */
+static const char usage_message[] = "\
+Usage: remctl-bench <options> <host> <command> [<args> ...]\n\
+       remctl-bench <options> -f <file> <host>\n\
+       remctl-bench -l <options> <command> [<args> ...]\n\
+\n\
+Options:\n\
+    -c <clients>  Number of concurrent connections (default: 1)\n\
+    -d <seconds>  Run for this long instead of a fixed number of commands\n\
+    -f <file>     Read a command mix from <file>, one command per line\n\
+                  preceded by its relative weight\n\
+    -h            Display this help\n\
+    -i <bytes>    Append an argument of this size to each command\n\
+    -k            Run all commands from a client over one connection\n\
+    -l            Start a local remctld using the test suite configuration\n\
+    -n <count>    Number of commands per client (default: 100)\n\
+    -p <port>     remctld port (default: 4373)\n\
+    -s <service>  remctld service principal (default: host/<host>)\n\
+    -t <timeout>  Network timeout in seconds (default: 0, no timeout)\n";
+
+
+/*
+ * Display the usage message for remctl-bench.
+ */
+__attribute__((__noreturn__)) static void
+usage(int status)
+{
+    fprintf((status == 0) ? stdout : stderr, "%s", usage_message);
+    exit(status);
+}
+
+
+/*
+ * Return the current time in seconds as a floating point number.
+ */
+static double
+current_time(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec + (double) tv.tv_usec / 1000000.0;
+}
+
+
+/*
+ * Record an elapsed time, given in seconds, in a histogram.
+ */
+static void
+histogram_record(struct histogram *hist, double elapsed)
+{
+    uint64_t value;
+    unsigned int shift;
+    size_t bucket;
+
+    value = (elapsed < 0) ? 0 : (uint64_t) (elapsed * 1000000.0);
+    if (value > hist->max)
+        hist->max = value;
+    if (value < 2 * HIST_SUB)
+        bucket = (size_t) value;
+    else {
+        for (shift = 0; (value >> shift) >= 2 * HIST_SUB; shift++)
+            ;
+        bucket = (shift + 1) * HIST_SUB + (size_t) (value >> shift) - HIST_SUB;
+        if (bucket >= HIST_BUCKETS)
+            bucket = HIST_BUCKETS - 1;
+    }
+    hist->counts[bucket]++;
+}
+
+
+/*
+ * Return the value, in microseconds, represented by a histogram bucket.  For
+ * the approximate buckets, this is the middle of the range they count.
+ */
+static double
+histogram_value(size_t bucket)
+{
+    unsigned int shift;
+    uint64_t low;
+
+    if (bucket < 2 * HIST_SUB)
+        return (double) bucket;
+    shift = (unsigned int) (bucket / HIST_SUB) - 1;
+    low = (uint64_t) (bucket % HIST_SUB + HIST_SUB) << shift;
+    return (double) low + (double) (1UL << shift) / 2.0;
+}
+
+
+/*
+ * Return the given percentile (between 0 and 1) of a histogram in
+ * microseconds, never more than the maximum value recorded.
+ */
+static double
+histogram_percentile(const struct histogram *hist, uint64_t total,
+                     double percentile)
+{
+    uint64_t seen = 0, wanted;
+    double value;
+    size_t i;
+
+    wanted = (uint64_t) (percentile * (double) total + 0.5);
+    if (wanted == 0)
+        wanted = 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= wanted)
+            break;
+    }
+    value = histogram_value(i);
+    return (value > (double) hist->max) ? (double) hist->max : value;
+}
+
+
+/*
+ * Add one histogram into another.
+ */
+static void
+histogram_merge(struct histogram *total, const struct histogram *hist)
+{
+    size_t i;
+
+    for (i = 0; i < HIST_BUCKETS; i++)
+        total->counts[i] += hist->counts[i];
+    if (hist->max > total->max)
+        total->max = hist->max;
+}
+
+
+/*
+ * Print one line of the latency report for a histogram, in milliseconds.
+ */
+static void
+histogram_print(const char *name, const struct histogram *hist)
+{
+    uint64_t total = 0;
+    size_t i;
+
+    for (i = 0; i < HIST_BUCKETS; i++)
+        total += hist->counts[i];
+    if (total == 0) {
+        printf("%-14s %10d\n", name, 0);
+        return;
+    }
+    printf("%-14s %10lu %10.3f %10.3f %10.3f %10.3f\n", name,
+           (unsigned long) total,
+           histogram_percentile(hist, total, 0.5) / 1000.0,
+           histogram_percentile(hist, total, 0.99) / 1000.0,
+           histogram_percentile(hist, total, 0.999) / 1000.0,
+           (double) hist->max / 1000.0);
+}
+
+
+/*
+ * Build a command from its arguments, adding an argument of input bytes of
+ * data at the end if input is not zero.
+ */
+static void
+command_init(struct command *command, unsigned long weight,
+             const char *const *args, size_t count, size_t input)
+{
+    size_t i;
+    char *data;
+
+    command->weight = weight;
+    command->count = count + (input > 0 ? 1 : 0);
+    command->iov = xcalloc(command->count, sizeof(struct iovec));
+    command->length = 0;
+    for (i = 0; i < count; i++) {
+        command->iov[i].iov_base = xstrdup(args[i]);
+        command->iov[i].iov_len = strlen(args[i]);
+        command->length += command->iov[i].iov_len;
+    }
+    if (input > 0) {
+        data = xmalloc(input);
+        memset(data, 'A', input);
+        command->iov[count].iov_base = data;
+        command->iov[count].iov_len = input;
+        command->length += input;
+    }
+}
+
+
+/*
+ * Read a command mix from a file.  Each line is a weight followed by the
+ * command and its arguments, separated by whitespace.  Blank lines and lines
+ * starting with # are ignored.
+ */
+static void
+read_mix(struct bench_config *config, const char *path, size_t input)
+{
+    FILE *file;
+    char buffer[BUFSIZ];
+    struct vector *args = NULL;
+    unsigned long weight, line = 0;
+    char *end;
+
+    file = fopen(path, "r");
+    if (file == NULL)
+        sysdie("cannot open %s", path);
+    while (fgets(buffer, sizeof(buffer), file) != NULL) {
+        line++;
+        if (strchr(buffer, '\n') == NULL && !feof(file))
+            die("%s:%lu: line too long", path, line);
+        args = vector_split_space(buffer, args);
+        if (args->count == 0 || args->strings[0][0] == '#')
+            continue;
+        weight = strtoul(args->strings[0], &end, 10);
+        if (*end != '\0' || weight == 0)
+            die("%s:%lu: invalid weight %s", path, line, args->strings[0]);
+        if (args->count < 2)
+            die("%s:%lu: no command given", path, line);
+        config->commands =
+            xreallocarray(config->commands, config->ncommands + 1,
+                          sizeof(struct command));
+        command_init(&config->commands[config->ncommands], weight,
+                     (const char *const *) args->strings + 1, args->count - 1,
+                     input);
+        config->ncommands++;
+        config->weights += weight;
+    }
+    if (ferror(file))
+        sysdie("cannot read %s", path);
+    fclose(file);
+    if (args != NULL)
+        vector_free(args);
+    if (config->ncommands == 0)
+        die("no commands found in %s", path);
+}
+
+
+/*
+ * Pick a command from the mix according to the weights.
+ */
+static const struct command *
+pick_command(const struct bench_config *config)
+{
+    unsigned long choice;
+    size_t i;
+
+    if (config->ncommands == 1)
+        return &config->commands[0];
+    choice = (unsigned long) rand() % config->weights;
+    for (i = 0; i < config->ncommands - 1; i++) {
+        if (choice < config->commands[i].weight)
+            break;
+        choice -= config->commands[i].weight;
+    }
+    return &config->commands[i];
+}
+
+
+/*
+ * Run one command on an open connection and read all of its output,
+ * recording the time from sending the command to the first reply.  Returns
+ * false if the command failed, and sets usable to whether the connection can
+ * still be used for another command.
+ */
+static bool
+run_command(struct remctl *r, const struct command *command,
+            struct stats *stats, bool *usable)
+{
+    struct remctl_output *output;
+    bool first = true;
+    double start;
+
+    *usable = false;
+    start = current_time();
+    if (!remctl_commandv(r, command->iov, command->count)) {
+        if (stats->errors == 0)
+            warn("%s", remctl_error(r));
+        return false;
+    }
+    stats->bytes_in += command->length;
+    do {
+        output = remctl_output(r);
+        if (output == NULL) {
+            if (stats->errors == 0)
+                warn("%s", remctl_error(r));
+            return false;
+        }
+        if (first) {
+            histogram_record(&stats->first, current_time() - start);
+            first = false;
+        }
+        if (output->type == REMCTL_OUT_OUTPUT)
+            stats->bytes_out += output->length;
+    } while (output->type == REMCTL_OUT_OUTPUT);
+    *usable = true;
+    if (output->type == REMCTL_OUT_ERROR) {
+        if (stats->errors == 0)
+            warn("server error: %.*s", (int) output->length, output->data);
+        return false;
+    }
+    return true;
+}
+
+
+/*
+ * The main loop of a worker process.  Runs commands until the count is
+ * reached or the time runs out, recording the results in stats.
+ */
+static void
+run_worker(const struct bench_config *config, struct stats *stats)
+{
+    struct remctl *r = NULL;
+    const struct command *command;
+    double start, deadline = 0;
+    unsigned long i;
+    bool usable;
+
+    srand((unsigned int) getpid());
+    stats->start = current_time();
+    if (config->duration > 0)
+        deadline = stats->start + (double) config->duration;
+    for (i = 0; deadline > 0 || i < config->count; i++) {
+        start = current_time();
+        if (deadline > 0 && start >= deadline)
+            break;
+        command = pick_command(config);
+        if (r == NULL) {
+            r = remctl_new();
+            if (r == NULL)
+                sysdie("cannot create remctl object");
+            if (config->timeout > 0)
+                remctl_set_timeout(r, config->timeout);
+            if (!remctl_open(r, config->host, config->port,
+                             config->principal)) {
+                if (stats->errors == 0)
+                    warn("%s", remctl_error(r));
+                stats->errors++;
+                remctl_close(r);
+                r = NULL;
+                continue;
+            }
+            histogram_record(&stats->handshake, current_time() - start);
+            stats->connections++;
+        }
+        if (run_command(r, command, stats, &usable))
+            stats->commands++;
+        else
+            stats->errors++;
+        histogram_record(&stats->latency, current_time() - start);
+        if (!usable || !config->keepalive) {
+            remctl_close(r);
+            r = NULL;
+        }
+    }
+    if (r != NULL)
+        remctl_close(r);
+    stats->end = current_time();
+}
+
+
+/*
+ * Read a worker's results from a pipe.  Returns false if the worker exited
+ * without sending complete results.
+ */
+static bool
+read_stats(int fd, struct stats *stats)
+{
+    char *p = (char *) stats;
+    size_t left = sizeof(struct stats);
+    ssize_t status;
+
+    while (left > 0) {
+        status = read(fd, p, left);
+        if (status < 0 && errno == EINTR)
+            continue;
+        if (status <= 0)
+            return false;
+        p += status;
+        left -= (size_t) status;
+    }
+    return true;
+}
+
+
+/*
+ * Start all the workers, collect and merge their results, and print the
+ * report.  Returns the exit status for the program.
+ */
+static int
+run_bench(const struct bench_config *config)
+{
+    struct stats *stats, *total;
+    int *fds, fd[2], status = 0;
+    pid_t *pids;
+    unsigned long i;
+    double elapsed;
+    bool merged = false;
+
+    stats = xmalloc(sizeof(struct stats));
+    total = xcalloc(1, sizeof(struct stats));
+    fds = xcalloc(config->clients, sizeof(int));
+    pids = xcalloc(config->clients, sizeof(pid_t));
+
+    /*
+     * Each worker is a separate process so that the GSS-API work on the
+     * client side runs in parallel.  The workers must use _exit so that
+     * they don't run the test suite cleanup handlers and stop remctld.
+     */
+    fflush(stdout);
+    fflush(stderr);
+    for (i = 0; i < config->clients; i++) {
+        if (pipe(fd) < 0)
+            sysdie("cannot create pipe");
+        pids[i] = fork();
+        if (pids[i] < 0)
+            sysdie("cannot fork");
+        else if (pids[i] == 0) {
+            close(fd[0]);
+            memset(stats, 0, sizeof(struct stats));
+            run_worker(config, stats);
+            if (xwrite(fd[1], stats, sizeof(struct stats)) < 0)
+                _exit(1);
+            _exit(0);
+        }
+        close(fd[1]);
+        fds[i] = fd[0];
+    }
+
+    /* Collect the results. */
+    for (i = 0; i < config->clients; i++) {
+        if (!read_stats(fds[i], stats)) {
+            warn("worker %lu failed", i + 1);
+            status = 1;
+        } else {
+            total->commands += stats->commands;
+            total->errors += stats->errors;
+            total->connections += stats->connections;
+            total->bytes_in += stats->bytes_in;
+            total->bytes_out += stats->bytes_out;
+            if (!merged || stats->start < total->start)
+                total->start = stats->start;
+            merged = true;
+            if (stats->end > total->end)
+                total->end = stats->end;
+            histogram_merge(&total->handshake, &stats->handshake);
+            histogram_merge(&total->first, &stats->first);
+            histogram_merge(&total->latency, &stats->latency);
+        }
+        close(fds[i]);
+        waitpid(pids[i], NULL, 0);
+    }
+    if (total->errors > 0)
+        status = 1;
+
+    /* Print the report. */
+    elapsed = total->end - total->start;
+    if (elapsed <= 0)
+        elapsed = 1e-6;
+    printf("clients:       %lu (%s)\n", config->clients,
+           config->keepalive ? "keep-alive" : "new connection per command");
+    printf("commands:      %lu (%lu errors, %lu connections)\n",
+           total->commands, total->errors, total->connections);
+    printf("elapsed:       %.3f s\n", elapsed);
+    printf("throughput:    %.1f commands/s\n",
+           (double) total->commands / elapsed);
+    printf("input:         %.2f MB/s (%.2f MB)\n",
+           (double) total->bytes_in / elapsed / 1e6,
+           (double) total->bytes_in / 1e6);
+    printf("output:        %.2f MB/s (%.2f MB)\n",
+           (double) total->bytes_out / elapsed / 1e6,
+           (double) total->bytes_out / 1e6);
+    printf("\n%-14s %10s %10s %10s %10s %10s\n", "(ms)", "count", "p50",
+           "p99", "p999", "max");
+    histogram_print("handshake", &total->handshake);
+    histogram_print("first reply", &total->first);
+    histogram_print("latency", &total->latency);
+
+    free(stats);
+    free(total);
+    free(fds);
+    free(pids);
+    return status;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    int option;
+    struct bench_config config;
+    struct kerberos_config *krbconf;
+    const char *mix = NULL;
+    bool local = false;
+    size_t input = 0;
+    char *end;
+    long tmp;
+
+    message_program_name = "remctl-bench";
+    memset(&config, 0, sizeof(config));
+    config.clients = 1;
+    config.count = 100;
+
+    while ((option = getopt(argc, argv, "+c:d:f:hi:kln:p:s:t:")) != EOF) {
+        switch (option) {
+        case 'c':
+            tmp = strtol(optarg, &end, 10);
+            if (*end != '\0' || tmp < 1)
+                die("invalid number of clients %s", optarg);
+            config.clients = (unsigned long) tmp;
+            break;
+        case 'd':
+            tmp = strtol(optarg, &end, 10);
+            if (*end != '\0' || tmp < 1)
+                die("invalid duration %s", optarg);
+            config.duration = (time_t) tmp;
+            break;
+        case 'f':
+            mix = optarg;
+            break;
+        case 'h':
+            usage(0);
+        case 'i':
+            tmp = strtol(optarg, &end, 10);
+            if (*end != '\0' || tmp < 0)
+                die("invalid input size %s", optarg);
+            input = (size_t) tmp;
+            break;
+        case 'k':
+            config.keepalive = true;
+            break;
+        case 'l':
+            local = true;
+            break;
+        case 'n':
+            tmp = strtol(optarg, &end, 10);
+            if (*end != '\0' || tmp < 1)
+                die("invalid command count %s", optarg);
+            config.count = (unsigned long) tmp;
+            break;
+        case 'p':
+            tmp = strtol(optarg, &end, 10);
+            if (*end != '\0' || tmp < 1 || tmp > (1L << 16) - 1)
+                die("invalid port number %s", optarg);
+            config.port = (unsigned short) tmp;
+            break;
+        case 's':
+            config.principal = optarg;
+            break;
+        case 't':
+            tmp = strtol(optarg, &end, 10);
+            if (*end != '\0' || tmp < 0)
+                die("invalid timeout value %s", optarg);
+            config.timeout = (time_t) tmp;
+            break;
+        case '+':
+            fprintf(stderr, "%s: invalid option -- +\n", argv[0]);
+            usage(1);
+        default:
+            usage(1);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    /* Get the server and the command mix. */
+    if (!local) {
+        if (argc < 1)
+            usage(1);
+        config.host = *argv++;
+        argc--;
+    }
+    if (mix != NULL) {
+        if (argc > 0)
+            usage(1);
+        read_mix(&config, mix, input);
+    } else {
+        if (argc < 1)
+            usage(1);
+        config.commands = xmalloc(sizeof(struct command));
+        command_init(&config.commands[0], 1, (const char *const *) argv,
+                     (size_t) argc, input);
+        config.ncommands = 1;
+        config.weights = 1;
+    }
+
+    /*
+     * In local mode, use the test suite machinery to get tickets and start
+     * remctld.  plan_lazy registers the exit handler that stops remctld and
+     * cleans up the tickets but prints nothing since no tests are run.
+     */
+    if (local) {
+        plan_lazy();
+        krbconf = kerberos_setup(TAP_KRB_NEEDS_KEYTAB);
+        remctld_start(krbconf, "data/conf-simple", (char *) 0);
+        config.host = "127.0.0.1";
+        config.port = 14373;
+        config.principal = krbconf->principal;
+    }
+    return run_bench(&config);
+}
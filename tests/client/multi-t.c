@@ -0,0 +1,123 @@
+/*
+ * Test suite for sets of equivalent servers.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/socket.h>
+#include <portable/system.h>
+
+#include <time.h>
+
+#include <client/remctl.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/kerberos.h>
+#include <tests/tap/remctl.h>
+#include <util/network.h>
+
+
+/*
+ * Check the result of running test test with remctl_multi.
+ */
+static void
+check_result(struct remctl_result *result)
+{
+    ok(result != NULL, "remctl_multi");
+    if (result == NULL) {
+        ok_block(3, 0, "remctl_multi returned NULL");
+        return;
+    }
+    is_string(NULL, result->error, "...with no error");
+    ok(result->stdout_len == 12
+           && memcmp("hello world\n", result->stdout_buf, 12) == 0,
+       "...and correct output");
+    is_int(0, result->status, "...and correct status");
+}
+
+
+int
+main(void)
+{
+    struct kerberos_config *config;
+    struct remctl *r;
+    struct remctl_output *output;
+    struct remctl_result *result;
+    const char *command[] = {"test", "test", NULL};
+    const char *hosts[] = {"127.0.0.3", "127.0.0.1", NULL};
+    const char *refused[] = {"127.0.0.3", NULL};
+    const char *none[] = {NULL};
+    const char *failover[] = {"127.0.0.4", "127.0.0.1", NULL};
+    const char *hedged[] = {"127.0.0.2", "127.0.0.1", NULL};
+    socket_type fd;
+    time_t start;
+
+    /*
+     * Set up Kerberos and remctld, listening only on 127.0.0.1 so that
+     * connections to other loopback addresses are refused.
+     */
+    config = kerberos_setup(TAP_KRB_NEEDS_KEYTAB);
+    remctld_start(config, "data/conf-simple", "-b", "127.0.0.1", (char *) 0);
+
+    plan(18);
+
+    /* remctl_open_multi skips servers that refuse connections. */
+    r = remctl_new();
+    if (r == NULL)
+        sysbail("cannot create remctl object");
+    remctl_set_timeout(r, 5);
+    ok(remctl_open_multi(r, hosts, 14373, config->principal),
+       "remctl_open_multi");
+    if (!remctl_command(r, command))
+        bail("remctl_command failed: %s", remctl_error(r));
+    output = remctl_output(r);
+    ok(output != NULL && output->type == REMCTL_OUT_OUTPUT
+           && output->length == 12
+           && memcmp("hello world\n", output->data, 12) == 0,
+       "...and output is correct");
+    output = remctl_output(r);
+    ok(output != NULL && output->type == REMCTL_OUT_STATUS
+           && output->status == 0,
+       "...and status is correct");
+
+    /* If all servers fail, the error from the last one is reported. */
+    ok(!remctl_open_multi(r, refused, 14373, config->principal),
+       "remctl_open_multi with no working server");
+    ok(strstr(remctl_error(r), "127.0.0.3") != NULL, "...with correct error");
+    ok(!remctl_open_multi(r, none, 14373, config->principal),
+       "remctl_open_multi with no servers");
+    is_string("no hosts given", remctl_error(r), "...with correct error");
+    remctl_close(r);
+
+    /* remctl_multi also fails over. */
+    result = remctl_multi(failover, 14373, config->principal, command, 0);
+    check_result(result);
+    remctl_result_free(result);
+    result = remctl_multi(refused, 14373, config->principal, command, 0);
+    ok(result != NULL && result->error != NULL, "remctl_multi failure");
+    ok(result != NULL && result->error != NULL
+           && strstr(result->error, "127.0.0.3") != NULL,
+       "...with correct error");
+    remctl_result_free(result);
+
+    /*
+     * Create a server on 127.0.0.2 that accepts connections but never
+     * responds.  With hedging, the command should be sent to 127.0.0.1 after
+     * the default one second delay.
+     */
+    fd = network_bind_ipv4(SOCK_STREAM, "127.0.0.2", 14373);
+    if (fd == INVALID_SOCKET || listen(fd, 5) < 0)
+        skip_block(5, "cannot listen on 127.0.0.2");
+    else {
+        start = time(NULL);
+        result = remctl_multi(hedged, 14373, config->principal, command, 1);
+        check_result(result);
+        remctl_result_free(result);
+        ok(time(NULL) - start < 5, "...without waiting for the slow server");
+        socket_close(fd);
+    }
+    return 0;
+}
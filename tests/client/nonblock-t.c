@@ -0,0 +1,220 @@
+/*
+ * Test suite for the non-blocking client interface.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <poll.h>
+
+#include <client/remctl.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/kerberos.h>
+#include <tests/tap/remctl.h>
+
+/* The number of connections to run in parallel. */
+#define CONNECTIONS 4
+
+
+/*
+ * Wait for the socket of a connection to be ready as requested by the last
+ * call to remctl_step and then call remctl_step again.  Returns the new
+ * status.
+ */
+static enum remctl_step_status
+wait_step(struct remctl *r, enum remctl_step_status status)
+{
+    struct pollfd pfd;
+
+    if (status == REMCTL_STEP_READ || status == REMCTL_STEP_WRITE) {
+        pfd.fd = remctl_fd(r);
+        pfd.events = (status == REMCTL_STEP_READ) ? POLLIN : POLLOUT;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 10 * 1000) <= 0)
+            sysbail("poll failed or timed out");
+    }
+    return remctl_step(r);
+}
+
+
+/*
+ * Drive a single connection until it is no longer waiting on the network and
+ * return the final status.
+ */
+static enum remctl_step_status
+run_step(struct remctl *r)
+{
+    enum remctl_step_status status;
+
+    status = remctl_step(r);
+    while (status == REMCTL_STEP_READ || status == REMCTL_STEP_WRITE)
+        status = wait_step(r, status);
+    return status;
+}
+
+
+/*
+ * Run several connections at the same time from one poll loop, each of which
+ * opens a connection, runs test test, and collects the output.
+ */
+static void
+test_parallel(struct kerberos_config *config)
+{
+    struct remctl *r[CONNECTIONS];
+    enum remctl_step_status status[CONNECTIONS];
+    bool sent[CONNECTIONS], finished[CONNECTIONS];
+    size_t stdout_len[CONNECTIONS];
+    int exit_status[CONNECTIONS];
+    struct pollfd pfd[CONNECTIONS];
+    struct remctl_output *output;
+    const char *command[] = {"test", "test", NULL};
+    size_t i, remaining;
+
+    for (i = 0; i < CONNECTIONS; i++) {
+        r[i] = remctl_new();
+        if (r[i] == NULL)
+            sysbail("cannot create remctl object");
+        if (!remctl_open_start(r[i], "127.0.0.1", 14373, config->principal))
+            bail("cannot start connection: %s", remctl_error(r[i]));
+        status[i] = REMCTL_STEP_WRITE;
+        sent[i] = false;
+        finished[i] = false;
+        stdout_len[i] = 0;
+        exit_status[i] = -1;
+    }
+
+    /* Drive every connection from the same poll loop. */
+    remaining = CONNECTIONS;
+    while (remaining > 0) {
+        for (i = 0; i < CONNECTIONS; i++) {
+            pfd[i].fd = finished[i] ? -1 : remctl_fd(r[i]);
+            pfd[i].events = (status[i] == REMCTL_STEP_READ) ? POLLIN : POLLOUT;
+            pfd[i].revents = 0;
+        }
+        if (poll(pfd, CONNECTIONS, 10 * 1000) <= 0)
+            sysbail("poll failed or timed out");
+        for (i = 0; i < CONNECTIONS; i++) {
+            if (finished[i] || pfd[i].revents == 0)
+                continue;
+            status[i] = remctl_step(r[i]);
+            while (status[i] == REMCTL_STEP_OUTPUT
+                   || status[i] == REMCTL_STEP_DONE) {
+                if (status[i] == REMCTL_STEP_DONE && !sent[i]) {
+                    if (!remctl_command_start(r[i], command))
+                        bail("cannot send command: %s", remctl_error(r[i]));
+                    sent[i] = true;
+                } else if (status[i] == REMCTL_STEP_DONE) {
+                    finished[i] = true;
+                    remaining--;
+                    break;
+                } else {
+                    output = remctl_output(r[i]);
+                    if (output == NULL)
+                        bail("output failed: %s", remctl_error(r[i]));
+                    if (output->type == REMCTL_OUT_OUTPUT)
+                        stdout_len[i] += output->length;
+                    else if (output->type == REMCTL_OUT_STATUS)
+                        exit_status[i] = output->status;
+                }
+                status[i] = remctl_step(r[i]);
+            }
+            if (status[i] == REMCTL_STEP_ERROR)
+                bail("step failed: %s", remctl_error(r[i]));
+        }
+    }
+    for (i = 0; i < CONNECTIONS; i++) {
+        is_int(12, stdout_len[i], "connection %lu got output",
+               (unsigned long) i);
+        is_int(0, exit_status[i], "connection %lu got status",
+               (unsigned long) i);
+        remctl_close(r[i]);
+    }
+}
+
+
+int
+main(void)
+{
+    struct kerberos_config *config;
+    struct remctl *r;
+    struct remctl_output *output;
+    enum remctl_step_status status;
+    const char *command[] = {"test", "test", NULL};
+    const char *large[] = {"test", "large-output", "1000000", NULL};
+    size_t length;
+
+    /* Set up Kerberos and remctld. */
+    config = kerberos_setup(TAP_KRB_NEEDS_KEYTAB);
+    remctld_start(config, "data/conf-simple", (char *) 0);
+
+    plan(21 + CONNECTIONS * 2);
+
+    /* Operations are rejected before the connection is opened. */
+    r = remctl_new();
+    if (r == NULL)
+        sysbail("cannot create remctl object");
+    is_int(-1, remctl_fd(r), "no socket before open");
+    ok(!remctl_command_start(r, command), "command before open fails");
+    is_string("connection not opened in non-blocking mode", remctl_error(r),
+              "...with correct error");
+
+    /* Open the connection and complete the handshake. */
+    ok(remctl_open_start(r, "127.0.0.1", 14373, config->principal),
+       "remctl_open_start");
+    ok(remctl_fd(r) >= 0, "...and socket is available");
+    ok(!remctl_noop_start(r), "NOOP before handshake fails");
+    is_string("operation already in progress", remctl_error(r),
+              "...with correct error");
+    status = run_step(r);
+    is_int(REMCTL_STEP_DONE, status, "handshake completes");
+
+    /* Run a simple command. */
+    ok(remctl_command_start(r, command), "remctl_command_start");
+    ok(!remctl_noop_start(r), "NOOP while command is pending fails");
+    status = run_step(r);
+    is_int(REMCTL_STEP_OUTPUT, status, "output is available");
+    output = remctl_output(r);
+    ok(output != NULL, "...and remctl_output returns it");
+    if (output == NULL)
+        ok_block(2, 0, "output is NULL (%s)", remctl_error(r));
+    else {
+        is_int(REMCTL_OUT_OUTPUT, output->type, "...of the right type");
+        ok(output->length == 12
+               && memcmp("hello world\n", output->data, 12) == 0,
+           "...with the right data");
+    }
+    status = run_step(r);
+    is_int(REMCTL_STEP_OUTPUT, status, "status is available");
+    output = remctl_output(r);
+    if (output == NULL)
+        ok(false, "status is NULL (%s)", remctl_error(r));
+    else
+        is_int(REMCTL_OUT_STATUS, output->type, "...and is a status");
+    is_int(REMCTL_STEP_DONE, run_step(r), "command is done");
+
+    /* Send a NOOP. */
+    ok(remctl_noop_start(r), "remctl_noop_start");
+    is_int(REMCTL_STEP_DONE, run_step(r), "...and NOOP completes");
+
+    /* Retrieve a large amount of output across many tokens. */
+    ok(remctl_command_start(r, large), "large output command");
+    length = 0;
+    while ((status = run_step(r)) == REMCTL_STEP_OUTPUT) {
+        output = remctl_output(r);
+        if (output == NULL)
+            break;
+        if (output->type == REMCTL_OUT_OUTPUT)
+            length += output->length;
+    }
+    is_int(1000000, length, "...and got all the output");
+    remctl_close(r);
+
+    /* Run several connections in parallel. */
+    test_parallel(config);
+    return 0;
+}
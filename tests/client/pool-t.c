@@ -0,0 +1,142 @@
+/*
+ * Test suite for the client connection pool.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/socket.h>
+#include <portable/system.h>
+
+#include <client/remctl.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/kerberos.h>
+#include <tests/tap/remctl.h>
+#include <tests/tap/string.h>
+
+
+/*
+ * Return the local port of a connection, used to tell whether a connection
+ * was reused from the pool.
+ */
+static unsigned short
+local_port(struct remctl *r)
+{
+    struct sockaddr_storage ss;
+    socklen_t length = sizeof(ss);
+
+    if (getsockname(remctl_fd(r), (struct sockaddr *) &ss, &length) < 0)
+        sysbail("cannot get local address");
+    if (ss.ss_family == AF_INET)
+        return ntohs(((struct sockaddr_in *) &ss)->sin_port);
+#ifdef HAVE_INET6
+    else if (ss.ss_family == AF_INET6)
+        return ntohs(((struct sockaddr_in6 *) &ss)->sin6_port);
+#endif
+    bail("unknown address family %d", ss.ss_family);
+}
+
+
+/*
+ * Open a pooled connection, run test test, and return the connection to the
+ * pool.  If finish is true, read and check the output first; otherwise,
+ * leave the output unread, which should keep the connection out of the pool.
+ * Returns the local port of the connection.
+ */
+static unsigned short
+run_command(struct kerberos_config *config, bool finish)
+{
+    struct remctl *r;
+    struct remctl_output *output;
+    const char *command[] = {"test", "test", NULL};
+    unsigned short port;
+
+    r = remctl_new();
+    if (r == NULL)
+        sysbail("cannot create remctl object");
+    ok(remctl_pool_open(r, "localhost", 14373, config->principal),
+       "remctl_pool_open");
+    port = local_port(r);
+    ok(remctl_command(r, command), "...and remctl_command");
+    if (finish) {
+        output = remctl_output(r);
+        ok(output != NULL && output->type == REMCTL_OUT_OUTPUT
+               && output->length == 12
+               && memcmp("hello world\n", output->data, 12) == 0,
+           "...and output is correct");
+        output = remctl_output(r);
+        ok(output != NULL && output->type == REMCTL_OUT_STATUS
+               && output->status == 0,
+           "...and status is correct");
+    }
+    remctl_pool_close(r);
+    return port;
+}
+
+
+int
+main(void)
+{
+    struct kerberos_config *config;
+    struct remctl_result *result;
+    const char *command[] = {"test", "test", NULL};
+    unsigned short first, second;
+    char *ccache;
+
+    /* Set up Kerberos and remctld. */
+    config = kerberos_setup(TAP_KRB_NEEDS_KEYTAB);
+    remctld_start(config, "data/conf-simple", (char *) 0);
+
+    plan(47);
+
+    /* Without the pool, every connection is new. */
+    first = run_command(config, true);
+    second = run_command(config, true);
+    ok(first != second, "connections not reused without the pool");
+
+    /* Enable the pool and check that connections are reused. */
+    ok(remctl_pool_enable(2, 0), "remctl_pool_enable");
+    first = run_command(config, true);
+    second = run_command(config, true);
+    is_int(first, second, "connection reused from the pool");
+
+    /* A connection with unread output is not returned to the pool. */
+    run_command(config, false);
+    second = run_command(config, true);
+    ok(first != second, "connection with pending output not reused");
+
+    /*
+     * Changing the default ticket cache means a new connection, even if the
+     * new name refers to the same ticket cache.
+     */
+    first = run_command(config, true);
+    basprintf(&ccache, "FILE:%s", config->cache);
+    if (setenv("KRB5CCNAME", ccache, 1) < 0)
+        sysbail("cannot set KRB5CCNAME");
+    second = run_command(config, true);
+    ok(first != second, "connection not reused with a new default cache");
+    if (setenv("KRB5CCNAME", config->cache, 1) < 0)
+        sysbail("cannot set KRB5CCNAME");
+    free(ccache);
+
+    /* The simple interface uses the pool. */
+    result = remctl("localhost", 14373, config->principal, command);
+    ok(result != NULL, "remctl with the pool enabled");
+    if (result == NULL)
+        ok_block(2, 0, "remctl returned NULL");
+    else {
+        is_string(NULL, result->error, "...with no error");
+        is_int(0, result->status, "...and correct status");
+    }
+    remctl_result_free(result);
+
+    /* Disabling the pool closes all connections. */
+    first = run_command(config, true);
+    remctl_pool_disable();
+    second = run_command(config, true);
+    ok(first != second, "connections not reused after disabling the pool");
+    return 0;
+}
@@ -1,7 +1,7 @@
 /*
- * Small C program to output an arbitrary amount of data to standard output
- * and then exit successfully.  Used to verify that we don't truncate data
- * output right before process close.
+ * Small C program to output an arbitrary amount of data to standard output,
+ * and optionally to standard error, and then exit successfully.  Used to
+ * verify that we don't truncate data output right before process close.
  *
  * Written by Russ Allbery <eagle@eyrie.org>
  * Copyright 2025 Russ Allbery <eagle@eyrie.org>
@@ -22,19 +22,29 @@ int
 main(int argc, const char *argv[])
 {
     unsigned long length;
+    unsigned long errlength = 0;
     char *data;
 
-    if (argc != 3) {
+    if (argc != 3 && argc != 4) {
         fprintf(stderr, "invalid arguments\n");
         exit(1);
     }
     length = strtoul(argv[2], NULL, 10);
-    if (length == 0) {
+    if (argc == 4)
+        errlength = strtoul(argv[3], NULL, 10);
+    if (length == 0 || (argc == 4 && errlength == 0)) {
         fprintf(stderr, "invalid data length\n");
         exit(1);
     }
     data = xmalloc(length);
     memset(data, '1', length);
     xwrite(STDOUT_FILENO, data, length);
+    free(data);
+    if (errlength > 0) {
+        data = xmalloc(errlength);
+        memset(data, '2', errlength);
+        xwrite(STDERR_FILENO, data, errlength);
+        free(data);
+    }
     exit(0);
 }
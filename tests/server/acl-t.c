@@ -35,9 +35,12 @@
 static bool
 acl_permit(const struct rule *rule, const char *user)
 {
-    struct client client = {-1,    -1, NULL, NULL,  0,     NULL, (char *) user,
-                            false, 0,  0,    false, false, NULL, NULL,
-                            NULL};
+    struct client client;
+
+    memset(&client, 0, sizeof(client));
+    client.fd = -1;
+    client.stderr_fd = -1;
+    client.user = (char *) user;
     return server_config_acl_permit(rule, &client);
 }
 
@@ -54,13 +57,16 @@ static bool
 acl_permit_anonymous(const struct rule *rule)
 {
     static char *pname = NULL;
-    struct client client = {-1, -1, NULL,  NULL,  0,    NULL, NULL, true,
-                            0,  0,  false, false, NULL, NULL, NULL};
+    struct client client;
 
     if (pname == NULL)
         basprintf(&pname, "%s/%s@%s", KRB5_WELLKNOWN_NAME, KRB5_ANON_NAME,
                   KRB5_ANON_REALM);
+    memset(&client, 0, sizeof(client));
+    client.fd = -1;
+    client.stderr_fd = -1;
     client.user = pname;
+    client.anonymous = true;
     return server_config_acl_permit(rule, &client);
 }
 
@@ -68,8 +74,7 @@ acl_permit_anonymous(const struct rule *rule)
 int
 main(void)
 {
-    struct rule rule = {NULL, 0,    NULL, NULL, NULL, NULL, NULL, 0,
-                        NULL, NULL, 0,    0,    NULL, NULL, NULL};
+    struct rule rule;
     const char *acls[5];
 #if defined(HAVE_PCRE) || defined(HAVE_PCRE2)
     char *colon;
@@ -79,6 +84,7 @@ main(void)
     if (chdir(getenv("C_TAP_SOURCE")) < 0)
         sysbail("can't chdir to C_TAP_SOURCE");
 
+    memset(&rule, 0, sizeof(rule));
     rule.file = (char *) "TEST";
     rule.acls = (char **) acls;
     acls[0] = "data/acl-simple";
@@ -61,9 +61,12 @@ static const struct group badguys = {(char *) "badguys", NULL, 42,
 static bool
 acl_permit(const struct rule *rule, const char *user)
 {
-    struct client client = {-1,    -1, NULL, NULL,  0,     NULL, (char *) user,
-                            false, 0,  0,    false, false, NULL, NULL,
-                            NULL};
+    struct client client;
+
+    memset(&client, 0, sizeof(client));
+    client.fd = -1;
+    client.stderr_fd = -1;
+    client.user = (char *) user;
     return server_config_acl_permit(rule, &client);
 }
 
@@ -74,23 +77,11 @@ int
 main(void)
 {
     const char *acls[5];
-    const struct rule rule = {(char *) "TEST",
-                              0,
-                              NULL,
-                              NULL,
-                              NULL,
-                              NULL,
-                              NULL,
-                              0,
-                              NULL,
-                              NULL,
-                              0,
-                              0,
-                              NULL,
-                              NULL,
-                              NULL};
+    struct rule rule;
 
     plan(2);
+    memset(&rule, 0, sizeof(rule));
+    rule.file = (char *) "TEST";
 
     errors_capture();
     acls[0] = "localgroup:foobargroup";
@@ -131,23 +122,12 @@ main(void)
     char *expected;
     char long_principal[VERY_LONG_PRINCIPAL];
     const char *acls[5];
-    const struct rule rule = {(char *) "TEST",
-                              0,
-                              NULL,
-                              NULL,
-                              NULL,
-                              NULL,
-                              NULL,
-                              0,
-                              NULL,
-                              NULL,
-                              0,
-                              0,
-                              NULL,
-                              NULL,
-                              (char **) acls};
+    struct rule rule;
 
     plan(16);
+    memset(&rule, 0, sizeof(rule));
+    rule.file = (char *) "TEST";
+    rule.acls = (char **) acls;
 
     /* Use a krb5.conf with a default realm of EXAMPLE.ORG. */
     kerberos_generate_conf("EXAMPLE.ORG");
@@ -0,0 +1,412 @@
+/*
+ * Test suite for the server result cache.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/event.h>
+#include <portable/system.h>
+#include <portable/uio.h>
+
+#include <sys/wait.h>
+
+#include <server/internal.h>
+#include <tests/tap/basic.h>
+
+/* What a child running a coalesced command should do. */
+enum leader_action
+{
+    LEADER_STORE,
+    LEADER_LARGE,
+    LEADER_ABANDON,
+    LEADER_EXIT
+};
+
+/* Size of output too large to cache, for a cache of 64KB. */
+#define LARGE_OUTPUT (16 * 1024)
+
+
+/*
+ * Build a command as a NULL-terminated array of iovecs from a NULL-terminated
+ * list of strings.  The strings are not copied.
+ */
+static struct iovec **
+make_command(const char *first, ...)
+{
+    va_list args;
+    struct iovec **argv;
+    const char *arg;
+    size_t i = 0;
+
+    argv = bcalloc_type(8, struct iovec *);
+    va_start(args, first);
+    for (arg = first; arg != NULL && i < 7; arg = va_arg(args, const char *)) {
+        argv[i] = bcalloc_type(1, struct iovec);
+        argv[i]->iov_base = (void *) arg;
+        argv[i]->iov_len = strlen(arg);
+        i++;
+    }
+    va_end(args);
+    return argv;
+}
+
+
+/*
+ * Free a command created by make_command.
+ */
+static void
+free_command(struct iovec **argv)
+{
+    size_t i;
+
+    for (i = 0; argv[i] != NULL; i++)
+        free(argv[i]);
+    free(argv);
+}
+
+
+/*
+ * Store a result with the given output on standard output and standard error
+ * and exit status, recording it the same way that a running command would
+ * and giving up on the command afterwards if the result couldn't be stored.
+ */
+static void
+store(const struct client *client, const struct rule *rule,
+      struct iovec **argv, const char *out, const char *err, int status)
+{
+    struct process process;
+    struct evbuffer *data;
+
+    memset(&process, 0, sizeof(process));
+    process.cache = evbuffer_new();
+    data = evbuffer_new();
+    if (process.cache == NULL || data == NULL)
+        bail("cannot create evbuffers");
+    evbuffer_add(data, out, strlen(out));
+    server_cache_record(&process, 1, data);
+    evbuffer_drain(data, evbuffer_get_length(data));
+    evbuffer_add(data, err, strlen(err));
+    server_cache_record(&process, 2, data);
+    if (process.cache != NULL) {
+        server_cache_store(client, rule, argv, process.cache, status);
+        evbuffer_free(process.cache);
+    }
+    server_cache_abandon(client, rule, argv);
+    evbuffer_free(data);
+}
+
+
+/*
+ * Look up a result and return the standard output in newly allocated memory,
+ * or NULL if it's not in the cache.  Also stores the exit status.
+ */
+static char *
+lookup(const struct client *client, const struct rule *rule,
+       struct iovec **argv, int *status)
+{
+    struct evbuffer *records, *data, *out;
+    char *result;
+    int stream;
+    size_t length;
+
+    records = evbuffer_new();
+    data = evbuffer_new();
+    out = evbuffer_new();
+    if (records == NULL || data == NULL || out == NULL)
+        bail("cannot create evbuffers");
+    result = NULL;
+    if (server_cache_lookup(client, rule, argv, records, status)) {
+        while (server_cache_next(records, &stream, data))
+            if (stream == 1)
+                evbuffer_add_buffer(out, data);
+            else
+                evbuffer_drain(data, evbuffer_get_length(data));
+        length = evbuffer_get_length(out);
+        result = bcalloc(length + 1, 1);
+        evbuffer_remove(out, result, length);
+    }
+    evbuffer_free(records);
+    evbuffer_free(data);
+    evbuffer_free(out);
+    return result;
+}
+
+
+/*
+ * Start a child that looks up a command, and so starts running it if the rule
+ * coalesces requests, and then either stores a result after a second, stores
+ * output too large to cache after a second, abandons the command after a
+ * second, or exits immediately, depending on action.  Returns once the child
+ * has looked up the command.
+ */
+static pid_t
+start_leader(const struct client *client, const struct rule *rule,
+             struct iovec **argv, enum leader_action action)
+{
+    struct evbuffer *records;
+    char *big;
+    int fds[2];
+    int status;
+    pid_t child;
+    char c = 0;
+
+    if (pipe(fds) < 0)
+        sysbail("cannot create pipe");
+    child = fork();
+    if (child < 0)
+        sysbail("cannot fork");
+    else if (child == 0) {
+        close(fds[0]);
+        records = evbuffer_new();
+        if (records == NULL)
+            _exit(1);
+        if (server_cache_lookup(client, rule, argv, records, &status))
+            _exit(1);
+        if (write(fds[1], &c, 1) < 1)
+            _exit(1);
+        if (action == LEADER_EXIT)
+            _exit(0);
+        sleep(1);
+        if (action == LEADER_STORE)
+            store(client, rule, argv, "once\n", "", 0);
+        else if (action == LEADER_LARGE) {
+            big = bcalloc(LARGE_OUTPUT, 1);
+            memset(big, 'x', LARGE_OUTPUT - 1);
+            store(client, rule, argv, big, "", 0);
+        } else
+            server_cache_abandon(client, rule, argv);
+        _exit(0);
+    }
+    close(fds[1]);
+    if (read(fds[0], &c, 1) < 1)
+        bail("leader child failed");
+    close(fds[0]);
+    return child;
+}
+
+
+int
+main(void)
+{
+    struct config *config;
+    struct rule *cached, *shared, *coalesced, *uncached;
+    struct client client, other;
+    struct iovec **argv, **argv2;
+    struct evbuffer *records, *data;
+    char *result, *big;
+    char name[32];
+    int status, stream;
+    pid_t child, waiters[3];
+    size_t i;
+    double start;
+    bool okay;
+
+    plan(35);
+    if (chdir(getenv("C_TAP_SOURCE")) < 0)
+        sysbail("can't chdir to C_TAP_SOURCE");
+
+    /* Check parsing of the configuration options. */
+    config = server_config_load("data/conf-cache");
+    if (config == NULL)
+        bail("server_config_load returned NULL");
+    cached = config->rules[0];
+    shared = config->rules[1];
+    coalesced = config->rules[2];
+    uncached = config->rules[3];
+    is_int(60, cached->cache, "cache");
+    ok(!cached->cache_global, "cache-scope defaults to user");
+    ok(shared->cache_global, "cache-scope=global");
+    ok(coalesced->coalesce && coalesced->cache == 0, "coalesce=yes");
+
+    /* Set up the clients and a command. */
+    memset(&client, 0, sizeof(client));
+    client.protocol = 2;
+    client.user = (char *) "user@EXAMPLE.ORG";
+    other = client;
+    other.user = (char *) "other@EXAMPLE.ORG";
+    argv = make_command("test", "cached", "arg", (const char *) NULL);
+
+    /* Without initialization, nothing is cached. */
+    ok(!server_cache_enabled(cached), "not enabled without initialization");
+    store(&client, cached, argv, "hello\n", "", 0);
+    ok(lookup(&client, cached, argv, &status) == NULL,
+       "...and nothing is stored");
+
+    /* Store and retrieve a result. */
+    server_cache_init(64 * 1024);
+    ok(server_cache_enabled(cached), "enabled after initialization");
+    ok(!server_cache_enabled(uncached), "...but not for rules without cache");
+    ok(lookup(&client, cached, argv, &status) == NULL, "initially empty");
+    store(&client, cached, argv, "hello\n", "warning\n", 3);
+    result = lookup(&client, cached, argv, &status);
+    is_string("hello\n", result, "cached output");
+    is_int(3, status, "...and exit status");
+    free(result);
+
+    /* Both streams are returned in order. */
+    records = evbuffer_new();
+    data = evbuffer_new();
+    if (records == NULL || data == NULL)
+        bail("cannot create evbuffers");
+    server_cache_lookup(&client, cached, argv, records, &status);
+    ok(server_cache_next(records, &stream, data), "first record");
+    is_int(1, stream, "...is standard output");
+    evbuffer_drain(data, evbuffer_get_length(data));
+    ok(server_cache_next(records, &stream, data), "second record");
+    is_int(2, stream, "...is standard error");
+    is_int(8, evbuffer_get_length(data), "...with the right length");
+    ok(!server_cache_next(records, &stream, data), "no more records");
+    evbuffer_free(records);
+    evbuffer_free(data);
+
+    /* The key includes the user, the protocol, and the arguments. */
+    ok(lookup(&other, cached, argv, &status) == NULL, "other user misses");
+    client.protocol = 1;
+    ok(lookup(&client, cached, argv, &status) == NULL, "protocol 1 misses");
+    client.protocol = 2;
+    argv2 = make_command("test", "cached", "other", (const char *) NULL);
+    ok(lookup(&client, cached, argv2, &status) == NULL,
+       "other arguments miss");
+
+    /* Results of rules with global scope are shared, and expire. */
+    store(&client, shared, argv2, "shared\n", "", 0);
+    result = lookup(&other, shared, argv2, &status);
+    is_string("shared\n", result, "global result seen by other user");
+    free(result);
+    sleep(2);
+    ok(lookup(&other, shared, argv2, &status) == NULL, "...and expires");
+
+    /* The cache is shared with children. */
+    child = fork();
+    if (child < 0)
+        sysbail("cannot fork");
+    else if (child == 0) {
+        store(&client, cached, argv2, "child\n", "", 0);
+        _exit(0);
+    }
+    if (waitpid(child, &status, 0) != child)
+        sysbail("cannot wait for child");
+    result = lookup(&client, cached, argv2, &status);
+    is_string("child\n", result, "result stored by child");
+    free(result);
+    free_command(argv2);
+
+    /* Identical requests wait for a running command and share its result. */
+    argv2 = make_command("test", "coalesced", (const char *) NULL);
+    child = start_leader(&client, coalesced, argv2, LEADER_STORE);
+    result = lookup(&client, coalesced, argv2, &status);
+    is_string("once\n", result, "coalesced request gets the result");
+    free(result);
+    waitpid(child, &status, 0);
+
+    /* If the command is abandoned, a waiting request runs it instead. */
+    sleep(3);
+    child = start_leader(&client, coalesced, argv2, LEADER_ABANDON);
+    ok(lookup(&client, coalesced, argv2, &status) == NULL,
+       "waiting request runs an abandoned command");
+    server_cache_abandon(&client, coalesced, argv2);
+    waitpid(child, &status, 0);
+
+    free_command(argv2);
+
+    /* The same happens if the process running the command dies. */
+    argv2 = make_command("test", "coalesced", "dies", (const char *) NULL);
+    child = start_leader(&client, coalesced, argv2, LEADER_EXIT);
+    waitpid(child, &status, 0);
+    server_cache_reap(child);
+    ok(lookup(&client, coalesced, argv2, &status) == NULL,
+       "command of a dead process is forgotten");
+    server_cache_abandon(&client, coalesced, argv2);
+    free_command(argv2);
+
+    /* Results larger than an eighth of the cache are not stored. */
+    big = bcalloc(LARGE_OUTPUT, 1);
+    memset(big, 'x', LARGE_OUTPUT - 1);
+    store(&client, cached, argv, big, "", 0);
+    result = lookup(&client, cached, argv, &status);
+    is_string("hello\n", result, "large result is not cached");
+    free(result);
+
+    /*
+     * If the output of a coalesced command is too large to share, the
+     * requests waiting for it all run the command at the same time.  Each
+     * takes a second, so running them one after another would take at least
+     * four seconds in all.
+     */
+    argv2 = make_command("test", "coalesced", "large", (const char *) NULL);
+    start = server_clock();
+    child = start_leader(&client, coalesced, argv2, LEADER_LARGE);
+    for (i = 0; i < 3; i++) {
+        waiters[i] = fork();
+        if (waiters[i] < 0)
+            sysbail("cannot fork");
+        else if (waiters[i] == 0) {
+            if (lookup(&client, coalesced, argv2, &status) != NULL)
+                _exit(1);
+            sleep(1);
+            store(&client, coalesced, argv2, big, "", 0);
+            _exit(0);
+        }
+    }
+    okay = true;
+    for (i = 0; i < 3; i++)
+        if (waitpid(waiters[i], &status, 0) != waiters[i]
+            || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            okay = false;
+    waitpid(child, &status, 0);
+    ok(okay, "waiting requests run a command with large output");
+    ok(server_clock() - start < 3.5, "...at the same time");
+
+    /* Later identical requests don't wait for each other either. */
+    child = start_leader(&client, coalesced, argv2, LEADER_LARGE);
+    start = server_clock();
+    ok(lookup(&client, coalesced, argv2, &status) == NULL,
+       "later request runs the command");
+    ok(server_clock() - start < 0.5, "...without waiting");
+    waitpid(child, &status, 0);
+    free_command(argv2);
+
+    /*
+     * Fill the cache with results of 6000 bytes, which use six blocks each,
+     * using the first one again partway through.  The least recently used
+     * results are evicted to make room, so the first remains.
+     */
+    big[6000] = '\0';
+    for (i = 0; i < 12; i++) {
+        snprintf(name, sizeof(name), "fill%lu", (unsigned long) i);
+        argv2 = make_command("test", "cached", name, (const char *) NULL);
+        store(&client, cached, argv2, big, "", 0);
+        free_command(argv2);
+        if (i == 5) {
+            result = lookup(&client, cached, argv, &status);
+            free(result);
+        }
+    }
+    result = lookup(&client, cached, argv, &status);
+    is_string("hello\n", result, "recently used result is kept");
+    free(result);
+    argv2 = make_command("test", "cached", "fill0", (const char *) NULL);
+    ok(lookup(&client, cached, argv2, &status) == NULL,
+       "...and least recently used result is evicted");
+    free_command(argv2);
+    argv2 = make_command("test", "cached", "fill11", (const char *) NULL);
+    result = lookup(&client, cached, argv2, &status);
+    ok(result != NULL && strlen(result) == 6000, "newest result is cached");
+    free(result);
+    free_command(argv2);
+
+    /* Flushing the cache discards everything. */
+    server_cache_flush();
+    ok(lookup(&client, cached, argv, &status) == NULL, "flush empties cache");
+
+    /* Clean up. */
+    free(big);
+    free_command(argv);
+    server_cache_free();
+    server_config_free(config);
+    return 0;
+}
@@ -49,7 +49,7 @@ main(void)
 {
     struct config *config;
 
-    plan(49);
+    plan(51);
     if (chdir(getenv("C_TAP_SOURCE")) < 0)
         sysbail("can't chdir to C_TAP_SOURCE");
 
@@ -65,6 +65,7 @@ main(void)
     ok(config->rules[0]->logmask == NULL, "logmask 1");
     is_string("data/acl-nonexistent", config->rules[0]->acls[0], "acl 1");
     ok(config->rules[0]->acls[1] == NULL, "...and only one acl");
+    ok(config->rules[0]->compress, "compress 1");
 
     is_string("test", config->rules[1]->command, "command 2");
     is_string("bar", config->rules[1]->subcommand, "subcommand 2");
@@ -86,6 +87,7 @@ main(void)
     ok(config->rules[2]->acls[1] == NULL, "...and only one acl");
     is_string("data/cmd-hello", config->rules[2]->summary, "summary 3");
     is_string("data/command-hello", config->rules[2]->help, "help 3");
+    ok(!config->rules[2]->compress, "compress 3");
 
     is_string("foo", config->rules[3]->command, "command 4");
     is_string("ALL", config->rules[3]->subcommand, "subcommand 4");
@@ -23,6 +23,79 @@
 #include <util/gss-tokens.h>
 #include <util/protocol.h>
 
+/*
+ * A command the user isn't allowed to run, whose last argument claims to be
+ * longer than the data that follows.  This would be rejected as an invalid
+ * command if it were reassembled.  The command and subcommand are in the
+ * first 22 bytes.
+ */
+/* clang-format off */
+static const char denied[] = {
+    0, 0, 0, 3,
+    0, 0, 0, 4, 't', 'e', 's', 't',
+    0, 0, 0, 6, 'n', 'o', 'a', 'u', 't', 'h',
+    0, 0, 0, 100, 'x', 'x', 'x', 'x'
+};
+/* clang-format on */
+
+
+/*
+ * Send the denied command as a continued command, split into tokens at the
+ * given offsets.  The last offset must be the length of the command.  Then
+ * check that it's rejected and that the connection can still be used to run
+ * another command.
+ */
+static void
+test_denied(struct remctl *r, const size_t *breaks, size_t count)
+{
+    const char *command[] = {"test", "status", "3", NULL};
+    struct remctl_output *output;
+    char buffer[BUFSIZ];
+    gss_buffer_desc token;
+    OM_uint32 major, minor;
+    size_t i, start;
+    int status = TOKEN_OK;
+
+    /* Send the command. */
+    start = 0;
+    for (i = 0; i < count && status == TOKEN_OK; i++) {
+        buffer[0] = 2;
+        buffer[1] = MESSAGE_COMMAND;
+        buffer[2] = 1;
+        buffer[3] = (i == 0) ? 1 : (i == count - 1) ? 3 : 2;
+        memcpy(buffer + 4, denied + start, breaks[i] - start);
+        token.value = buffer;
+        token.length = 4 + breaks[i] - start;
+        status = token_send_priv(r->fd, r->context,
+                                 TOKEN_DATA | TOKEN_PROTOCOL, &token, 0,
+                                 &major, &minor);
+        start = breaks[i];
+    }
+    is_int(TOKEN_OK, status, "denied command sent okay");
+
+    /* It should be rejected without complaining about the bad argument. */
+    r->ready = 1;
+    output = remctl_output(r);
+    ok(output != NULL, "got output");
+    if (output == NULL)
+        ok_block(2, false, "got output");
+    else {
+        is_int(REMCTL_OUT_ERROR, output->type, "...of type error");
+        is_int(ERROR_ACCESS, output->error, "...with access denied");
+    }
+
+    /* The connection should still work. */
+    ok(remctl_command(r, command), "remctl_command after denial");
+    output = remctl_output(r);
+    ok(output != NULL, "got output");
+    if (output == NULL)
+        ok_block(2, false, "got output");
+    else {
+        is_int(REMCTL_OUT_STATUS, output->type, "...of type status");
+        is_int(3, output->status, "...with correct status");
+    }
+}
+
 
 int
 main(void)
@@ -41,6 +114,8 @@ main(void)
         0, 0, 0, 1, '2'
     };
     /* clang-format on */
+    static const size_t whole[] = {22, 28, sizeof(denied)};
+    static const size_t split[] = {10, 18, 26, sizeof(denied)};
     char buffer[BUFSIZ];
     gss_buffer_desc token;
     OM_uint32 major, minor;
@@ -50,7 +125,7 @@ main(void)
     config = kerberos_setup(TAP_KRB_NEEDS_KEYTAB);
     remctld_start(config, "data/conf-simple", NULL);
 
-    plan(9);
+    plan(25);
 
     /* Open a connection. */
     r = remctl_new();
@@ -97,6 +172,14 @@ main(void)
         is_int(REMCTL_OUT_STATUS, output->type, "...of type status");
         is_int(2, output->status, "...with correct status");
     }
+
+    /*
+     * Send a denied command.  First send the command and subcommand in the
+     * first token, and then split them across tokens so that the server has
+     * to wait for more data before it can check them.
+     */
+    test_denied(r, whole, ARRAY_SIZE(whole));
+    test_denied(r, split, ARRAY_SIZE(split));
     remctl_close(r);
 
     return 0;
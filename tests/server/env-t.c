@@ -78,7 +78,7 @@ main(void)
     config = kerberos_setup(TAP_KRB_NEEDS_KEYTAB);
     remctld_start(config, "data/conf-simple", NULL);
 
-    plan(5);
+    plan(6);
 
     /* Run the tests. */
     r = remctl_new();
@@ -107,6 +107,12 @@ main(void)
     ok(expires > time(NULL), "REMOTE_EXPIRES is in the future (%lu)",
        (unsigned long) expires);
 
+    /* The request ID ends in the number of the command on the connection. */
+    value = test_env(r, "REMCTL_REQUEST_ID");
+    ok(strlen(value) > 3 && strcmp(value + strlen(value) - 3, "-6\n") == 0,
+       "value for REMCTL_REQUEST_ID");
+    free(value);
+
     remctl_close(r);
     free(expected);
     return 0;
@@ -0,0 +1,135 @@
+/*
+ * Test suite for server concurrency limits.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <sys/wait.h>
+
+#include <server/internal.h>
+#include <tests/tap/basic.h>
+
+
+/*
+ * Try to acquire a slot for a rule in a child process and return the result.
+ * If release is false, the child exits while still holding the slot.
+ */
+static enum limits_status
+child_acquire(const struct rule *rule, bool release, pid_t *pid)
+{
+    pid_t child;
+    int status;
+    enum limits_status result;
+
+    child = fork();
+    if (child < 0)
+        sysbail("cannot fork");
+    else if (child == 0) {
+        result = server_limits_acquire(rule);
+        if (result == LIMITS_OK && release)
+            server_limits_release(rule);
+        _exit((int) result);
+    }
+    if (waitpid(child, &status, 0) != child)
+        sysbail("cannot wait for child");
+    if (pid != NULL)
+        *pid = child;
+    return (enum limits_status) WEXITSTATUS(status);
+}
+
+
+int
+main(void)
+{
+    struct config *config;
+    struct rule *busy, *mon1, *mon2, *bulk;
+    pid_t child, holder;
+    enum limits_status result;
+    int status;
+
+    plan(21);
+    if (chdir(getenv("C_TAP_SOURCE")) < 0)
+        sysbail("can't chdir to C_TAP_SOURCE");
+
+    /* Check parsing of the configuration options. */
+    config = server_config_load("data/conf-limits");
+    if (config == NULL)
+        bail("server_config_load returned NULL");
+    busy = config->rules[0];
+    mon1 = config->rules[1];
+    mon2 = config->rules[2];
+    bulk = config->rules[3];
+    is_int(1, busy->concurrency, "concurrency");
+    is_int(1, busy->queue, "queue");
+    is_int(2, busy->queue_timeout, "queue-timeout");
+    is_string("monitor", mon1->class, "class");
+    is_int(1, mon1->reserve, "reserve");
+
+    /* Without initialization, everything runs. */
+    server_limits_rules(config);
+    is_int(0, busy->limit, "no slots without initialization");
+    is_int(LIMITS_OK, server_limits_acquire(busy), "acquire succeeds");
+    server_limits_release(busy);
+
+    /* Assign slots with a total limit of two. */
+    server_limits_init(2);
+    server_limits_rules(config);
+    ok(busy->limit != 0, "busy has a slot");
+    is_int(mon1->limit, mon2->limit, "rules in a class share a slot");
+    ok(bulk->limit != 0 && bulk->limit != busy->limit,
+       "other rules have their own slot with a total limit");
+
+    /*
+     * Take the only slot for busy.  A second request waits in the queue and
+     * times out, and a third while the second is waiting is rejected.
+     */
+    is_int(LIMITS_OK, server_limits_acquire(busy), "acquire busy");
+    child = fork();
+    if (child < 0)
+        sysbail("cannot fork");
+    else if (child == 0) {
+        result = server_limits_acquire(busy);
+        _exit((int) result);
+    }
+    sleep(1);
+    is_int(LIMITS_BUSY, server_limits_acquire(busy), "...third is rejected");
+    if (waitpid(child, &status, 0) != child)
+        sysbail("cannot wait for child");
+    is_int(LIMITS_TIMEOUT, WEXITSTATUS(status), "...second times out");
+    server_limits_release(busy);
+
+    /* A child that exits holding a slot is cleaned up when reaped. */
+    is_int(LIMITS_OK, child_acquire(busy, false, &holder), "child acquires");
+    is_int(LIMITS_TIMEOUT, child_acquire(busy, true, NULL),
+           "...and still holds the slot after exit");
+    server_limits_reap(holder);
+    is_int(LIMITS_OK, child_acquire(busy, true, NULL),
+           "...until it is reaped");
+
+    /*
+     * One of the two total slots is reserved for the monitor class, so bulk
+     * can only run one command at a time.  The monitor class can use the
+     * shared slot too, but only if it's free.
+     */
+    is_int(LIMITS_OK, server_limits_acquire(bulk), "bulk takes shared slot");
+    is_int(LIMITS_BUSY, child_acquire(bulk, true, NULL),
+           "...and no more are available");
+    is_int(LIMITS_OK, server_limits_acquire(mon1), "reserved slot is free");
+    is_int(LIMITS_BUSY, child_acquire(mon2, true, NULL),
+           "...but the class can't take the shared slot");
+    server_limits_release(bulk);
+    is_int(LIMITS_OK, child_acquire(mon2, true, NULL),
+           "...until it's released");
+    server_limits_release(mon1);
+
+    /* Clean up. */
+    server_limits_free();
+    server_config_free(config);
+    return 0;
+}
@@ -20,12 +20,17 @@
 int
 main(void)
 {
-    struct rule rule = {NULL, 0,    NULL, NULL, NULL, NULL, NULL, 0,
-                        NULL, NULL, 0,    0,    NULL, NULL, NULL};
+    struct rule rule = {NULL, 0,    NULL, NULL, NULL, NULL, NULL,
+                        0,    NULL, NULL, 0,    0,    NULL, NULL,
+                        NULL, 0,    NULL, 0,    0,    0,    0,
+                        0,    0,    false, false, false};
     struct iovec **command;
+    struct client client;
+    struct process process;
+    const char *prefix, *suffix;
     int i;
 
-    plan(8);
+    plan(11);
 
     /* Command without subcommand. */
     command = bcalloc(5, sizeof(struct iovec *));
@@ -106,6 +111,45 @@ main(void)
     server_log_command(command, &rule, "test");
     is_string("COMMAND from test: foo **MASKED** arg1 **MASKED**\n", errors,
               "two masked parameters");
+
+    /* Completion record for the first command on a connection. */
+    memset(&client, 0, sizeof(client));
+    client.user = (char *) "test@EXAMPLE.ORG";
+    client.count = 1;
+    client.dns_time = 0.5;
+    client.gss_time = 0.25;
+    memset(&process, 0, sizeof(process));
+    process.client = &client;
+    process.id = "1-2-1";
+    process.command = "foo";
+    process.acl_time = 0.125;
+    process.started = 10;
+    process.spawned = 11;
+    process.exited = 13;
+    process.bytes[0] = 10;
+    process.bytes[1] = 20;
+    process.utime = 0.5;
+    process.stime = 0.25;
+    process.maxrss = 1024;
+    server_log_set_slow(0);
+    errors_capture();
+    server_log_completion(&process, "b r", 0, server_clock());
+    prefix = "COMPLETED id=1-2-1 user=test@EXAMPLE.ORG command=foo"
+             " subcommand=b.r status=0 dns=0.500000 gss=0.250000"
+             " acl=0.125000 spawn=1.000000 run=2.000000 total=";
+    suffix = " stdout=10 stderr=20 utime=0.500000 stime=0.250000"
+             " maxrss=1024\n";
+    ok(errors != NULL && strncmp(errors, prefix, strlen(prefix)) == 0,
+       "completion record");
+    ok(errors != NULL && strstr(errors, suffix) != NULL,
+       "...with the right statistics");
+
+    /* Fast commands are only logged at debug. */
+    server_log_set_slow(1000);
+    client.count = 2;
+    errors_capture();
+    server_log_completion(&process, NULL, 0, server_clock());
+    ok(errors == NULL, "fast command logged at debug");
     errors_uncapture();
     free(errors);
     errors = NULL;
@@ -0,0 +1,148 @@
+/*
+ * Test suite for server metrics.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <server/internal.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/string.h>
+#include <util/tokens.h>
+
+
+/*
+ * Read the contents of a file into newly allocated memory and return it.
+ */
+static char *
+read_file(const char *path)
+{
+    FILE *file;
+    char *data;
+    size_t size = 64 * 1024;
+    size_t length;
+
+    file = fopen(path, "r");
+    if (file == NULL)
+        sysbail("cannot open %s", path);
+    data = bmalloc(size);
+    length = fread(data, 1, size - 1, file);
+    if (ferror(file))
+        sysbail("cannot read %s", path);
+    fclose(file);
+    data[length] = '\0';
+    return data;
+}
+
+
+/*
+ * Check that a line is present in the metrics output.
+ */
+static void
+has_line(const char *data, const char *line)
+{
+    char *wanted;
+
+    basprintf(&wanted, "\n%s\n", line);
+    ok(strstr(data, wanted) != NULL, "%s", line);
+    free(wanted);
+}
+
+
+int
+main(void)
+{
+    struct config *config;
+    struct timeval start;
+    char *tmpdir, *path, *data;
+    pid_t child;
+    int i, status;
+
+    plan(19);
+    if (chdir(getenv("C_TAP_SOURCE")) < 0)
+        sysbail("can't chdir to C_TAP_SOURCE");
+
+    /* Without initialization, nothing is recorded or written. */
+    config = server_config_load("data/conf-test");
+    if (config == NULL)
+        bail("server_config_load returned NULL");
+    server_metrics_rules(config);
+    is_int(0, config->rules[0]->metric, "no rule slots without metrics");
+    server_metrics_count(METRICS_COMMANDS, 1);
+    tmpdir = test_tmpdir();
+    basprintf(&path, "%s/metrics.prom", tmpdir);
+    ok(server_metrics_write(path), "write without metrics succeeds");
+    ok(access(path, F_OK) < 0, "...and writes nothing");
+
+    /* Assign slots to the rules, and check reuse across reloads. */
+    server_metrics_init();
+    server_metrics_rules(config);
+    is_int(1, config->rules[0]->metric, "first rule slot");
+    is_int(4, config->rules[3]->metric, "last rule slot");
+    server_metrics_rules(config);
+    is_int(4, config->rules[3]->metric, "slots are reused");
+
+    /* Record some data in children and make sure the parent sees it. */
+    for (i = 0; i < 4; i++) {
+        child = fork();
+        if (child < 0)
+            sysbail("cannot fork");
+        else if (child == 0) {
+            server_metrics_count(METRICS_COMMANDS, 1);
+            server_metrics_count(METRICS_BYTES_IN, 100);
+            server_metrics_rule(config->rules[1]);
+            server_metrics_handshake_failed(TOKEN_FAIL_EOF);
+            _exit(0);
+        }
+        if (waitpid(child, &status, 0) != child)
+            sysbail("cannot wait for child");
+    }
+
+    /* Record a time of about 1.5ms and one that went backwards. */
+    gettimeofday(&start, NULL);
+    if (start.tv_usec >= 1500)
+        start.tv_usec -= 1500;
+    else {
+        start.tv_sec--;
+        start.tv_usec += 1000000 - 1500;
+    }
+    server_metrics_time(METRICS_ACL, &start);
+    start.tv_sec += 10;
+    server_metrics_time(METRICS_ACL, &start);
+    server_metrics_handshake_failed(12);
+
+    /* Write and check the metrics file. */
+    ok(server_metrics_write(path), "write metrics");
+    data = read_file(path);
+    has_line(data, "# TYPE remctld_commands_total counter");
+    has_line(data, "remctld_commands_total 4");
+    has_line(data, "remctld_command_input_bytes_total 400");
+    has_line(data, "remctld_connections_total 0");
+    has_line(data, "remctld_handshake_failures_total{reason=\"eof\"} 4");
+    has_line(data, "remctld_handshake_failures_total{reason=\"unknown\"} 1");
+    has_line(data, "remctld_rule_commands_total{command=\"test\","
+                   "subcommand=\"bar\"} 4");
+    has_line(data, "remctld_rule_commands_total{command=\"foo\","
+                   "subcommand=\"ALL\"} 0");
+    has_line(data, "remctld_acl_check_seconds_bucket{le=\"0.000001\"} 1");
+    has_line(data, "remctld_acl_check_seconds_bucket{le=\"0.001024\"} 1");
+    has_line(data, "remctld_acl_check_seconds_bucket{le=\"+Inf\"} 2");
+    has_line(data, "remctld_acl_check_seconds_count 2");
+    free(data);
+
+    /* Clean up. */
+    server_metrics_free();
+    server_config_free(config);
+    unlink(path);
+    free(path);
+    test_tmpdir_free(tmpdir);
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Test suite for server rate limits.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <sys/wait.h>
+
+#include <server/internal.h>
+#include <tests/tap/basic.h>
+
+
+int
+main(void)
+{
+    pid_t child;
+    int status;
+    double start, elapsed;
+
+    plan(14);
+
+    /* Without initialization, everything is allowed. */
+    server_ratelimit_set(RATELIMIT_COMMANDS, 1, 1);
+    ok(server_ratelimit_check(RATELIMIT_COMMANDS, "user", 1),
+       "first command without initialization");
+    ok(server_ratelimit_check(RATELIMIT_COMMANDS, "user", 1),
+       "...and second command");
+
+    /* With a burst of two, the third quick command is rejected. */
+    server_ratelimit_set(RATELIMIT_COMMANDS, 0.5, 2);
+    server_ratelimit_init();
+    ok(server_ratelimit_check(RATELIMIT_COMMANDS, "user", 1),
+       "first command");
+    ok(server_ratelimit_check(RATELIMIT_COMMANDS, "user", 1),
+       "second command");
+    ok(!server_ratelimit_check(RATELIMIT_COMMANDS, "user", 1),
+       "third command is rejected");
+    ok(server_ratelimit_check(RATELIMIT_COMMANDS, "other", 1),
+       "other users are not affected");
+    ok(server_ratelimit_check(RATELIMIT_CONNECTIONS, "user", 1),
+       "limits that are not set always succeed");
+
+    /* The limit is shared with children. */
+    server_ratelimit_set(RATELIMIT_CONNECTIONS, 0.5, 1);
+    child = fork();
+    if (child < 0)
+        sysbail("cannot fork");
+    else if (child == 0) {
+        server_ratelimit_check(RATELIMIT_CONNECTIONS, "127.0.0.1", 1);
+        _exit(0);
+    }
+    if (waitpid(child, &status, 0) != child)
+        sysbail("cannot wait for child");
+    ok(!server_ratelimit_check(RATELIMIT_CONNECTIONS, "127.0.0.1", 1),
+       "connection limit is shared with children");
+    ok(server_ratelimit_check(RATELIMIT_CONNECTIONS, "127.0.0.2", 1),
+       "...but not with other addresses");
+
+    /* Tokens refill over time. */
+    server_ratelimit_set(RATELIMIT_COMMANDS, 20, 1);
+    ok(server_ratelimit_check(RATELIMIT_COMMANDS, "fast", 1),
+       "first fast command");
+    sleep(1);
+    ok(server_ratelimit_check(RATELIMIT_COMMANDS, "fast", 1),
+       "...and another after the bucket refills");
+
+    /*
+     * Output is paced instead of rejected.  With 1000 bytes per second and a
+     * burst of 1000, sending 1500 bytes should take about half a second.
+     */
+    server_ratelimit_set(RATELIMIT_OUTPUT, 1000, 1000);
+    start = server_clock();
+    server_ratelimit_wait(RATELIMIT_OUTPUT, "user", 1000);
+    server_ratelimit_wait(RATELIMIT_OUTPUT, "user", 500);
+    elapsed = server_clock() - start;
+    ok(elapsed >= 0.4 && elapsed < 5, "output is paced (%.2fs)", elapsed);
+
+    /* The event loop instead asks how long to wait before reading more. */
+    ok(server_ratelimit_delay(RATELIMIT_OUTPUT, "other", 1000) <= 0,
+       "no delay within the burst");
+    elapsed = server_ratelimit_delay(RATELIMIT_OUTPUT, "other", 500);
+    ok(elapsed > 0.4 && elapsed <= 0.5, "...and delay after it (%.2fs)",
+       elapsed);
+
+    /* Clean up. */
+    server_ratelimit_free();
+    return 0;
+}
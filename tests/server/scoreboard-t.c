@@ -0,0 +1,193 @@
+/*
+ * Test suite for the server scoreboard.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/socket.h>
+#include <portable/system.h>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <server/internal.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/messages.h>
+#include <tests/tap/string.h>
+
+
+/*
+ * Print the scoreboard at the given path and return the output in newly
+ * allocated memory, or NULL if printing it failed.
+ */
+static char *
+print_board(const char *path, const char *tmpdir)
+{
+    FILE *output;
+    char *outpath, *data;
+    size_t size = 64 * 1024;
+    size_t length;
+    bool okay;
+
+    basprintf(&outpath, "%s/scoreboard.out", tmpdir);
+    output = fopen(outpath, "w+");
+    if (output == NULL)
+        sysbail("cannot create %s", outpath);
+    okay = server_scoreboard_print(path, output);
+    rewind(output);
+    data = bmalloc(size);
+    length = fread(data, 1, size - 1, output);
+    if (ferror(output))
+        sysbail("cannot read %s", outpath);
+    fclose(output);
+    unlink(outpath);
+    free(outpath);
+    data[length] = '\0';
+    if (!okay) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+
+int
+main(void)
+{
+    struct sockaddr_in sin;
+    struct stat st;
+    char *tmpdir, *path, *target, *data;
+    FILE *file;
+    pid_t child;
+    int status;
+
+    plan(19);
+    if (chdir(getenv("C_TAP_SOURCE")) < 0)
+        sysbail("can't chdir to C_TAP_SOURCE");
+
+    /* Printing a missing scoreboard fails. */
+    tmpdir = test_tmpdir();
+    basprintf(&path, "%s/scoreboard", tmpdir);
+    errors_capture();
+    data = print_board(path, tmpdir);
+    errors_uncapture();
+    ok(data == NULL, "printing a missing scoreboard fails");
+    ok(errors != NULL && strncmp(errors, "cannot open scoreboard", 22) == 0,
+       "...with the right error");
+    free(errors);
+    errors = NULL;
+
+    /* Without initialization, updates do nothing. */
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(0x7f000001UL);
+    server_scoreboard_connect((struct sockaddr *) &sin);
+    server_scoreboard_forked(getpid());
+    server_scoreboard_user("nobody");
+    ok(access(path, F_OK) < 0, "no scoreboard without initialization");
+
+    /*
+     * Create an empty scoreboard.  Put a symlink to another file in its place
+     * first, which should be replaced rather than followed.
+     */
+    basprintf(&target, "%s/scoreboard.target", tmpdir);
+    file = fopen(target, "w");
+    if (file == NULL || fputs("keep\n", file) == EOF || fclose(file) != 0)
+        sysbail("cannot create %s", target);
+    if (symlink(target, path) < 0)
+        sysbail("cannot create symlink %s", path);
+    server_scoreboard_init(path);
+    if (lstat(path, &st) < 0)
+        sysbail("cannot stat %s", path);
+    ok(S_ISREG(st.st_mode), "scoreboard replaces a symlink");
+    is_int(0600, st.st_mode & 07777, "...and is only readable by the owner");
+    if (stat(target, &st) < 0)
+        sysbail("cannot stat %s", target);
+    is_int(5, st.st_size, "...and the symlink target is untouched");
+    unlink(target);
+    free(target);
+    data = print_board(path, tmpdir);
+    ok(data != NULL, "print empty scoreboard");
+    ok(data != NULL && strstr(data, " 0 of 256 slots in use\n") != NULL,
+       "...with no slots in use");
+    free(data);
+
+    /* A failed fork releases the slot again. */
+    server_scoreboard_connect((struct sockaddr *) &sin);
+    server_scoreboard_forked(-1);
+    data = print_board(path, tmpdir);
+    ok(strstr(data, " 0 of 256 slots in use\n") != NULL,
+       "failed fork frees the slot");
+    free(data);
+
+    /* Simulate a connection handled by a child running a command. */
+    server_scoreboard_connect((struct sockaddr *) &sin);
+    child = fork();
+    if (child < 0)
+        sysbail("cannot fork");
+    server_scoreboard_forked(child);
+    if (child == 0) {
+        server_scoreboard_user("user@EXAMPLE.ORG");
+        server_scoreboard_bytes(10, 0);
+        server_scoreboard_command("test", "env", 1234);
+        server_scoreboard_bytes(0, 300);
+        _exit(0);
+    }
+    if (waitpid(child, &status, 0) != child)
+        sysbail("cannot wait for child");
+    data = print_board(path, tmpdir);
+    ok(strstr(data, " 1 of 256 slots in use\n") != NULL, "one slot in use");
+    ok(strstr(data, " running ") != NULL, "...which is running");
+    ok(strstr(data, " 10        300    1234 ") != NULL,
+       "...with bytes and command PID");
+    ok(strstr(data, " 127.0.0.1 user@EXAMPLE.ORG test env\n") != NULL,
+       "...and address, user, and command");
+    free(data);
+
+    /* A second connection that completes a command goes back to idle. */
+    server_scoreboard_connect((struct sockaddr *) &sin);
+    child = fork();
+    if (child < 0)
+        sysbail("cannot fork");
+    server_scoreboard_forked(child);
+    if (child == 0) {
+        server_scoreboard_user("user@EXAMPLE.ORG");
+        server_scoreboard_command("test", NULL, 1234);
+        server_scoreboard_state(SCOREBOARD_OUTPUT);
+        server_scoreboard_state(SCOREBOARD_IDLE);
+        _exit(0);
+    }
+    if (waitpid(child, &status, 0) != child)
+        sysbail("cannot wait for child");
+    data = print_board(path, tmpdir);
+    ok(strstr(data, " 2 of 256 slots in use\n") != NULL, "two slots in use");
+    ok(strstr(data, " handshake ") == NULL, "...with no handshake");
+    ok(strstr(data, " idle ") != NULL, "...and one idle");
+    ok(strstr(data, " user@EXAMPLE.ORG -\n") != NULL, "...with no command");
+    free(data);
+
+    /* Reaping the second child frees its slot. */
+    server_scoreboard_reap(child);
+    data = print_board(path, tmpdir);
+    ok(strstr(data, " 1 of 256 slots in use\n") != NULL, "reap frees a slot");
+    free(data);
+
+    /* Files that aren't scoreboards are rejected. */
+    server_scoreboard_free();
+    errors_capture();
+    data = print_board("data/conf-simple", tmpdir);
+    errors_uncapture();
+    ok(data == NULL, "printing a non-scoreboard fails");
+    free(errors);
+    errors = NULL;
+
+    /* Clean up. */
+    unlink(path);
+    free(path);
+    test_tmpdir_free(tmpdir);
+    return 0;
+}
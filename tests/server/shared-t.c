@@ -0,0 +1,76 @@
+/*
+ * Test suite for the shared memory lock of the server.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <sys/wait.h>
+
+#include <server/internal.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/messages.h>
+
+
+int
+main(void)
+{
+    struct shared_lock *lock;
+    int *counter;
+    pid_t child;
+    int status;
+
+    plan(7);
+
+    /* An uncontended lock can be taken and released repeatedly. */
+    lock = server_shared_lock_new();
+    counter = server_shared_new(sizeof(int), "test");
+    ok(*counter == 0, "shared memory is zero-filled");
+    ok(!server_shared_lock(lock), "lock is not taken over");
+    server_shared_unlock(lock);
+    ok(!server_shared_lock(lock), "...and can be taken again");
+    server_shared_unlock(lock);
+
+    /* The lock and the memory are shared with children. */
+    child = fork();
+    if (child < 0)
+        sysbail("cannot fork");
+    else if (child == 0) {
+        server_shared_lock(lock);
+        (*counter)++;
+        server_shared_unlock(lock);
+        _exit(0);
+    }
+    if (waitpid(child, &status, 0) != child)
+        sysbail("cannot wait for child");
+    is_int(1, *counter, "child updated shared memory");
+
+    /* A child that dies holding the lock doesn't block everyone else. */
+    child = fork();
+    if (child < 0)
+        sysbail("cannot fork");
+    else if (child == 0) {
+        server_shared_lock(lock);
+        _exit(0);
+    }
+    if (waitpid(child, &status, 0) != child)
+        sysbail("cannot wait for child");
+    errors_capture();
+    ok(server_shared_lock(lock), "lock of dead child is taken over");
+    errors_uncapture();
+    ok(errors != NULL, "...with a warning");
+    free(errors);
+    errors = NULL;
+    server_shared_unlock(lock);
+    ok(!server_shared_lock(lock), "...and is then normal again");
+    server_shared_unlock(lock);
+
+    server_shared_free(counter, sizeof(int));
+    server_shared_lock_free(lock);
+    return 0;
+}
@@ -26,15 +26,17 @@ main(void)
     struct kerberos_config *config;
     struct remctl *r;
     struct remctl_output *output;
-    size_t total;
+    size_t total, errtotal;
     const char *command_streaming[] = {"test", "streaming", NULL};
     const char *command_cat[] = {"test", "large-output", "1728361", NULL};
+    const char *command_both[] = {"test", "large-output", "1728361", "654321",
+                                  NULL};
 
     /* Unless we have Kerberos available, we can't really do anything. */
     config = kerberos_setup(TAP_KRB_NEEDS_KEYTAB);
     remctld_start(config, "data/conf-simple", NULL);
 
-    plan(45);
+    plan(65);
 
     /* First, version 2. */
     r = remctl_new();
@@ -118,6 +120,90 @@ main(void)
     is_int(1728361, total, "...correct total size");
     remctl_close(r);
 
+    /* The same, but with the server compressing the output if possible. */
+    r = remctl_new();
+    ok(r != NULL, "remctl_new with compression");
+    if (r == NULL)
+        bail("remctl_new returned NULL");
+    if (!remctl_set_compression(r, 1))
+        diag("compression not supported, testing without it");
+    ok(remctl_open(r, "localhost", 14373, config->principal), "remctl_open");
+    ok(remctl_command(r, command_cat), "remctl_command cat");
+    output = remctl_output(r);
+    total = 0;
+    while (output != NULL && output->type == REMCTL_OUT_OUTPUT) {
+        if (output->stream == 1)
+            total += output->length;
+        output = remctl_output(r);
+    }
+    ok(output != NULL && output->type == REMCTL_OUT_STATUS,
+       "...output ends with status");
+    if (output == NULL)
+        ok(false, "...correct exit status");
+    else
+        is_int(0, output->status, "...correct exit status");
+    is_int(1728361, total, "...correct total size");
+    remctl_close(r);
+
+    /* The same, but with large tokens. */
+    r = remctl_new();
+    ok(r != NULL, "remctl_new with large tokens");
+    if (r == NULL)
+        bail("remctl_new returned NULL");
+    remctl_set_large_tokens(r, 1);
+    ok(remctl_open(r, "localhost", 14373, config->principal), "remctl_open");
+    ok(r->large, "...and large tokens were negotiated");
+    ok(remctl_command(r, command_cat), "remctl_command cat");
+    output = remctl_output(r);
+    total = 0;
+    while (output != NULL && output->type == REMCTL_OUT_OUTPUT) {
+        if (output->stream == 1)
+            total += output->length;
+        output = remctl_output(r);
+    }
+    ok(output != NULL && output->type == REMCTL_OUT_STATUS,
+       "...output ends with status");
+    if (output == NULL)
+        ok(false, "...correct exit status");
+    else
+        is_int(0, output->status, "...correct exit status");
+    is_int(1728361, total, "...correct total size");
+    remctl_close(r);
+
+    /*
+     * A slow client that doesn't read anything for a while, with output to
+     * both standard output and standard error.  The server has to stop
+     * reading output while its queue for the client is full, start again
+     * once the client catches up, drain standard error after the command has
+     * finished writing standard output, and notice that the command exited.
+     */
+    r = remctl_new();
+    ok(r != NULL, "remctl_new for slow client");
+    if (r == NULL)
+        bail("remctl_new returned NULL");
+    ok(remctl_open(r, "localhost", 14373, config->principal), "remctl_open");
+    ok(remctl_command(r, command_both), "remctl_command with stderr");
+    sleep(2);
+    output = remctl_output(r);
+    total = 0;
+    errtotal = 0;
+    while (output != NULL && output->type == REMCTL_OUT_OUTPUT) {
+        if (output->stream == 1)
+            total += output->length;
+        else
+            errtotal += output->length;
+        output = remctl_output(r);
+    }
+    ok(output != NULL && output->type == REMCTL_OUT_STATUS,
+       "...output ends with status");
+    if (output == NULL)
+        ok(false, "...correct exit status");
+    else
+        is_int(0, output->status, "...correct exit status");
+    is_int(1728361, total, "...correct standard output size");
+    is_int(654321, errtotal, "...correct standard error size");
+    remctl_close(r);
+
     /* Now, version 1. */
     r = remctl_new();
     ok(r != NULL, "remctl_new protocol version 1");
@@ -0,0 +1,114 @@
+/*
+ * Test suite for compression of protocol messages.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/gssapi.h>
+#include <portable/system.h>
+
+#include <tests/tap/basic.h>
+#include <util/compress.h>
+#include <util/protocol.h>
+
+/* Length of the test messages. */
+#define MESSAGE_LENGTH 4096
+
+
+/*
+ * Fill a buffer with a MESSAGE_OUTPUT message.  If random is true, the output
+ * is pseudorandom bytes that won't compress; otherwise, it's repetitive text.
+ */
+static void
+make_message(char *message, size_t length, bool random)
+{
+    static const char text[] = "remctl output line\n";
+    unsigned long seed = 42;
+    size_t i;
+
+    message[0] = 3;
+    message[1] = MESSAGE_OUTPUT;
+    message[2] = 1;
+    memset(message + 3, 0, 4);
+    for (i = 7; i < length; i++)
+        if (random) {
+            seed = seed * 1103515245UL + 12345UL;
+            message[i] = (char) ((seed >> 16) & 0xff);
+        } else {
+            message[i] = text[i % (sizeof(text) - 1)];
+        }
+}
+
+
+int
+main(void)
+{
+    char message[MESSAGE_LENGTH];
+    gss_buffer_desc token, result, bad;
+    enum compress_types type;
+    bool status;
+
+    plan(13);
+
+    /* Choosing an algorithm. */
+    is_int(COMPRESS_NONE, compress_choose(0), "no common algorithm");
+#ifdef HAVE_ZLIB
+    is_int(COMPRESS_ZLIB, compress_choose(CAPABILITY_ZLIB), "zlib");
+#else
+    is_int(COMPRESS_NONE, compress_choose(CAPABILITY_ZLIB), "no zlib");
+#endif
+    type = compress_choose(compress_capabilities());
+    if (type == COMPRESS_NONE) {
+        skip_block(11, "no compression support");
+        return 0;
+    }
+
+    /* Round-trip a compressible message. */
+    make_message(message, sizeof(message), false);
+    status = compress_message(type, message, sizeof(message), &token);
+    ok(status, "compress a message");
+    if (!status)
+        bail("cannot compress a message");
+    ok(token.length < sizeof(message), "...and it gets smaller");
+    is_int(3, ((char *) token.value)[0], "...with the right version");
+    is_int(MESSAGE_COMPRESSED, ((char *) token.value)[1], "...and type");
+    status = compress_inflate(&token, &result, TOKEN_MAX_DATA);
+    ok(status, "inflate the message");
+    ok(status && result.length == sizeof(message)
+           && memcmp(result.value, message, sizeof(message)) == 0,
+       "...and get back the original");
+    if (status)
+        free(result.value);
+
+    /* Inflating fails if the message would be too large. */
+    ok(!compress_inflate(&token, &result, sizeof(message) - 1),
+       "inflating fails if the message is too long");
+
+    /* Corrupt or truncated tokens are rejected. */
+    ((char *) token.value)[2] = 99;
+    ok(!compress_inflate(&token, &result, TOKEN_MAX_DATA),
+       "unknown algorithm is rejected");
+    bad.value = token.value;
+    bad.length = 5;
+    ok(!compress_inflate(&bad, &result, TOKEN_MAX_DATA),
+       "truncated token is rejected");
+    free(token.value);
+
+    /* Compressed messages may not contain compressed messages. */
+    message[1] = MESSAGE_COMPRESSED;
+    if (!compress_message(type, message, sizeof(message), &token))
+        bail("cannot compress a message");
+    ok(!compress_inflate(&token, &result, TOKEN_MAX_DATA),
+       "nested compressed message is rejected");
+    free(token.value);
+
+    /* Messages that don't get smaller aren't compressed. */
+    make_message(message, sizeof(message), true);
+    ok(!compress_message(type, message, sizeof(message), &token),
+       "incompressible message is not compressed");
+    return 0;
+}
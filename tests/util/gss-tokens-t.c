@@ -29,10 +29,12 @@ main(void)
     OM_uint32 c_stat, c_min_stat, s_stat, s_min_stat, ret_flags;
     gss_OID doid;
     int status, flags;
+    size_t limit;
+    char *buffer;
 
     /* Unless we have Kerberos available, we can't really do anything. */
     config = kerberos_setup(TAP_KRB_NEEDS_KEYTAB);
-    plan(28);
+    plan(30);
 
     /*
      * We have to set up a context first in order to do this test, which is
@@ -155,6 +157,21 @@ main(void)
     is_int(GSS_S_COMPLETE, s_stat, "...and would send correct MIC");
     gss_release_buffer(&c_min_stat, &client_tok);
 
+    /* The wrap limit leaves room for the protection layer. */
+    limit = token_wrap_limit(server_ctx, 1024);
+    ok(limit > 512 && limit < 1024, "wrap limit is reasonable");
+    buffer = bcalloc(limit, 1);
+    server_tok.value = buffer;
+    server_tok.length = limit;
+    s_stat = gss_wrap(&s_min_stat, server_ctx, 1, GSS_C_QOP_DEFAULT,
+                      &server_tok, NULL, &client_tok);
+    ok(s_stat == GSS_S_COMPLETE && client_tok.length <= 1024,
+       "...and a token of that size fits");
+    gss_release_buffer(&s_min_stat, &client_tok);
+    free(buffer);
+    server_tok.value = (char *) "hello";
+    server_tok.length = 5;
+
     /*
      * Test sending and receiving a token with a timeout.  This and the tests
      * below must come last, and after any successful token test, because
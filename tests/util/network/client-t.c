@@ -5,7 +5,7 @@
  * which can be found at <https://www.eyrie.org/~eagle/software/rra-c-util/>.
  *
  * Written by Russ Allbery <eagle@eyrie.org>
- * Copyright 2005, 2013-2014, 2016-2020 Russ Allbery <eagle@eyrie.org>
+ * Copyright 2005, 2013-2014, 2016-2020, 2026 Russ Allbery <eagle@eyrie.org>
  * Copyright 2009-2013
  *     The Board of Trustees of the Leland Stanford Junior University
  *
@@ -37,6 +37,7 @@
 #include <errno.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <time.h>
 
 #include <tests/tap/basic.h>
 #include <util/macros.h>
@@ -296,6 +297,110 @@ test_timeout_ipv4(void)
     socket_close(fd);
 }
 
+/*
+ * Fill in an addrinfo struct and sockaddr_in for the IPv4 loopback address
+ * and the given port, chaining it to next.  Used to build address lists for
+ * testing network_connect_staggered.
+ */
+static void
+loopback_addrinfo(struct addrinfo *ai, struct sockaddr_in *sin,
+                  unsigned short port, struct addrinfo *next)
+{
+    memset(sin, 0, sizeof(*sin));
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(port);
+    sin->sin_addr.s_addr = htonl(0x7f000001UL);
+    memset(ai, 0, sizeof(*ai));
+    ai->ai_family = AF_INET;
+    ai->ai_socktype = SOCK_STREAM;
+    ai->ai_addr = (struct sockaddr *) sin;
+    ai->ai_addrlen = sizeof(*sin);
+    ai->ai_next = next;
+}
+
+
+/*
+ * Test staggered connections.  Listen on port 11119 and try connecting to a
+ * list of addresses where the first one either refuses connections or never
+ * answers, and check that the connection falls through to the working port
+ * well before the timeout.
+ */
+static void
+test_staggered_ipv4(void)
+{
+    socket_type fd, stalled, c;
+    socket_type block[20];
+    struct addrinfo first, second;
+    struct sockaddr_in first_sin, second_sin;
+    struct sockaddr_storage peer;
+    socklen_t length;
+    unsigned int conn, i;
+    time_t start;
+
+    /* Create the working listener. */
+    fd = network_bind_ipv4(SOCK_STREAM, "127.0.0.1", 11119);
+    if (fd == INVALID_SOCKET)
+        sysbail("cannot create or bind socket");
+    if (listen(fd, 5) < 0)
+        sysbail("cannot listen to socket");
+    alarm(20);
+
+    /* Port 11120 has no listener, so the first attempt is refused. */
+    loopback_addrinfo(&second, &second_sin, 11119, NULL);
+    loopback_addrinfo(&first, &first_sin, 11120, &second);
+    c = network_connect_staggered(&first, NULL, 5);
+    ok(c != INVALID_SOCKET, "Staggered: skipped refused address");
+    length = sizeof(peer);
+    if (getpeername(c, (struct sockaddr *) &peer, &length) < 0)
+        sysbail("cannot get peer address");
+    is_int(11119, network_sockaddr_port((struct sockaddr *) &peer),
+           "...and connected to the right port");
+    socket_close(c);
+
+    /* If every address is refused, the error is reported. */
+    loopback_addrinfo(&second, &second_sin, 11121, NULL);
+    c = network_connect_staggered(&first, NULL, 5);
+    ok(c == INVALID_SOCKET, "Staggered: all addresses refused");
+    is_int(ECONNREFUSED, socket_errno, "...with correct error code");
+
+    /*
+     * Now create a listener on 11120 that never accepts connections and try
+     * to fill its listen queue so that further connections hang, as in
+     * test_timeout_ipv4.  If that works, a staggered connection should skip
+     * past it to the working port after a short delay rather than waiting for
+     * the timeout.
+     */
+    stalled = network_bind_ipv4(SOCK_STREAM, "127.0.0.1", 11120);
+    if (stalled == INVALID_SOCKET)
+        sysbail("cannot create or bind socket");
+    if (listen(stalled, 0) < 0)
+        sysbail("cannot listen to socket");
+    for (conn = 0; conn < ARRAY_SIZE(block); conn++) {
+        block[conn] = network_connect_host("127.0.0.1", 11120, NULL, 1);
+        if (block[conn] == INVALID_SOCKET)
+            break;
+    }
+    if (conn == ARRAY_SIZE(block) || socket_errno != ETIMEDOUT)
+        skip_block(2, "short listen queue does not prevent connections");
+    else {
+        loopback_addrinfo(&second, &second_sin, 11119, NULL);
+        start = time(NULL);
+        c = network_connect_staggered(&first, NULL, 10);
+        ok(c != INVALID_SOCKET, "Staggered: skipped stalled address");
+        ok(time(NULL) - start < 5, "...without waiting for the timeout");
+        if (c != INVALID_SOCKET)
+            socket_close(c);
+    }
+    alarm(0);
+
+    /* Clean up. */
+    for (i = 0; i < conn; i++)
+        if (block[i] != INVALID_SOCKET)
+            socket_close(block[i]);
+    socket_close(stalled);
+    socket_close(fd);
+}
+
 
 /*
  * Test the network read function with a timeout.  We fork off a child process
@@ -437,7 +542,7 @@ int
 main(void)
 {
     /* Set up the plan. */
-    plan(22);
+    plan(28);
 
     /* Test network_client_create. */
     test_create_ipv4(NULL);
@@ -446,6 +551,9 @@ main(void)
     /* Test network_connect with a timeout. */
     test_timeout_ipv4();
 
+    /* Test staggered connections with network_connect_staggered. */
+    test_staggered_ipv4();
+
     /* Test network_read and network_write. */
     test_network_read();
     test_network_write();
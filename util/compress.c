@@ -0,0 +1,235 @@
+/*
+ * Compression of protocol messages.
+ *
+ * If the client and server both support it, which they discover with
+ * MESSAGE_CAPABILITIES, large messages may be sent wrapped in a
+ * MESSAGE_COMPRESSED message, which has the following format after the usual
+ * protocol version and message type:
+ *
+ *     1 octet     compression algorithm
+ *     4 octets    length of the uncompressed message
+ *     <length>    compressed message
+ *
+ * The uncompressed message is a complete protocol message, including its own
+ * protocol version and message type, and is never itself compressed.  zlib
+ * and Zstandard are supported if the libraries were found at build time, and
+ * Zstandard is preferred if both sides support it.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/gssapi.h>
+#include <portable/socket.h>
+#include <portable/system.h>
+
+#ifdef HAVE_ZLIB
+#    include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#    include <zstd.h>
+#endif
+
+#include <util/compress.h>
+#include <util/protocol.h>
+
+/* The length of the MESSAGE_COMPRESSED header. */
+#define COMPRESS_HEADER (1 + 1 + 1 + 4)
+
+/*
+ * Compression levels.  Output may be hundreds of megabytes, so favor speed;
+ * the fastest levels still do well on the mostly textual output of typical
+ * commands.
+ */
+#define COMPRESS_ZLIB_LEVEL 1
+#define COMPRESS_ZSTD_LEVEL 1
+
+
+/*
+ * Return the capability flags for the supported compression algorithms.
+ */
+unsigned long
+compress_capabilities(void)
+{
+    unsigned long capabilities = 0;
+
+#ifdef HAVE_ZLIB
+    capabilities |= CAPABILITY_ZLIB;
+#endif
+#ifdef HAVE_ZSTD
+    capabilities |= CAPABILITY_ZSTD;
+#endif
+    return capabilities;
+}
+
+
+/*
+ * Choose a compression algorithm given the capability flags supported by
+ * both sides, or COMPRESS_NONE if there is none in common.
+ */
+enum compress_types
+compress_choose(unsigned long capabilities)
+{
+    capabilities &= compress_capabilities();
+    if (capabilities & CAPABILITY_ZSTD)
+        return COMPRESS_ZSTD;
+    else if (capabilities & CAPABILITY_ZLIB)
+        return COMPRESS_ZLIB;
+    else
+        return COMPRESS_NONE;
+}
+
+
+/*
+ * Compress a message into a newly allocated MESSAGE_COMPRESSED token.
+ * Returns false if the message can't be compressed or doesn't get smaller.
+ */
+bool
+compress_message(enum compress_types type, const void *message, size_t length,
+                 gss_buffer_t token)
+{
+    size_t bound, size;
+    uint32_t tmp;
+    char *p;
+
+    /* Determine the maximum size of the compressed data. */
+    switch (type) {
+#ifdef HAVE_ZLIB
+    case COMPRESS_ZLIB:
+        bound = compressBound(length);
+        break;
+#else
+    case COMPRESS_ZLIB:
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESS_ZSTD:
+        bound = ZSTD_compressBound(length);
+        break;
+#else
+    case COMPRESS_ZSTD:
+#endif
+    case COMPRESS_NONE:
+    default:
+        return false;
+    }
+    if (length > UINT32_MAX || bound > SIZE_MAX - COMPRESS_HEADER)
+        return false;
+    p = malloc(COMPRESS_HEADER + bound);
+    if (p == NULL)
+        return false;
+
+    /* Compress the message after the header. */
+    size = bound;
+    switch (type) {
+#ifdef HAVE_ZLIB
+    case COMPRESS_ZLIB: {
+        uLongf zsize = (uLongf) bound;
+
+        if (compress2((Bytef *) p + COMPRESS_HEADER, &zsize, message,
+                      (uLong) length, COMPRESS_ZLIB_LEVEL)
+            != Z_OK)
+            goto fail;
+        size = zsize;
+        break;
+    }
+#else
+    case COMPRESS_ZLIB:
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESS_ZSTD:
+        size = ZSTD_compress(p + COMPRESS_HEADER, bound, message, length,
+                             COMPRESS_ZSTD_LEVEL);
+        if (ZSTD_isError(size))
+            goto fail;
+        break;
+#else
+    case COMPRESS_ZSTD:
+#endif
+    case COMPRESS_NONE:
+    default:
+        goto fail;
+    }
+    if (COMPRESS_HEADER + size >= length)
+        goto fail;
+
+    /* Fill in the header. */
+    p[0] = 3;
+    p[1] = MESSAGE_COMPRESSED;
+    p[2] = (char) type;
+    tmp = htonl((uint32_t) length);
+    memcpy(p + 3, &tmp, 4);
+    token->value = p;
+    token->length = COMPRESS_HEADER + size;
+    return true;
+
+fail:
+    free(p);
+    return false;
+}
+
+
+/*
+ * Decompress the message wrapped in a MESSAGE_COMPRESSED token into newly
+ * allocated memory.  Returns false on any failure.
+ */
+bool
+compress_inflate(gss_buffer_t token, gss_buffer_t message, size_t max)
+{
+    const char *data;
+    size_t length, size;
+    uint32_t tmp;
+    char *p;
+
+    /* Parse the header. */
+    if (token->length < COMPRESS_HEADER)
+        return false;
+    data = token->value;
+    memcpy(&tmp, data + 3, 4);
+    length = ntohl(tmp);
+    if (length < 2 || length > max)
+        return false;
+    size = token->length - COMPRESS_HEADER;
+    p = malloc(length);
+    if (p == NULL)
+        return false;
+
+    /* Decompress the message, which must be exactly the expected length. */
+    switch (data[2]) {
+#ifdef HAVE_ZLIB
+    case COMPRESS_ZLIB: {
+        uLongf zlength = (uLongf) length;
+
+        if (uncompress((Bytef *) p, &zlength,
+                       (const Bytef *) data + COMPRESS_HEADER, (uLong) size)
+            != Z_OK)
+            goto fail;
+        if (zlength != length)
+            goto fail;
+        break;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESS_ZSTD:
+        size = ZSTD_decompress(p, length, data + COMPRESS_HEADER, size);
+        if (ZSTD_isError(size) || size != length)
+            goto fail;
+        break;
+#endif
+    default:
+        goto fail;
+    }
+
+    /* A compressed message can't contain another compressed message. */
+    if (p[1] == MESSAGE_COMPRESSED)
+        goto fail;
+    message->value = p;
+    message->length = length;
+    return true;
+
+fail:
+    free(p);
+    return false;
+}
@@ -0,0 +1,57 @@
+/*
+ * Prototypes for compression of protocol messages.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef UTIL_COMPRESS_H
+#define UTIL_COMPRESS_H 1
+
+#include <config.h>
+#include <portable/gssapi.h>
+#include <portable/macros.h>
+#include <portable/stdbool.h>
+
+#include <sys/types.h>
+
+#include <util/protocol.h>
+
+BEGIN_DECLS
+
+/* Default to a hidden visibility for all util functions. */
+#pragma GCC visibility push(hidden)
+
+/*
+ * Returns the capability flags for the compression algorithms this build
+ * supports, and chooses the preferred algorithm given the capability flags
+ * supported by both sides.  Both sides of a connection make the same choice
+ * from the same flags.
+ */
+unsigned long compress_capabilities(void);
+enum compress_types compress_choose(unsigned long capabilities);
+
+/*
+ * Compress a complete protocol message and store a MESSAGE_COMPRESSED
+ * message wrapping it in token, allocated with malloc.  Returns false without
+ * allocating anything if the message could not be compressed or would not be
+ * any smaller, in which case it should be sent as is.
+ */
+bool compress_message(enum compress_types, const void *message, size_t length,
+                      gss_buffer_t token);
+
+/*
+ * Given a MESSAGE_COMPRESSED message, decompress the message it wraps and
+ * store it in message, allocated with malloc.  Returns false if the message
+ * is malformed, uses an unsupported algorithm, or would be longer than max.
+ */
+bool compress_inflate(gss_buffer_t token, gss_buffer_t message, size_t max);
+
+/* Undo default visibility change. */
+#pragma GCC visibility pop
+
+END_DECLS
+
+#endif /* UTIL_COMPRESS_H */
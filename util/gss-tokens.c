@@ -42,9 +42,11 @@ enum token_status token_recv(int, int *, gss_buffer_t, size_t, time_t);
  * Wraps, encrypts, and sends a data payload token.  Takes the file descriptor
  * to send to, the GSS-API context, the flags to send with the token, the
  * token, and the status variables.  Returns TOKEN_OK on success and
- * TOKEN_FAIL_SYSTEM or TOKEN_FAIL_GSSAPI on failure.  If the latter is
- * returned, the major and minor status variables will be set to something
- * useful.
+ * TOKEN_FAIL_LARGE, TOKEN_FAIL_SYSTEM, or TOKEN_FAIL_GSSAPI on failure.  The
+ * caller is responsible for not sending more data than the other side
+ * accepts, which is TOKEN_MAX_DATA unless larger tokens were negotiated.  If
+ * the latter is returned, the major and minor status variables will be set
+ * to something useful.
  *
  * As a hack to support remctl v1, look to see if the flags includes
  * TOKEN_SEND_MIC and don't include TOKEN_PROTOCOL.  If so, expect the remote
@@ -58,7 +60,7 @@ token_send_priv(socket_type fd, gss_ctx_id_t ctx, int flags, gss_buffer_t tok,
     int state, micflags;
     enum token_status status;
 
-    if (tok->length > TOKEN_MAX_DATA)
+    if (tok->length > TOKEN_MAX_LARGE)
         return TOKEN_FAIL_LARGE;
     *major = gss_wrap(minor, ctx, 1, GSS_C_QOP_DEFAULT, tok, &state, &out);
     if (*major != GSS_S_COMPLETE)
@@ -131,3 +133,23 @@ token_recv_priv(socket_type fd, gss_ctx_id_t ctx, int *flags, gss_buffer_t tok,
     }
     return TOKEN_OK;
 }
+
+
+/*
+ * Returns the largest data payload that, after wrapping with confidentiality
+ * protection, fits in a token of at most max octets.  Returns 0 if the
+ * GSS-API library can't tell us.
+ */
+size_t
+token_wrap_limit(gss_ctx_id_t ctx, size_t max)
+{
+    OM_uint32 major, minor, limit;
+
+    if (max > UINT32_MAX)
+        max = UINT32_MAX;
+    major = gss_wrap_size_limit(&minor, ctx, 1, GSS_C_QOP_DEFAULT,
+                                (OM_uint32) max, &limit);
+    if (major != GSS_S_COMPLETE)
+        return 0;
+    return (limit > max) ? max : limit;
+}
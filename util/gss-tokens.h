@@ -37,6 +37,12 @@ enum token_status token_recv_priv(socket_type, gss_ctx_id_t, int *flags,
                                   gss_buffer_t, size_t max, time_t,
                                   OM_uint32 *, OM_uint32 *);
 
+/*
+ * Returns the largest data payload that fits in a token of at most the given
+ * size after applying the GSS-API protection layer, or 0 on failure.
+ */
+size_t token_wrap_limit(gss_ctx_id_t, size_t max);
+
 /* Undo default visibility change. */
 #pragma GCC visibility pop
 
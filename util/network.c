@@ -20,7 +20,7 @@
  * which can be found at <https://www.eyrie.org/~eagle/software/rra-c-util/>.
  *
  * Written by Russ Allbery <eagle@eyrie.org>
- * Copyright 2014-2017, 2024 Russ Allbery <eagle@eyrie.org>
+ * Copyright 2014-2017, 2024, 2026 Russ Allbery <eagle@eyrie.org>
  * Copyright 2009, 2011-2014
  *     The Board of Trustees of the Leland Stanford Junior University
  * Copyright 2004-2008 Internet Systems Consortium, Inc. ("ISC")
@@ -64,6 +64,12 @@
 #include <util/xmalloc.h>
 #include <util/xwrite.h>
 
+/*
+ * Delay in milliseconds between staggered connection attempts, the value
+ * recommended by RFC 8305.
+ */
+#define NETWORK_CONNECT_DELAY 250
+
 /* Macros to set the len attribute of sockaddrs. */
 #if HAVE_STRUCT_SOCKADDR_SA_LEN
 #    define sin_set_length(s)  ((s)->sin_len = sizeof(struct sockaddr_in))
@@ -616,6 +622,225 @@ network_connect_host(const char *host, unsigned short port, const char *source,
     return fd;
 }
 
+/*
+ * Return the current time in milliseconds, used to schedule staggered
+ * connection attempts.
+ */
+static double
+connect_now(void)
+{
+#ifdef _WIN32
+    return (double) GetTickCount64();
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec * 1000 + (double) tv.tv_usec / 1000;
+#endif
+}
+
+
+/*
+ * Internal helper function to start a non-blocking connect to one address.
+ * Returns the socket on success, setting connected to true if the connect
+ * completed immediately and false if it is still in progress.  Returns
+ * INVALID_SOCKET on failure and sets the socket errno.
+ */
+static socket_type
+connect_start(const struct addrinfo *ai, const char *source, bool *connected)
+{
+    socket_type fd;
+    int oerrno;
+
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd == INVALID_SOCKET)
+        return INVALID_SOCKET;
+    if (!network_source(fd, ai->ai_family, source))
+        goto fail;
+    if (!fdflag_nonblocking(fd, true))
+        goto fail;
+    *connected = (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0);
+    if (*connected || socket_errno == EINPROGRESS)
+        return fd;
+
+fail:
+    oerrno = socket_errno;
+    socket_close(fd);
+    socket_set_errno(oerrno);
+    return INVALID_SOCKET;
+}
+
+
+/*
+ * Like network_connect, but make staggered parallel connection attempts as
+ * described in RFC 8305 ("Happy Eyeballs") instead of trying each address in
+ * turn.  The addresses are reordered to alternate between address families,
+ * starting with the family of the first address.  A new attempt is started
+ * every NETWORK_CONNECT_DELAY milliseconds, or immediately once all
+ * outstanding attempts have failed, and the first connection to complete
+ * wins.  The timeout, if not 0, applies to each attempt separately.
+ *
+ * This way, an unreachable address (such as an IPv6 address on a host with
+ * broken IPv6 routing) only delays the connection by NETWORK_CONNECT_DELAY
+ * instead of by the full timeout.  Returns the file descriptor of the open
+ * socket on success, or INVALID_SOCKET on failure with the reason for the
+ * last failure in errno.
+ */
+socket_type
+network_connect_staggered(const struct addrinfo *ai, const char *source,
+                          time_t timeout)
+{
+    const struct addrinfo **order, *first, *other, *current;
+    socket_type *fds;
+    double *started;
+    double now, last, limit, wait;
+    size_t count, next, active, i;
+    socket_type fd = INVALID_SOCKET;
+    socket_type maxfd;
+    struct timeval tv;
+    fd_set wset, eset;
+    socklen_t length;
+    int status, err = ETIMEDOUT;
+    bool connected;
+
+    /* If there's only one address, there's nothing to stagger. */
+    for (count = 0, current = ai; current != NULL; current = current->ai_next)
+        count++;
+    if (count == 1)
+        return network_connect(ai, source, timeout);
+
+    /*
+     * This is used from the client library, so fall back on a sequential
+     * connect rather than dying if memory allocation fails.
+     */
+    order = calloc(count, sizeof(const struct addrinfo *));
+    fds = calloc(count, sizeof(socket_type));
+    started = calloc(count, sizeof(double));
+    if (order == NULL || fds == NULL || started == NULL) {
+        free(order);
+        free(fds);
+        free(started);
+        return network_connect(ai, source, timeout);
+    }
+
+    /* Interleave the addresses by family, keeping their relative order. */
+    first = ai;
+    other = ai;
+    for (i = 0; i < count; i++) {
+        while (first != NULL && first->ai_family != ai->ai_family)
+            first = first->ai_next;
+        while (other != NULL && other->ai_family == ai->ai_family)
+            other = other->ai_next;
+        if (other != NULL && (first == NULL || i % 2 == 1)) {
+            order[i] = other;
+            other = other->ai_next;
+        } else if (first != NULL) {
+            order[i] = first;
+            first = first->ai_next;
+        }
+    }
+
+    /*
+     * Start a new attempt whenever no attempt is in progress or the last one
+     * was started NETWORK_CONNECT_DELAY ago, and otherwise wait for one of
+     * the outstanding attempts to complete.
+     */
+    next = 0;
+    active = 0;
+    last = 0;
+    while (fd == INVALID_SOCKET && (next < count || active > 0)) {
+        now = connect_now();
+        if (next < count
+            && (active == 0 || now - last >= NETWORK_CONNECT_DELAY)) {
+            fd = connect_start(order[next], source, &connected);
+            next++;
+            if (fd == INVALID_SOCKET)
+                err = socket_errno;
+            else if (!connected) {
+                fds[active] = fd;
+                started[active] = now;
+                active++;
+                last = now;
+                fd = INVALID_SOCKET;
+            }
+            continue;
+        }
+
+        /* Wait until the next attempt is due or an attempt times out. */
+        wait = -1;
+        if (next < count)
+            wait = last + NETWORK_CONNECT_DELAY - now;
+        if (timeout > 0)
+            for (i = 0; i < active; i++) {
+                limit = started[i] + (double) timeout * 1000 - now;
+                if (wait < 0 || limit < wait)
+                    wait = limit;
+            }
+        if (wait >= 0 && wait < 1)
+            wait = 1;
+        FD_ZERO(&wset);
+        FD_ZERO(&eset);
+        maxfd = 0;
+        for (i = 0; i < active; i++) {
+            FD_SET(fds[i], &wset);
+            FD_SET(fds[i], &eset);
+            if (fds[i] > maxfd)
+                maxfd = fds[i];
+        }
+        tv.tv_sec = (time_t) (wait / 1000);
+        tv.tv_usec = (long) (wait - (double) tv.tv_sec * 1000) * 1000;
+        status = select(maxfd + 1, NULL, &wset, &eset,
+                        (wait < 0) ? NULL : &tv);
+        if (status < 0 && socket_errno != EINTR) {
+            err = socket_errno;
+            break;
+        }
+
+        /*
+         * Check each outstanding attempt, keeping the first one that
+         * succeeded and discarding the ones that failed or timed out.
+         */
+        now = connect_now();
+        for (i = active; i-- > 0;) {
+            if (status > 0
+                && (FD_ISSET(fds[i], &wset) || FD_ISSET(fds[i], &eset))) {
+                length = sizeof(err);
+                if (getsockopt(fds[i], SOL_SOCKET, SO_ERROR, (void *) &err,
+                               &length)
+                    < 0)
+                    err = socket_errno;
+                if (err == 0 && fd == INVALID_SOCKET) {
+                    fd = fds[i];
+                    fds[i] = fds[--active];
+                    started[i] = started[active];
+                    continue;
+                }
+            } else if (timeout > 0
+                       && now - started[i] >= (double) timeout * 1000) {
+                err = ETIMEDOUT;
+            } else {
+                continue;
+            }
+            socket_close(fds[i]);
+            fds[i] = fds[--active];
+            started[i] = started[active];
+        }
+    }
+
+    /* Abandon any attempts still in progress. */
+    for (i = 0; i < active; i++)
+        socket_close(fds[i]);
+    free(order);
+    free(fds);
+    free(started);
+    if (fd == INVALID_SOCKET) {
+        socket_set_errno(err);
+        return INVALID_SOCKET;
+    }
+    fdflag_nonblocking(fd, false);
+    return fd;
+}
+
 
 /*
  * Create a new socket of the specified domain and type and do the binding as
@@ -5,7 +5,7 @@
  * which can be found at <https://www.eyrie.org/~eagle/software/rra-c-util/>.
  *
  * Written by Russ Allbery <eagle@eyrie.org>
- * Copyright 2014, 2016-2017 Russ Allbery <eagle@eyrie.org>
+ * Copyright 2014, 2016-2017, 2026 Russ Allbery <eagle@eyrie.org>
  * Copyright 2009-2013
  *     The Board of Trustees of the Leland Stanford Junior University
  * Copyright 2004-2010 Internet Systems Consortium, Inc. ("ISC")
@@ -113,6 +113,17 @@ socket_type network_connect_host(const char *host, unsigned short port,
                                  const char *source, time_t)
     __attribute__((__nonnull__(1)));
 
+/*
+ * Like network_connect, but make staggered parallel connection attempts to
+ * the addresses, alternating between address families, as described in RFC
+ * 8305.  A new attempt is started every 250ms until one succeeds, so a single
+ * unreachable address doesn't delay the connection by the full timeout.  The
+ * timeout applies to each attempt separately.
+ */
+socket_type network_connect_staggered(const struct addrinfo *,
+                                      const char *source, time_t)
+    __attribute__((__nonnull__(1)));
+
 /*
  * Creates a socket of the specified domain and type and binds it to the
  * appropriate source address, either the one supplied or all addresses if the
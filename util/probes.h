@@ -0,0 +1,40 @@
+/*
+ * Static tracepoints for the remctl client and server.
+ *
+ * If <sys/sdt.h> from SystemTap is available, these macros define USDT
+ * probes under the provider name remctl, which can be attached to by tools
+ * such as bpftrace, perf, and SystemTap.  A probe that isn't attached costs
+ * only a no-op instruction.  Without <sys/sdt.h>, or if configure was run
+ * with --disable-probes, the macros expand to no-op expressions.
+ *
+ * Probe names use double underscores, which the tracing tools display as
+ * dashes.  Arguments must be integers or pointers.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef UTIL_PROBES_H
+#define UTIL_PROBES_H 1
+
+#include <config.h>
+
+#ifdef HAVE_SYS_SDT_H
+#    include <sys/sdt.h>
+#    define PROBE0(name)          DTRACE_PROBE(remctl, name)
+#    define PROBE1(name, a)       DTRACE_PROBE1(remctl, name, a)
+#    define PROBE2(name, a, b)    DTRACE_PROBE2(remctl, name, a, b)
+#    define PROBE3(name, a, b, c) DTRACE_PROBE3(remctl, name, a, b, c)
+#    define PROBE4(name, a, b, c, d) \
+        DTRACE_PROBE4(remctl, name, a, b, c, d)
+#else
+#    define PROBE0(name)             ((void) 0)
+#    define PROBE1(name, a)          ((void) 0)
+#    define PROBE2(name, a, b)       ((void) 0)
+#    define PROBE3(name, a, b, c)    ((void) 0)
+#    define PROBE4(name, a, b, c, d) ((void) 0)
+#endif
+
+#endif /* !UTIL_PROBES_H */
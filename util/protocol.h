@@ -19,13 +19,33 @@
 /* Message types. */
 /* clang-format off */
 enum message_types {
-    MESSAGE_COMMAND = 1,
-    MESSAGE_QUIT    = 2,
-    MESSAGE_OUTPUT  = 3,
-    MESSAGE_STATUS  = 4,
-    MESSAGE_ERROR   = 5,
-    MESSAGE_VERSION = 6,
-    MESSAGE_NOOP    = 7
+    MESSAGE_COMMAND      = 1,
+    MESSAGE_QUIT         = 2,
+    MESSAGE_OUTPUT       = 3,
+    MESSAGE_STATUS       = 4,
+    MESSAGE_ERROR        = 5,
+    MESSAGE_VERSION      = 6,
+    MESSAGE_NOOP         = 7,
+    MESSAGE_CAPABILITIES = 8,
+    MESSAGE_COMPRESSED   = 9
+};
+/* clang-format on */
+
+/* Capability flags exchanged in MESSAGE_CAPABILITIES. */
+/* clang-format off */
+enum capability_flags {
+    CAPABILITY_ZLIB  = (1 << 0), /* Messages compressed with zlib. */
+    CAPABILITY_ZSTD  = (1 << 1), /* Messages compressed with Zstandard. */
+    CAPABILITY_LARGE = (1 << 2)  /* Tokens up to TOKEN_MAX_LARGE. */
+};
+/* clang-format on */
+
+/* Compression algorithms used in MESSAGE_COMPRESSED. */
+/* clang-format off */
+enum compress_types {
+    COMPRESS_NONE = 0,
+    COMPRESS_ZLIB = 1,
+    COMPRESS_ZSTD = 2
 };
 /* clang-format on */
 
@@ -33,6 +53,12 @@ enum message_types {
 #define TOKEN_MAX_LENGTH    (1024 * 1024)
 #define TOKEN_MAX_DATA      (64 * 1024)
 
+/*
+ * Maximum length of tokens, and so of the data in them, if both sides support
+ * CAPABILITY_LARGE.
+ */
+#define TOKEN_MAX_LARGE     (4 * 1024 * 1024)
+
 /*
  * Maximum data payload for a MESSAGE_OUTPUT message, which is TOKEN_MAX_DATA
  * minus the overhead for MESSAGE_OUTPUT labeling.  This is slightly different
@@ -41,6 +67,12 @@ enum message_types {
 #define TOKEN_MAX_OUTPUT    (TOKEN_MAX_DATA - 1 - 1 - 1 - 4)
 #define TOKEN_MAX_OUTPUT_V1 (TOKEN_MAX_DATA - 4 - 4)
 
+/*
+ * Messages shorter than this are never compressed, since the savings would
+ * not be worth the work.
+ */
+#define COMPRESS_MIN_LENGTH 512
+
 /* Windows uses this for something else. */
 #ifdef _WIN32
 #    undef ERROR_BAD_COMMAND
@@ -58,7 +90,9 @@ enum error_codes {
     ERROR_TOOMANY_ARGS       = 7, /* Argument count exceeds server limit. */
     ERROR_TOOMUCH_DATA       = 8, /* Argument size exceeds server limit. */
     ERROR_UNEXPECTED_MESSAGE = 9, /* Message type not valid now. */
-    ERROR_NO_HELP            = 10 /* No help defined for this command. */
+    ERROR_NO_HELP            = 10, /* No help defined for this command. */
+    ERROR_RATE_LIMIT         = 11, /* Client exceeded a server rate limit. */
+    ERROR_BUSY               = 12  /* Too many instances of command running. */
 };
 /* clang-format on */
 
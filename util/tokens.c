@@ -24,6 +24,7 @@
 
 #include <util/messages.h>
 #include <util/network.h>
+#include <util/probes.h>
 #include <util/tokens.h>
 #include <util/xwrite.h>
 
@@ -80,7 +81,10 @@ token_send(socket_type fd, int flags, gss_buffer_t tok, time_t timeout)
     memcpy(buffer + 1 + sizeof(OM_uint32), tok->value, tok->length);
     okay = network_write(fd, buffer, buflen, timeout);
     free(buffer);
-    return okay ? TOKEN_OK : map_socket_error(socket_errno);
+    if (!okay)
+        return map_socket_error(socket_errno);
+    PROBE3(token__send, fd, flags, tok->length);
+    return TOKEN_OK;
 }
 
 
@@ -125,6 +129,7 @@ token_recv(socket_type fd, int *flags, gss_buffer_t tok, size_t max,
         return TOKEN_FAIL_LARGE;
     if (tok->length == 0) {
         tok->value = NULL;
+        PROBE3(token__recv, fd, *flags, tok->length);
         return TOKEN_OK;
     }
 
@@ -137,5 +142,6 @@ token_recv(socket_type fd, int *flags, gss_buffer_t tok, size_t max,
         socket_set_errno(err);
         return map_socket_error(err);
     }
+    PROBE3(token__recv, fd, *flags, tok->length);
     return TOKEN_OK;
 }